@@ -0,0 +1,37 @@
+#ifndef NFTABLES_CMD_RESULTS_H
+#define NFTABLES_CMD_RESULTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <nftables.h>
+
+struct cmd_results_chunk;
+
+/**
+ * struct cmd_results - objects added by the commands of the last run
+ *
+ * @results:	objects, in the order the kernel reported them
+ * @num:	number of objects
+ * @size:	allocated size of @results
+ * @chunks:	storage of the names the objects refer to
+ */
+struct cmd_results {
+	struct nft_cmd_result		*results;
+	unsigned int			num;
+	unsigned int			size;
+	struct cmd_results_chunk	*chunks;
+};
+
+extern struct cmd_results *cmd_results_alloc(void);
+extern void cmd_results_free(struct cmd_results *res);
+extern void cmd_results_clear(struct cmd_results *res);
+
+extern void cmd_results_add(struct cmd_results *res,
+			    const struct nft_echo_object *obj);
+extern void cmd_results_bind(struct cmd_results *res,
+			     const struct list_head *cmds);
+extern void cmd_results_bind_locations(struct cmd_results *res, uint32_t first,
+				       const struct location *locs,
+				       unsigned int num);
+
+#endif /* NFTABLES_CMD_RESULTS_H */
@@ -27,6 +27,8 @@ extern struct expr *ct_expr_alloc(const struct location *loc,
 				  enum nft_ct_keys key, int8_t direction,
 				  uint8_t nfproto);
 extern void ct_expr_update_type(struct proto_ctx *ctx, struct expr *expr);
+extern const char *ct_key_name(enum nft_ct_keys key);
+extern const char *ct_dir_name(int8_t dir);
 
 extern struct stmt *notrack_stmt_alloc(const struct location *loc);
 
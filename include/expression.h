@@ -173,6 +173,7 @@ struct expr_ops {
  * @EXPR_F_PROTOCOL:		expressions describes upper layer protocol
  * @EXPR_F_INTERVAL_END:	set member ends an open interval
  * @EXPR_F_BOOLEAN:		expression is boolean (set by relational expr on LHS)
+ * @EXPR_F_INTERVALS:		set elements have been converted to intervals
  */
 enum expr_flags {
 	EXPR_F_CONSTANT		= 0x1,
@@ -180,6 +181,7 @@ enum expr_flags {
 	EXPR_F_PROTOCOL		= 0x4,
 	EXPR_F_INTERVAL_END	= 0x8,
 	EXPR_F_BOOLEAN		= 0x10,
+	EXPR_F_INTERVALS	= 0x20,
 };
 
 #include <payload.h>
@@ -333,6 +335,7 @@ extern struct expr *expr_alloc(const struct location *loc,
 			       enum byteorder byteorder, unsigned int len);
 extern struct expr *expr_clone(const struct expr *expr);
 extern struct expr *expr_get(struct expr *expr);
+extern struct expr *expr_unshare(struct expr *expr);
 extern void expr_free(struct expr *expr);
 extern void expr_print(const struct expr *expr, struct output_ctx *octx);
 extern bool expr_cmp(const struct expr *e1, const struct expr *e2);
@@ -0,0 +1,31 @@
+#ifndef NFTABLES_INCLUDE_CACHE_H
+#define NFTABLES_INCLUDE_CACHE_H
+
+#include <sys/stat.h>
+
+struct include_cache;
+struct parser_state;
+struct location;
+struct expr;
+struct cmd;
+
+extern struct include_cache *include_cache_open(const char *dir,
+						const char *filename,
+						const struct stat *st,
+						const char *data, size_t len);
+extern void include_cache_free(struct include_cache *cache);
+
+extern int include_cache_load(struct include_cache *cache,
+			      struct parser_state *state,
+			      const struct location *loc);
+
+extern void include_cache_record_define(struct parser_state *state,
+					const struct location *loc,
+					const char *identifier,
+					const struct expr *expr);
+extern void include_cache_record_cmd(struct parser_state *state,
+				     const struct cmd *cmd);
+extern void include_cache_invalidate(struct include_cache *cache);
+extern void include_cache_store(struct parser_state *state);
+
+#endif /* NFTABLES_INCLUDE_CACHE_H */
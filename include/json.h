@@ -0,0 +1,9 @@
+#ifndef NFTABLES_JSON_H
+#define NFTABLES_JSON_H
+
+struct netlink_ctx;
+struct cmd;
+
+extern int json_list(struct netlink_ctx *ctx, struct cmd *cmd);
+
+#endif /* NFTABLES_JSON_H */
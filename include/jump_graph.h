@@ -0,0 +1,62 @@
+#ifndef NFTABLES_JUMP_GRAPH_H
+#define NFTABLES_JUMP_GRAPH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct expr;
+struct handle;
+struct jump_graph;
+struct netlink_ctx;
+struct nft_cache;
+
+/* Same as the kernel jump stack size. */
+#define JUMP_GRAPH_MAX_DEPTH	16
+
+/**
+ * enum jump_graph_node_type - jump graph node type
+ *
+ * @JUMP_GRAPH_CHAIN:	chain, its edges come from jump and goto verdicts
+ * @JUMP_GRAPH_SET:	verdict map, its edges come from its elements
+ */
+enum jump_graph_node_type {
+	JUMP_GRAPH_CHAIN,
+	JUMP_GRAPH_SET,
+};
+
+/**
+ * struct jump_target - destination of a new jump graph edge
+ *
+ * @type:	node type of the destination
+ * @name:	chain or map name, in the table of the source
+ * @expr:	expression the edge comes from, for error reporting
+ */
+struct jump_target {
+	enum jump_graph_node_type	type;
+	const char			*name;
+	const struct expr		*expr;
+};
+
+extern struct jump_graph *jump_graph_alloc(struct nft_cache *cache);
+extern int jump_graph_load(struct jump_graph *graph, struct netlink_ctx *ctx,
+			   const struct handle *h);
+extern bool jump_graph_is_loaded(const struct jump_graph *graph,
+				 const struct handle *h);
+extern void jump_graph_free(struct jump_graph *graph);
+extern void jump_graph_invalidate(struct jump_graph *graph,
+				  const struct handle *h);
+
+extern int jump_graph_add(struct jump_graph *graph,
+			  enum jump_graph_node_type type,
+			  const struct handle *h, const char *name,
+			  const struct jump_target *targets, unsigned int num,
+			  unsigned int *bad);
+extern void jump_graph_flush(struct jump_graph *graph,
+			     enum jump_graph_node_type type,
+			     const struct handle *h, const char *name);
+extern void jump_graph_delete(struct jump_graph *graph,
+			      enum jump_graph_node_type type,
+			      const struct handle *h, const char *name);
+extern void jump_graph_flush_ruleset(struct jump_graph *graph, uint32_t family);
+
+#endif /* NFTABLES_JUMP_GRAPH_H */
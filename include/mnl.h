@@ -5,8 +5,24 @@
 #include <netlink.h>
 #include <libmnl/libmnl.h>
 
-struct mnl_socket *netlink_open_sock(void);
-void netlink_close_sock(struct mnl_socket *nf_sock);
+struct nft_sock *netlink_open_sock(void);
+struct nft_sock *netlink_open_mock_sock(void);
+void netlink_close_sock(struct nft_sock *nf_sock);
+
+struct nft_sock *nft_sock_open(void);
+struct nft_sock *nft_sock_open_mock(const struct nft_sock *peer);
+struct nft_sock *nft_sock_open_peer(const struct nft_sock *sock);
+void nft_sock_close(struct nft_sock *sock);
+int nft_sock_reopen(struct nft_sock *sock);
+int nft_sock_fd(const struct nft_sock *sock);
+uint32_t nft_sock_portid(const struct nft_sock *sock);
+ssize_t nft_sock_sendto(struct nft_sock *sock, const void *buf, size_t len);
+ssize_t nft_sock_sendmsg(struct nft_sock *sock, const struct msghdr *msg);
+ssize_t nft_sock_recvfrom(struct nft_sock *sock, void *buf, size_t len);
+int nft_sock_recvmmsg(struct nft_sock *sock, struct mmsghdr *msgs,
+		      unsigned int vlen);
+int nft_sock_setsockopt(struct nft_sock *sock, int level, int optname,
+			const void *val, socklen_t len);
 
 uint32_t mnl_seqnum_alloc(uint32_t *seqnum);
 uint16_t mnl_genid_get(struct netlink_ctx *ctx);
@@ -33,7 +49,12 @@ int mnl_nft_rule_batch_replace(struct nftnl_rule *nlr, struct nftnl_batch *batch
 			       unsigned int flags, uint32_t seqnum);
 
 struct nftnl_rule_list *mnl_nft_rule_dump(struct netlink_ctx *ctx,
-					  int family);
+					  int family, const char *table,
+					  const char *chain);
+int mnl_nft_rule_dump_cb(struct netlink_ctx *ctx, int family,
+			 const char *table, const char *chain,
+			 int (*cb)(const struct nlmsghdr *nlh, void *data),
+			 void *data);
 
 int mnl_nft_chain_add(struct netlink_ctx *ctx, struct nftnl_chain *nlc,
 		      unsigned int flags);
@@ -79,6 +100,8 @@ int mnl_nft_setelem_batch_del(struct nftnl_set *nls, struct nftnl_batch *batch,
 int mnl_nft_setelem_batch_flush(struct nftnl_set *nls, struct nftnl_batch *batch,
 				unsigned int flags, uint32_t seqnum);
 int mnl_nft_setelem_get(struct netlink_ctx *ctx, struct nftnl_set *nls);
+void mnl_nft_setelem_get_multi(struct netlink_ctx *ctx, struct nftnl_set **nls,
+			       int *err, unsigned int num);
 
 struct nftnl_obj_list *mnl_nft_obj_dump(struct netlink_ctx *ctx, int family,
 					const char *table,
@@ -91,11 +114,12 @@ int mnl_nft_obj_batch_del(struct nftnl_obj *nln, struct nftnl_batch *batch,
 
 struct nftnl_ruleset *mnl_nft_ruleset_dump(struct netlink_ctx *ctx,
 					   uint32_t family);
-int mnl_nft_event_listener(struct mnl_socket *nf_sock, unsigned int debug_mask,
+int mnl_nft_event_listener(struct nft_sock *nf_sock, unsigned int debug_mask,
 			   struct output_ctx *octx,
 			   int (*cb)(const struct nlmsghdr *nlh, void *data),
-			   void *cb_data);
+			   void *cb_data,
+			   void (*report)(void *data, uint64_t msecs));
 
-bool mnl_batch_supported(struct mnl_socket *nf_sock, uint32_t *seqnum);
+bool mnl_batch_supported(struct nft_sock *nf_sock, uint32_t *seqnum);
 
 #endif /* _NFTABLES_MNL_H_ */
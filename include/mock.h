@@ -0,0 +1,20 @@
+#ifndef NFTABLES_MOCK_H
+#define NFTABLES_MOCK_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+struct mock_sock;
+
+extern struct mock_sock *mock_sock_open(const struct mock_sock *peer);
+extern void mock_sock_close(struct mock_sock *sock);
+
+extern int mock_sock_fd(const struct mock_sock *sock);
+extern uint32_t mock_sock_portid(const struct mock_sock *sock);
+extern int mock_sock_subscribe(struct mock_sock *sock, unsigned int group);
+
+extern ssize_t mock_sock_send(struct mock_sock *sock, const void *buf,
+			      size_t len);
+extern ssize_t mock_sock_recv(struct mock_sock *sock, void *buf, size_t len);
+
+#endif /* NFTABLES_MOCK_H */
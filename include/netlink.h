@@ -44,7 +44,7 @@ extern const struct location netlink_location;
  * @cache:	cache context
  */
 struct netlink_ctx {
-	struct mnl_socket	*nf_sock;
+	struct nft_sock		*nf_sock;
 	struct list_head	*msgs;
 	struct list_head	list;
 	struct set		*set;
@@ -166,11 +166,20 @@ extern int netlink_delete_setelems(struct netlink_ctx *ctx, const struct handle
 				   const struct expr *expr);
 extern int netlink_get_setelems(struct netlink_ctx *ctx, const struct handle *h,
 				const struct location *loc, struct set *set);
+extern int netlink_list_setelems(struct netlink_ctx *ctx, struct list_head *sets,
+				 const struct location *loc);
 extern int netlink_flush_setelems(struct netlink_ctx *ctx, const struct handle *h,
 				  const struct location *loc);
+extern int netlink_replace_setelems(struct netlink_ctx *ctx,
+				    const struct handle *h,
+				    const struct expr *expr);
 
 extern int netlink_list_objs(struct netlink_ctx *ctx, const struct handle *h,
 			     const struct location *loc);
+extern int netlink_get_obj_stats(struct netlink_ctx *ctx,
+				 const struct handle *h, uint32_t type,
+				 bool reset, struct nft_obj_stats *objs,
+				 unsigned int num);
 extern int netlink_reset_objs(struct netlink_ctx *ctx, const struct handle *h,
 			      const struct location *loc, uint32_t type,
 			      bool dump);
@@ -192,7 +201,7 @@ extern void netlink_dump_obj(struct nftnl_obj *nlo, struct netlink_ctx *ctx);
 extern int netlink_batch_send(struct netlink_ctx *ctx, struct list_head *err_list);
 
 extern uint16_t netlink_genid_get(struct netlink_ctx *ctx);
-extern void netlink_restart(struct mnl_socket *nf_sock);
+extern void netlink_restart(struct nft_sock *nf_sock);
 #define netlink_abi_error()	\
 	__netlink_abi_error(__FILE__, __LINE__, strerror(errno));
 extern void __noreturn __netlink_abi_error(const char *file, int line, const char *reason);
@@ -216,12 +225,17 @@ struct netlink_mon_handler {
 	const struct location	*loc;
 	unsigned int		debug_mask;
 	bool			cache_needed;
+	bool			cache_rules;
 	struct nft_cache	*cache;
+	const struct handle	*filter;
+	enum monitor_mode	mode;
 };
 
 extern int netlink_monitor(struct netlink_mon_handler *monhandler,
-			    struct mnl_socket *nf_sock);
-bool netlink_batch_supported(struct mnl_socket *nf_sock, uint32_t *seqnum);
+			    struct nft_sock *nf_sock);
+extern void netlink_events_cache_update(struct netlink_mon_handler *monh,
+					const struct nlmsghdr *nlh, int type);
+bool netlink_batch_supported(struct nft_sock *nf_sock, uint32_t *seqnum);
 
 int netlink_echo_callback(const struct nlmsghdr *nlh, void *data);
 
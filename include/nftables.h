@@ -7,33 +7,50 @@
 #include <utils.h>
 #include <nftables/nftables.h>
 
+struct nft_stats_ctx;
+struct cmd_results;
+
 struct output_ctx {
 	unsigned int numeric;
 	unsigned int stateless;
 	unsigned int ip2name;
 	unsigned int handle;
 	unsigned int echo;
+	unsigned int json;
 	FILE *output_fp;
+	struct nft_stats_ctx *stats;
+	nft_echo_cb_t echo_cb;
+	void *echo_data;
+	struct cmd_results *results;
 };
 
+/* Objects added by the batch are echoed back to be printed or reported. */
+static inline bool nft_output_echo(const struct output_ctx *octx)
+{
+	return octx->echo || octx->echo_cb != NULL || octx->results != NULL;
+}
+
 struct nft_cache {
 	uint16_t		genid;
 	struct list_head	list;
 	uint32_t		seqnum;
 };
 
-struct mnl_socket;
+struct nft_sock;
 
 struct nft_ctx {
-	struct mnl_socket	*nf_sock;
+	struct nft_sock		*nf_sock;
 	char			**include_paths;
 	unsigned int		num_include_paths;
+	char			*include_cache;
 	unsigned int		parser_max_errors;
 	unsigned int		debug_mask;
 	struct output_ctx	output;
 	bool			check;
+	bool			stream;
 	struct nft_cache	cache;
 	uint32_t		flags;
+	struct rule_counters	*rule_counters;
 };
 
 enum nftables_exit_codes {
@@ -44,6 +61,8 @@ enum nftables_exit_codes {
 };
 
 struct input_descriptor;
+struct include_cache;
+struct rule_counters;
 struct location {
 	const struct input_descriptor		*indesc;
 	union {
@@ -86,23 +105,28 @@ enum input_descriptor_types {
 /**
  * struct input_descriptor
  *
+ * @list:		list node, inputs are kept until the scanner is destroyed
  * @location:		location, used for include statements
  * @type:		input descriptor type
  * @name:		name describing the input
- * @union:		buffer or file descriptor, depending on type
+ * @data:		input buffer, the file contents for files
+ * @size:		size of the file contents including the trailing NULs
+ * @mapped:		file contents are mapped rather than read into memory
+ * @cache:		include cache entry recorded while parsing the file
  * @lineno:		current line number in the input
  * @column:		current column in the input
  * @token_offset:	offset of the current token to the beginning
  * @line_offset:	offset of the current line to the beginning
  */
 struct input_descriptor {
+	struct list_head		list;
 	struct location			location;
 	enum input_descriptor_types	type;
 	const char			*name;
-	union {
-		const char		*data;
-		FILE			*fp;
-	};
+	const char			*data;
+	size_t				size;
+	bool				mapped;
+	struct include_cache		*cache;
 	unsigned int			lineno;
 	unsigned int			column;
 	off_t				token_offset;
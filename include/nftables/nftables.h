@@ -33,16 +33,184 @@ enum nft_numeric_level {
 	NFT_NUMERIC_ALL,
 };
 
+/**
+ * enum nft_stats_phase - phases wall and CPU time are accounted to
+ *
+ * Time is accounted to the innermost phase only, e.g. the cache fetches
+ * triggered from evaluation are not accounted to NFT_STATS_EVALUATE.
+ */
+enum nft_stats_phase {
+	NFT_STATS_OTHER,
+	NFT_STATS_PARSE,
+	NFT_STATS_EVALUATE,
+	NFT_STATS_CACHE_GENID,
+	NFT_STATS_CACHE_TABLE,
+	NFT_STATS_CACHE_CHAIN,
+	NFT_STATS_CACHE_SET,
+	NFT_STATS_CACHE_SETELEM,
+	NFT_STATS_CACHE_OBJ,
+	NFT_STATS_CACHE_RULE,
+	NFT_STATS_LINEARIZE,
+	NFT_STATS_BATCH,
+	NFT_STATS_SENDMSG,
+	NFT_STATS_ACK,
+	__NFT_STATS_MAX
+};
+#define NFT_STATS_MAX		(__NFT_STATS_MAX - 1)
+
+/* nf_tables message types are indexed by NFT_MSG_*, other messages
+ * (acknowledgments, batch delimiters) are accounted to @ctrl.
+ */
+#define NFT_STATS_MSG_TYPES	32
+
+struct nft_stats_time {
+	uint64_t	wall_ns;
+	uint64_t	cpu_ns;
+	uint64_t	calls;
+};
+
+struct nft_stats_msg {
+	uint64_t	tx_msgs;
+	uint64_t	tx_bytes;
+	uint64_t	rx_msgs;
+	uint64_t	rx_bytes;
+};
+
+struct nft_stats {
+	struct nft_stats_time	phase[__NFT_STATS_MAX];
+	struct nft_stats_msg	msg[NFT_STATS_MSG_TYPES];
+	struct nft_stats_msg	ctrl;
+	uint64_t		allocs;
+	uint64_t		alloc_bytes;
+	uint64_t		peak_rss_kb;
+};
+
+#define NFT_OBJ_STATS_NAMELEN	256
+
+/**
+ * struct nft_obj_stats - state of a named counter or quota
+ *
+ * @family:	table family
+ * @type:	NFT_OBJECT_COUNTER or NFT_OBJECT_QUOTA
+ * @table:	table name
+ * @name:	object name
+ * @packets:	counter packets
+ * @bytes:	counter bytes
+ * @quota:	quota bytes
+ * @consumed:	quota bytes consumed
+ * @flags:	quota flags
+ */
+struct nft_obj_stats {
+	uint32_t	family;
+	uint32_t	type;
+	char		table[NFT_OBJ_STATS_NAMELEN];
+	char		name[NFT_OBJ_STATS_NAMELEN];
+	uint64_t	packets;
+	uint64_t	bytes;
+	uint64_t	quota;
+	uint64_t	consumed;
+	uint32_t	flags;
+};
+
+/* The rule was not seen by the previous poll, deltas are the full count. */
+#define NFT_RULE_COUNTER_F_NEW	(1 << 0)
+
+/**
+ * struct nft_rule_counter - anonymous counters of a rule
+ *
+ * @family:		table family
+ * @table:		table name
+ * @chain:		chain name
+ * @handle:		rule handle
+ * @packets:		packets, summed over the counters of the rule
+ * @bytes:		bytes, summed over the counters of the rule
+ * @delta_packets:	packets since the previous poll
+ * @delta_bytes:	bytes since the previous poll
+ * @flags:		NFT_RULE_COUNTER_F_* flags
+ *
+ * The names belong to the context and remain valid until the next call to
+ * nft_ctx_get_rule_counters() or nft_ctx_free().
+ */
+struct nft_rule_counter {
+	uint32_t	family;
+	const char	*table;
+	const char	*chain;
+	uint64_t	handle;
+	uint64_t	packets;
+	uint64_t	bytes;
+	uint64_t	delta_packets;
+	uint64_t	delta_bytes;
+	uint32_t	flags;
+};
+
+/**
+ * enum nft_echo_type - type of an object reported by the echo callback
+ */
+enum nft_echo_type {
+	NFT_ECHO_TABLE,
+	NFT_ECHO_CHAIN,
+	NFT_ECHO_RULE,
+	NFT_ECHO_SET,
+	NFT_ECHO_OBJ,
+};
+
+/**
+ * struct nft_echo_object - object added by a command, as echoed by the kernel
+ *
+ * @type:	NFT_ECHO_* object type
+ * @family:	table family
+ * @table:	table name
+ * @chain:	chain name (chains and rules)
+ * @name:	set or stateful object name
+ * @handle:	chain or rule handle, 0 for other objects
+ * @set_id:	set ID within the batch (sets)
+ * @seqnum:	sequence number of the batch message that added the object
+ *
+ * The names are only valid during the callback.
+ */
+struct nft_echo_object {
+	enum nft_echo_type	type;
+	uint32_t		family;
+	const char		*table;
+	const char		*chain;
+	const char		*name;
+	uint64_t		handle;
+	uint32_t		set_id;
+	uint32_t		seqnum;
+};
+
+typedef void (*nft_echo_cb_t)(const struct nft_echo_object *obj, void *data);
+
+/**
+ * struct nft_cmd_result - object added by a command of the last run
+ *
+ * @cmd:	index of the command in the batch, counting from 0
+ * @line:	line the command starts at, 0 if unknown
+ * @object:	object added, with the handles assigned by the kernel
+ *
+ * Chains, sets, objects and rules declared in a table block count as
+ * commands of their own, with the line they are declared at.
+ */
+struct nft_cmd_result {
+	unsigned int		cmd;
+	unsigned int		line;
+	struct nft_echo_object	object;
+};
+
 /**
  * Possible flags to pass to nft_ctx_new()
  */
 #define NFT_CTX_DEFAULT		0
+/* talk to an in-process emulation of nf_tables instead of the kernel */
+#define NFT_CTX_NETLINK_MOCK	(1 << 0)
 
 struct nft_ctx *nft_ctx_new(uint32_t flags);
 void nft_ctx_free(struct nft_ctx *ctx);
 
 bool nft_ctx_get_dry_run(struct nft_ctx *ctx);
 void nft_ctx_set_dry_run(struct nft_ctx *ctx, bool dry);
+bool nft_ctx_get_stream(struct nft_ctx *ctx);
+void nft_ctx_set_stream(struct nft_ctx *ctx, bool stream);
 enum nft_numeric_level nft_ctx_output_get_numeric(struct nft_ctx *ctx);
 void nft_ctx_output_set_numeric(struct nft_ctx *ctx, enum nft_numeric_level level);
 bool nft_ctx_output_get_stateless(struct nft_ctx *ctx);
@@ -55,10 +223,33 @@ bool nft_ctx_output_get_handle(struct nft_ctx *ctx);
 void nft_ctx_output_set_handle(struct nft_ctx *ctx, bool val);
 bool nft_ctx_output_get_echo(struct nft_ctx *ctx);
 void nft_ctx_output_set_echo(struct nft_ctx *ctx, bool val);
+void nft_ctx_output_set_echo_cb(struct nft_ctx *ctx, nft_echo_cb_t cb,
+				void *data);
+bool nft_ctx_output_get_json(struct nft_ctx *ctx);
+void nft_ctx_output_set_json(struct nft_ctx *ctx, bool val);
+bool nft_ctx_output_get_stats(struct nft_ctx *ctx);
+void nft_ctx_output_set_stats(struct nft_ctx *ctx, bool val);
+bool nft_ctx_output_get_results(struct nft_ctx *ctx);
+void nft_ctx_output_set_results(struct nft_ctx *ctx, bool val);
+
+int nft_ctx_get_stats(struct nft_ctx *ctx, struct nft_stats *stats);
+int nft_ctx_get_results(struct nft_ctx *ctx,
+			const struct nft_cmd_result **results);
+int nft_ctx_get_obj_stats(struct nft_ctx *ctx, uint32_t family,
+			  const char *table, uint32_t type, bool reset,
+			  struct nft_obj_stats *objs, unsigned int num);
+int nft_ctx_get_rule_counters(struct nft_ctx *ctx, uint32_t family,
+			      const char *table, const char *chain,
+			      struct nft_rule_counter *rules, unsigned int num);
+void nft_rule_counters_print(FILE *fp, const struct nft_rule_counter *rules,
+			     unsigned int num, bool json);
+void nft_ctx_reset_stats(struct nft_ctx *ctx);
+void nft_stats_print(FILE *fp, const struct nft_stats *stats, bool json);
 
 FILE *nft_ctx_set_output(struct nft_ctx *ctx, FILE *fp);
 int nft_ctx_add_include_path(struct nft_ctx *ctx, const char *path);
 void nft_ctx_clear_include_paths(struct nft_ctx *ctx);
+int nft_ctx_set_include_cache(struct nft_ctx *ctx, const char *dir);
 
 int nft_run_cmd_from_buffer(struct nft_ctx *nft, char *buf, size_t buflen);
 int nft_run_cmd_from_filename(struct nft_ctx *nft, const char *filename);
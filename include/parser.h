@@ -15,8 +15,9 @@
 
 struct parser_state {
 	struct input_descriptor		*indesc;
-	struct input_descriptor		indescs[MAX_INCLUDE_DEPTH];
+	struct input_descriptor		*indescs[MAX_INCLUDE_DEPTH];
 	unsigned int			indesc_idx;
+	struct list_head		indesc_list;
 
 	struct list_head		*msgs;
 	unsigned int			nerrs;
@@ -27,17 +28,25 @@ struct parser_state {
 
 	struct list_head		cmds;
 	struct eval_ctx			ectx;
+
+	void				(*cmd_cb)(struct parser_state *state,
+						  struct list_head *cmds,
+						  void *data);
+	void				*cmd_data;
 };
 
-struct mnl_socket;
+struct nft_sock;
 
-extern void parser_init(struct mnl_socket *nf_sock, struct nft_cache *cache,
+extern void parser_init(struct nft_sock *nf_sock, struct nft_cache *cache,
 			struct parser_state *state, struct list_head *msgs,
 			unsigned int debug_level, struct output_ctx *octx);
 extern int nft_parse(struct nft_ctx *ctx, void *, struct parser_state *state);
+extern void parser_add_cmds(struct parser_state *state,
+			    struct list_head *cmds);
 
 extern void *scanner_init(struct parser_state *state);
 extern void scanner_destroy(void *scanner);
+extern void scanner_restore_input(void *scanner);
 
 extern int scanner_read_file(void *scanner, const char *filename,
 			     const struct location *loc);
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <nftables.h>
 #include <list.h>
+#include <datatype.h>
 
 /**
  * struct handle_spec - handle ID
@@ -37,6 +38,7 @@ struct position_spec {
  * @obj:	stateful object name (stateful object only)
  * @handle:	rule handle (rules only)
  * @position:	rule position (rules only)
+ * @index:	index of the reference rule plus one (rules only)
  * @set_id:	set ID (sets only)
  */
 struct handle {
@@ -47,6 +49,7 @@ struct handle {
 	const char		*obj;
 	struct handle_spec	handle;
 	struct position_spec	position;
+	struct position_spec	index;
 	uint32_t		set_id;
 };
 
@@ -73,15 +76,38 @@ extern void scope_release(const struct scope *scope);
  * @list:	scope symbol list node
  * @identifier:	identifier
  * @expr:	initializer
+ * @values:	evaluated initializers, shared by all references
  */
 struct symbol {
 	struct list_head	list;
 	const char		*identifier;
 	struct expr		*expr;
+	struct list_head	values;
+};
+
+/**
+ * struct symbol_value - initializer evaluated in a given context
+ *
+ * @list:	symbol values list node
+ * @dtype:	context datatype
+ * @byteorder:	context byteorder
+ * @len:	context length
+ * @maxval:	context maximum value
+ * @expr:	evaluated expression
+ */
+struct symbol_value {
+	struct list_head	list;
+	const struct datatype	*dtype;
+	enum byteorder		byteorder;
+	unsigned int		len;
+	unsigned int		maxval;
+	struct expr		*expr;
 };
 
 extern void symbol_bind(struct scope *scope, const char *identifier,
 			struct expr *expr);
+extern void symbol_unbind(const struct scope *scope,
+			  const char *identifier);
 extern struct symbol *symbol_lookup(const struct scope *scope,
 				    const char *identifier);
 
@@ -144,6 +170,7 @@ enum chain_flags {
  * @type:	chain type
  * @dev:	device (if any)
  * @rules:	rules contained in the chain
+ * @rule_index:	rules of the chain by handle and position, if loaded
  */
 struct chain {
 	struct list_head	list;
@@ -159,6 +186,7 @@ struct chain {
 	const char		*dev;
 	struct scope		scope;
 	struct list_head	rules;
+	struct rule_index	*rule_index;
 };
 
 extern const char *chain_type_name_lookup(const char *name);
@@ -169,9 +197,11 @@ extern void chain_free(struct chain *chain);
 extern void chain_add_hash(struct chain *chain, struct table *table);
 extern struct chain *chain_lookup(const struct table *table,
 				  const struct handle *h);
+extern void chain_index_rules(struct chain *chain);
 
 extern const char *family2str(unsigned int family);
 extern const char *hooknum2str(unsigned int family, unsigned int hooknum);
+extern const char *chain_policy2str(uint32_t policy);
 extern void chain_print_plain(const struct chain *chain,
 			      struct output_ctx *octx);
 
@@ -220,7 +250,10 @@ extern struct rule *rule_lookup(const struct chain *chain, uint64_t handle);
  * @init:	initializer
  * @rg_cache:	cached range element (left)
  * @policy:	set mechanism policy
+ * @policy_auto: reason for an automatically selected policy
  * @automerge:	merge adjacents and overlapping elements, if possible
+ * @nelems:	number of elements added along with the set
+ * @changed:	created or changed by the batch being evaluated
  * @desc:	set mechanism desc
  */
 struct set {
@@ -238,12 +271,37 @@ struct set {
 	struct expr		*init;
 	struct expr		*rg_cache;
 	uint32_t		policy;
+	uint32_t		policy_auto;
 	bool			automerge;
+	uint32_t		nelems;
+	bool			changed;
 	struct {
 		uint32_t	size;
 	} desc;
 };
 
+/**
+ * enum set_policy_auto - reason for an automatically selected set policy
+ *
+ * @SET_POLICY_AUTO_NONE:	policy was given by the user
+ * @SET_POLICY_AUTO_PENDING:	policy is selected when the set is added
+ * @SET_POLICY_AUTO_INTERVAL:	interval sets are kept in a tree anyway
+ * @SET_POLICY_AUTO_NARROW_KEY:	keys of up to 16 bits fit a bitmap
+ * @SET_POLICY_AUTO_FEW_ELEMS:	constant set with few elements
+ * @SET_POLICY_AUTO_MANY_ELEMS:	constant set with many elements
+ * @SET_POLICY_AUTO_DYNAMIC:	elements may be added later on
+ */
+enum set_policy_auto {
+	SET_POLICY_AUTO_NONE,
+	SET_POLICY_AUTO_PENDING,
+	SET_POLICY_AUTO_INTERVAL,
+	SET_POLICY_AUTO_NARROW_KEY,
+	SET_POLICY_AUTO_FEW_ELEMS,
+	SET_POLICY_AUTO_MANY_ELEMS,
+	SET_POLICY_AUTO_DYNAMIC,
+	__SET_POLICY_AUTO_MAX,
+};
+
 extern struct set *set_alloc(const struct location *loc);
 extern struct set *set_get(struct set *set);
 extern void set_free(struct set *set);
@@ -253,6 +311,7 @@ extern struct set *set_lookup_global(uint32_t family, const char *table,
 				     const char *name, struct nft_cache *cache);
 extern void set_print(const struct set *set, struct output_ctx *octx);
 extern void set_print_plain(const struct set *s, struct output_ctx *octx);
+extern const char *set_policy2str(uint32_t policy);
 
 #include <statement.h>
 
@@ -373,6 +432,7 @@ enum cmd_ops {
  * @CMD_OBJ_QUOTAS:	multiple quotas
  * @CMD_OBJ_LIMIT:	limit
  * @CMD_OBJ_LIMITS:	multiple limits
+ * @CMD_OBJ_SETELEM_FILE: set elements read from a file
  */
 enum cmd_obj {
 	CMD_OBJ_INVALID,
@@ -399,6 +459,7 @@ enum cmd_obj {
 	CMD_OBJ_CT_HELPERS,
 	CMD_OBJ_LIMIT,
 	CMD_OBJ_LIMITS,
+	CMD_OBJ_SETELEM_FILE,
 };
 
 struct markup {
@@ -408,6 +469,37 @@ struct markup {
 struct markup *markup_alloc(uint32_t format);
 void markup_free(struct markup *m);
 
+/**
+ * enum setelem_file_format - format of a set element file
+ *
+ * @SETELEM_FILE_RAW:	fixed size records, key followed by data, as stored
+ *			by the kernel
+ * @SETELEM_FILE_CSV:	one element per line, key and data separated by a
+ *			comma
+ */
+enum setelem_file_format {
+	SETELEM_FILE_RAW,
+	SETELEM_FILE_CSV,
+};
+
+/**
+ * struct setelem_file - set elements to be read from a file
+ *
+ * @location:	location of the file name
+ * @path:	file name
+ * @format:	file format
+ */
+struct setelem_file {
+	struct location			location;
+	char				*path;
+	enum setelem_file_format	format;
+};
+
+struct setelem_file *setelem_file_alloc(const struct location *loc,
+					const char *path,
+					enum setelem_file_format format);
+void setelem_file_free(struct setelem_file *file);
+
 enum {
 	CMD_MONITOR_OBJ_ANY,
 	CMD_MONITOR_OBJ_TABLES,
@@ -420,12 +512,36 @@ enum {
 	CMD_MONITOR_OBJ_MAX
 };
 
+/**
+ * enum monitor_mode - what the monitor command does with the events
+ *
+ * @MONITOR_MODE_EVENTS:	print every event
+ * @MONITOR_MODE_COUNTS:	count events per object, print their rates
+ * @MONITOR_MODE_PROFILE:	aggregate traces into a rule hit profile
+ */
+enum monitor_mode {
+	MONITOR_MODE_EVENTS,
+	MONITOR_MODE_COUNTS,
+	MONITOR_MODE_PROFILE,
+};
+
+/**
+ * struct monitor - monitor command
+ *
+ * @location:	location of the event type
+ * @format:	output format
+ * @flags:	mask of the netlink event types to listen to
+ * @type:	monitored object type (CMD_MONITOR_OBJ_*)
+ * @event:	event type ("new", "destroy"), NULL for any
+ * @mode:	what to do with the events
+ */
 struct monitor {
 	struct location	location;
 	uint32_t	format;
 	uint32_t	flags;
 	uint32_t	type;
 	const char	*event;
+	enum monitor_mode mode;
 };
 
 struct monitor *monitor_alloc(uint32_t format, uint32_t type, const char *event);
@@ -460,6 +576,7 @@ struct cmd {
 		struct monitor	*monitor;
 		struct markup	*markup;
 		struct obj	*object;
+		struct setelem_file *elem_file;
 	};
 	const void		*arg;
 };
@@ -490,9 +607,14 @@ extern void cmd_free(struct cmd *cmd);
  * @debug_mask: debugging bitmask
  * @ectx:	expression context
  * @pctx:	payload context
+ * @set_literals: set literals seen in this batch, or since the last
+ *		  commands were streamed
+ * @jump_graph:	jump graph of the ruleset, loaded on first use
+ * @changed_sets: sets created or changed by the batch so far
+ * @num_changed_sets: number of entries in @changed_sets
  */
 struct eval_ctx {
-	struct mnl_socket	*nf_sock;
+	struct nft_sock		*nf_sock;
 	struct list_head	*msgs;
 	struct cmd		*cmd;
 	struct table		*table;
@@ -504,20 +626,36 @@ struct eval_ctx {
 	unsigned int		debug_mask;
 	struct expr_ctx		ectx;
 	struct proto_ctx	pctx;
+	struct set_literal_table *set_literals;
+	struct jump_graph	*jump_graph;
+	struct set		**changed_sets;
+	unsigned int		num_changed_sets;
 };
 
 extern int cmd_evaluate(struct eval_ctx *ctx, struct cmd *cmd);
+extern void eval_ctx_release(struct eval_ctx *ctx);
+extern void eval_ctx_release_set_literals(struct eval_ctx *ctx);
 
 extern struct error_record *rule_postprocess(struct rule *rule);
 
 struct netlink_ctx;
 extern int do_command(struct netlink_ctx *ctx, struct cmd *cmd);
 
-extern int cache_update(struct mnl_socket *nf_sock, struct nft_cache *cache,
+extern int cache_update(struct nft_sock *nf_sock, struct nft_cache *cache,
 			enum cmd_ops cmd, struct list_head *msgs, bool debug,
 			struct output_ctx *octx);
+extern int cache_update_norules(struct nft_sock *nf_sock,
+				struct nft_cache *cache,
+				struct list_head *msgs, bool debug,
+				struct output_ctx *octx);
+extern int cache_update_tables(struct nft_sock *nf_sock,
+			       struct nft_cache *cache,
+			       const struct list_head *cmds,
+			       struct list_head *msgs, bool debug,
+			       struct output_ctx *octx);
 extern void cache_flush(struct list_head *table_list);
 extern void cache_release(struct nft_cache *cache);
+extern void cache_release_rule_indexes(struct nft_cache *cache);
 
 enum udata_type {
 	UDATA_TYPE_COMMENT,
@@ -531,6 +669,7 @@ enum udata_set_type {
 	UDATA_SET_KEYBYTEORDER,
 	UDATA_SET_DATABYTEORDER,
 	UDATA_SET_MERGE_ELEMENTS,
+	UDATA_SET_POLICY_AUTO,
 	__UDATA_SET_MAX,
 };
 #define UDATA_SET_MAX (__UDATA_SET_MAX - 1)
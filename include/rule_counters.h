@@ -0,0 +1,16 @@
+#ifndef NFTABLES_RULE_COUNTERS_H
+#define NFTABLES_RULE_COUNTERS_H
+
+struct netlink_ctx;
+struct handle;
+struct nft_rule_counter;
+struct rule_counters;
+
+extern int rule_counters_poll(struct netlink_ctx *ctx,
+			      struct rule_counters **rcp,
+			      const struct handle *h,
+			      struct nft_rule_counter *rules,
+			      unsigned int num);
+extern void rule_counters_free(struct rule_counters *rc);
+
+#endif /* NFTABLES_RULE_COUNTERS_H */
@@ -0,0 +1,114 @@
+#ifndef NFTABLES_RULE_INDEX_H
+#define NFTABLES_RULE_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <list.h>
+
+struct handle;
+struct netlink_ctx;
+struct rule;
+
+/**
+ * struct rule_index_entry - rule of an indexed chain
+ *
+ * @hnode:	handle hash table node
+ * @left:	entries before this one in its subtree
+ * @right:	entries after this one in its subtree
+ * @parent:	parent entry, NULL for the root
+ * @size:	number of entries in the subtree
+ * @prio:	random tree priority
+ * @handle:	rule handle, 0 if the rule is added by the current batch
+ * @rule:	cached rule, NULL if only the handle is known
+ */
+struct rule_index_entry {
+	struct hlist_node		hnode;
+	struct rule_index_entry		*left;
+	struct rule_index_entry		*right;
+	struct rule_index_entry		*parent;
+	unsigned int			size;
+	uint32_t			prio;
+	uint64_t			handle;
+	struct rule			*rule;
+};
+
+/**
+ * enum rule_index_op - rule edit made by a command
+ *
+ * @RULE_INDEX_APPEND:	rule added at the end of the chain
+ * @RULE_INDEX_PREPEND:	rule inserted at the start of the chain
+ * @RULE_INDEX_AFTER:	rule added after the rule with the given handle
+ * @RULE_INDEX_BEFORE:	rule inserted before the rule with the given handle
+ * @RULE_INDEX_DELETE:	rule with the given handle deleted
+ * @RULE_INDEX_REPLACE:	rule with the given handle replaced
+ */
+enum rule_index_op {
+	RULE_INDEX_APPEND,
+	RULE_INDEX_PREPEND,
+	RULE_INDEX_AFTER,
+	RULE_INDEX_BEFORE,
+	RULE_INDEX_DELETE,
+	RULE_INDEX_REPLACE,
+};
+
+/**
+ * struct rule_index_edit - rule edit waiting for the index to be loaded
+ *
+ * @op:		edit type
+ * @handle:	handle of the rule the edit refers to
+ * @count:	number of rules appended or prepended
+ */
+struct rule_index_edit {
+	enum rule_index_op		op;
+	uint64_t			handle;
+	unsigned int			count;
+};
+
+/**
+ * struct rule_index - rules of a chain by handle and by position
+ *
+ * @hash:	entries with a handle, hashed by handle
+ * @hsize:	hash table size, a power of two
+ * @nhandles:	number of entries in the hash table
+ * @root:	tree of all entries, in chain order
+ * @seed:	state of the priority generator
+ * @loaded:	entries match the chain, otherwise edits are logged
+ * @log:	edits made before the index is loaded
+ * @nlog:	number of logged edits
+ */
+struct rule_index {
+	struct hlist_head		*hash;
+	unsigned int			hsize;
+	unsigned int			nhandles;
+	struct rule_index_entry		*root;
+	uint32_t			seed;
+	bool				loaded;
+	struct rule_index_edit		*log;
+	unsigned int			nlog;
+};
+
+extern struct rule_index *rule_index_alloc(bool loaded);
+extern void rule_index_free(struct rule_index *ri);
+extern void rule_index_flush(struct rule_index *ri);
+extern int rule_index_load(struct rule_index *ri, struct netlink_ctx *ctx,
+			   const struct handle *h);
+
+extern unsigned int rule_index_count(const struct rule_index *ri);
+extern struct rule_index_entry *rule_index_lookup(const struct rule_index *ri,
+						  uint64_t handle);
+extern struct rule_index_entry *rule_index_nth(const struct rule_index *ri,
+					       unsigned int pos);
+extern unsigned int rule_index_position(const struct rule_index_entry *e);
+extern struct rule_index_entry *rule_index_prev(struct rule_index_entry *e);
+extern struct rule_index_entry *rule_index_next(struct rule_index_entry *e);
+
+extern struct rule_index_entry *rule_index_insert(struct rule_index *ri,
+						  struct rule_index_entry *ref,
+						  bool after, uint64_t handle,
+						  struct rule *rule);
+extern void rule_index_remove(struct rule_index *ri,
+			      struct rule_index_entry *e);
+extern void rule_index_edit(struct rule_index *ri, enum rule_index_op op,
+			    uint64_t handle);
+
+#endif /* NFTABLES_RULE_INDEX_H */
@@ -0,0 +1,19 @@
+#ifndef NFTABLES_SETELEM_FILE_H
+#define NFTABLES_SETELEM_FILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct datatype;
+struct handle;
+struct netlink_ctx;
+struct set;
+struct setelem_file;
+
+extern bool setelem_file_type_supported(const struct datatype *dtype,
+					unsigned int len);
+extern int setelem_file_load(struct netlink_ctx *ctx, const struct handle *h,
+			     const struct set *set,
+			     const struct setelem_file *file, uint32_t flags);
+
+#endif /* NFTABLES_SETELEM_FILE_H */
@@ -328,5 +328,6 @@ extern void stmt_print(const struct stmt *stmt, struct output_ctx *octx);
 
 const char *get_rate(uint64_t byte_rate, uint64_t *rate);
 const char *get_unit(uint64_t u);
+const char *log_level(uint32_t level);
 
 #endif /* NFTABLES_STATEMENT_H */
@@ -0,0 +1,40 @@
+#ifndef NFTABLES_STATS_H
+#define NFTABLES_STATS_H
+
+#include <time.h>
+#include <nftables.h>
+#include <utils.h>
+
+/**
+ * struct nft_stats_ctx - statistics collection state
+ *
+ * @stats:		accumulated statistics
+ * @phase:		phase elapsed time is currently accounted to
+ * @running:		a command run is in progress
+ * @wall:		wall clock time @phase was entered or resumed
+ * @cpu:		process CPU time @phase was entered or resumed
+ * @allocs:		allocations made by the run in progress
+ * @prev_allocs:	allocation counters in use before the run started
+ */
+struct nft_stats_ctx {
+	struct nft_stats	stats;
+	enum nft_stats_phase	phase;
+	bool			running;
+	struct timespec		wall;
+	struct timespec		cpu;
+	struct xalloc_counters	allocs;
+	struct xalloc_counters	*prev_allocs;
+};
+
+extern void stats_run_begin(struct output_ctx *octx);
+extern void stats_run_end(struct output_ctx *octx);
+
+extern enum nft_stats_phase stats_phase_enter(struct output_ctx *octx,
+					      enum nft_stats_phase phase);
+extern void stats_phase_leave(struct output_ctx *octx,
+			      enum nft_stats_phase prev);
+
+extern void stats_msg_tx(struct output_ctx *octx, const void *buf, size_t len);
+extern void stats_msg_rx(struct output_ctx *octx, const void *buf, size_t len);
+
+#endif /* NFTABLES_STATS_H */
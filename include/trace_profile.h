@@ -0,0 +1,16 @@
+#ifndef NFTABLES_TRACE_PROFILE_H
+#define NFTABLES_TRACE_PROFILE_H
+
+#include <stdint.h>
+
+struct nlmsghdr;
+struct netlink_mon_handler;
+struct trace_profile;
+
+extern struct trace_profile *trace_profile_alloc(struct netlink_mon_handler *monh);
+extern void trace_profile_free(struct trace_profile *p);
+
+extern int trace_profile_event_cb(const struct nlmsghdr *nlh, void *data);
+extern void trace_profile_report(void *data, uint64_t msecs);
+
+#endif /* NFTABLES_TRACE_PROFILE_H */
@@ -132,6 +132,21 @@ extern void *xmalloc_array(size_t nmemb, size_t size);
 extern void *xrealloc(void *ptr, size_t size);
 extern void *xzalloc(size_t size);
 extern char *xstrdup(const char *s);
+
+/**
+ * struct xalloc_counters - allocations made through the x*alloc() helpers
+ *
+ * @count:	number of allocations
+ * @bytes:	allocated bytes
+ */
+struct xalloc_counters {
+	uint64_t	count;
+	uint64_t	bytes;
+};
+
+extern struct xalloc_counters *xalloc_counters_set(struct xalloc_counters *c);
+extern void xalloc_counters_add(const struct xalloc_counters *c);
+extern bool xalloc_counting(void);
 extern void xstrunescape(const char *in, char *out);
 
 #endif /* NFTABLES_UTILS_H */
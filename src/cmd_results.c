@@ -0,0 +1,221 @@
+/*
+ * Handles assigned to the objects added by each command.
+ *
+ * Objects are collected from the echo replies as the batch is processed,
+ * then bound to the commands that added them by sequence number: every
+ * command is given its own sequence number when it is put in the batch and
+ * the kernel echoes objects back with the number of the message that added
+ * them.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <string.h>
+
+#include <cmd_results.h>
+#include <list.h>
+#include <rule.h>
+#include <utils.h>
+
+#define CMD_RESULTS_CHUNK_SIZE	16384
+
+/**
+ * struct cmd_results_chunk - block of names
+ *
+ * @next:	chunk allocated before this one
+ * @used:	bytes of @data in use
+ * @size:	size of @data
+ * @data:	NUL terminated names
+ */
+struct cmd_results_chunk {
+	struct cmd_results_chunk	*next;
+	size_t				used;
+	size_t				size;
+	char				data[];
+};
+
+struct cmd_results *cmd_results_alloc(void)
+{
+	return xzalloc(sizeof(struct cmd_results));
+}
+
+void cmd_results_clear(struct cmd_results *res)
+{
+	struct cmd_results_chunk *chunk, *next;
+
+	for (chunk = res->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		xfree(chunk);
+	}
+	res->chunks = NULL;
+
+	xfree(res->results);
+	res->results = NULL;
+	res->num = 0;
+	res->size = 0;
+}
+
+void cmd_results_free(struct cmd_results *res)
+{
+	if (res == NULL)
+		return;
+
+	cmd_results_clear(res);
+	xfree(res);
+}
+
+static const char *cmd_results_strdup(struct cmd_results *res,
+				      const char *prev, const char *str)
+{
+	struct cmd_results_chunk *chunk = res->chunks;
+	size_t len;
+	char *p;
+
+	if (str == NULL)
+		return NULL;
+	/* objects of the same table and chain usually come in a row */
+	if (prev != NULL && !strcmp(prev, str))
+		return prev;
+
+	len = strlen(str) + 1;
+	if (chunk == NULL || chunk->size - chunk->used < len) {
+		size_t size = len > CMD_RESULTS_CHUNK_SIZE ?
+			      len : CMD_RESULTS_CHUNK_SIZE;
+
+		chunk = xmalloc(sizeof(*chunk) + size);
+		chunk->next = res->chunks;
+		chunk->used = 0;
+		chunk->size = size;
+		res->chunks = chunk;
+	}
+
+	p = chunk->data + chunk->used;
+	memcpy(p, str, len);
+	chunk->used += len;
+	return p;
+}
+
+/**
+ * cmd_results_add - record an object echoed by the kernel
+ *
+ * @res:	results of the current run
+ * @obj:	object, its names are copied
+ *
+ * The object is bound to its command by cmd_results_bind().
+ */
+void cmd_results_add(struct cmd_results *res,
+		     const struct nft_echo_object *obj)
+{
+	const struct nft_echo_object *prev = NULL;
+	struct nft_cmd_result *r;
+
+	if (res->num == res->size) {
+		res->size = res->size ? res->size * 2 : 64;
+		res->results = xrealloc(res->results,
+					res->size * sizeof(*res->results));
+	}
+	if (res->num > 0)
+		prev = &res->results[res->num - 1].object;
+
+	r = &res->results[res->num++];
+	memset(r, 0, sizeof(*r));
+	r->object = *obj;
+	r->object.table = cmd_results_strdup(res, prev ? prev->table : NULL,
+					     obj->table);
+	r->object.chain = cmd_results_strdup(res, prev ? prev->chain : NULL,
+					     obj->chain);
+	r->object.name = cmd_results_strdup(res, prev ? prev->name : NULL,
+					    obj->name);
+}
+
+static unsigned int location_line(const struct location *loc)
+{
+	const struct input_descriptor *indesc = loc->indesc;
+
+	if (indesc == NULL ||
+	    indesc->type == INDESC_INVALID ||
+	    indesc->type == INDESC_INTERNAL ||
+	    indesc->type == INDESC_NETLINK)
+		return 0;
+
+	return loc->first_line;
+}
+
+/**
+ * cmd_results_bind - match the objects to the commands that added them
+ *
+ * @res:	results of the current run
+ * @cmds:	commands of the batch, as sent
+ *
+ * Objects echoed in batch order are matched in a single pass over the
+ * commands, the search only starts over if an object comes out of order.
+ * Objects with no matching command are dropped.
+ */
+void cmd_results_bind(struct cmd_results *res, const struct list_head *cmds)
+{
+	const struct cmd *cmd = NULL;
+	struct nft_cmd_result *r;
+	unsigned int i, n = 0, idx = 0;
+
+	if (list_empty(cmds))
+		goto out;
+
+	cmd = list_first_entry(cmds, struct cmd, list);
+	for (i = 0; i < res->num; i++) {
+		r = &res->results[i];
+
+		if (r->object.seqnum < cmd->seqnum) {
+			cmd = list_first_entry(cmds, struct cmd, list);
+			idx = 0;
+		}
+		while (cmd->seqnum < r->object.seqnum &&
+		       !list_is_last(&cmd->list, cmds)) {
+			cmd = list_entry(cmd->list.next, struct cmd, list);
+			idx++;
+		}
+		if (cmd->seqnum != r->object.seqnum)
+			continue;
+
+		r->cmd = idx;
+		r->line = location_line(&cmd->location);
+		res->results[n++] = *r;
+	}
+out:
+	res->num = n;
+}
+
+/**
+ * cmd_results_bind_locations - match the objects to commands by location
+ *
+ * @res:	results of the current run
+ * @first:	sequence number of the first command
+ * @locs:	locations of the commands, by sequence number from @first
+ * @num:	number of commands
+ *
+ * Used when the commands were released as they were put in the batch. They
+ * were given consecutive sequence numbers, so the sequence number of an
+ * object is enough to find its command. Objects with no matching command are
+ * dropped.
+ */
+void cmd_results_bind_locations(struct cmd_results *res, uint32_t first,
+				const struct location *locs, unsigned int num)
+{
+	struct nft_cmd_result *r;
+	unsigned int i, n = 0;
+	uint32_t idx;
+
+	for (i = 0; i < res->num; i++) {
+		r = &res->results[i];
+
+		idx = r->object.seqnum - first;
+		if (idx >= num)
+			continue;
+
+		r->cmd = idx;
+		r->line = location_line(&locs[idx]);
+		res->results[n++] = *r;
+	}
+	res->num = n;
+}
@@ -271,29 +271,42 @@ static const struct ct_template ct_templates[] = {
 					      BYTEORDER_HOST_ENDIAN, 32),
 };
 
+const char *ct_key_name(enum nft_ct_keys key)
+{
+	return ct_templates[key].token;
+}
+
+const char *ct_dir_name(int8_t dir)
+{
+	const struct symbolic_constant *s;
+
+	for (s = ct_dir_tbl.symbols; s->identifier != NULL; s++) {
+		if (dir == (int)s->value)
+			return s->identifier;
+	}
+	return NULL;
+}
+
 static void ct_print(enum nft_ct_keys key, int8_t dir, uint8_t nfproto,
 		     struct output_ctx *octx)
 {
-	const struct symbolic_constant *s;
 	const struct proto_desc *desc;
+	const char *name;
 
 	nft_print(octx, "ct ");
 	if (dir < 0)
 		goto done;
 
-	for (s = ct_dir_tbl.symbols; s->identifier != NULL; s++) {
-		if (dir == (int)s->value) {
-			nft_print(octx, "%s ", s->identifier);
-			break;
-		}
-	}
+	name = ct_dir_name(dir);
+	if (name != NULL)
+		nft_print(octx, "%s ", name);
 
 	switch (key) {
 	case NFT_CT_SRC: /* fallthrough */
 	case NFT_CT_DST:
 		desc = proto_find_upper(&proto_inet, nfproto);
 		if (desc)
-			printf("%s ", desc->name);
+			nft_print(octx, "%s ", desc->name);
 		break;
 	default:
 		break;
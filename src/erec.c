@@ -118,11 +118,9 @@ void erec_print(struct output_ctx *octx, const struct error_record *erec,
 	const struct location *loc = erec->locations, *iloc;
 	const struct input_descriptor *indesc = loc->indesc, *tmp;
 	const char *line = NULL; /* silence gcc */
-	char buf[1024] = {};
 	char *pbuf = NULL;
 	unsigned int i, end;
-	int l, ret;
-	off_t orig_offset = 0;
+	int l;
 	FILE *f = octx->output_fp;
 
 	if (!f)
@@ -135,13 +133,7 @@ void erec_print(struct output_ctx *octx, const struct error_record *erec,
 		*strchrnul(line, '\n') = '\0';
 		break;
 	case INDESC_FILE:
-		orig_offset = ftell(indesc->fp);
-		fseek(indesc->fp, loc->line_offset, SEEK_SET);
-		ret = fread(buf, 1, sizeof(buf) - 1, indesc->fp);
-		if (ret > 0)
-			*strchrnul(buf, '\n') = '\0';
-		line = buf;
-		fseek(indesc->fp, orig_offset, SEEK_SET);
+		line = indesc->data + loc->line_offset;
 		break;
 	case INDESC_INTERNAL:
 	case INDESC_NETLINK:
@@ -184,7 +176,8 @@ void erec_print(struct output_ctx *octx, const struct error_record *erec,
 		fprintf(f, "%s\n", erec->msg);
 
 		if (indesc->type != INDESC_INTERNAL)
-			fprintf(f, "%s\n", line);
+			fprintf(f, "%.*s\n",
+				(int)(strchrnul(line, '\n') - line), line);
 
 		end = 0;
 		for (l = erec->num_locations - 1; l >= 0; l--) {
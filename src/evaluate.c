@@ -13,6 +13,8 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <inttypes.h>
+#include <errno.h>
 #include <arpa/inet.h>
 #include <linux/netfilter.h>
 #include <linux/netfilter_arp.h>
@@ -29,6 +31,11 @@
 #include <gmputil.h>
 #include <utils.h>
 #include <xt.h>
+#include <stats.h>
+#include <setelem_file.h>
+#include <netlink.h>
+#include <jump_graph.h>
+#include <rule_index.h>
 
 static int expr_evaluate(struct eval_ctx *ctx, struct expr **expr);
 
@@ -71,6 +78,300 @@ static void key_fix_dtype_byteorder(struct expr *key)
 		concat_type_destroy(dtype);
 }
 
+/*
+ * Rules in the same table often carry identical set literals, generated
+ * per-interface copies for instance. The kernel binds an anonymous set to
+ * a single rule, so each rule still needs its own set and kernel memory
+ * use does not change, but identical literals share one element list in
+ * userspace which is then only converted to intervals once.
+ *
+ * The shared elements keep the locations of the first literal. Literals
+ * are only shared once they are evaluated, and only if nothing reports
+ * errors on their elements later on: the first literal is converted to
+ * intervals before any other, so its errors point to the right rule.
+ */
+#define SET_LITERAL_HSIZE	1024
+
+struct set_literal {
+	struct hlist_node	hnode;
+	uint32_t		family;
+	char			*table;
+	uint32_t		hash;
+	uint32_t		dtype;
+	enum byteorder		byteorder;
+	unsigned int		len;
+	struct expr		*init;
+};
+
+struct set_literal_table {
+	struct hlist_head	hash[SET_LITERAL_HSIZE];
+};
+
+struct set_literal_elem {
+	mpz_t			low;
+	mpz_t			high;
+};
+
+static bool set_literal_shareable(const struct expr *key,
+				  const struct expr *set)
+{
+	const struct expr *elem;
+
+	if (set->ops->type != EXPR_SET || set->size == 0 ||
+	    set->set_flags & (NFT_SET_MAP | NFT_SET_OBJECT | NFT_SET_EVAL |
+			      NFT_SET_TIMEOUT))
+		return false;
+	if (key->len == 0 || key->len > NFT_DATA_VALUE_MAXLEN * BITS_PER_BYTE)
+		return false;
+	/* binop_transfer() rewrites the elements and reports errors on them */
+	if (key->ops->type == EXPR_BINOP)
+		return false;
+
+	list_for_each_entry(elem, &set->expressions, list) {
+		if (elem->ops->type != EXPR_SET_ELEM ||
+		    elem->timeout || elem->expiration ||
+		    elem->comment != NULL || elem->stmt != NULL)
+			return false;
+
+		switch (elem->key->ops->type) {
+		case EXPR_VALUE:
+		case EXPR_PREFIX:
+		case EXPR_RANGE:
+			break;
+		default:
+			return false;
+		}
+	}
+	return true;
+}
+
+static uint32_t set_literal_hash_value(uint32_t hash, const mpz_t value,
+				       unsigned int len)
+{
+	unsigned char data[NFT_DATA_VALUE_MAXLEN];
+	unsigned int i;
+
+	mpz_export_data(data, value, BYTEORDER_BIG_ENDIAN, len);
+	for (i = 0; i < len; i++)
+		hash = (hash ^ data[i]) * 16777619U;
+	return hash;
+}
+
+/* The element order does not matter, so the element hashes are summed up */
+static uint32_t set_literal_hash(const struct expr *key,
+				 const struct expr *set)
+{
+	unsigned int len = div_round_up(key->len, BITS_PER_BYTE);
+	const struct expr *elem;
+	uint32_t hash, sum = 0;
+	mpz_t low, high;
+
+	mpz_init(low);
+	mpz_init(high);
+	list_for_each_entry(elem, &set->expressions, list) {
+		range_expr_value_low(low, elem->key);
+		range_expr_value_high(high, elem->key);
+		hash = set_literal_hash_value(2166136261U ^ elem->elem_flags,
+					      low, len);
+		sum += set_literal_hash_value(hash, high, len);
+	}
+	mpz_clear(high);
+	mpz_clear(low);
+
+	hash = 2166136261U ^ key->dtype->type;
+	hash = (hash ^ key->byteorder) * 16777619U;
+	hash = (hash ^ key->len) * 16777619U;
+	hash = (hash ^ set->set_flags) * 16777619U;
+	hash = (hash ^ set->size) * 16777619U;
+	return hash ^ sum;
+}
+
+static int set_literal_elem_cmp(const void *p1, const void *p2)
+{
+	const struct set_literal_elem *e1 = p1, *e2 = p2;
+	int d;
+
+	d = mpz_cmp(e1->low, e2->low);
+	if (d == 0)
+		d = mpz_cmp(e1->high, e2->high);
+	return d;
+}
+
+static struct set_literal_elem *set_literal_elems(const struct expr *set)
+{
+	struct set_literal_elem *elems;
+	const struct expr *elem;
+	unsigned int n = 0;
+
+	elems = xmalloc(set->size * sizeof(*elems));
+	list_for_each_entry(elem, &set->expressions, list) {
+		mpz_init(elems[n].low);
+		mpz_init(elems[n].high);
+		range_expr_value_low(elems[n].low, elem->key);
+		range_expr_value_high(elems[n].high, elem->key);
+		n++;
+	}
+	qsort(elems, n, sizeof(*elems), set_literal_elem_cmp);
+	return elems;
+}
+
+static void set_literal_elems_free(struct set_literal_elem *elems,
+				   unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		mpz_clear(elems[i].low);
+		mpz_clear(elems[i].high);
+	}
+	xfree(elems);
+}
+
+static bool set_literal_equal(const struct set_literal *sl,
+			      const struct expr *key,
+			      const struct expr *set)
+{
+	struct set_literal_elem *e1, *e2;
+	unsigned int i;
+	bool ret = true;
+
+	if (sl->init == set)
+		return true;
+	if (sl->dtype != key->dtype->type ||
+	    sl->byteorder != key->byteorder ||
+	    sl->len != key->len ||
+	    sl->init->set_flags != set->set_flags ||
+	    sl->init->size != set->size)
+		return false;
+
+	e1 = set_literal_elems(sl->init);
+	e2 = set_literal_elems(set);
+	for (i = 0; i < set->size && ret; i++) {
+		if (mpz_cmp(e1[i].low, e2[i].low) ||
+		    mpz_cmp(e1[i].high, e2[i].high))
+			ret = false;
+	}
+	set_literal_elems_free(e2, set->size);
+	set_literal_elems_free(e1, set->size);
+	return ret;
+}
+
+/*
+ * Return the element list of an identical set literal seen before in the
+ * same table, or register @set and return it unmodified.
+ */
+static struct expr *set_literal_get(struct eval_ctx *ctx,
+				    const struct expr *key,
+				    struct expr *set)
+{
+	const struct handle *h;
+	struct set_literal *sl;
+	struct hlist_node *n;
+	uint32_t hash, idx;
+
+	if (!set_literal_shareable(key, set))
+		return set;
+
+	h = ctx->table != NULL ? &ctx->table->handle : &ctx->cmd->handle;
+	if (h->table == NULL)
+		return set;
+
+	if (ctx->set_literals == NULL)
+		ctx->set_literals = xzalloc(sizeof(*ctx->set_literals));
+
+	hash = set_literal_hash(key, set);
+	idx = hash % SET_LITERAL_HSIZE;
+	hlist_for_each_entry(sl, n, &ctx->set_literals->hash[idx], hnode) {
+		if (sl->hash != hash || sl->family != h->family ||
+		    strcmp(sl->table, h->table) ||
+		    !set_literal_equal(sl, key, set))
+			continue;
+
+		expr_free(set);
+		return expr_get(sl->init);
+	}
+
+	sl = xzalloc(sizeof(*sl));
+	sl->family = h->family;
+	sl->table = xstrdup(h->table);
+	sl->hash = hash;
+	sl->dtype = key->dtype->type;
+	sl->byteorder = key->byteorder;
+	sl->len = key->len;
+	sl->init = expr_get(set);
+	hlist_add_head(&sl->hnode, &ctx->set_literals->hash[idx]);
+
+	return set;
+}
+
+/*
+ * The batch creates or changes @set. Its elements cannot be replaced later
+ * in the batch: the difference is computed against the kernel, which does
+ * not hold these changes yet.
+ */
+static void set_mark_changed(struct eval_ctx *ctx, struct set *set)
+{
+	unsigned int num = ctx->num_changed_sets;
+
+	if (set->changed)
+		return;
+	set->changed = true;
+
+	/* grow in powers of two */
+	if ((num & (num - 1)) == 0)
+		ctx->changed_sets = xrealloc(ctx->changed_sets,
+					     (num ? num * 2 : 1) *
+					     sizeof(struct set *));
+	ctx->changed_sets[ctx->num_changed_sets++] = set_get(set);
+}
+
+/*
+ * Forget the set literals seen so far. When the batch is streamed, this is
+ * done once the commands are in the batch, so that they can be released.
+ */
+void eval_ctx_release_set_literals(struct eval_ctx *ctx)
+{
+	struct hlist_node *n, *next;
+	struct set_literal *sl;
+	unsigned int i;
+
+	if (ctx->set_literals == NULL)
+		return;
+
+	for (i = 0; i < SET_LITERAL_HSIZE; i++) {
+		hlist_for_each_entry_safe(sl, n, next,
+					  &ctx->set_literals->hash[i], hnode) {
+			hlist_del(&sl->hnode);
+			expr_free(sl->init);
+			xfree(sl->table);
+			xfree(sl);
+		}
+	}
+}
+
+void eval_ctx_release(struct eval_ctx *ctx)
+{
+	unsigned int i;
+
+	jump_graph_free(ctx->jump_graph);
+	ctx->jump_graph = NULL;
+
+	for (i = 0; i < ctx->num_changed_sets; i++) {
+		ctx->changed_sets[i]->changed = false;
+		set_free(ctx->changed_sets[i]);
+	}
+	xfree(ctx->changed_sets);
+	ctx->changed_sets = NULL;
+	ctx->num_changed_sets = 0;
+
+	if (ctx->cache != NULL)
+		cache_release_rule_indexes(ctx->cache);
+
+	eval_ctx_release_set_literals(ctx);
+	xfree(ctx->set_literals);
+	ctx->set_literals = NULL;
+}
+
 static struct expr *implicit_set_declaration(struct eval_ctx *ctx,
 					     const char *name,
 					     struct expr *key,
@@ -86,7 +387,7 @@ static struct expr *implicit_set_declaration(struct eval_ctx *ctx,
 	set->flags	= NFT_SET_ANONYMOUS | expr->set_flags;
 	set->handle.set = xstrdup(name);
 	set->key	= key;
-	set->init	= expr;
+	set->init	= set_literal_get(ctx, key, expr);
 	set->automerge	= set->flags & NFT_SET_INTERVAL;
 
 	if (ctx->table != NULL)
@@ -95,12 +396,12 @@ static struct expr *implicit_set_declaration(struct eval_ctx *ctx,
 		handle_merge(&set->handle, &ctx->cmd->handle);
 		memset(&h, 0, sizeof(h));
 		handle_merge(&h, &set->handle);
-		cmd = cmd_alloc(CMD_ADD, CMD_OBJ_SET, &h, &expr->location, set);
+		cmd = cmd_alloc(CMD_ADD, CMD_OBJ_SET, &h, &set->location, set);
 		cmd->location = set->location;
 		list_add_tail(&cmd->list, &ctx->cmd->list);
 	}
 
-	return set_ref_expr_alloc(&expr->location, set);
+	return set_ref_expr_alloc(&set->location, set);
 }
 
 static enum ops byteorder_conversion_op(struct expr *expr,
@@ -162,13 +463,58 @@ static struct table *table_lookup_global(struct eval_ctx *ctx)
 	return table;
 }
 
+/*
+ * Set literals bound to a define are evaluated once per context and shared by
+ * all references to it, users that modify them have to expr_unshare() them.
+ * Like a copy of the define, the shared set points to the define on errors.
+ * Each rule referencing it still gets its own anonymous set in the kernel.
+ */
+static bool symbol_value_shareable(const struct eval_ctx *ctx,
+				   const struct symbol *sym)
+{
+	return sym->expr->ops->type == EXPR_SET && ctx->set == NULL &&
+	       ctx->ectx.dtype != NULL &&
+	       !(ctx->ectx.dtype->flags & DTYPE_F_ALLOC);
+}
+
+static struct expr *symbol_value_lookup(const struct eval_ctx *ctx,
+					const struct symbol *sym)
+{
+	const struct symbol_value *val;
+
+	list_for_each_entry(val, &sym->values, list) {
+		if (val->dtype == ctx->ectx.dtype &&
+		    val->byteorder == ctx->ectx.byteorder &&
+		    val->len == ctx->ectx.len &&
+		    val->maxval == ctx->ectx.maxval)
+			return expr_get(val->expr);
+	}
+	return NULL;
+}
+
+static void symbol_value_add(const struct expr_ctx *ectx, struct symbol *sym,
+			     struct expr *expr)
+{
+	struct symbol_value *val;
+
+	val = xzalloc(sizeof(*val));
+	val->dtype	= ectx->dtype;
+	val->byteorder	= ectx->byteorder;
+	val->len	= ectx->len;
+	val->maxval	= ectx->maxval;
+	val->expr	= expr_get(expr);
+	list_add_tail(&val->list, &sym->values);
+}
+
 /*
  * Symbol expression: parse symbol and evaluate resulting expression.
  */
 static int expr_evaluate_symbol(struct eval_ctx *ctx, struct expr **expr)
 {
 	struct error_record *erec;
-	struct symbol *sym;
+	struct expr_ctx ectx = ctx->ectx;
+	struct symbol *sym = NULL;
+	bool share = false;
 	struct table *table;
 	struct set *set;
 	struct expr *new;
@@ -189,6 +535,15 @@ static int expr_evaluate_symbol(struct eval_ctx *ctx, struct expr **expr)
 			return expr_error(ctx->msgs, *expr,
 					  "undefined identifier '%s'",
 					  (*expr)->identifier);
+		share = symbol_value_shareable(ctx, sym);
+		if (share) {
+			new = symbol_value_lookup(ctx, sym);
+			if (new != NULL) {
+				expr_free(*expr);
+				*expr = new;
+				return 0;
+			}
+		}
 		new = expr_clone(sym->expr);
 		break;
 	case SYMBOL_SET:
@@ -214,7 +569,12 @@ static int expr_evaluate_symbol(struct eval_ctx *ctx, struct expr **expr)
 	expr_free(*expr);
 	*expr = new;
 
-	return expr_evaluate(ctx, expr);
+	if (expr_evaluate(ctx, expr) < 0)
+		return -1;
+
+	if (share && (*expr)->ops->type == EXPR_SET)
+		symbol_value_add(&ectx, sym, *expr);
+	return 0;
 }
 
 static int expr_evaluate_string(struct eval_ctx *ctx, struct expr **exprp)
@@ -1486,6 +1846,7 @@ static int binop_transfer(struct eval_ctx *ctx, struct expr **expr)
 			if (err <= 0)
 				return err;
 		}
+		(*expr)->right = expr_unshare((*expr)->right);
 		list_for_each_entry_safe(i, next, &(*expr)->right->expressions,
 					 list) {
 			list_del(&i->list);
@@ -1514,6 +1875,8 @@ static int binop_transfer(struct eval_ctx *ctx, struct expr **expr)
 				break;
 			}
 		}
+		(*expr)->right->set->init =
+			expr_unshare((*expr)->right->set->init);
 		list_for_each_entry_safe(i, next, &(*expr)->right->set->init->expressions,
 					 list) {
 			list_del(&i->list);
@@ -2814,6 +3177,201 @@ int stmt_evaluate(struct eval_ctx *ctx, struct stmt *stmt)
 	}
 }
 
+/*
+ * Jump graph of the ruleset, as modified by the commands of the batch
+ * evaluated so far. The table of @h is loaded on first use, unless the
+ * cache has not been loaded: single commands are not worth a dump of the
+ * ruleset, the table is left to the kernel then.
+ */
+static struct jump_graph *jump_graph_get(struct eval_ctx *ctx,
+					 const struct handle *h)
+{
+	struct netlink_ctx nl_ctx = {
+		.list		= LIST_HEAD_INIT(nl_ctx.list),
+		.nf_sock	= ctx->nf_sock,
+		.cache		= ctx->cache,
+		.msgs		= ctx->msgs,
+		.debug_mask	= ctx->debug_mask,
+		.octx		= ctx->octx,
+	};
+
+	if (ctx->jump_graph == NULL)
+		ctx->jump_graph = jump_graph_alloc(ctx->cache);
+	if (jump_graph_is_loaded(ctx->jump_graph, h))
+		return ctx->jump_graph;
+
+	if (ctx->cache->genid == 0) {
+		jump_graph_invalidate(ctx->jump_graph, h);
+		return ctx->jump_graph;
+	}
+
+replay:
+	if (cache_update(ctx->nf_sock, ctx->cache, ctx->cmd->op, ctx->msgs,
+			 ctx->debug_mask & NFT_DEBUG_NETLINK, ctx->octx) < 0)
+		return NULL;
+
+	nl_ctx.seqnum = ctx->cache->seqnum++;
+	if (jump_graph_load(ctx->jump_graph, &nl_ctx, h) < 0) {
+		if (errno == EINTR) {
+			netlink_restart(ctx->nf_sock);
+			goto replay;
+		}
+		return NULL;
+	}
+	return ctx->jump_graph;
+}
+
+/*
+ * The command removes edges the graph cannot tell apart from others, the
+ * kernel is left to check the rest of the batch in the table of the
+ * command.
+ */
+static void jump_graph_stale(struct eval_ctx *ctx)
+{
+	if (ctx->jump_graph == NULL)
+		ctx->jump_graph = jump_graph_alloc(ctx->cache);
+
+	jump_graph_invalidate(ctx->jump_graph, &ctx->cmd->handle);
+}
+
+/*
+ * Jump graph to apply a removal to. If the table of the command has not
+ * been loaded yet, the removal would need a rule dump, the table is left
+ * stale instead.
+ */
+static struct jump_graph *jump_graph_loaded(struct eval_ctx *ctx)
+{
+	if (ctx->jump_graph == NULL ||
+	    !jump_graph_is_loaded(ctx->jump_graph, &ctx->cmd->handle)) {
+		jump_graph_stale(ctx);
+		return NULL;
+	}
+	return ctx->jump_graph;
+}
+
+struct jump_targets {
+	struct jump_target	*targets;
+	unsigned int		num;
+};
+
+static void jump_targets_add(struct jump_targets *jt,
+			     enum jump_graph_node_type type, const char *name,
+			     const struct expr *expr)
+{
+	/* grow in powers of two */
+	if ((jt->num & (jt->num - 1)) == 0)
+		jt->targets = xrealloc(jt->targets,
+				       (jt->num ? jt->num * 2 : 1) *
+				       sizeof(struct jump_target));
+
+	jt->targets[jt->num].type = type;
+	jt->targets[jt->num].name = name;
+	jt->targets[jt->num].expr = expr;
+	jt->num++;
+}
+
+static void jump_targets_add_verdict(struct jump_targets *jt,
+				     const struct expr *verdict)
+{
+	if (verdict->ops->type != EXPR_VERDICT || verdict->chain == NULL)
+		return;
+
+	switch (verdict->verdict) {
+	case NFT_JUMP:
+	case NFT_GOTO:
+		jump_targets_add(jt, JUMP_GRAPH_CHAIN, verdict->chain, verdict);
+		break;
+	}
+}
+
+static void jump_targets_add_elems(struct jump_targets *jt,
+				   const struct expr *set)
+{
+	const struct expr *elem;
+
+	list_for_each_entry(elem, &set->expressions, list) {
+		if (elem->ops->type == EXPR_MAPPING)
+			jump_targets_add_verdict(jt, elem->right);
+	}
+}
+
+static void jump_targets_add_rule(struct jump_targets *jt,
+				  const struct rule *rule)
+{
+	const struct expr *mappings;
+	const struct stmt *stmt;
+
+	list_for_each_entry(stmt, &rule->stmts, list) {
+		if (stmt->ops->type != STMT_VERDICT)
+			continue;
+
+		if (stmt->expr->ops->type != EXPR_MAP) {
+			jump_targets_add_verdict(jt, stmt->expr);
+			continue;
+		}
+
+		mappings = stmt->expr->mappings;
+		if (mappings->ops->type != EXPR_SET_REF)
+			continue;
+		if (mappings->set->flags & NFT_SET_ANONYMOUS) {
+			if (mappings->set->init != NULL)
+				jump_targets_add_elems(jt, mappings->set->init);
+		} else {
+			jump_targets_add(jt, JUMP_GRAPH_SET,
+					 mappings->set->handle.set, mappings);
+		}
+	}
+}
+
+/*
+ * Add the edges from the chain or verdict map @name to @jt to the jump
+ * graph, unless they create a loop or overflow the jump stack.
+ */
+static int jump_graph_check(struct eval_ctx *ctx,
+			    enum jump_graph_node_type type,
+			    const struct handle *h, const char *name,
+			    struct jump_targets *jt)
+{
+	const struct jump_target *target;
+	struct jump_graph *graph;
+	unsigned int bad;
+	int ret = 0;
+
+	if (jt->num == 0)
+		return 0;
+
+	graph = jump_graph_get(ctx, h);
+	if (graph == NULL) {
+		ret = -1;
+		goto out;
+	}
+
+	switch (jump_graph_add(graph, type, h, name, jt->targets, jt->num,
+			       &bad)) {
+	case -ELOOP:
+		target = &jt->targets[bad];
+		if (target->type == JUMP_GRAPH_CHAIN)
+			ret = expr_error(ctx->msgs, target->expr,
+					 "jump to chain '%s' creates a loop",
+					 target->name);
+		else
+			ret = expr_error(ctx->msgs, target->expr,
+					 "map '%s' jumps back to chain '%s'",
+					 target->name, name);
+		break;
+	case -EMLINK:
+		target = &jt->targets[bad];
+		ret = expr_error(ctx->msgs, target->expr,
+				 "%s '%s' exceeds the jump stack size of %u",
+				 target->type == JUMP_GRAPH_CHAIN ? "jump to chain" : "map",
+				 target->name, JUMP_GRAPH_MAX_DEPTH);
+		break;
+	}
+out:
+	xfree(jt->targets);
+	return ret;
+}
+
 static int setelem_evaluate(struct eval_ctx *ctx, struct expr **expr)
 {
 	struct table *table;
@@ -2828,18 +3386,85 @@ static int setelem_evaluate(struct eval_ctx *ctx, struct expr **expr)
 	if (set == NULL)
 		return cmd_error(ctx, "Could not process rule: Set '%s' does not exist",
 				 ctx->cmd->handle.set);
+	if (ctx->cmd->op == CMD_REPLACE && set->changed)
+		return cmd_error(ctx, "Could not process rule: Elements of set '%s' cannot be replaced after the set is created or changed in the same batch",
+				 ctx->cmd->handle.set);
 
 	ctx->set = set;
 	expr_set_context(&ctx->ectx, set->key->dtype, set->key->len);
 	if (expr_evaluate(ctx, expr) < 0)
 		return -1;
 	ctx->set = NULL;
+	set_mark_changed(ctx, set);
+
+	/* Size hint for a set that is added in the same batch */
+	if (ctx->cmd->op == CMD_ADD || ctx->cmd->op == CMD_CREATE)
+		set->nelems += (*expr)->size;
+
+	if (ctx->cmd->op != CMD_DELETE &&
+	    set->flags & NFT_SET_MAP && set->datatype->type == TYPE_VERDICT) {
+		struct jump_targets jt = {};
+
+		jump_targets_add_elems(&jt, *expr);
+		return jump_graph_check(ctx, JUMP_GRAPH_SET, &ctx->cmd->handle,
+					set->handle.set, &jt);
+	}
+	return 0;
+}
+
+static int setelem_file_evaluate(struct eval_ctx *ctx,
+				 const struct setelem_file *file)
+{
+	struct table *table;
+	struct set *set;
+
+	table = table_lookup_global(ctx);
+	if (table == NULL)
+		return cmd_error(ctx, "Could not process rule: Table '%s' does not exist",
+				 ctx->cmd->handle.table);
+
+	set = set_lookup(table, ctx->cmd->handle.set);
+	if (set == NULL)
+		return cmd_error(ctx, "Could not process rule: Set '%s' does not exist",
+				 ctx->cmd->handle.set);
+
+	/* elements are sent as they are read, there is no interval conversion */
+	if (set->flags & NFT_SET_INTERVAL)
+		return cmd_error(ctx, "Elements of interval set '%s' cannot be loaded from a file",
+				 set->handle.set);
+	if (set->flags & NFT_SET_OBJECT)
+		return cmd_error(ctx, "Elements of object map '%s' cannot be loaded from a file",
+				 set->handle.set);
+	set_mark_changed(ctx, set);
+
+	switch (file->format) {
+	case SETELEM_FILE_RAW:
+		if (set->flags & NFT_SET_MAP &&
+		    set->datatype->type == TYPE_VERDICT)
+			return cmd_error(ctx, "Verdict map '%s' cannot be loaded from a raw file",
+					 set->handle.set);
+		break;
+	case SETELEM_FILE_CSV:
+		if (!setelem_file_type_supported(set->key->dtype,
+						 set->key->len))
+			return cmd_error(ctx, "Keys of type %s cannot be read from a csv file",
+					 set->key->dtype->name);
+		if (set->flags & NFT_SET_MAP &&
+		    set->datatype->type != TYPE_VERDICT &&
+		    !setelem_file_type_supported(set->datatype,
+						 set->datalen))
+			return cmd_error(ctx, "Data of type %s cannot be read from a csv file",
+					 set->datatype->name);
+		break;
+	}
+
 	return 0;
 }
 
 static int set_evaluate(struct eval_ctx *ctx, struct set *set)
 {
 	struct table *table;
+	struct set *cached;
 	const char *type;
 
 	table = table_lookup_global(ctx);
@@ -2888,19 +3513,194 @@ static int set_evaluate(struct eval_ctx *ctx, struct set *set)
 	}
 	ctx->set = NULL;
 
-	if (set_lookup(table, set->handle.set) == NULL)
+	cached = set_lookup(table, set->handle.set);
+	if (cached == NULL) {
+		cached = set;
 		set_add_hash(set_get(set), table);
+	}
+	set_mark_changed(ctx, cached);
 
 	/* Default timeout value implies timeout support */
 	if (set->timeout)
 		set->flags |= NFT_SET_TIMEOUT;
 
+	if (set->init != NULL && !(set->flags & NFT_SET_ANONYMOUS) &&
+	    set->flags & NFT_SET_MAP && set->datatype->type == TYPE_VERDICT) {
+		struct jump_targets jt = {};
+
+		jump_targets_add_elems(&jt, set->init);
+		return jump_graph_check(ctx, JUMP_GRAPH_SET, &set->handle,
+					set->handle.set, &jt);
+	}
+	return 0;
+}
+
+static struct chain *rule_chain_lookup(struct eval_ctx *ctx,
+				       const struct handle *h)
+{
+	struct table *table;
+
+	if (h->table == NULL || h->chain == NULL)
+		return NULL;
+
+	table = table_lookup(h, ctx->cache);
+	if (table == NULL)
+		return NULL;
+
+	return chain_lookup(table, h);
+}
+
+/*
+ * Rule index of a chain, as modified by the commands of the batch evaluated
+ * so far. It is loaded on first use, only the rule handles are fetched.
+ */
+static struct rule_index *chain_rule_index_load(struct eval_ctx *ctx,
+						struct chain *chain)
+{
+	struct netlink_ctx nl_ctx = {
+		.list		= LIST_HEAD_INIT(nl_ctx.list),
+		.nf_sock	= ctx->nf_sock,
+		.cache		= ctx->cache,
+		.msgs		= ctx->msgs,
+		.debug_mask	= ctx->debug_mask,
+		.octx		= ctx->octx,
+	};
+
+	if (chain->rule_index == NULL)
+		chain->rule_index = rule_index_alloc(false);
+replay:
+	nl_ctx.seqnum = ctx->cache->seqnum++;
+	if (rule_index_load(chain->rule_index, &nl_ctx, &chain->handle) < 0) {
+		if (errno == EINTR) {
+			netlink_restart(ctx->nf_sock);
+			goto replay;
+		}
+		return NULL;
+	}
+	return chain->rule_index;
+}
+
+/*
+ * Rule index to record an edit of the chain in. It is not loaded, edits
+ * are logged until a command needs it.
+ */
+static struct rule_index *chain_rule_index(struct chain *chain)
+{
+	if (chain->rule_index == NULL)
+		chain->rule_index = rule_index_alloc(false);
+
+	return chain->rule_index;
+}
+
+/*
+ * A chain added by the batch starts out empty, there is nothing to load.
+ * Without a cache, the chain may exist already and its index is loaded on
+ * first use instead.
+ */
+static void chain_rule_index_init(struct eval_ctx *ctx, struct chain *chain)
+{
+	if (ctx->cache->genid != 0 && chain->rule_index == NULL)
+		chain->rule_index = rule_index_alloc(true);
+}
+
+/*
+ * The kernel places rules next to a rule given by handle only, rules added
+ * by this batch have none yet. Refer to a neighbour instead, turning an add
+ * after a new rule into an insert before the next one and an insert before
+ * a new rule into an add after the previous one.
+ */
+static int rule_index_resolve(struct eval_ctx *ctx, struct rule *rule,
+			      struct rule_index_entry **ref, bool *after)
+{
+	struct handle *h = &rule->handle;
+	struct rule_index_entry *e = *ref;
+
+	if (e->handle == 0) {
+		e = *after ? rule_index_next(e) : rule_index_prev(e);
+		if (e != NULL && e->handle == 0) {
+			erec_queue(error(&h->index.location,
+					 "Could not process rule: rule at index %" PRIu64 " and its neighbours are added by this batch",
+					 h->index.id - 1),
+				   ctx->msgs);
+			return -1;
+		}
+		if (e != NULL) {
+			ctx->cmd->op = *after ? CMD_INSERT : CMD_ADD;
+			*after = !*after;
+		}
+	}
+
+	*ref = e;
+	h->position.location = h->index.location;
+	h->position.id = e ? e->handle : 0;
+	return 0;
+}
+
+/*
+ * Resolve an index position against the rule index of the chain, and record
+ * the rule in the index. Rules of chain blocks are recorded by
+ * chain_evaluate().
+ */
+static int rule_index_evaluate(struct eval_ctx *ctx, struct rule *rule)
+{
+	struct handle *h = &rule->handle;
+	struct rule_index_entry *ref = NULL;
+	bool after = ctx->cmd->op != CMD_INSERT;
+	struct rule_index *ri;
+	struct chain *chain;
+
+	if (ctx->cmd->obj != CMD_OBJ_RULE)
+		return 0;
+
+	if (h->index.id != 0) {
+		if (cache_update(ctx->nf_sock, ctx->cache, ctx->cmd->op,
+				 ctx->msgs, ctx->debug_mask & NFT_DEBUG_NETLINK,
+				 ctx->octx) < 0)
+			return -1;
+
+		chain = rule_chain_lookup(ctx, h);
+		if (chain == NULL)
+			return cmd_error(ctx, "Could not process rule: Chain '%s' does not exist",
+					 h->chain);
+		ri = chain_rule_index_load(ctx, chain);
+		if (ri == NULL)
+			return -1;
+
+		ref = rule_index_nth(ri, h->index.id - 1);
+		if (ref == NULL) {
+			erec_queue(error(&h->index.location,
+					 "Could not process rule: index %" PRIu64 " is out of range, chain '%s' has %u rules",
+					 h->index.id - 1, h->chain,
+					 rule_index_count(ri)),
+				   ctx->msgs);
+			return -1;
+		}
+		if (rule_index_resolve(ctx, rule, &ref, &after) < 0)
+			return -1;
+		rule_index_insert(ri, ref, after, 0, NULL);
+		return 0;
+	}
+
+	chain = rule_chain_lookup(ctx, h);
+	if (chain == NULL)
+		return 0;
+	ri = chain_rule_index(chain);
+
+	if (ctx->cmd->op == CMD_REPLACE)
+		rule_index_edit(ri, RULE_INDEX_REPLACE, h->handle.id);
+	else if (h->position.id != 0)
+		rule_index_edit(ri, after ? RULE_INDEX_AFTER : RULE_INDEX_BEFORE,
+				h->position.id);
+	else
+		rule_index_edit(ri, after ? RULE_INDEX_APPEND :
+					    RULE_INDEX_PREPEND, 0);
 	return 0;
 }
 
 static int rule_evaluate(struct eval_ctx *ctx, struct rule *rule)
 {
 	struct stmt *stmt, *tstmt = NULL;
+	struct jump_targets jt = {};
 	struct error_record *erec;
 
 	proto_ctx_init(&ctx->pctx, rule->handle.family, ctx->debug_mask);
@@ -2926,7 +3726,12 @@ static int rule_evaluate(struct eval_ctx *ctx, struct rule *rule)
 		return -1;
 	}
 
-	return 0;
+	jump_targets_add_rule(&jt, rule);
+	if (jump_graph_check(ctx, JUMP_GRAPH_CHAIN, &rule->handle,
+			     rule->handle.chain, &jt) < 0)
+		return -1;
+
+	return rule_index_evaluate(ctx, rule);
 }
 
 static uint32_t str2hooknum(uint32_t family, const char *hook)
@@ -2969,6 +3774,7 @@ static uint32_t str2hooknum(uint32_t family, const char *hook)
 
 static int chain_evaluate(struct eval_ctx *ctx, struct chain *chain)
 {
+	struct chain *cached = chain;
 	struct table *table;
 	struct rule *rule;
 
@@ -2981,15 +3787,22 @@ static int chain_evaluate(struct eval_ctx *ctx, struct chain *chain)
 		if (chain_lookup(table, &ctx->cmd->handle) == NULL) {
 			chain = chain_alloc(NULL);
 			handle_merge(&chain->handle, &ctx->cmd->handle);
+			chain_rule_index_init(ctx, chain);
 			chain_add_hash(chain, table);
 		}
 		return 0;
 	} else {
-		if (chain_lookup(table, &chain->handle) == NULL)
-			chain_add_hash(chain_get(chain), table);
+		cached = chain_lookup(table, &chain->handle);
+		if (cached == NULL) {
+			cached = chain_get(chain);
+			chain_rule_index_init(ctx, cached);
+			chain_add_hash(cached, table);
+		}
 	}
 
 	if (chain->flags & CHAIN_F_BASECHAIN) {
+		/* the chain may be cached by an earlier command already */
+		cached->flags |= CHAIN_F_BASECHAIN;
 		chain->hooknum = str2hooknum(chain->handle.family,
 					     chain->hookstr);
 		if (chain->hooknum == NF_INET_NUMHOOKS)
@@ -3002,6 +3815,9 @@ static int chain_evaluate(struct eval_ctx *ctx, struct chain *chain)
 		if (rule_evaluate(ctx, rule) < 0)
 			return -1;
 	}
+
+	list_for_each_entry(rule, &chain->rules, list)
+		rule_index_edit(chain_rule_index(cached), RULE_INDEX_APPEND, 0);
 	return 0;
 }
 
@@ -3042,6 +3858,9 @@ static int cmd_evaluate_add(struct eval_ctx *ctx, struct cmd *cmd)
 {
 	int ret;
 
+	if (cmd->op == CMD_REPLACE)
+		jump_graph_stale(ctx);
+
 	switch (cmd->obj) {
 	case CMD_OBJ_SETELEM:
 		ret = cache_update(ctx->nf_sock, ctx->cache, cmd->op,
@@ -3050,6 +3869,13 @@ static int cmd_evaluate_add(struct eval_ctx *ctx, struct cmd *cmd)
 			return ret;
 
 		return setelem_evaluate(ctx, &cmd->expr);
+	case CMD_OBJ_SETELEM_FILE:
+		ret = cache_update(ctx->nf_sock, ctx->cache, cmd->op,
+				   ctx->msgs, ctx->debug_mask & NFT_DEBUG_NETLINK, ctx->octx);
+		if (ret < 0)
+			return ret;
+
+		return setelem_file_evaluate(ctx, cmd->elem_file);
 	case CMD_OBJ_SET:
 		ret = cache_update(ctx->nf_sock, ctx->cache, cmd->op,
 				   ctx->msgs, ctx->debug_mask & NFT_DEBUG_NETLINK, ctx->octx);
@@ -3080,6 +3906,69 @@ static int cmd_evaluate_add(struct eval_ctx *ctx, struct cmd *cmd)
 	}
 }
 
+/*
+ * Remove a chain, a map or a whole table from the jump graph. Objects
+ * deleted by handle are not known by name, the graph turns stale then.
+ */
+static int jump_graph_delete_obj(struct eval_ctx *ctx,
+				 enum jump_graph_node_type type,
+				 const char *name)
+{
+	struct jump_graph *graph;
+
+	if (ctx->cmd->handle.table == NULL ||
+	    (name == NULL && ctx->cmd->obj != CMD_OBJ_TABLE)) {
+		jump_graph_stale(ctx);
+		return 0;
+	}
+
+	/* a deleted table has no edges left, there is nothing to load */
+	if (name == NULL) {
+		if (ctx->jump_graph == NULL)
+			ctx->jump_graph = jump_graph_alloc(ctx->cache);
+		graph = ctx->jump_graph;
+	} else {
+		graph = jump_graph_loaded(ctx);
+	}
+	if (graph != NULL)
+		jump_graph_delete(graph, type, &ctx->cmd->handle, name);
+	return 0;
+}
+
+static void rule_index_delete(struct eval_ctx *ctx, const struct handle *h)
+{
+	struct chain *chain;
+
+	chain = rule_chain_lookup(ctx, h);
+	if (chain != NULL)
+		rule_index_edit(chain_rule_index(chain), RULE_INDEX_DELETE,
+				h->handle.id);
+}
+
+/*
+ * The chain, or every chain of the table if none is given, has no rules
+ * left once the command is applied.
+ */
+static void rule_index_clear(struct eval_ctx *ctx, const struct handle *h)
+{
+	struct table *table;
+	struct chain *chain;
+
+	if (h->table == NULL)
+		return;
+
+	table = table_lookup(h, ctx->cache);
+	if (table == NULL)
+		return;
+
+	list_for_each_entry(chain, &table->chains, list) {
+		if (h->chain != NULL && strcmp(chain->handle.chain, h->chain))
+			continue;
+
+		rule_index_flush(chain_rule_index(chain));
+	}
+}
+
 static int cmd_evaluate_delete(struct eval_ctx *ctx, struct cmd *cmd)
 {
 	int ret;
@@ -3091,11 +3980,22 @@ static int cmd_evaluate_delete(struct eval_ctx *ctx, struct cmd *cmd)
 		if (ret < 0)
 			return ret;
 
+		jump_graph_stale(ctx);
 		return setelem_evaluate(ctx, &cmd->expr);
-	case CMD_OBJ_SET:
 	case CMD_OBJ_RULE:
+		jump_graph_stale(ctx);
+		rule_index_delete(ctx, &cmd->handle);
+		return 0;
+	case CMD_OBJ_SET:
+		return jump_graph_delete_obj(ctx, JUMP_GRAPH_SET, cmd->handle.set);
 	case CMD_OBJ_CHAIN:
+		if (cmd->handle.chain != NULL)
+			rule_index_clear(ctx, &cmd->handle);
+		return jump_graph_delete_obj(ctx, JUMP_GRAPH_CHAIN,
+					     cmd->handle.chain);
 	case CMD_OBJ_TABLE:
+		rule_index_clear(ctx, &cmd->handle);
+		return jump_graph_delete_obj(ctx, JUMP_GRAPH_CHAIN, NULL);
 	case CMD_OBJ_COUNTER:
 	case CMD_OBJ_QUOTA:
 	case CMD_OBJ_CT_HELPER:
@@ -3130,8 +4030,16 @@ static int cmd_evaluate_list(struct eval_ctx *ctx, struct cmd *cmd)
 	struct set *set;
 	int ret;
 
-	ret = cache_update(ctx->nf_sock, ctx->cache, cmd->op, ctx->msgs,
-			   ctx->debug_mask & NFT_DEBUG_NETLINK, ctx->octx);
+	/* the JSON listing fetches the rules itself, see json_list() */
+	if (ctx->octx->json)
+		ret = cache_update_norules(ctx->nf_sock, ctx->cache, ctx->msgs,
+					   ctx->debug_mask & NFT_DEBUG_NETLINK,
+					   ctx->octx);
+	else
+		ret = cache_update(ctx->nf_sock, ctx->cache, cmd->op,
+				   ctx->msgs,
+				   ctx->debug_mask & NFT_DEBUG_NETLINK,
+				   ctx->octx);
 	if (ret < 0)
 		return ret;
 
@@ -3252,6 +4160,10 @@ static int cmd_evaluate_flush(struct eval_ctx *ctx, struct cmd *cmd)
 	switch (cmd->obj) {
 	case CMD_OBJ_RULESET:
 		cache_flush(&ctx->cache->list);
+		/* there is nothing left to load from the kernel */
+		if (ctx->jump_graph == NULL)
+			ctx->jump_graph = jump_graph_alloc(ctx->cache);
+		jump_graph_flush_ruleset(ctx->jump_graph, cmd->handle.family);
 		break;
 	case CMD_OBJ_TABLE:
 		/* Flushing a table does not empty the sets in the table nor remove
@@ -3259,6 +4171,10 @@ static int cmd_evaluate_flush(struct eval_ctx *ctx, struct cmd *cmd)
 		 */
 	case CMD_OBJ_CHAIN:
 		/* Chains don't hold sets */
+		rule_index_clear(ctx, &cmd->handle);
+		if (jump_graph_loaded(ctx) != NULL)
+			jump_graph_flush(ctx->jump_graph, JUMP_GRAPH_CHAIN,
+					 &cmd->handle, cmd->handle.chain);
 		break;
 	case CMD_OBJ_SET:
 		table = table_lookup(&cmd->handle, ctx->cache);
@@ -3269,6 +4185,7 @@ static int cmd_evaluate_flush(struct eval_ctx *ctx, struct cmd *cmd)
 		if (set == NULL || set->flags & (NFT_SET_MAP | NFT_SET_EVAL))
 			return cmd_error(ctx, "Could not process rule: Set '%s' does not exist",
 					 cmd->handle.set);
+		set_mark_changed(ctx, set);
 		return 0;
 	case CMD_OBJ_MAP:
 		table = table_lookup(&cmd->handle, ctx->cache);
@@ -3279,6 +4196,11 @@ static int cmd_evaluate_flush(struct eval_ctx *ctx, struct cmd *cmd)
 		if (set == NULL || !(set->flags & NFT_SET_MAP))
 			return cmd_error(ctx, "Could not process rule: Map '%s' does not exist",
 					 cmd->handle.set);
+		set_mark_changed(ctx, set);
+		if (set->datatype->type == TYPE_VERDICT &&
+		    jump_graph_loaded(ctx) != NULL)
+			jump_graph_flush(ctx->jump_graph, JUMP_GRAPH_SET,
+					 &cmd->handle, cmd->handle.set);
 		return 0;
 	case CMD_OBJ_METER:
 		table = table_lookup(&cmd->handle, ctx->cache);
@@ -3289,6 +4211,7 @@ static int cmd_evaluate_flush(struct eval_ctx *ctx, struct cmd *cmd)
 		if (set == NULL || !(set->flags & NFT_SET_EVAL))
 			return cmd_error(ctx, "Could not process rule: Meter '%s' does not exist",
 					 cmd->handle.set);
+		set_mark_changed(ctx, set);
 		return 0;
 	default:
 		BUG("invalid command object type %u\n", cmd->obj);
@@ -3315,6 +4238,7 @@ static int cmd_evaluate_rename(struct eval_ctx *ctx, struct cmd *cmd)
 		if (chain_lookup(table, &ctx->cmd->handle) == NULL)
 			return cmd_error(ctx, "Could not process rule: Chain '%s' does not exist",
 					 ctx->cmd->handle.chain);
+		jump_graph_stale(ctx);
 		break;
 	default:
 		BUG("invalid command object type %u\n", cmd->obj);
@@ -3401,10 +4325,15 @@ static int cmd_evaluate_monitor(struct eval_ctx *ctx, struct cmd *cmd)
 	uint32_t event;
 	int ret;
 
-	ret = cache_update(ctx->nf_sock, ctx->cache, cmd->op, ctx->msgs,
-			   ctx->debug_mask & NFT_DEBUG_NETLINK, ctx->octx);
-	if (ret < 0)
-		return ret;
+	/* events are not decoded when only counting them */
+	if (cmd->monitor->mode != MONITOR_MODE_COUNTS) {
+		ret = cache_update(ctx->nf_sock, ctx->cache, cmd->op,
+				   ctx->msgs,
+				   ctx->debug_mask & NFT_DEBUG_NETLINK,
+				   ctx->octx);
+		if (ret < 0)
+			return ret;
+	}
 
 	if (cmd->monitor->event == NULL)
 		event = CMD_MONITOR_EVENT_ANY;
@@ -3417,6 +4346,11 @@ static int cmd_evaluate_monitor(struct eval_ctx *ctx, struct cmd *cmd)
 				     cmd->monitor->event);
 	}
 
+	if (cmd->monitor->mode == MONITOR_MODE_PROFILE &&
+	    cmd->monitor->type != CMD_MONITOR_OBJ_TRACE)
+		return monitor_error(ctx, cmd->monitor,
+				     "profile is only supported for trace");
+
 	cmd->monitor->flags = monitor_flags[event][cmd->monitor->type];
 	return 0;
 }
@@ -3461,19 +4395,8 @@ static const char *cmd_op_to_name(enum cmd_ops op)
 	return cmd_op_name[op];
 }
 
-int cmd_evaluate(struct eval_ctx *ctx, struct cmd *cmd)
+static int cmd_evaluate_op(struct eval_ctx *ctx, struct cmd *cmd)
 {
-	if (ctx->debug_mask & NFT_DEBUG_EVALUATION) {
-		struct error_record *erec;
-
-		erec = erec_create(EREC_INFORMATIONAL, &cmd->location,
-				   "Evaluate %s", cmd_op_to_name(cmd->op));
-		erec_print(ctx->octx, erec, ctx->debug_mask);
-		nft_print(ctx->octx, "\n\n");
-		erec_destroy(erec);
-	}
-
-	ctx->cmd = cmd;
 	switch (cmd->op) {
 	case CMD_ADD:
 	case CMD_REPLACE:
@@ -3502,3 +4425,26 @@ int cmd_evaluate(struct eval_ctx *ctx, struct cmd *cmd)
 		BUG("invalid command operation %u\n", cmd->op);
 	};
 }
+
+int cmd_evaluate(struct eval_ctx *ctx, struct cmd *cmd)
+{
+	enum nft_stats_phase phase;
+	int ret;
+
+	if (ctx->debug_mask & NFT_DEBUG_EVALUATION) {
+		struct error_record *erec;
+
+		erec = erec_create(EREC_INFORMATIONAL, &cmd->location,
+				   "Evaluate %s", cmd_op_to_name(cmd->op));
+		erec_print(ctx->octx, erec, ctx->debug_mask);
+		nft_print(ctx->octx, "\n\n");
+		erec_destroy(erec);
+	}
+
+	ctx->cmd = cmd;
+	phase = stats_phase_enter(ctx->octx, NFT_STATS_EVALUATE);
+	ret = cmd_evaluate_op(ctx, cmd);
+	stats_phase_leave(ctx->octx, phase);
+
+	return ret;
+}
@@ -59,6 +59,22 @@ struct expr *expr_get(struct expr *expr)
 	return expr;
 }
 
+/*
+ * Return an expression that is safe to modify: the expression itself if
+ * there are no other references, otherwise a private copy.
+ */
+struct expr *expr_unshare(struct expr *expr)
+{
+	struct expr *new;
+
+	if (expr->refcnt == 1)
+		return expr;
+
+	new = expr_clone(expr);
+	expr_free(expr);
+	return new;
+}
+
 void expr_free(struct expr *expr)
 {
 	if (expr == NULL)
@@ -680,6 +696,7 @@ static void compound_expr_clone(struct expr *new, const struct expr *expr)
 	init_list_head(&new->expressions);
 	list_for_each_entry(i, &expr->expressions, list)
 		compound_expr_add(new, expr_clone(i));
+	new->set_flags = expr->set_flags;
 }
 
 static void compound_expr_destroy(struct expr *expr)
@@ -1013,6 +1030,7 @@ static void set_elem_expr_clone(struct expr *new, const struct expr *expr)
 	new->key = expr_clone(expr->key);
 	new->expiration = expr->expiration;
 	new->timeout = expr->timeout;
+	new->elem_flags = expr->elem_flags;
 	if (expr->comment)
 		new->comment = xstrdup(expr->comment);
 }
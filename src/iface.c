@@ -21,8 +21,12 @@
 #include <netlink.h>
 #include <iface.h>
 
-static LIST_HEAD(iface_list);
-static bool iface_cache_init;
+/*
+ * The interface cache is per thread: threads may run in different network
+ * namespaces and use libnftables concurrently.
+ */
+static __thread struct list_head iface_list;
+static __thread bool iface_cache_init;
 
 static int data_attr_cb(const struct nlattr *attr, void *data)
 {
@@ -75,6 +79,9 @@ void iface_cache_update(void)
 	rt = mnl_nlmsg_put_extra_header(nlh, sizeof(struct rtgenmsg));
 	rt->rtgen_family = AF_PACKET;
 
+	init_list_head(&iface_list);
+	iface_cache_init = true;
+
 	nl = mnl_socket_open(NETLINK_ROUTE);
 	if (nl == NULL)
 		netlink_init_error();
@@ -98,8 +105,6 @@ void iface_cache_update(void)
 		netlink_init_error();
 
 	mnl_socket_close(nl);
-
-	iface_cache_init = true;
 }
 
 void iface_cache_release(void)
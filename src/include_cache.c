@@ -0,0 +1,801 @@
+/*
+ * On-disk cache of parsed include files.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nftables.h>
+#include <erec.h>
+#include <expression.h>
+#include <datatype.h>
+#include <rule.h>
+#include <parser.h>
+#include <include_cache.h>
+#include <utils.h>
+
+/*
+ * An include file is cacheable if it consists only of top-level defines and
+ * element additions. Their expressions are recorded as they are parsed, and
+ * once the whole input parsed without errors, written to a cache file named
+ * after the path of the include file:
+ *
+ *	header:	magic, version, path, mtime, size, device, inode, hash of
+ *		the contents
+ *	items:	define (name, expression) or element command (op, handle,
+ *		expression), terminated by INCLUDE_CACHE_END
+ *
+ * Expressions are stored as they come out of the parser, before evaluation,
+ * so loading them has the same result as parsing the file again. Element
+ * commands are evaluated on load, since that depends on the ruleset. The
+ * entry is checked against the contents of the include file, as tools such
+ * as cp -p, touch -r, rsync -t or tar preserve the file status: an up to
+ * date entry spares parsing the file, not reading it.
+ *
+ * Entries are only read from and written to a directory owned by the
+ * caller that nobody else can write to, since they are trusted like the
+ * include file itself.
+ */
+#define INCLUDE_CACHE_MAGIC	0x6e667463	/* "nftc" */
+
+enum include_cache_items {
+	INCLUDE_CACHE_END,
+	INCLUDE_CACHE_DEFINE,
+	INCLUDE_CACHE_ELEMENTS,
+};
+
+/**
+ * struct include_cache - cache entry of an include file
+ *
+ * @path:	cache file
+ * @name:	canonical path of the include file
+ * @st:		status of the include file when it was read
+ * @hash:	hash of the contents of the include file
+ * @buf:	serialized items recorded while parsing the file
+ * @len:	length of @buf
+ * @size:	allocated size of @buf
+ * @invalid:	file contains statements that are not cacheable
+ */
+struct include_cache {
+	char			*path;
+	char			*name;
+	struct stat		st;
+	uint64_t		hash;
+	char			*buf;
+	size_t			len;
+	size_t			size;
+	bool			invalid;
+};
+
+/*
+ * Cache files are named after the hash of the include file path, the hash
+ * of its contents is stored in the header.
+ */
+static uint64_t include_cache_hash(const char *data, size_t len)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (unsigned char)data[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/* Only the caller may be able to modify cache entries. */
+static bool include_cache_trusted(const struct stat *st)
+{
+	return st->st_uid == geteuid() &&
+	       !(st->st_mode & (S_IWGRP | S_IWOTH));
+}
+
+struct include_cache *include_cache_open(const char *dir, const char *filename,
+					 const struct stat *st,
+					 const char *data, size_t len)
+{
+	struct include_cache *cache;
+	char name[PATH_MAX];
+	struct stat dst;
+
+	if (stat(dir, &dst) < 0 || !S_ISDIR(dst.st_mode) ||
+	    !include_cache_trusted(&dst))
+		return NULL;
+
+	if (realpath(filename, name) == NULL)
+		return NULL;
+
+	cache = xzalloc(sizeof(*cache));
+	cache->name = xstrdup(name);
+	cache->st   = *st;
+	cache->hash = include_cache_hash(data, len);
+	if (asprintf(&cache->path, "%s/%016" PRIx64 ".cache", dir,
+		     include_cache_hash(name, strlen(name))) < 0)
+		memory_allocation_error();
+
+	return cache;
+}
+
+void include_cache_free(struct include_cache *cache)
+{
+	xfree(cache->path);
+	xfree(cache->name);
+	xfree(cache->buf);
+	xfree(cache);
+}
+
+void include_cache_invalidate(struct include_cache *cache)
+{
+	cache->invalid = true;
+}
+
+/*
+ * Serialization
+ */
+
+static void put_data(struct include_cache *cache, const void *data, size_t len)
+{
+	if (cache->len + len > cache->size) {
+		cache->size = max(cache->size * 2, cache->len + len + 4096);
+		cache->buf  = xrealloc(cache->buf, cache->size);
+	}
+	memcpy(cache->buf + cache->len, data, len);
+	cache->len += len;
+}
+
+static void put_u8(struct include_cache *cache, uint8_t val)
+{
+	put_data(cache, &val, sizeof(val));
+}
+
+static void put_u32(struct include_cache *cache, uint32_t val)
+{
+	put_data(cache, &val, sizeof(val));
+}
+
+static void put_u64(struct include_cache *cache, uint64_t val)
+{
+	put_data(cache, &val, sizeof(val));
+}
+
+/* Strings are stored with their length plus one, zero means NULL. */
+static void put_str(struct include_cache *cache, const char *str)
+{
+	uint32_t len = str ? strlen(str) : 0;
+
+	put_u32(cache, str ? len + 1 : 0);
+	if (str != NULL)
+		put_data(cache, str, len);
+}
+
+static bool put_expr(struct include_cache *cache, const struct expr *expr,
+		     const struct scope *scope)
+{
+	const struct expr *i;
+	unsigned int len;
+
+	if (datatype_lookup(expr->dtype->type) != expr->dtype)
+		return false;
+
+	put_u8(cache, expr->ops->type);
+	put_u32(cache, expr->flags);
+	put_u32(cache, expr->dtype->type);
+	put_u32(cache, expr->byteorder);
+	put_u32(cache, expr->len);
+
+	switch (expr->ops->type) {
+	case EXPR_VERDICT:
+		put_u32(cache, expr->verdict);
+		put_str(cache, expr->chain);
+		return true;
+	case EXPR_SYMBOL:
+		if (expr->scope != NULL && expr->scope != scope)
+			return false;
+		put_u32(cache, expr->symtype);
+		put_u8(cache, expr->scope != NULL);
+		put_str(cache, expr->identifier);
+		return true;
+	case EXPR_VALUE:
+		if (expr->byteorder == BYTEORDER_INVALID)
+			return false;
+		len = div_round_up(expr->len, BITS_PER_BYTE);
+		{
+			unsigned char data[len];
+
+			mpz_export_data(data, expr->value, expr->byteorder, len);
+			put_data(cache, data, len);
+		}
+		return true;
+	case EXPR_PREFIX:
+		put_u32(cache, expr->prefix_len);
+		return put_expr(cache, expr->prefix, scope);
+	case EXPR_RANGE:
+	case EXPR_MAPPING:
+		return put_expr(cache, expr->left, scope) &&
+		       put_expr(cache, expr->right, scope);
+	case EXPR_BINOP:
+		put_u32(cache, expr->op);
+		return put_expr(cache, expr->left, scope) &&
+		       put_expr(cache, expr->right, scope);
+	case EXPR_CONCAT:
+	case EXPR_LIST:
+	case EXPR_SET:
+		put_u32(cache, expr->set_flags);
+		put_u32(cache, expr->size);
+		list_for_each_entry(i, &expr->expressions, list) {
+			if (!put_expr(cache, i, scope))
+				return false;
+		}
+		return true;
+	case EXPR_SET_ELEM:
+		if (expr->stmt != NULL)
+			return false;
+		put_u64(cache, expr->timeout);
+		put_u64(cache, expr->expiration);
+		put_u32(cache, expr->elem_flags);
+		put_str(cache, expr->comment);
+		return put_expr(cache, expr->key, scope);
+	default:
+		return false;
+	}
+}
+
+static struct include_cache *include_cache_recorder(struct parser_state *state,
+						    const struct location *loc)
+{
+	struct include_cache *cache = loc->indesc->cache;
+
+	if (cache == NULL || cache->invalid)
+		return NULL;
+
+	if (state->scope != 0) {
+		cache->invalid = true;
+		return NULL;
+	}
+	return cache;
+}
+
+void include_cache_record_define(struct parser_state *state,
+				 const struct location *loc,
+				 const char *identifier,
+				 const struct expr *expr)
+{
+	struct include_cache *cache = include_cache_recorder(state, loc);
+
+	if (cache == NULL)
+		return;
+
+	put_u8(cache, INCLUDE_CACHE_DEFINE);
+	put_str(cache, identifier);
+	if (!put_expr(cache, expr, &state->top_scope))
+		cache->invalid = true;
+}
+
+void include_cache_record_cmd(struct parser_state *state, const struct cmd *cmd)
+{
+	struct include_cache *cache;
+
+	cache = include_cache_recorder(state, &cmd->location);
+	if (cache == NULL)
+		return;
+
+	if ((cmd->op != CMD_ADD && cmd->op != CMD_CREATE) ||
+	    cmd->obj != CMD_OBJ_SETELEM) {
+		cache->invalid = true;
+		return;
+	}
+
+	put_u8(cache, INCLUDE_CACHE_ELEMENTS);
+	put_u32(cache, cmd->op);
+	put_u32(cache, cmd->handle.family);
+	put_str(cache, cmd->handle.table);
+	put_str(cache, cmd->handle.set);
+	if (!put_expr(cache, cmd->expr, &state->top_scope))
+		cache->invalid = true;
+}
+
+static void include_cache_header(struct include_cache *cache)
+{
+	put_u32(cache, INCLUDE_CACHE_MAGIC);
+	put_str(cache, PACKAGE_VERSION);
+	put_str(cache, cache->name);
+	put_u64(cache, cache->st.st_mtim.tv_sec);
+	put_u64(cache, cache->st.st_mtim.tv_nsec);
+	put_u64(cache, cache->st.st_size);
+	put_u64(cache, cache->st.st_dev);
+	put_u64(cache, cache->st.st_ino);
+	put_u64(cache, cache->hash);
+}
+
+static void include_cache_write(struct include_cache *cache)
+{
+	struct include_cache header = {
+		.name	= cache->name,
+		.st	= cache->st,
+		.hash	= cache->hash,
+	};
+	char *tmp;
+	FILE *fp;
+	int fd;
+
+	include_cache_header(&header);
+	put_u8(cache, INCLUDE_CACHE_END);
+
+	if (asprintf(&tmp, "%s.%d", cache->path, getpid()) < 0)
+		memory_allocation_error();
+
+	/* The cache is an optimization only, errors are not fatal. */
+	fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+	if (fd < 0)
+		goto out;
+
+	fp = fdopen(fd, "w");
+	if (fp == NULL) {
+		close(fd);
+		unlink(tmp);
+		goto out;
+	}
+
+	if (fwrite(header.buf, 1, header.len, fp) != header.len ||
+	    fwrite(cache->buf, 1, cache->len, fp) != cache->len) {
+		fclose(fp);
+		unlink(tmp);
+		goto out;
+	}
+	if (fclose(fp) != 0 || rename(tmp, cache->path) < 0)
+		unlink(tmp);
+out:
+	xfree(header.buf);
+	xfree(tmp);
+}
+
+void include_cache_store(struct parser_state *state)
+{
+	struct input_descriptor *indesc;
+
+	if (state->nerrs)
+		return;
+
+	list_for_each_entry(indesc, &state->indesc_list, list) {
+		if (indesc->cache != NULL && !indesc->cache->invalid)
+			include_cache_write(indesc->cache);
+	}
+}
+
+/*
+ * Deserialization
+ */
+
+struct include_cache_reader {
+	const char		*data;
+	size_t			len;
+	size_t			off;
+	bool			error;
+	struct parser_state	*state;
+	const struct location	*loc;
+	struct list_head	items;
+};
+
+/**
+ * struct include_cache_item - item loaded from the cache
+ *
+ * @list:	list node
+ * @type:	item type
+ * @op:		command operation, for element commands
+ * @identifier:	symbol name, for defines
+ * @handle:	set handle, for element commands
+ * @expr:	expression
+ */
+struct include_cache_item {
+	struct list_head		list;
+	enum include_cache_items	type;
+	enum cmd_ops			op;
+	char				*identifier;
+	struct handle			handle;
+	struct expr			*expr;
+};
+
+static const void *get_data(struct include_cache_reader *r, size_t len)
+{
+	const void *data = r->data + r->off;
+
+	if (r->error || len > r->len - r->off) {
+		r->error = true;
+		return NULL;
+	}
+	r->off += len;
+	return data;
+}
+
+static uint8_t get_u8(struct include_cache_reader *r)
+{
+	const uint8_t *val = get_data(r, sizeof(*val));
+
+	return val ? *val : 0;
+}
+
+static uint32_t get_u32(struct include_cache_reader *r)
+{
+	const void *data = get_data(r, sizeof(uint32_t));
+	uint32_t val = 0;
+
+	if (data != NULL)
+		memcpy(&val, data, sizeof(val));
+	return val;
+}
+
+static uint64_t get_u64(struct include_cache_reader *r)
+{
+	const void *data = get_data(r, sizeof(uint64_t));
+	uint64_t val = 0;
+
+	if (data != NULL)
+		memcpy(&val, data, sizeof(val));
+	return val;
+}
+
+static char *get_str(struct include_cache_reader *r)
+{
+	uint32_t len = get_u32(r);
+	const char *data;
+	char *str;
+
+	if (len-- == 0)
+		return NULL;
+
+	data = get_data(r, len);
+	if (data == NULL)
+		return NULL;
+
+	str = xmalloc(len + 1);
+	memcpy(str, data, len);
+	str[len] = '\0';
+	return str;
+}
+
+static bool get_str_equal(struct include_cache_reader *r, const char *str)
+{
+	char *tmp = get_str(r);
+	bool ret;
+
+	ret = tmp != NULL && !strcmp(tmp, str);
+	xfree(tmp);
+	return ret;
+}
+
+/* Symbols defined earlier in the cached file are bound only after loading. */
+static bool include_cache_symbol_known(struct include_cache_reader *r,
+				       const char *identifier)
+{
+	struct include_cache_item *item;
+
+	if (symbol_lookup(&r->state->top_scope, identifier) != NULL)
+		return true;
+
+	list_for_each_entry(item, &r->items, list) {
+		if (item->type == INCLUDE_CACHE_DEFINE &&
+		    !strcmp(item->identifier, identifier))
+			return true;
+	}
+	return false;
+}
+
+static struct expr *get_expr(struct include_cache_reader *r)
+{
+	const struct datatype *dtype;
+	enum byteorder byteorder;
+	struct expr *expr = NULL, *left, *right;
+	unsigned int flags, len, n, i;
+	enum expr_types type;
+	const void *data;
+	char *str;
+	int val;
+
+	type	  = get_u8(r);
+	flags	  = get_u32(r);
+	dtype	  = datatype_lookup(get_u32(r));
+	byteorder = get_u32(r);
+	len	  = get_u32(r);
+	if (r->error || dtype == NULL)
+		goto err;
+
+	switch (type) {
+	case EXPR_VERDICT:
+		val = get_u32(r);
+		expr = verdict_expr_alloc(r->loc, val, get_str(r));
+		break;
+	case EXPR_SYMBOL:
+		val = get_u32(r);
+		n = get_u8(r);
+		str = get_str(r);
+		if (str == NULL)
+			goto err;
+		if (val == SYMBOL_DEFINE &&
+		    !include_cache_symbol_known(r, str)) {
+			xfree(str);
+			goto err;
+		}
+		expr = symbol_expr_alloc(r->loc, val,
+					 n ? &r->state->top_scope : NULL, str);
+		xfree(str);
+		break;
+	case EXPR_VALUE:
+		if (byteorder == BYTEORDER_INVALID)
+			goto err;
+		data = get_data(r, div_round_up(len, BITS_PER_BYTE));
+		if (data == NULL)
+			goto err;
+		expr = constant_expr_alloc(r->loc, dtype, byteorder, len, data);
+		break;
+	case EXPR_PREFIX:
+		n = get_u32(r);
+		left = get_expr(r);
+		if (left == NULL)
+			goto err;
+		expr = prefix_expr_alloc(r->loc, left, n);
+		break;
+	case EXPR_RANGE:
+	case EXPR_MAPPING:
+	case EXPR_BINOP:
+		n = type == EXPR_BINOP ? get_u32(r) : 0;
+		left = get_expr(r);
+		if (left == NULL)
+			goto err;
+		right = get_expr(r);
+		if (right == NULL) {
+			expr_free(left);
+			goto err;
+		}
+		if (type == EXPR_RANGE)
+			expr = range_expr_alloc(r->loc, left, right);
+		else if (type == EXPR_MAPPING)
+			expr = mapping_expr_alloc(r->loc, left, right);
+		else
+			expr = binop_expr_alloc(r->loc, n, left, right);
+		break;
+	case EXPR_CONCAT:
+	case EXPR_LIST:
+	case EXPR_SET:
+		if (type == EXPR_CONCAT)
+			expr = concat_expr_alloc(r->loc);
+		else if (type == EXPR_LIST)
+			expr = list_expr_alloc(r->loc);
+		else
+			expr = set_expr_alloc(r->loc, NULL);
+
+		expr->set_flags = get_u32(r);
+		n = get_u32(r);
+		for (i = 0; i < n; i++) {
+			left = get_expr(r);
+			if (left == NULL)
+				goto err;
+			compound_expr_add(expr, left);
+		}
+		break;
+	case EXPR_SET_ELEM: {
+		uint64_t timeout, expiration;
+		uint32_t elem_flags;
+
+		timeout	   = get_u64(r);
+		expiration = get_u64(r);
+		elem_flags = get_u32(r);
+		str	   = get_str(r);
+		left	   = get_expr(r);
+		if (left == NULL) {
+			xfree(str);
+			goto err;
+		}
+		expr = set_elem_expr_alloc(r->loc, left);
+		expr->timeout	 = timeout;
+		expr->expiration = expiration;
+		expr->elem_flags = elem_flags;
+		expr->comment	 = str;
+		break;
+	}
+	default:
+		goto err;
+	}
+
+	expr->flags	= flags;
+	expr->dtype	= dtype;
+	expr->byteorder	= byteorder;
+	expr->len	= len;
+	return expr;
+err:
+	if (expr != NULL)
+		expr_free(expr);
+	r->error = true;
+	return NULL;
+}
+
+static void include_cache_items_free(struct list_head *items)
+{
+	struct include_cache_item *item, *next;
+
+	list_for_each_entry_safe(item, next, items, list) {
+		list_del(&item->list);
+		xfree(item->identifier);
+		handle_free(&item->handle);
+		if (item->expr != NULL)
+			expr_free(item->expr);
+		xfree(item);
+	}
+}
+
+static bool include_cache_read_header(struct include_cache_reader *r,
+				      const struct include_cache *cache)
+{
+	return get_u32(r) == INCLUDE_CACHE_MAGIC &&
+	       get_str_equal(r, PACKAGE_VERSION) &&
+	       get_str_equal(r, cache->name) &&
+	       get_u64(r) == (uint64_t)cache->st.st_mtim.tv_sec &&
+	       get_u64(r) == (uint64_t)cache->st.st_mtim.tv_nsec &&
+	       get_u64(r) == (uint64_t)cache->st.st_size &&
+	       get_u64(r) == (uint64_t)cache->st.st_dev &&
+	       get_u64(r) == (uint64_t)cache->st.st_ino &&
+	       get_u64(r) == cache->hash &&
+	       !r->error;
+}
+
+static bool include_cache_read_items(struct include_cache_reader *r)
+{
+	struct include_cache_item *item;
+	uint8_t type;
+
+	while ((type = get_u8(r)) != INCLUDE_CACHE_END) {
+		if (r->error)
+			return false;
+
+		item = xzalloc(sizeof(*item));
+		item->type = type;
+		switch (type) {
+		case INCLUDE_CACHE_DEFINE:
+			item->identifier = get_str(r);
+			if (item->identifier == NULL ||
+			    include_cache_symbol_known(r, item->identifier))
+				r->error = true;
+			break;
+		case INCLUDE_CACHE_ELEMENTS:
+			item->op	     = get_u32(r);
+			item->handle.family = get_u32(r);
+			item->handle.table  = get_str(r);
+			item->handle.set    = get_str(r);
+			break;
+		default:
+			r->error = true;
+			break;
+		}
+
+		if (!r->error)
+			item->expr = get_expr(r);
+		list_add_tail(&item->list, &r->items);
+		if (r->error)
+			return false;
+	}
+	return !r->error;
+}
+
+static char *include_cache_read(const char *path, size_t *len)
+{
+	struct stat st;
+	char *buf;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_NOFOLLOW);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+	    !include_cache_trusted(&st)) {
+		close(fd);
+		return NULL;
+	}
+
+	buf = xmalloc(st.st_size + 1);
+	if (read(fd, buf, st.st_size) != st.st_size) {
+		xfree(buf);
+		buf = NULL;
+	}
+	close(fd);
+
+	*len = st.st_size;
+	return buf;
+}
+
+/*
+ * Load the cached contents of an include file, as if it was parsed at the
+ * location of the include statement. Defines are bound to the top-level scope
+ * and element commands are evaluated and queued. Nothing is applied unless
+ * the whole cache entry is valid and all of its commands evaluate, the file
+ * is parsed normally otherwise, so that errors point into the file.
+ */
+int include_cache_load(struct include_cache *cache, struct parser_state *state,
+		       const struct location *loc)
+{
+	struct include_cache_reader r = {
+		.state	= state,
+		.loc	= loc,
+	};
+	struct list_head *msgs = state->ectx.msgs;
+	struct include_cache_item *item;
+	struct error_record *erec, *next;
+	struct cmd *cmd, *tmp;
+	LIST_HEAD(errors);
+	LIST_HEAD(cmds);
+	char *buf;
+	int ret = 0;
+
+	init_list_head(&r.items);
+
+	buf = include_cache_read(cache->path, &r.len);
+	if (buf == NULL)
+		return -1;
+	r.data = buf;
+
+	if (!include_cache_read_header(&r, cache) ||
+	    !include_cache_read_items(&r)) {
+		include_cache_items_free(&r.items);
+		xfree(buf);
+		return -1;
+	}
+	xfree(buf);
+
+	/* errors would point to the include statement, keep them apart */
+	state->ectx.msgs = &errors;
+	list_for_each_entry(item, &r.items, list) {
+		switch (item->type) {
+		case INCLUDE_CACHE_DEFINE:
+			symbol_bind(&state->top_scope, item->identifier,
+				    item->expr);
+			break;
+		case INCLUDE_CACHE_ELEMENTS:
+			cmd = cmd_alloc(item->op, CMD_OBJ_SETELEM,
+					&item->handle, loc, item->expr);
+			memset(&item->handle, 0, sizeof(item->handle));
+
+			list_add_tail(&cmd->list, &cmds);
+			if (cmd_evaluate(&state->ectx, cmd) < 0)
+				ret = -1;
+			break;
+		default:
+			BUG("unknown include cache item %u\n", item->type);
+		}
+		item->expr = NULL;
+		if (ret < 0)
+			break;
+	}
+	state->ectx.msgs = msgs;
+
+	if (ret < 0) {
+		list_for_each_entry_safe(cmd, tmp, &cmds, list) {
+			list_del(&cmd->list);
+			cmd_free(cmd);
+		}
+		list_for_each_entry(item, &r.items, list) {
+			if (item->type == INCLUDE_CACHE_DEFINE &&
+			    item->expr == NULL)
+				symbol_unbind(&state->top_scope,
+					      item->identifier);
+		}
+		list_for_each_entry_safe(erec, next, &errors, list) {
+			list_del(&erec->list);
+			erec_destroy(erec);
+		}
+	} else {
+		parser_add_cmds(state, &cmds);
+	}
+	include_cache_items_free(&r.items);
+
+	return ret;
+}
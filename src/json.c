@@ -0,0 +1,1141 @@
+/*
+ * JSON listing of the ruleset.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <libmnl/libmnl.h>
+#include <libnftnl/rule.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nf_tables.h>
+#include <linux/netfilter/nf_nat.h>
+#include <linux/netfilter/nf_log.h>
+
+#include <nftables.h>
+#include <expression.h>
+#include <statement.h>
+#include <payload.h>
+#include <proto.h>
+#include <meta.h>
+#include <ct.h>
+#include <exthdr.h>
+#include <mnl.h>
+#include <netlink.h>
+#include <rule.h>
+#include <json.h>
+#include <utils.h>
+
+/**
+ * struct json_ctx - state of a JSON listing
+ *
+ * @octx:	output context, its stream is swapped while printing strings
+ * @fp:		stream the document is written to
+ * @esc:	stream escaping what is written to @fp
+ * @sep:	separator to print before the next object of the array
+ * @family:	only list tables of this family, unless NFPROTO_UNSPEC
+ */
+struct json_ctx {
+	struct output_ctx	*octx;
+	FILE			*fp;
+	FILE			*esc;
+	const char		*sep;
+	uint32_t		family;
+};
+
+static ssize_t json_escape_write(void *cookie, const char *buf, size_t size)
+{
+	FILE *fp = cookie;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		unsigned char c = buf[i];
+
+		switch (c) {
+		case '"':
+			fputs("\\\"", fp);
+			break;
+		case '\\':
+			fputs("\\\\", fp);
+			break;
+		case '\n':
+			fputs("\\n", fp);
+			break;
+		case '\t':
+			fputs("\\t", fp);
+			break;
+		default:
+			if (c < 0x20)
+				fprintf(fp, "\\u%04x", c);
+			else
+				fputc(c, fp);
+			break;
+		}
+	}
+	return size;
+}
+
+static const cookie_io_functions_t json_escape_funcs = {
+	.write	= json_escape_write,
+};
+
+/*
+ * Strings are printed by the existing print callbacks, the output stream
+ * is replaced by one that escapes them on their way to the real one.
+ */
+static void json_str_begin(struct json_ctx *jctx)
+{
+	fputc('"', jctx->fp);
+	jctx->octx->output_fp = jctx->esc;
+}
+
+static void json_str_end(struct json_ctx *jctx)
+{
+	fflush(jctx->esc);
+	jctx->octx->output_fp = jctx->fp;
+	fputc('"', jctx->fp);
+}
+
+static void json_str(struct json_ctx *jctx, const char *key, const char *s)
+{
+	fprintf(jctx->fp, ", \"%s\": ", key);
+	json_str_begin(jctx);
+	fputs(s, jctx->esc);
+	json_str_end(jctx);
+}
+
+static void json_u64(struct json_ctx *jctx, const char *key, uint64_t val)
+{
+	fprintf(jctx->fp, ", \"%s\": %" PRIu64, key, val);
+}
+
+/* Objects of the array start on a line of their own. */
+static void json_obj_begin(struct json_ctx *jctx, const char *type,
+			   const struct handle *h, const char *name)
+{
+	fprintf(jctx->fp, "%s{\"%s\": {\"family\": \"%s\"", jctx->sep, type,
+		family2str(h->family));
+	jctx->sep = ",\n";
+
+	if (strcmp(type, "table"))
+		json_str(jctx, "table", h->table);
+	json_str(jctx, "name", name);
+	if (jctx->octx->handle > 0 && h->handle.id)
+		json_u64(jctx, "handle", h->handle.id);
+}
+
+static void json_obj_end(struct json_ctx *jctx)
+{
+	fputs("}}", jctx->fp);
+	fflush(jctx->fp);
+}
+
+static void json_table(struct json_ctx *jctx, const struct table *table)
+{
+	json_obj_begin(jctx, "table", &table->handle, table->handle.table);
+	if (table->flags & TABLE_F_DORMANT)
+		fputs(", \"flags\": [\"dormant\"]", jctx->fp);
+	json_obj_end(jctx);
+}
+
+static void json_chain(struct json_ctx *jctx, const struct chain *chain)
+{
+	json_obj_begin(jctx, "chain", &chain->handle, chain->handle.chain);
+	if (chain->flags & CHAIN_F_BASECHAIN) {
+		json_str(jctx, "type", chain->type);
+		json_str(jctx, "hook",
+			 hooknum2str(chain->handle.family, chain->hooknum));
+		if (chain->dev != NULL)
+			json_str(jctx, "dev", chain->dev);
+		fprintf(jctx->fp, ", \"prio\": %d", chain->priority);
+		json_str(jctx, "policy", chain_policy2str(chain->policy));
+	}
+	json_obj_end(jctx);
+}
+
+static void json_quoted(struct json_ctx *jctx, const char *s)
+{
+	json_str_begin(jctx);
+	fputs(s, jctx->esc);
+	json_str_end(jctx);
+}
+
+static void json_member(struct json_ctx *jctx, const char **sep,
+			const char *key)
+{
+	fprintf(jctx->fp, "%s\"%s\": ", *sep, key);
+	*sep = ", ";
+}
+
+/*
+ * Values are printed by their print callbacks, as a number if that is what
+ * they print, as a string otherwise. Quoted strings lose their quotes.
+ */
+static void json_value(struct json_ctx *jctx, const struct expr *expr)
+{
+	FILE *fp = jctx->octx->output_fp;
+	char *buf = NULL;
+	size_t len = 0, i;
+	FILE *mem;
+
+	mem = open_memstream(&buf, &len);
+	if (mem == NULL)
+		memory_allocation_error();
+
+	jctx->octx->output_fp = mem;
+	expr_print(expr, jctx->octx);
+	jctx->octx->output_fp = fp;
+	fclose(mem);
+
+	for (i = 0; i < len && isdigit((unsigned char)buf[i]); i++)
+		;
+	if (len > 0 && i == len && (buf[0] != '0' || len == 1)) {
+		fputs(buf, jctx->fp);
+	} else if (len >= 2 && buf[0] == '"' && buf[len - 1] == '"') {
+		buf[len - 1] = '\0';
+		json_quoted(jctx, buf + 1);
+	} else {
+		json_quoted(jctx, buf);
+	}
+	free(buf);
+}
+
+static void json_expr(struct json_ctx *jctx, const struct expr *expr);
+
+static void json_expr_list(struct json_ctx *jctx, const struct list_head *list)
+{
+	const struct expr *i;
+	const char *sep = "";
+
+	fputc('[', jctx->fp);
+	list_for_each_entry(i, list, list) {
+		fputs(sep, jctx->fp);
+		json_expr(jctx, i);
+		sep = ", ";
+	}
+	fputc(']', jctx->fp);
+}
+
+static void json_expr_pair(struct json_ctx *jctx, const char *key,
+			   const struct expr *left, const struct expr *right)
+{
+	fprintf(jctx->fp, "{\"%s\": [", key);
+	json_expr(jctx, left);
+	fputs(", ", jctx->fp);
+	json_expr(jctx, right);
+	fputs("]}", jctx->fp);
+}
+
+static void json_verdict(struct json_ctx *jctx, const struct expr *expr)
+{
+	const char *name;
+
+	switch (expr->verdict) {
+	case NFT_CONTINUE:
+		name = "continue";
+		break;
+	case NFT_BREAK:
+		name = "break";
+		break;
+	case NFT_RETURN:
+		name = "return";
+		break;
+	case NFT_JUMP:
+	case NFT_GOTO:
+		fprintf(jctx->fp, "{\"%s\": {\"target\": ",
+			expr->verdict == NFT_JUMP ? "jump" : "goto");
+		json_quoted(jctx, expr->chain);
+		fputs("}}", jctx->fp);
+		return;
+	default:
+		switch (expr->verdict & NF_VERDICT_MASK) {
+		case NF_ACCEPT:
+			name = "accept";
+			break;
+		case NF_DROP:
+			name = "drop";
+			break;
+		case NF_QUEUE:
+			name = "queue";
+			break;
+		default:
+			json_value(jctx, expr);
+			return;
+		}
+	}
+	fprintf(jctx->fp, "{\"%s\": null}", name);
+}
+
+static void json_ct(struct json_ctx *jctx, enum nft_ct_keys key, int8_t dir,
+		    uint8_t nfproto)
+{
+	const struct proto_desc *desc;
+	const char *name;
+
+	fprintf(jctx->fp, "{\"ct\": {\"key\": \"%s\"", ct_key_name(key));
+	name = dir >= 0 ? ct_dir_name(dir) : NULL;
+	if (name != NULL) {
+		fprintf(jctx->fp, ", \"dir\": \"%s\"", name);
+
+		desc = proto_find_upper(&proto_inet, nfproto);
+		if ((key == NFT_CT_SRC || key == NFT_CT_DST) && desc != NULL)
+			fprintf(jctx->fp, ", \"family\": \"%s\"", desc->name);
+	}
+	fputs("}}", jctx->fp);
+}
+
+static void json_exthdr(struct json_ctx *jctx, const struct expr *expr)
+{
+	const struct exthdr_desc *desc = expr->exthdr.desc;
+
+	fprintf(jctx->fp, "{\"%s\": {\"name\": \"%s\"",
+		expr->exthdr.op == NFT_EXTHDR_OP_TCPOPT ? "tcp_option" : "exthdr",
+		desc != NULL ? desc->name : "unknown-exthdr");
+	if (!(expr->exthdr.flags & NFT_EXTHDR_F_PRESENT))
+		fprintf(jctx->fp, ", \"field\": \"%s\"",
+			expr->exthdr.tmpl->token);
+	fputs("}}", jctx->fp);
+}
+
+static const char *json_relational_op(const struct expr *expr)
+{
+	switch (expr->op) {
+	case OP_IMPLICIT:
+		if (expr->right->ops->type == EXPR_SET ||
+		    expr->right->ops->type == EXPR_SET_REF)
+			return "in";
+		return "==";
+	case OP_FLAGCMP:
+	case OP_LOOKUP:
+		return "in";
+	default:
+		return expr_op_symbols[expr->op];
+	}
+}
+
+/*
+ * Expressions are printed as objects keyed by what they are. Those without
+ * a structure of their own, such as rt, fib, numgen and hash, map their name
+ * to their nft syntax.
+ */
+static void json_expr(struct json_ctx *jctx, const struct expr *expr)
+{
+	FILE *fp = jctx->fp;
+	const char *sep = "";
+
+	switch (expr->ops->type) {
+	case EXPR_VALUE:
+	case EXPR_SYMBOL:
+		json_value(jctx, expr);
+		break;
+	case EXPR_VERDICT:
+		json_verdict(jctx, expr);
+		break;
+	case EXPR_PREFIX:
+		fputs("{\"prefix\": {\"addr\": ", fp);
+		json_expr(jctx, expr->prefix);
+		fprintf(fp, ", \"len\": %u}}", expr->prefix_len);
+		break;
+	case EXPR_RANGE:
+		json_expr_pair(jctx, "range", expr->left, expr->right);
+		break;
+	case EXPR_PAYLOAD:
+		if (payload_is_known(expr))
+			fprintf(fp, "{\"payload\": {\"protocol\": \"%s\", \"field\": \"%s\"}}",
+				expr->payload.desc->name,
+				expr->payload.tmpl->token);
+		else
+			fprintf(fp, "{\"payload\": {\"base\": \"%s\", \"offset\": %u, \"len\": %u}}",
+				proto_base_tokens[expr->payload.base],
+				expr->payload.offset, expr->len);
+		break;
+	case EXPR_EXTHDR:
+		json_exthdr(jctx, expr);
+		break;
+	case EXPR_META:
+		fprintf(fp, "{\"meta\": \"%s\"}", meta_key_name(expr->meta.key));
+		break;
+	case EXPR_CT:
+		json_ct(jctx, expr->ct.key, expr->ct.direction, expr->ct.nfproto);
+		break;
+	case EXPR_CONCAT:
+		fputs("{\"concat\": ", fp);
+		json_expr_list(jctx, &expr->expressions);
+		fputc('}', fp);
+		break;
+	case EXPR_LIST:
+		json_expr_list(jctx, &expr->expressions);
+		break;
+	case EXPR_SET:
+		fputs("{\"set\": ", fp);
+		json_expr_list(jctx, &expr->expressions);
+		fputc('}', fp);
+		break;
+	case EXPR_SET_REF:
+		if (expr->set->flags & NFT_SET_ANONYMOUS &&
+		    expr->set->init != NULL) {
+			json_expr(jctx, expr->set->init);
+			break;
+		}
+		json_str_begin(jctx);
+		fprintf(jctx->esc, "@%s", expr->set->handle.set);
+		json_str_end(jctx);
+		break;
+	case EXPR_SET_ELEM:
+		if (!expr->timeout && !expr->expiration && !expr->comment) {
+			json_expr(jctx, expr->key);
+			break;
+		}
+		fputs("{\"elem\": {", fp);
+		json_member(jctx, &sep, "val");
+		json_expr(jctx, expr->key);
+		if (expr->timeout)
+			json_u64(jctx, "timeout", expr->timeout / 1000);
+		if (expr->expiration)
+			json_u64(jctx, "expires", expr->expiration / 1000);
+		if (expr->comment)
+			json_str(jctx, "comment", expr->comment);
+		fputs("}}", fp);
+		break;
+	case EXPR_MAPPING:
+		fputc('[', fp);
+		json_expr(jctx, expr->left);
+		fputs(", ", fp);
+		json_expr(jctx, expr->right);
+		fputc(']', fp);
+		break;
+	case EXPR_MAP:
+		fputs("{\"map\": {\"key\": ", fp);
+		json_expr(jctx, expr->map);
+		fputs(", \"data\": ", fp);
+		json_expr(jctx, expr->mappings);
+		fputs("}}", fp);
+		break;
+	case EXPR_UNARY:
+		json_expr(jctx, expr->arg);
+		break;
+	case EXPR_BINOP:
+		json_expr_pair(jctx, expr_op_symbols[expr->op], expr->left,
+			       expr->right);
+		break;
+	case EXPR_RELATIONAL:
+		fprintf(fp, "{\"match\": {\"op\": \"%s\", \"left\": ",
+			json_relational_op(expr));
+		json_expr(jctx, expr->left);
+		fputs(", \"right\": ", fp);
+		json_expr(jctx, expr->right);
+		fputs("}}", fp);
+		break;
+	default:
+		fprintf(fp, "{\"%s\": ", expr->ops->name);
+		json_value(jctx, expr);
+		fputc('}', fp);
+		break;
+	}
+}
+
+static void json_nat_flags(struct json_ctx *jctx, const char **sep,
+			   uint32_t flags)
+{
+	const char *delim = "";
+
+	if (flags == 0)
+		return;
+
+	json_member(jctx, sep, "flags");
+	fputc('[', jctx->fp);
+	if (flags & NF_NAT_RANGE_PROTO_RANDOM) {
+		fprintf(jctx->fp, "%s\"random\"", delim);
+		delim = ", ";
+	}
+	if (flags & NF_NAT_RANGE_PROTO_RANDOM_FULLY) {
+		fprintf(jctx->fp, "%s\"fully-random\"", delim);
+		delim = ", ";
+	}
+	if (flags & NF_NAT_RANGE_PERSISTENT)
+		fprintf(jctx->fp, "%s\"persistent\"", delim);
+	fputc(']', jctx->fp);
+}
+
+static void json_log(struct json_ctx *jctx, const struct stmt *stmt)
+{
+	static const struct {
+		uint32_t	flag;
+		const char	*name;
+	} log_flags[] = {
+		{ NF_LOG_TCPSEQ,	"tcp sequence" },
+		{ NF_LOG_TCPOPT,	"tcp options" },
+		{ NF_LOG_IPOPT,		"ip options" },
+		{ NF_LOG_UID,		"skuid" },
+		{ NF_LOG_MACDECODE,	"ether" },
+	};
+	const char *sep = "", *delim = "";
+	unsigned int i;
+
+	fputs("{\"log\": {", jctx->fp);
+	if (stmt->log.flags & STMT_LOG_PREFIX) {
+		json_member(jctx, &sep, "prefix");
+		json_quoted(jctx, stmt->log.prefix);
+	}
+	if (stmt->log.flags & STMT_LOG_GROUP) {
+		json_member(jctx, &sep, "group");
+		fprintf(jctx->fp, "%u", stmt->log.group);
+	}
+	if (stmt->log.flags & STMT_LOG_SNAPLEN) {
+		json_member(jctx, &sep, "snaplen");
+		fprintf(jctx->fp, "%u", stmt->log.snaplen);
+	}
+	if (stmt->log.flags & STMT_LOG_QTHRESHOLD) {
+		json_member(jctx, &sep, "queue-threshold");
+		fprintf(jctx->fp, "%u", stmt->log.qthreshold);
+	}
+	if (stmt->log.flags & STMT_LOG_LEVEL) {
+		json_member(jctx, &sep, "level");
+		fprintf(jctx->fp, "\"%s\"", log_level(stmt->log.level));
+	}
+	if (stmt->log.logflags) {
+		json_member(jctx, &sep, "flags");
+		fputc('[', jctx->fp);
+		if ((stmt->log.logflags & NF_LOG_MASK) == NF_LOG_MASK) {
+			fputs("\"all\"", jctx->fp);
+		} else {
+			for (i = 0; i < array_size(log_flags); i++) {
+				if (!(stmt->log.logflags & log_flags[i].flag))
+					continue;
+				fprintf(jctx->fp, "%s\"%s\"", delim,
+					log_flags[i].name);
+				delim = ", ";
+			}
+		}
+		fputc(']', jctx->fp);
+	}
+	fputs("}}", jctx->fp);
+}
+
+static void json_reject(struct json_ctx *jctx, const struct stmt *stmt)
+{
+	const char *type;
+
+	switch (stmt->reject.type) {
+	case NFT_REJECT_TCP_RST:
+		type = "tcp reset";
+		break;
+	case NFT_REJECT_ICMPX_UNREACH:
+		type = "icmpx";
+		break;
+	default:
+		type = stmt->reject.family == NFPROTO_IPV6 ? "icmpv6" : "icmp";
+		break;
+	}
+
+	fprintf(jctx->fp, "{\"reject\": {\"type\": \"%s\"", type);
+	if (stmt->reject.expr != NULL) {
+		fputs(", \"expr\": ", jctx->fp);
+		json_expr(jctx, stmt->reject.expr);
+	}
+	fputs("}}", jctx->fp);
+}
+
+static void json_nat(struct json_ctx *jctx, const struct stmt *stmt)
+{
+	const struct expr *addr = NULL, *port;
+	const char *name, *sep = "";
+	uint32_t flags;
+
+	switch (stmt->ops->type) {
+	case STMT_NAT:
+		name = stmt->nat.type == NFT_NAT_SNAT ? "snat" : "dnat";
+		addr = stmt->nat.addr;
+		port = stmt->nat.proto;
+		flags = stmt->nat.flags;
+		break;
+	case STMT_MASQ:
+		name = "masquerade";
+		port = stmt->masq.proto;
+		flags = stmt->masq.flags;
+		break;
+	default:
+		name = "redirect";
+		port = stmt->redir.proto;
+		flags = stmt->redir.flags;
+		break;
+	}
+
+	fprintf(jctx->fp, "{\"%s\": {", name);
+	if (addr != NULL) {
+		json_member(jctx, &sep, "addr");
+		json_expr(jctx, addr);
+	}
+	if (port != NULL) {
+		json_member(jctx, &sep, "port");
+		json_expr(jctx, port);
+	}
+	json_nat_flags(jctx, &sep, flags);
+	fputs("}}", jctx->fp);
+}
+
+static void json_queue(struct json_ctx *jctx, const struct stmt *stmt)
+{
+	const char *sep = "", *delim = "";
+
+	fputs("{\"queue\": {", jctx->fp);
+	if (stmt->queue.queue != NULL) {
+		json_member(jctx, &sep, "num");
+		json_expr(jctx, stmt->queue.queue);
+	}
+	if (stmt->queue.flags) {
+		json_member(jctx, &sep, "flags");
+		fputc('[', jctx->fp);
+		if (stmt->queue.flags & NFT_QUEUE_FLAG_BYPASS) {
+			fputs("\"bypass\"", jctx->fp);
+			delim = ", ";
+		}
+		if (stmt->queue.flags & NFT_QUEUE_FLAG_CPU_FANOUT)
+			fprintf(jctx->fp, "%s\"fanout\"", delim);
+		fputc(']', jctx->fp);
+	}
+	fputs("}}", jctx->fp);
+}
+
+static const char *json_objref_type(uint32_t type)
+{
+	switch (type) {
+	case NFT_OBJECT_COUNTER:
+		return "counter";
+	case NFT_OBJECT_QUOTA:
+		return "quota";
+	case NFT_OBJECT_CT_HELPER:
+		return "ct_helper";
+	case NFT_OBJECT_LIMIT:
+		return "limit";
+	default:
+		return "unknown";
+	}
+}
+
+static void json_mangle_end(struct json_ctx *jctx, const struct expr *value)
+{
+	fputs(", \"value\": ", jctx->fp);
+	json_expr(jctx, value);
+	fputs("}}", jctx->fp);
+}
+
+/* Statements that only exist in nft syntax map their name to it. */
+static void json_stmt_text(struct json_ctx *jctx, const struct stmt *stmt)
+{
+	fprintf(jctx->fp, "{\"%s\": ", stmt->ops->name);
+	json_str_begin(jctx);
+	stmt->ops->print(stmt, jctx->octx);
+	json_str_end(jctx);
+	fputc('}', jctx->fp);
+}
+
+static void json_stmt(struct json_ctx *jctx, const struct stmt *stmt)
+{
+	bool stateless = jctx->octx->stateless;
+	FILE *fp = jctx->fp;
+	const char *sep = "";
+
+	switch (stmt->ops->type) {
+	case STMT_EXPRESSION:
+	case STMT_VERDICT:
+		json_expr(jctx, stmt->expr);
+		break;
+	case STMT_COUNTER:
+		fprintf(fp, "{\"counter\": {\"packets\": %" PRIu64 ", \"bytes\": %" PRIu64 "}}",
+			stateless ? 0 : stmt->counter.packets,
+			stateless ? 0 : stmt->counter.bytes);
+		break;
+	case STMT_LIMIT:
+		fprintf(fp, "{\"limit\": {\"rate\": %" PRIu64 ", \"per\": \"%s\"",
+			stmt->limit.rate, get_unit(stmt->limit.unit));
+		if (stmt->limit.burst > 0)
+			fprintf(fp, ", \"burst\": %u", stmt->limit.burst);
+		fprintf(fp, ", \"unit\": \"%s\"",
+			stmt->limit.type == NFT_LIMIT_PKT_BYTES ?
+			"bytes" : "packets");
+		if (stmt->limit.flags & NFT_LIMIT_F_INV)
+			fputs(", \"inv\": true", fp);
+		fputs("}}", fp);
+		break;
+	case STMT_QUOTA:
+		fprintf(fp, "{\"quota\": {\"bytes\": %" PRIu64 ", \"used\": %" PRIu64,
+			stmt->quota.bytes, stateless ? 0 : stmt->quota.used);
+		if (stmt->quota.flags & NFT_QUOTA_F_INV)
+			fputs(", \"inv\": true", fp);
+		fputs("}}", fp);
+		break;
+	case STMT_LOG:
+		json_log(jctx, stmt);
+		break;
+	case STMT_REJECT:
+		json_reject(jctx, stmt);
+		break;
+	case STMT_NAT:
+	case STMT_MASQ:
+	case STMT_REDIR:
+		json_nat(jctx, stmt);
+		break;
+	case STMT_QUEUE:
+		json_queue(jctx, stmt);
+		break;
+	case STMT_NOTRACK:
+		fputs("{\"notrack\": null}", fp);
+		break;
+	case STMT_OBJREF:
+		fprintf(fp, "{\"%s\": ", json_objref_type(stmt->objref.type));
+		json_expr(jctx, stmt->objref.expr);
+		fputc('}', fp);
+		break;
+	case STMT_SET:
+		fprintf(fp, "{\"set\": {\"op\": \"%s\", \"elem\": ",
+			stmt->set.op == NFT_DYNSET_OP_UPDATE ? "update" : "add");
+		json_expr(jctx, stmt->set.key);
+		fputs(", \"set\": ", fp);
+		json_expr(jctx, stmt->set.set);
+		fputs("}}", fp);
+		break;
+	case STMT_PAYLOAD:
+		fputs("{\"mangle\": {\"key\": ", fp);
+		json_expr(jctx, stmt->payload.expr);
+		json_mangle_end(jctx, stmt->payload.val);
+		break;
+	case STMT_EXTHDR:
+		fputs("{\"mangle\": {\"key\": ", fp);
+		json_expr(jctx, stmt->exthdr.expr);
+		json_mangle_end(jctx, stmt->exthdr.val);
+		break;
+	case STMT_META:
+		fprintf(fp, "{\"mangle\": {\"key\": {\"meta\": \"%s\"}",
+			meta_key_name(stmt->meta.key));
+		json_mangle_end(jctx, stmt->meta.expr);
+		break;
+	case STMT_CT:
+		fputs("{\"mangle\": {\"key\": ", fp);
+		json_ct(jctx, stmt->ct.key, stmt->ct.direction, NFPROTO_UNSPEC);
+		json_mangle_end(jctx, stmt->ct.expr);
+		break;
+	case STMT_DUP:
+		fputs("{\"dup\": {", fp);
+		if (stmt->dup.to != NULL) {
+			json_member(jctx, &sep, "addr");
+			json_expr(jctx, stmt->dup.to);
+		}
+		if (stmt->dup.dev != NULL) {
+			json_member(jctx, &sep, "dev");
+			json_expr(jctx, stmt->dup.dev);
+		}
+		fputs("}}", fp);
+		break;
+	case STMT_FWD:
+		fputs("{\"fwd\": {\"dev\": ", fp);
+		json_expr(jctx, stmt->fwd.to);
+		fputs("}}", fp);
+		break;
+	case STMT_XT:
+		fprintf(fp, "{\"xt\": {\"type\": \"%s\", \"name\": ",
+			stmt->xt.type == NFT_XT_MATCH ? "match" :
+			stmt->xt.type == NFT_XT_TARGET ? "target" : "watcher");
+		json_quoted(jctx, stmt->xt.name);
+		fputs("}}", fp);
+		break;
+	default:
+		json_stmt_text(jctx, stmt);
+		break;
+	}
+}
+
+static void json_rule(struct json_ctx *jctx, const struct rule *rule)
+{
+	const struct stmt *stmt;
+	const char *sep = "";
+
+	fprintf(jctx->fp, "%s{\"rule\": {\"family\": \"%s\"", jctx->sep,
+		family2str(rule->handle.family));
+	jctx->sep = ",\n";
+	json_str(jctx, "table", rule->handle.table);
+	json_str(jctx, "chain", rule->handle.chain);
+	if (jctx->octx->handle > 0)
+		json_u64(jctx, "handle", rule->handle.handle.id);
+	if (rule->comment)
+		json_str(jctx, "comment", rule->comment);
+
+	fputs(", \"stmts\": [", jctx->fp);
+	list_for_each_entry(stmt, &rule->stmts, list) {
+		fputs(sep, jctx->fp);
+		json_stmt(jctx, stmt);
+		sep = ", ";
+	}
+	fputc(']', jctx->fp);
+	json_obj_end(jctx);
+}
+
+/* Elements are printed one by one, straight from the cached set. */
+static void json_set_elems(struct json_ctx *jctx, const struct set *set)
+{
+	const struct expr *elem;
+	const char *sep = "";
+
+	fputs(", \"elem\": [", jctx->fp);
+	if (set->init != NULL) {
+		list_for_each_entry(elem, &set->init->expressions, list) {
+			fputs(sep, jctx->fp);
+			json_expr(jctx, elem);
+			sep = ", ";
+			fflush(jctx->fp);
+		}
+	}
+	fputc(']', jctx->fp);
+}
+
+static void json_set(struct json_ctx *jctx, const struct set *set,
+		     bool elems)
+{
+	const char *type, *sep = "";
+
+	if (set->flags & (NFT_SET_MAP | NFT_SET_OBJECT))
+		type = "map";
+	else if (set->flags & NFT_SET_EVAL)
+		type = "meter";
+	else
+		type = "set";
+
+	json_obj_begin(jctx, type, &set->handle, set->handle.set);
+	json_str(jctx, "type", set->key->dtype->name);
+	if (set->flags & NFT_SET_MAP)
+		json_str(jctx, "map", set->datatype->name);
+	else if (set->flags & NFT_SET_OBJECT)
+		json_str(jctx, "map", obj_type_name(set->objtype));
+
+	if (set->policy != NFT_SET_POL_PERFORMANCE)
+		json_str(jctx, "policy", set_policy2str(set->policy));
+	if (set->desc.size > 0)
+		json_u64(jctx, "size", set->desc.size);
+
+	if (set->flags & (NFT_SET_CONSTANT | NFT_SET_INTERVAL |
+			  NFT_SET_TIMEOUT)) {
+		fputs(", \"flags\": [", jctx->fp);
+		if (set->flags & NFT_SET_CONSTANT) {
+			fprintf(jctx->fp, "%s\"constant\"", sep);
+			sep = ", ";
+		}
+		if (set->flags & NFT_SET_INTERVAL) {
+			fprintf(jctx->fp, "%s\"interval\"", sep);
+			sep = ", ";
+		}
+		if (set->flags & NFT_SET_TIMEOUT)
+			fprintf(jctx->fp, "%s\"timeout\"", sep);
+		fputc(']', jctx->fp);
+	}
+	if (set->timeout)
+		json_u64(jctx, "timeout", set->timeout / 1000);
+	if (set->gc_int)
+		json_u64(jctx, "gc-interval", set->gc_int / 1000);
+
+	if (elems)
+		json_set_elems(jctx, set);
+	json_obj_end(jctx);
+}
+
+static void json_obj(struct json_ctx *jctx, const struct obj *obj)
+{
+	bool stateless = jctx->octx->stateless;
+
+	switch (obj->type) {
+	case NFT_OBJECT_COUNTER:
+		json_obj_begin(jctx, "counter", &obj->handle, obj->handle.obj);
+		json_u64(jctx, "packets",
+			 stateless ? 0 : obj->counter.packets);
+		json_u64(jctx, "bytes", stateless ? 0 : obj->counter.bytes);
+		break;
+	case NFT_OBJECT_QUOTA:
+		json_obj_begin(jctx, "quota", &obj->handle, obj->handle.obj);
+		json_u64(jctx, "bytes", obj->quota.bytes);
+		json_u64(jctx, "used", stateless ? 0 : obj->quota.used);
+		if (obj->quota.flags & NFT_QUOTA_F_INV)
+			fputs(", \"inv\": true", jctx->fp);
+		break;
+	case NFT_OBJECT_CT_HELPER:
+		json_obj_begin(jctx, "ct_helper", &obj->handle,
+			       obj->handle.obj);
+		json_str(jctx, "type", obj->ct_helper.name);
+		json_u64(jctx, "protocol", obj->ct_helper.l4proto);
+		json_str(jctx, "l3proto",
+			 family2str(obj->ct_helper.l3proto));
+		break;
+	case NFT_OBJECT_LIMIT:
+		json_obj_begin(jctx, "limit", &obj->handle, obj->handle.obj);
+		json_u64(jctx, "rate", obj->limit.rate);
+		json_str(jctx, "per", get_unit(obj->limit.unit));
+		json_u64(jctx, "burst", obj->limit.burst);
+		json_str(jctx, "unit", obj->limit.type == NFT_LIMIT_PKT_BYTES ?
+				       "bytes" : "packets");
+		if (obj->limit.flags & NFT_LIMIT_F_INV)
+			fputs(", \"inv\": true", jctx->fp);
+		break;
+	default:
+		return;
+	}
+	json_obj_end(jctx);
+}
+
+static bool json_table_match(const struct json_ctx *jctx,
+			     const struct cmd *cmd, const struct table *table)
+{
+	if (jctx->family != NFPROTO_UNSPEC &&
+	    jctx->family != table->handle.family)
+		return false;
+
+	return cmd->handle.table == NULL ||
+	       !strcmp(cmd->handle.table, table->handle.table);
+}
+
+static bool json_set_match(const struct cmd *cmd, const struct set *set)
+{
+	switch (cmd->obj) {
+	case CMD_OBJ_SETS:
+		return !(set->flags & (NFT_SET_ANONYMOUS | NFT_SET_MAP));
+	case CMD_OBJ_MAPS:
+		return set->flags & NFT_SET_MAP;
+	case CMD_OBJ_METERS:
+		return set->flags & NFT_SET_EVAL;
+	case CMD_OBJ_SET:
+	case CMD_OBJ_MAP:
+	case CMD_OBJ_METER:
+		return !strcmp(cmd->handle.set, set->handle.set);
+	default:
+		return !(set->flags & NFT_SET_ANONYMOUS);
+	}
+}
+
+static uint32_t json_obj_type(const struct cmd *cmd)
+{
+	switch (cmd->obj) {
+	case CMD_OBJ_COUNTER:
+	case CMD_OBJ_COUNTERS:
+		return NFT_OBJECT_COUNTER;
+	case CMD_OBJ_QUOTA:
+	case CMD_OBJ_QUOTAS:
+		return NFT_OBJECT_QUOTA;
+	case CMD_OBJ_CT_HELPER:
+	case CMD_OBJ_CT_HELPERS:
+		return NFT_OBJECT_CT_HELPER;
+	case CMD_OBJ_LIMIT:
+	case CMD_OBJ_LIMITS:
+		return NFT_OBJECT_LIMIT;
+	default:
+		return NFT_OBJECT_UNSPEC;
+	}
+}
+
+static bool json_chain_match(const struct cmd *cmd, const struct chain *chain)
+{
+	return cmd->obj != CMD_OBJ_CHAIN ||
+	       !strcmp(cmd->handle.chain, chain->handle.chain);
+}
+
+/**
+ * struct json_rules - rules written out while they are dumped
+ *
+ * @jctx:	state of the JSON listing
+ * @ctx:	netlink context the rules are decoded with
+ * @cmd:	list command
+ * @table:	table the rules are dumped from
+ * @next:	next chain of @table to be printed
+ * @last:	last chain printed
+ */
+struct json_rules {
+	struct json_ctx		*jctx;
+	struct netlink_ctx	*ctx;
+	const struct cmd	*cmd;
+	const struct table	*table;
+	const struct chain	*next;
+	const struct chain	*last;
+};
+
+/*
+ * Chains are printed from the cache ahead of their rules, the dump returns
+ * rules in the same order. Rules of a chain that was printed earlier are
+ * printed where they show up, each names its chain anyway. With no chain,
+ * all the remaining ones are printed.
+ */
+static void json_chains_upto(struct json_rules *jr, const struct chain *chain)
+{
+	const struct list_head *head = &jr->table->chains;
+	const struct chain *c;
+
+	if (chain != NULL) {
+		if (chain == jr->last)
+			return;
+
+		for (c = jr->next; &c->list != head;
+		     c = list_entry(c->list.next, struct chain, list)) {
+			if (c == chain)
+				break;
+		}
+		if (&c->list == head)
+			return;
+	}
+
+	while (&jr->next->list != head) {
+		c = jr->next;
+		jr->next = list_entry(c->list.next, struct chain, list);
+		if (!json_chain_match(jr->cmd, c))
+			continue;
+
+		json_chain(jr->jctx, c);
+		jr->last = c;
+		if (c == chain)
+			break;
+	}
+}
+
+static int json_rule_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct json_rules *jr = data;
+	const struct chain *chain;
+	struct nftnl_rule *nlr;
+	struct handle h = {};
+	struct rule *rule;
+
+	nlr = nftnl_rule_alloc();
+	if (nlr == NULL)
+		memory_allocation_error();
+
+	if (nftnl_rule_nlmsg_parse(nlh, nlr) < 0)
+		goto out;
+
+	/* the dump may not be filtered, see mnl_nft_rule_dump_cb() */
+	h.family = nftnl_rule_get_u32(nlr, NFTNL_RULE_FAMILY);
+	h.table = nftnl_rule_get_str(nlr, NFTNL_RULE_TABLE);
+	h.chain = nftnl_rule_get_str(nlr, NFTNL_RULE_CHAIN);
+	if (h.family != jr->table->handle.family ||
+	    h.table == NULL || h.chain == NULL ||
+	    strcmp(h.table, jr->table->handle.table))
+		goto out;
+
+	/* chains added after the cache was loaded are not listed */
+	chain = chain_lookup(jr->table, &h);
+	if (chain == NULL || !json_chain_match(jr->cmd, chain))
+		goto out;
+
+	json_chains_upto(jr, chain);
+
+	netlink_dump_rule(nlr, jr->ctx);
+	rule = netlink_delinearize_rule(jr->ctx, nlr);
+	json_rule(jr->jctx, rule);
+	rule_free(rule);
+out:
+	nftnl_rule_free(nlr);
+	return MNL_CB_OK;
+}
+
+static int json_list_table(struct json_ctx *jctx, struct netlink_ctx *ctx,
+			   const struct cmd *cmd, const struct table *table)
+{
+	uint32_t type = json_obj_type(cmd);
+	bool all, sets, elems, chains;
+	const struct obj *obj;
+	const struct set *set;
+	struct json_rules jr = {
+		.jctx	= jctx,
+		.ctx	= ctx,
+		.cmd	= cmd,
+		.table	= table,
+		.next	= list_first_entry(&table->chains, struct chain, list),
+	};
+
+	json_table(jctx, table);
+
+	/* list table without a name only lists the tables */
+	if (cmd->obj == CMD_OBJ_TABLE && cmd->handle.table == NULL)
+		return 0;
+
+	all = cmd->obj == CMD_OBJ_TABLE || cmd->obj == CMD_OBJ_RULESET;
+	elems = all || cmd->obj == CMD_OBJ_SET || cmd->obj == CMD_OBJ_MAP ||
+		cmd->obj == CMD_OBJ_METER;
+	sets = elems || cmd->obj == CMD_OBJ_SETS ||
+	       cmd->obj == CMD_OBJ_MAPS || cmd->obj == CMD_OBJ_METERS;
+	chains = all || cmd->obj == CMD_OBJ_CHAIN ||
+		 cmd->obj == CMD_OBJ_CHAINS;
+
+	list_for_each_entry(obj, &table->objs, list) {
+		if (!all &&
+		    (obj->type != type ||
+		     (cmd->handle.obj != NULL &&
+		      strcmp(cmd->handle.obj, obj->handle.obj))))
+			continue;
+		json_obj(jctx, obj);
+	}
+
+	list_for_each_entry(set, &table->sets, list) {
+		if (sets && json_set_match(cmd, set))
+			json_set(jctx, set, elems);
+	}
+
+	if (!chains)
+		return 0;
+
+	if (cmd->obj != CMD_OBJ_CHAINS &&
+	    mnl_nft_rule_dump_cb(ctx, table->handle.family,
+				 table->handle.table,
+				 cmd->obj == CMD_OBJ_CHAIN ?
+				 cmd->handle.chain : NULL,
+				 json_rule_cb, &jr) < 0 &&
+	    errno == EINTR)
+		return -1;
+
+	json_chains_upto(&jr, NULL);
+	return 0;
+}
+
+/*
+ * Tables, chains, sets and objects are written from the cache, which holds
+ * no rules for this listing, see cache_update_norules(). The rules of each
+ * table are decoded from its dump one at a time and written out as they
+ * are received, without building the document first, so memory use does
+ * not depend on the number of rules. If the ruleset changes meanwhile, the
+ * document is closed where the listing stopped and an error is reported.
+ */
+int json_list(struct netlink_ctx *ctx, struct cmd *cmd)
+{
+	struct json_ctx jctx = {
+		.octx	= ctx->octx,
+		.fp	= ctx->octx->output_fp,
+		.sep	= "\n",
+		.family	= cmd->handle.family,
+	};
+	const struct table *table;
+	int ret = 0;
+
+	jctx.esc = fopencookie(jctx.fp, "w", json_escape_funcs);
+	if (jctx.esc == NULL)
+		memory_allocation_error();
+
+	fputs("{\"nftables\": [", jctx.fp);
+	list_for_each_entry(table, &ctx->cache->list, list) {
+		if (!json_table_match(&jctx, cmd, table))
+			continue;
+
+		ret = json_list_table(&jctx, ctx, cmd, table);
+		if (ret < 0)
+			break;
+	}
+	fputs("\n]}\n", jctx.fp);
+	fflush(jctx.fp);
+
+	fclose(jctx.esc);
+
+	if (ret < 0)
+		return netlink_io_error(ctx, &cmd->location,
+					"Ruleset changed while it was listed, the listing is incomplete");
+	return 0;
+}
@@ -0,0 +1,807 @@
+/*
+ * Graph of the jumps between chains, used to catch loops and jump
+ * stack overflows before the batch is sent.
+ *
+ * Chains and verdict maps are the nodes. A chain has an edge to every
+ * chain its rules jump or go to and to every verdict map they look up, a
+ * verdict map has an edge to every chain its elements jump or go to. Jumps
+ * never leave a table, so the graph is loaded from the kernel one table at
+ * a time, the first time a command of the batch adds edges to it, then
+ * updated by the commands of the batch as they are evaluated. Commands that
+ * remove edges which cannot be told apart, such as deleting a single rule,
+ * leave the table stale and the remaining checks to the kernel.
+ *
+ * Loading a table takes a dump of its rules on top of the cache, so the
+ * checks only run if the cache is loaded already, as it is for files.
+ *
+ * Like in the kernel, the jump stack is only measured from base chains:
+ * chains no base chain leads to can be nested as deep as they like until
+ * they are jumped to.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <libmnl/libmnl.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nf_tables.h>
+
+#include <nftables.h>
+#include <netlink.h>
+#include <mnl.h>
+#include <rule.h>
+#include <expression.h>
+#include <datatype.h>
+#include <jump_graph.h>
+#include <utils.h>
+
+#define JUMP_GRAPH_HSIZE	4096
+
+/**
+ * struct jg_node - chain or verdict map
+ *
+ * @hnode:	hash table node
+ * @type:	chain or verdict map
+ * @family:	nfnetlink family
+ * @table:	table name
+ * @name:	chain or map name
+ * @base:	base chain, the jump stack is measured from here
+ * @out:	nodes this one jumps to
+ * @nout:	number of entries in @out
+ * @in:		nodes jumping to this one
+ * @nin:	number of entries in @in
+ * @edge_mark:	last walk this node was found as a destination in
+ * @mark:	last walk this node was visited by
+ * @height_mark: last walk @height was computed by
+ * @height:	longest number of jumps from this node
+ * @depth_mark:	last walk @depth was computed by
+ * @depth:	longest number of jumps from a base chain to this node, -1 if
+ *		no base chain leads here
+ */
+struct jg_node {
+	struct hlist_node		hnode;
+	enum jump_graph_node_type	type;
+	uint32_t			family;
+	char				*table;
+	char				*name;
+	bool				base;
+	struct jg_node			**out;
+	unsigned int			nout;
+	struct jg_node			**in;
+	unsigned int			nin;
+	unsigned int			edge_mark;
+	unsigned int			mark;
+	unsigned int			height_mark;
+	int				height;
+	unsigned int			depth_mark;
+	int				depth;
+};
+
+/**
+ * struct jg_table - table whose edges are in the graph
+ *
+ * @list:	list node
+ * @family:	nfnetlink family
+ * @name:	table name
+ * @stale:	edges are missing or out of date, the table is not checked
+ */
+struct jg_table {
+	struct list_head	list;
+	uint32_t		family;
+	char			*name;
+	bool			stale;
+};
+
+/**
+ * struct jump_graph - jumps between the chains of the ruleset
+ *
+ * @nodes:	nodes, hashed by type, family, table and name
+ * @tables:	tables loaded so far
+ * @cache:	ruleset cache, the verdict maps are loaded from there
+ * @flushed:	families flushed by the batch, as a bitmask, tables of these
+ *		are not loaded from the kernel
+ * @walk:	number of walks so far, used to mark visited nodes
+ * @stale:	edges are missing or out of date in any table, the graph is
+ *		not used
+ */
+struct jump_graph {
+	struct hlist_head	nodes[JUMP_GRAPH_HSIZE];
+	struct list_head	tables;
+	struct nft_cache	*cache;
+	unsigned int		flushed;
+	unsigned int		walk;
+	bool			stale;
+};
+
+static uint32_t jg_hash_str(uint32_t hash, const char *s)
+{
+	while (s && *s)
+		hash = (hash ^ (unsigned char)*s++) * 16777619U;
+
+	return hash;
+}
+
+static uint32_t jg_hash(enum jump_graph_node_type type, uint32_t family,
+			const char *table, const char *name)
+{
+	return jg_hash_str(jg_hash_str(2166136261U ^ (family << 1 | type),
+				       table), name) % JUMP_GRAPH_HSIZE;
+}
+
+static struct jg_node *jg_node_get(struct jump_graph *graph,
+				   enum jump_graph_node_type type,
+				   uint32_t family, const char *table,
+				   const char *name)
+{
+	struct hlist_node *n;
+	struct jg_node *node;
+	uint32_t hash;
+
+	hash = jg_hash(type, family, table, name);
+	hlist_for_each_entry(node, n, &graph->nodes[hash], hnode) {
+		if (node->type == type && node->family == family &&
+		    !strcmp(node->table, table) && !strcmp(node->name, name))
+			return node;
+	}
+
+	node = xzalloc(sizeof(*node));
+	node->type = type;
+	node->family = family;
+	node->table = xstrdup(table);
+	node->name = xstrdup(name);
+	hlist_add_head(&node->hnode, &graph->nodes[hash]);
+
+	return node;
+}
+
+static struct jg_table *jg_table_lookup(const struct jump_graph *graph,
+					uint32_t family, const char *name)
+{
+	struct jg_table *table;
+
+	list_for_each_entry(table, &graph->tables, list) {
+		if (table->family == family && !strcmp(table->name, name))
+			return table;
+	}
+	return NULL;
+}
+
+static struct jg_table *jg_table_get(struct jump_graph *graph,
+				     uint32_t family, const char *name)
+{
+	struct jg_table *table;
+
+	table = jg_table_lookup(graph, family, name);
+	if (table != NULL)
+		return table;
+
+	table = xzalloc(sizeof(*table));
+	table->family = family;
+	table->name = xstrdup(name);
+	list_add_tail(&table->list, &graph->tables);
+
+	return table;
+}
+
+/* Edges of the table of @h can be checked and updated. */
+static bool jg_table_usable(const struct jump_graph *graph,
+			    const struct handle *h)
+{
+	const struct jg_table *table;
+
+	if (graph->stale || h->table == NULL)
+		return false;
+
+	table = jg_table_lookup(graph, h->family, h->table);
+	return table != NULL && !table->stale;
+}
+
+static bool jg_chain_is_base(const struct jump_graph *graph,
+			     const struct handle *h, const char *name)
+{
+	const struct table *table;
+	const struct chain *chain;
+	struct handle ch = {
+		.family	= h->family,
+		.table	= h->table,
+		.chain	= name,
+	};
+
+	table = table_lookup(&ch, graph->cache);
+	if (table == NULL)
+		return false;
+
+	chain = chain_lookup(table, &ch);
+	return chain != NULL && chain->flags & CHAIN_F_BASECHAIN;
+}
+
+static void jg_array_add(struct jg_node ***array, unsigned int *num,
+			 struct jg_node *node)
+{
+	/* grow in powers of two */
+	if ((*num & (*num - 1)) == 0)
+		*array = xrealloc(*array, (*num ? *num * 2 : 1) *
+					  sizeof(struct jg_node *));
+	(*array)[(*num)++] = node;
+}
+
+static void jg_array_del(struct jg_node **array, unsigned int *num,
+			 const struct jg_node *node)
+{
+	unsigned int i;
+
+	for (i = 0; i < *num; i++) {
+		if (array[i] == node) {
+			array[i] = array[--(*num)];
+			return;
+		}
+	}
+}
+
+static void jg_edge_add(struct jg_node *from, struct jg_node *to)
+{
+	jg_array_add(&from->out, &from->nout, to);
+	jg_array_add(&to->in, &to->nin, from);
+}
+
+static void jg_node_flush(struct jg_node *node)
+{
+	unsigned int i;
+
+	for (i = 0; i < node->nout; i++)
+		jg_array_del(node->out[i]->in, &node->out[i]->nin, node);
+	xfree(node->out);
+	node->out = NULL;
+	node->nout = 0;
+}
+
+static void jg_node_free(struct jg_node *node)
+{
+	unsigned int i;
+
+	jg_node_flush(node);
+	for (i = 0; i < node->nin; i++)
+		jg_array_del(node->in[i]->out, &node->in[i]->nout, node);
+	hlist_del(&node->hnode);
+	xfree(node->in);
+	xfree(node->table);
+	xfree(node->name);
+	xfree(node);
+}
+
+static bool jg_node_match(const struct jg_node *node,
+			  enum jump_graph_node_type type,
+			  const struct handle *h, const char *name)
+{
+	if (h->family != NFPROTO_UNSPEC && node->family != h->family)
+		return false;
+	if (h->table != NULL && strcmp(node->table, h->table))
+		return false;
+	if (name != NULL &&
+	    (node->type != type || strcmp(node->name, name)))
+		return false;
+
+	return true;
+}
+
+/* Nodes already visited in the same walk do not lead to @to. */
+static bool jg_reaches(struct jump_graph *graph, struct jg_node *from,
+		       const struct jg_node *to)
+{
+	unsigned int i;
+
+	if (from == to)
+		return true;
+	if (from->mark == graph->walk)
+		return false;
+	from->mark = graph->walk;
+
+	for (i = 0; i < from->nout; i++) {
+		if (jg_reaches(graph, from->out[i], to))
+			return true;
+	}
+	return false;
+}
+
+/* Jumping into a chain takes one level of the stack, a map lookup none. */
+static int jg_level(const struct jg_node *node)
+{
+	return node->type == JUMP_GRAPH_CHAIN ? 1 : 0;
+}
+
+static int jg_height(struct jump_graph *graph, struct jg_node *node)
+{
+	unsigned int i;
+	int h;
+
+	if (node->height_mark == graph->walk)
+		return node->height;
+	node->height_mark = graph->walk;
+	node->height = 0;
+
+	for (i = 0; i < node->nout; i++) {
+		h = jg_level(node->out[i]) + jg_height(graph, node->out[i]);
+		if (h > node->height)
+			node->height = h;
+	}
+	return node->height;
+}
+
+static int jg_depth(struct jump_graph *graph, struct jg_node *node)
+{
+	unsigned int i;
+	int d;
+
+	if (node->depth_mark == graph->walk)
+		return node->depth;
+	node->depth_mark = graph->walk;
+
+	if (node->base) {
+		node->depth = 0;
+		return 0;
+	}
+
+	node->depth = -1;
+	for (i = 0; i < node->nin; i++) {
+		d = jg_depth(graph, node->in[i]);
+		if (d < 0)
+			continue;
+		if (d + jg_level(node) > node->depth)
+			node->depth = d + jg_level(node);
+	}
+	return node->depth;
+}
+
+struct jump_graph *jump_graph_alloc(struct nft_cache *cache)
+{
+	struct jump_graph *graph;
+
+	graph = xzalloc(sizeof(*graph));
+	init_list_head(&graph->tables);
+	graph->cache = cache;
+
+	return graph;
+}
+
+void jump_graph_free(struct jump_graph *graph)
+{
+	struct jg_table *table, *next;
+	struct hlist_node *n, *tmp;
+	struct jg_node *node;
+	unsigned int i;
+
+	if (graph == NULL)
+		return;
+
+	for (i = 0; i < JUMP_GRAPH_HSIZE; i++) {
+		hlist_for_each_safe(n, tmp, &graph->nodes[i]) {
+			node = hlist_entry(n, struct jg_node, hnode);
+			hlist_del(&node->hnode);
+			xfree(node->out);
+			xfree(node->in);
+			xfree(node->table);
+			xfree(node->name);
+			xfree(node);
+		}
+	}
+	list_for_each_entry_safe(table, next, &graph->tables, list) {
+		list_del(&table->list);
+		xfree(table->name);
+		xfree(table);
+	}
+	xfree(graph);
+}
+
+/*
+ * Stop checking the table of @h, or the whole ruleset if @h has no table.
+ * A table that is not loaded yet is not loaded anymore.
+ */
+void jump_graph_invalidate(struct jump_graph *graph, const struct handle *h)
+{
+	if (h->table == NULL) {
+		graph->stale = true;
+		return;
+	}
+	jg_table_get(graph, h->family, h->table)->stale = true;
+}
+
+/* The table of @h is loaded or stale, it is not loaded again. */
+bool jump_graph_is_loaded(const struct jump_graph *graph,
+			  const struct handle *h)
+{
+	return graph->stale || h->table == NULL ||
+	       jg_table_lookup(graph, h->family, h->table) != NULL;
+}
+
+/*
+ * Add edges from the chain or map @name to @targets. Returns -ELOOP if one
+ * of them leads back to @name, -EMLINK if it makes a path of as many jumps
+ * as the jump stack holds, like the kernel does. @bad is set to the
+ * offending target then and the graph is left unchanged.
+ */
+int jump_graph_add(struct jump_graph *graph, enum jump_graph_node_type type,
+		   const struct handle *h, const char *name,
+		   const struct jump_target *targets, unsigned int num,
+		   unsigned int *bad)
+{
+	struct jg_node *from, **to;
+	unsigned int i;
+	int depth, ret = 0;
+
+	if (num == 0 || !jg_table_usable(graph, h))
+		return 0;
+
+	from = jg_node_get(graph, type, h->family, h->table, name);
+	if (type == JUMP_GRAPH_CHAIN)
+		from->base = jg_chain_is_base(graph, h, name);
+	to = xmalloc_array(num, sizeof(*to));
+	for (i = 0; i < num; i++)
+		to[i] = jg_node_get(graph, targets[i].type, h->family,
+				    h->table, targets[i].name);
+
+	/* existing edges have been checked when they were added */
+	graph->walk++;
+	for (i = 0; i < from->nout; i++)
+		from->out[i]->edge_mark = graph->walk;
+
+	for (i = 0; i < num; i++) {
+		if (to[i]->edge_mark == graph->walk)
+			continue;
+		if (jg_reaches(graph, to[i], from)) {
+			ret = -ELOOP;
+			goto out;
+		}
+	}
+
+	/* no base chain leads here yet, the stack is checked once one does */
+	depth = jg_depth(graph, from);
+	for (i = 0; i < num && depth >= 0; i++) {
+		if (to[i]->edge_mark == graph->walk)
+			continue;
+		if (depth + jg_level(to[i]) + jg_height(graph, to[i]) >=
+		    JUMP_GRAPH_MAX_DEPTH) {
+			ret = -EMLINK;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < num; i++) {
+		if (to[i]->edge_mark == graph->walk)
+			continue;
+		to[i]->edge_mark = graph->walk;
+		jg_edge_add(from, to[i]);
+	}
+out:
+	*bad = i;
+	xfree(to);
+	return ret;
+}
+
+/*
+ * Remove the edges leaving @name, or leaving every node of type @type in
+ * the table of @h if @name is NULL.
+ */
+void jump_graph_flush(struct jump_graph *graph, enum jump_graph_node_type type,
+		      const struct handle *h, const char *name)
+{
+	struct hlist_node *n;
+	struct jg_node *node;
+	unsigned int i;
+
+	if (!jg_table_usable(graph, h))
+		return;
+
+	for (i = 0; i < JUMP_GRAPH_HSIZE; i++) {
+		hlist_for_each_entry(node, n, &graph->nodes[i], hnode) {
+			if (node->type == type &&
+			    jg_node_match(node, type, h, name))
+				jg_node_flush(node);
+		}
+	}
+}
+
+static void jg_delete_nodes(struct jump_graph *graph,
+			    enum jump_graph_node_type type,
+			    const struct handle *h, const char *name)
+{
+	struct hlist_node *n, *tmp;
+	struct jg_node *node;
+	unsigned int i;
+
+	for (i = 0; i < JUMP_GRAPH_HSIZE; i++) {
+		hlist_for_each_safe(n, tmp, &graph->nodes[i]) {
+			node = hlist_entry(n, struct jg_node, hnode);
+			if (!jg_node_match(node, type, h, name))
+				continue;
+			jg_node_free(node);
+		}
+	}
+}
+
+/*
+ * Remove the node @name, or every node in the table of @h if @name is
+ * NULL. A deleted table has no edges left, it does not need to be loaded
+ * anymore.
+ */
+void jump_graph_delete(struct jump_graph *graph, enum jump_graph_node_type type,
+		       const struct handle *h, const char *name)
+{
+	if (name != NULL) {
+		if (jg_table_usable(graph, h))
+			jg_delete_nodes(graph, type, h, name);
+		return;
+	}
+
+	if (graph->stale || h->table == NULL)
+		return;
+
+	jg_delete_nodes(graph, type, h, NULL);
+	jg_table_get(graph, h->family, h->table)->stale = false;
+}
+
+/*
+ * Remove every node of @family, of all families if NFPROTO_UNSPEC. The
+ * tables of the family are empty from now on, they are not loaded from
+ * the kernel anymore.
+ */
+void jump_graph_flush_ruleset(struct jump_graph *graph, uint32_t family)
+{
+	struct handle h = {
+		.family	= family,
+	};
+	struct jg_table *table;
+
+	jg_delete_nodes(graph, JUMP_GRAPH_CHAIN, &h, NULL);
+	list_for_each_entry(table, &graph->tables, list) {
+		if (family == NFPROTO_UNSPEC || table->family == family)
+			table->stale = false;
+	}
+
+	if (family == NFPROTO_UNSPEC) {
+		graph->flushed = ~0U;
+		graph->stale = false;
+	} else {
+		graph->flushed |= 1U << family;
+	}
+}
+
+struct jg_load {
+	struct jump_graph	*graph;
+	const struct handle	*h;
+	uint32_t		family;
+	const char		*table;
+	const char		*chain;
+};
+
+static void jg_load_edge(struct jg_load *load, enum jump_graph_node_type type,
+			 const char *name)
+{
+	struct jg_node *from, *to;
+
+	if (load->table == NULL || load->chain == NULL)
+		return;
+
+	from = jg_node_get(load->graph, JUMP_GRAPH_CHAIN, load->family,
+			   load->table, load->chain);
+	to = jg_node_get(load->graph, type, load->family, load->table, name);
+	jg_edge_add(from, to);
+}
+
+static void jg_parse_verdict(const struct nlattr *nest, struct jg_load *load)
+{
+	const struct nlattr *attr, *verdict;
+	const char *chain = NULL;
+	uint32_t code = 0;
+
+	mnl_attr_for_each_nested(verdict, nest) {
+		if (mnl_attr_get_type(verdict) != NFTA_DATA_VERDICT ||
+		    mnl_attr_validate(verdict, MNL_TYPE_NESTED) < 0)
+			continue;
+
+		mnl_attr_for_each_nested(attr, verdict) {
+			switch (mnl_attr_get_type(attr)) {
+			case NFTA_VERDICT_CODE:
+				if (mnl_attr_validate(attr, MNL_TYPE_U32) < 0)
+					break;
+				code = ntohl(mnl_attr_get_u32(attr));
+				break;
+			case NFTA_VERDICT_CHAIN:
+				if (mnl_attr_validate(attr, MNL_TYPE_NUL_STRING) < 0)
+					break;
+				chain = mnl_attr_get_str(attr);
+				break;
+			}
+		}
+	}
+
+	if (chain != NULL &&
+	    ((int)code == NFT_JUMP || (int)code == NFT_GOTO))
+		jg_load_edge(load, JUMP_GRAPH_CHAIN, chain);
+}
+
+static void jg_parse_expr(const struct nlattr *nest, struct jg_load *load)
+{
+	const struct nlattr *attr, *data = NULL, *value = NULL;
+	uint32_t dreg = NFT_REG_VERDICT + 1;
+	const char *name = NULL, *set = NULL;
+
+	mnl_attr_for_each_nested(attr, nest) {
+		switch (mnl_attr_get_type(attr)) {
+		case NFTA_EXPR_NAME:
+			if (mnl_attr_validate(attr, MNL_TYPE_NUL_STRING) < 0)
+				break;
+			name = mnl_attr_get_str(attr);
+			break;
+		case NFTA_EXPR_DATA:
+			if (mnl_attr_validate(attr, MNL_TYPE_NESTED) < 0)
+				break;
+			data = attr;
+			break;
+		}
+	}
+
+	if (name == NULL || data == NULL)
+		return;
+
+	if (!strcmp(name, "immediate")) {
+		mnl_attr_for_each_nested(attr, data) {
+			switch (mnl_attr_get_type(attr)) {
+			case NFTA_IMMEDIATE_DREG:
+				if (mnl_attr_validate(attr, MNL_TYPE_U32) < 0)
+					break;
+				dreg = ntohl(mnl_attr_get_u32(attr));
+				break;
+			case NFTA_IMMEDIATE_DATA:
+				if (mnl_attr_validate(attr, MNL_TYPE_NESTED) < 0)
+					break;
+				value = attr;
+				break;
+			}
+		}
+		if (dreg == NFT_REG_VERDICT && value != NULL)
+			jg_parse_verdict(value, load);
+	} else if (!strcmp(name, "lookup")) {
+		mnl_attr_for_each_nested(attr, data) {
+			switch (mnl_attr_get_type(attr)) {
+			case NFTA_LOOKUP_DREG:
+				if (mnl_attr_validate(attr, MNL_TYPE_U32) < 0)
+					break;
+				dreg = ntohl(mnl_attr_get_u32(attr));
+				break;
+			case NFTA_LOOKUP_SET:
+				if (mnl_attr_validate(attr, MNL_TYPE_NUL_STRING) < 0)
+					break;
+				set = mnl_attr_get_str(attr);
+				break;
+			}
+		}
+		if (dreg == NFT_REG_VERDICT && set != NULL)
+			jg_load_edge(load, JUMP_GRAPH_SET, set);
+	}
+}
+
+/* Only the immediate verdicts and the verdict map lookups are looked at. */
+static int jg_rule_cb(const struct nlmsghdr *nlh, void *data)
+{
+	const struct nfgenmsg *nfg = mnl_nlmsg_get_payload(nlh);
+	const struct nlattr *attr, *elem, *exprs = NULL;
+	struct jg_load *load = data;
+
+	load->family = nfg->nfgen_family;
+	load->table = NULL;
+	load->chain = NULL;
+
+	mnl_attr_for_each(attr, nlh, sizeof(struct nfgenmsg)) {
+		switch (mnl_attr_get_type(attr)) {
+		case NFTA_RULE_TABLE:
+			if (mnl_attr_validate(attr, MNL_TYPE_NUL_STRING) < 0)
+				break;
+			load->table = mnl_attr_get_str(attr);
+			break;
+		case NFTA_RULE_CHAIN:
+			if (mnl_attr_validate(attr, MNL_TYPE_NUL_STRING) < 0)
+				break;
+			load->chain = mnl_attr_get_str(attr);
+			break;
+		case NFTA_RULE_EXPRESSIONS:
+			if (mnl_attr_validate(attr, MNL_TYPE_NESTED) < 0)
+				break;
+			exprs = attr;
+			break;
+		}
+	}
+
+	/* the dump may not be filtered, see mnl_nft_rule_dump_cb() */
+	if (exprs == NULL || load->family != load->h->family ||
+	    load->table == NULL || strcmp(load->table, load->h->table))
+		return MNL_CB_OK;
+
+	mnl_attr_for_each_nested(elem, exprs) {
+		if (mnl_attr_get_type(elem) != NFTA_LIST_ELEM ||
+		    mnl_attr_validate(elem, MNL_TYPE_NESTED) < 0)
+			continue;
+		jg_parse_expr(elem, load);
+	}
+	return MNL_CB_OK;
+}
+
+static void jg_load_set(struct jump_graph *graph, const struct set *set)
+{
+	struct jg_node *from, *to;
+	const struct expr *elem;
+
+	if (!(set->flags & NFT_SET_MAP) ||
+	    set->datatype->type != TYPE_VERDICT || set->init == NULL)
+		return;
+
+	from = jg_node_get(graph, JUMP_GRAPH_SET, set->handle.family,
+			   set->handle.table, set->handle.set);
+	list_for_each_entry(elem, &set->init->expressions, list) {
+		if (elem->ops->type != EXPR_MAPPING ||
+		    elem->right->ops->type != EXPR_VERDICT ||
+		    elem->right->chain == NULL)
+			continue;
+
+		to = jg_node_get(graph, JUMP_GRAPH_CHAIN, set->handle.family,
+				 set->handle.table, elem->right->chain);
+		jg_edge_add(from, to);
+	}
+}
+
+/*
+ * Load the edges of the table of @h, unless it is loaded already: those
+ * of the verdict maps and the base chains come from the cache, which must
+ * be up to date, those of the chains from a dump of the rules of the
+ * table.
+ */
+int jump_graph_load(struct jump_graph *graph, struct netlink_ctx *ctx,
+		    const struct handle *h)
+{
+	struct jg_load load = {
+		.graph	= graph,
+		.h	= h,
+	};
+	const struct table *table;
+	const struct chain *chain;
+	const struct set *set;
+	struct jg_node *node;
+
+	if (jump_graph_is_loaded(graph, h))
+		return 0;
+
+	table = table_lookup(h, graph->cache);
+	if (table != NULL) {
+		list_for_each_entry(set, &table->sets, list)
+			jg_load_set(graph, set);
+		list_for_each_entry(chain, &table->chains, list) {
+			if (!(chain->flags & CHAIN_F_BASECHAIN))
+				continue;
+			node = jg_node_get(graph, JUMP_GRAPH_CHAIN, h->family,
+					   h->table, chain->handle.chain);
+			node->base = true;
+		}
+	}
+
+	if (!(graph->flushed & (1U << h->family)) &&
+	    mnl_nft_rule_dump_cb(ctx, h->family, h->table, NULL,
+				 jg_rule_cb, &load) < 0) {
+		/* start over from scratch on the next attempt */
+		jg_delete_nodes(graph, JUMP_GRAPH_CHAIN, h, NULL);
+		if (errno == EINTR)
+			return -1;
+
+		return netlink_io_error(ctx, NULL,
+					"Could not receive rules from kernel: %s",
+					strerror(errno));
+	}
+
+	jg_table_get(graph, h->family, h->table);
+	return 0;
+}
@@ -10,16 +10,38 @@
 #include <erec.h>
 #include <mnl.h>
 #include <parser.h>
+#include <include_cache.h>
 #include <utils.h>
 #include <iface.h>
+#include <stats.h>
+#include <rule_counters.h>
+#include <cmd_results.h>
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 
+static void nft_netlink_ctx_init(struct nft_ctx *nft, struct netlink_ctx *ctx,
+				 struct list_head *msgs,
+				 struct nft_sock *nf_sock,
+				 struct nftnl_batch *batch,
+				 bool batch_supported)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->msgs = msgs;
+	ctx->batch = batch;
+	ctx->batch_supported = batch_supported;
+	ctx->octx = &nft->output;
+	ctx->nf_sock = nf_sock;
+	ctx->cache = &nft->cache;
+	ctx->debug_mask = nft->debug_mask;
+	init_list_head(&ctx->list);
+}
+
 static int nft_netlink(struct nft_ctx *nft,
 		       struct parser_state *state, struct list_head *msgs,
-		       struct mnl_socket *nf_sock)
+		       struct nft_sock *nf_sock)
 {
 	uint32_t batch_seqnum, seqnum = 0;
 	struct nftnl_batch *batch;
@@ -28,22 +50,27 @@ static int nft_netlink(struct nft_ctx *nft,
 	struct mnl_err *err, *tmp;
 	LIST_HEAD(err_list);
 	bool batch_supported = netlink_batch_supported(nf_sock, &seqnum);
+	enum nft_stats_phase phase;
+	bool batch_built = false;
 	int ret = 0;
 
+	phase = stats_phase_enter(&nft->output, NFT_STATS_BATCH);
 	batch = mnl_batch_init();
 
+	/* echoed objects are printed against the cache, fetch it once */
+	if (nft->output.echo) {
+		ret = cache_update_tables(nf_sock, &nft->cache, &state->cmds,
+					  msgs, nft->debug_mask & NFT_DEBUG_NETLINK,
+					  &nft->output);
+		if (ret < 0)
+			goto out;
+	}
+
 	batch_seqnum = mnl_batch_begin(batch, mnl_seqnum_alloc(&seqnum));
 	list_for_each_entry(cmd, &state->cmds, list) {
-		memset(&ctx, 0, sizeof(ctx));
-		ctx.msgs = msgs;
+		nft_netlink_ctx_init(nft, &ctx, msgs, nf_sock, batch,
+				     batch_supported);
 		ctx.seqnum = cmd->seqnum = mnl_seqnum_alloc(&seqnum);
-		ctx.batch = batch;
-		ctx.batch_supported = batch_supported;
-		ctx.octx = &nft->output;
-		ctx.nf_sock = nf_sock;
-		ctx.cache = &nft->cache;
-		ctx.debug_mask = nft->debug_mask;
-		init_list_head(&ctx.list);
 		ret = do_command(&ctx, cmd);
 		if (ret < 0)
 			goto out;
@@ -51,10 +78,15 @@ static int nft_netlink(struct nft_ctx *nft,
 	if (!nft->check)
 		mnl_batch_end(batch, mnl_seqnum_alloc(&seqnum));
 
+	stats_phase_leave(&nft->output, phase);
+	batch_built = true;
+
 	if (!mnl_batch_ready(batch))
 		goto out;
 
 	ret = netlink_batch_send(&ctx, &err_list);
+	if (nft->output.results)
+		cmd_results_bind(nft->output.results, &state->cmds);
 
 	list_for_each_entry_safe(err, tmp, &err_list, head) {
 		list_for_each_entry(cmd, &state->cmds, list) {
@@ -72,38 +104,239 @@ static int nft_netlink(struct nft_ctx *nft,
 		}
 	}
 out:
+	if (!batch_built)
+		stats_phase_leave(&nft->output, phase);
 	mnl_batch_reset(batch);
 	return ret;
 }
 
-static int nft_run(struct nft_ctx *nft, struct mnl_socket *nf_sock,
+/**
+ * struct nft_stream - batch built while the input is parsed
+ *
+ * @nft:		context
+ * @nf_sock:		netlink socket
+ * @msgs:		error records
+ * @batch:		batch the commands are put in
+ * @batch_supported:	the kernel supports batches
+ * @seqnum:		last sequence number allocated
+ * @batch_seqnum:	sequence number of the batch begin message
+ * @locs:		locations of the commands in the batch, by sequence
+ *			number from @batch_seqnum + 1
+ * @num:		number of commands in the batch
+ * @size:		allocated size of @locs
+ * @ret:		a command could not be put in the batch
+ *
+ * Commands are put in the batch and released as soon as they are
+ * evaluated, only their location is kept to report errors from the kernel.
+ */
+struct nft_stream {
+	struct nft_ctx		*nft;
+	struct nft_sock		*nf_sock;
+	struct list_head	*msgs;
+	struct nftnl_batch	*batch;
+	bool			batch_supported;
+	uint32_t		seqnum;
+	uint32_t		batch_seqnum;
+	struct location		*locs;
+	unsigned int		num;
+	unsigned int		size;
+	int			ret;
+};
+
+static void nft_stream_init(struct nft_stream *stream, struct nft_ctx *nft,
+			    struct list_head *msgs, struct nft_sock *nf_sock)
+{
+	memset(stream, 0, sizeof(*stream));
+	stream->nft = nft;
+	stream->nf_sock = nf_sock;
+	stream->msgs = msgs;
+	stream->batch_supported = netlink_batch_supported(nf_sock,
+							  &stream->seqnum);
+	stream->batch = mnl_batch_init();
+	stream->batch_seqnum = mnl_batch_begin(stream->batch,
+				mnl_seqnum_alloc(&stream->seqnum));
+}
+
+static void nft_stream_free(struct nft_stream *stream)
+{
+	mnl_batch_reset(stream->batch);
+	xfree(stream->locs);
+}
+
+/* Rules of table blocks are not needed anymore once they are in the batch. */
+static void nft_stream_release_rules(struct table *table)
+{
+	struct rule *rule, *next;
+	struct chain *chain;
+
+	list_for_each_entry(chain, &table->chains, list) {
+		list_for_each_entry_safe(rule, next, &chain->rules, list) {
+			list_del(&rule->list);
+			rule_free(rule);
+		}
+	}
+}
+
+static void nft_stream_cmds(struct parser_state *state,
+			    struct list_head *cmds, void *data)
+{
+	struct nft_stream *stream = data;
+	struct nft_ctx *nft = stream->nft;
+	enum nft_stats_phase phase;
+	struct netlink_ctx ctx;
+	struct cmd *cmd, *next;
+
+	list_for_each_entry(cmd, cmds, list)
+		nft_cmd_expand(cmd);
+
+	/* after an error, nothing is sent, commands are only released */
+	phase = stats_phase_enter(&nft->output, NFT_STATS_BATCH);
+	list_for_each_entry(cmd, cmds, list) {
+		if (stream->ret < 0 || state->nerrs > 0)
+			break;
+
+		if (stream->num == stream->size) {
+			stream->size = stream->size ? stream->size * 2 : 1024;
+			stream->locs = xrealloc(stream->locs, stream->size *
+						sizeof(*stream->locs));
+		}
+		stream->locs[stream->num++] = cmd->location;
+
+		nft_netlink_ctx_init(nft, &ctx, stream->msgs, stream->nf_sock,
+				     stream->batch, stream->batch_supported);
+		ctx.seqnum = cmd->seqnum = mnl_seqnum_alloc(&stream->seqnum);
+		stream->ret = do_command(&ctx, cmd);
+	}
+	stats_phase_leave(&nft->output, phase);
+
+	list_for_each_entry_safe(cmd, next, cmds, list) {
+		if (cmd->obj == CMD_OBJ_TABLE && cmd->table != NULL)
+			nft_stream_release_rules(cmd->table);
+		list_del(&cmd->list);
+		cmd_free(cmd);
+	}
+
+	/* shared set literals would keep the elements of every rule */
+	eval_ctx_release_set_literals(&state->ectx);
+}
+
+static const struct location *nft_stream_loc(const struct nft_stream *stream,
+					     uint32_t seqnum)
+{
+	uint32_t idx = seqnum - stream->batch_seqnum - 1;
+
+	if (stream->num == 0)
+		return NULL;
+	/* errors with the batch itself are reported on the first command */
+	if (seqnum == stream->batch_seqnum)
+		idx = 0;
+	if (idx >= stream->num)
+		return NULL;
+
+	return &stream->locs[idx];
+}
+
+static int nft_stream_send(struct nft_stream *stream)
+{
+	struct nft_ctx *nft = stream->nft;
+	const struct location *loc;
+	struct mnl_err *err, *tmp;
+	struct netlink_ctx ctx;
+	LIST_HEAD(err_list);
+	int ret;
+
+	if (stream->ret < 0)
+		return stream->ret;
+	if (!nft->check)
+		mnl_batch_end(stream->batch, mnl_seqnum_alloc(&stream->seqnum));
+	if (!mnl_batch_ready(stream->batch))
+		return 0;
+
+	nft_netlink_ctx_init(nft, &ctx, stream->msgs, stream->nf_sock,
+			     stream->batch, stream->batch_supported);
+	ret = netlink_batch_send(&ctx, &err_list);
+	if (nft->output.results)
+		cmd_results_bind_locations(nft->output.results,
+					   stream->batch_seqnum + 1,
+					   stream->locs, stream->num);
+
+	list_for_each_entry_safe(err, tmp, &err_list, head) {
+		loc = nft_stream_loc(stream, err->seqnum);
+		if (loc != NULL)
+			netlink_io_error(&ctx, loc,
+					 "Could not process rule: %s",
+					 strerror(err->err));
+		errno = err->err;
+		mnl_err_list_free(err);
+	}
+	return ret;
+}
+
+static int nft_run(struct nft_ctx *nft, struct nft_sock *nf_sock,
 		   void *scanner, struct parser_state *state,
 		   struct list_head *msgs)
 {
+	/* echo fetches the cache for the tables of the whole batch first */
+	bool stream = nft->stream && !nft->output.echo;
+	struct nft_stream st;
+	enum nft_stats_phase phase;
 	struct cmd *cmd, *next;
 	int ret;
 
+	if (nft->output.results)
+		cmd_results_clear(nft->output.results);
+
+	if (stream) {
+		nft_stream_init(&st, nft, msgs, nf_sock);
+		state->cmd_cb = nft_stream_cmds;
+		state->cmd_data = &st;
+	}
+
+	phase = stats_phase_enter(&nft->output, NFT_STATS_PARSE);
 	ret = nft_parse(nft, scanner, state);
+	stats_phase_leave(&nft->output, phase);
+	scanner_restore_input(scanner);
 	if (ret != 0 || state->nerrs > 0) {
 		ret = -1;
 		goto err1;
 	}
+	include_cache_store(state);
+
+	if (stream) {
+		ret = nft_stream_send(&st);
+		goto err1;
+	}
 
 	list_for_each_entry(cmd, &state->cmds, list)
 		nft_cmd_expand(cmd);
 
 	ret = nft_netlink(nft, state, msgs, nf_sock);
 err1:
+	if (stream)
+		nft_stream_free(&st);
 	list_for_each_entry_safe(cmd, next, &state->cmds, list) {
 		list_del(&cmd->list);
 		cmd_free(cmd);
 	}
+	eval_ctx_release(&state->ectx);
 
 	return ret;
 }
 
+/*
+ * The symbol tables loaded by nft_init() are never modified afterwards, so
+ * they are shared by all contexts. They are set up by the first context and
+ * released along with the last one.
+ */
+static pthread_mutex_t nft_init_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int nft_init_refcnt;
+
 static void nft_init(void)
 {
+	pthread_mutex_lock(&nft_init_lock);
+	if (nft_init_refcnt++ > 0)
+		goto out;
+
 	mark_table_init();
 	realm_table_rt_init();
 	devgroup_table_init();
@@ -113,15 +346,23 @@ static void nft_init(void)
 #ifdef HAVE_LIBXTABLES
 	xt_init();
 #endif
+out:
+	pthread_mutex_unlock(&nft_init_lock);
 }
 
 static void nft_exit(void)
 {
+	pthread_mutex_lock(&nft_init_lock);
+	if (--nft_init_refcnt > 0)
+		goto out;
+
 	ct_label_table_exit();
 	realm_table_rt_exit();
 	devgroup_table_exit();
 	realm_table_meta_exit();
 	mark_table_exit();
+out:
+	pthread_mutex_unlock(&nft_init_lock);
 }
 
 int nft_ctx_add_include_path(struct nft_ctx *ctx, const char *path)
@@ -151,9 +392,27 @@ void nft_ctx_clear_include_paths(struct nft_ctx *ctx)
 	ctx->include_paths = NULL;
 }
 
+int nft_ctx_set_include_cache(struct nft_ctx *ctx, const char *dir)
+{
+	xfree(ctx->include_cache);
+	ctx->include_cache = NULL;
+
+	if (dir == NULL)
+		return 0;
+
+	ctx->include_cache = strdup(dir);
+	if (ctx->include_cache == NULL)
+		return -1;
+
+	return 0;
+}
+
 static void nft_ctx_netlink_init(struct nft_ctx *ctx)
 {
-	ctx->nf_sock = netlink_open_sock();
+	if (ctx->flags & NFT_CTX_NETLINK_MOCK)
+		ctx->nf_sock = netlink_open_mock_sock();
+	else
+		ctx->nf_sock = netlink_open_sock();
 }
 
 struct nft_ctx *nft_ctx_new(uint32_t flags)
@@ -169,7 +428,7 @@ struct nft_ctx *nft_ctx_new(uint32_t flags)
 	ctx->flags = flags;
 	ctx->output.output_fp = stdout;
 
-	if (flags == NFT_CTX_DEFAULT)
+	if (flags == NFT_CTX_DEFAULT || flags & NFT_CTX_NETLINK_MOCK)
 		nft_ctx_netlink_init(ctx);
 
 	return ctx;
@@ -182,7 +441,11 @@ void nft_ctx_free(struct nft_ctx *ctx)
 
 	iface_cache_release();
 	cache_release(&ctx->cache);
+	rule_counters_free(ctx->rule_counters);
 	nft_ctx_clear_include_paths(ctx);
+	xfree(ctx->include_cache);
+	xfree(ctx->output.stats);
+	cmd_results_free(ctx->output.results);
 	xfree(ctx);
 	nft_exit();
 }
@@ -199,6 +462,23 @@ FILE *nft_ctx_set_output(struct nft_ctx *ctx, FILE *fp)
 	return old;
 }
 
+bool nft_ctx_get_stream(struct nft_ctx *ctx)
+{
+	return ctx->stream;
+}
+
+/*
+ * Put commands in the batch as soon as they are parsed and release them,
+ * instead of parsing the whole input first. Memory use then depends on the
+ * size of the batch rather than on the number of commands. Commands that do
+ * not go in the batch, such as list, run as they are parsed. Ignored with
+ * echo, which needs all commands to fetch the cache beforehand.
+ */
+void nft_ctx_set_stream(struct nft_ctx *ctx, bool stream)
+{
+	ctx->stream = stream;
+}
+
 bool nft_ctx_get_dry_run(struct nft_ctx *ctx)
 {
 	return ctx->check;
@@ -269,6 +549,185 @@ void nft_ctx_output_set_echo(struct nft_ctx *ctx, bool val)
 	ctx->output.echo = val;
 }
 
+/*
+ * Report the tables, chains, rules, sets and stateful objects added by the
+ * commands, with the handles the kernel assigned, as the acknowledgments
+ * come in. Unlike echo, nothing is printed and no cache is needed. Pass a
+ * NULL callback to stop reporting.
+ */
+void nft_ctx_output_set_echo_cb(struct nft_ctx *ctx, nft_echo_cb_t cb,
+				void *data)
+{
+	ctx->output.echo_cb = cb;
+	ctx->output.echo_data = data;
+}
+
+bool nft_ctx_output_get_json(struct nft_ctx *ctx)
+{
+	return ctx->output.json;
+}
+
+void nft_ctx_output_set_json(struct nft_ctx *ctx, bool val)
+{
+	ctx->output.json = val;
+}
+
+bool nft_ctx_output_get_stats(struct nft_ctx *ctx)
+{
+	return ctx->output.stats != NULL;
+}
+
+void nft_ctx_output_set_stats(struct nft_ctx *ctx, bool val)
+{
+	if (val && !ctx->output.stats) {
+		ctx->output.stats = xzalloc(sizeof(struct nft_stats_ctx));
+	} else if (!val) {
+		xfree(ctx->output.stats);
+		ctx->output.stats = NULL;
+	}
+}
+
+int nft_ctx_get_stats(struct nft_ctx *ctx, struct nft_stats *stats)
+{
+	if (!ctx->output.stats) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	*stats = ctx->output.stats->stats;
+	return 0;
+}
+
+bool nft_ctx_output_get_results(struct nft_ctx *ctx)
+{
+	return ctx->output.results != NULL;
+}
+
+/*
+ * Collect the objects added by each command, along with the handles the
+ * kernel assigned to them. Results are read with nft_ctx_get_results().
+ */
+void nft_ctx_output_set_results(struct nft_ctx *ctx, bool val)
+{
+	if (val && !ctx->output.results) {
+		ctx->output.results = cmd_results_alloc();
+	} else if (!val) {
+		cmd_results_free(ctx->output.results);
+		ctx->output.results = NULL;
+	}
+}
+
+/*
+ * Return the number of objects added by the last run and point @results to
+ * them, in the order they were added. They remain valid until the next run.
+ */
+int nft_ctx_get_results(struct nft_ctx *ctx,
+			const struct nft_cmd_result **results)
+{
+	if (!ctx->output.results) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	*results = ctx->output.results->results;
+	return ctx->output.results->num;
+}
+
+/* Netlink context for the polling calls, which neither cache nor print. */
+static void nft_poll_ctx_init(struct nft_ctx *ctx, struct netlink_ctx *nlctx,
+			      struct list_head *msgs)
+{
+	memset(nlctx, 0, sizeof(*nlctx));
+	init_list_head(&nlctx->list);
+	nlctx->msgs = msgs;
+	nlctx->nf_sock = ctx->nf_sock;
+	nlctx->octx = &ctx->output;
+	nlctx->cache = &ctx->cache;
+	nlctx->debug_mask = ctx->debug_mask;
+	nlctx->seqnum = ctx->cache.seqnum++;
+}
+
+static void nft_poll_ctx_exit(struct list_head *msgs)
+{
+	struct error_record *erec, *next;
+
+	list_for_each_entry_safe(erec, next, msgs, list) {
+		list_del(&erec->list);
+		erec_destroy(erec);
+	}
+}
+
+/*
+ * Poll named counters and quotas with a single object dump. No cache is
+ * built and nothing is printed, errors are reported through errno.
+ */
+int nft_ctx_get_obj_stats(struct nft_ctx *ctx, uint32_t family,
+			  const char *table, uint32_t type, bool reset,
+			  struct nft_obj_stats *objs, unsigned int num)
+{
+	struct handle h = {
+		.family	= family,
+		.table	= table,
+	};
+	struct netlink_ctx nlctx;
+	LIST_HEAD(msgs);
+	int ret, err;
+
+	nft_poll_ctx_init(ctx, &nlctx, &msgs);
+
+	do {
+		ret = netlink_get_obj_stats(&nlctx, &h, type, reset, objs, num);
+		err = errno;
+		if (ret < 0 && err == EINTR)
+			netlink_restart(ctx->nf_sock);
+		/* an interrupted reset dump has already reset some objects */
+	} while (ret < 0 && err == EINTR && !reset);
+
+	nft_poll_ctx_exit(&msgs);
+
+	errno = err;
+	return ret;
+}
+
+/*
+ * Poll the anonymous counters of the rules with a single rule dump, along
+ * with their increase since the previous call on this context.
+ */
+int nft_ctx_get_rule_counters(struct nft_ctx *ctx, uint32_t family,
+			      const char *table, const char *chain,
+			      struct nft_rule_counter *rules, unsigned int num)
+{
+	struct handle h = {
+		.family	= family,
+		.table	= table,
+		.chain	= chain,
+	};
+	struct netlink_ctx nlctx;
+	LIST_HEAD(msgs);
+	int ret, err;
+
+	nft_poll_ctx_init(ctx, &nlctx, &msgs);
+
+	do {
+		ret = rule_counters_poll(&nlctx, &ctx->rule_counters, &h,
+					 rules, num);
+		err = errno;
+		if (ret < 0 && err == EINTR)
+			netlink_restart(ctx->nf_sock);
+	} while (ret < 0 && err == EINTR);
+
+	nft_poll_ctx_exit(&msgs);
+
+	errno = err;
+	return ret;
+}
+
+void nft_ctx_reset_stats(struct nft_ctx *ctx)
+{
+	if (ctx->output.stats)
+		memset(&ctx->output.stats->stats, 0, sizeof(struct nft_stats));
+}
+
 static const struct input_descriptor indesc_cmdline = {
 	.type	= INDESC_BUFFER,
 	.name	= "<cmdline>",
@@ -282,6 +741,7 @@ int nft_run_cmd_from_buffer(struct nft_ctx *nft, char *buf, size_t buflen)
 	void *scanner;
 	FILE *fp;
 
+	stats_run_begin(&nft->output);
 	parser_init(nft->nf_sock, &nft->cache, &state,
 		    &msgs, nft->debug_mask, &nft->output);
 	scanner = scanner_init(&state);
@@ -295,6 +755,7 @@ int nft_run_cmd_from_buffer(struct nft_ctx *nft, char *buf, size_t buflen)
 	nft_ctx_set_output(nft, fp);
 	scanner_destroy(scanner);
 	iface_cache_release();
+	stats_run_end(&nft->output);
 
 	return rc;
 }
@@ -307,10 +768,13 @@ int nft_run_cmd_from_filename(struct nft_ctx *nft, const char *filename)
 	int rc;
 	FILE *fp;
 
+	stats_run_begin(&nft->output);
 	rc = cache_update(nft->nf_sock, &nft->cache, CMD_INVALID, &msgs,
 			  nft->debug_mask, &nft->output);
-	if (rc < 0)
+	if (rc < 0) {
+		stats_run_end(&nft->output);
 		return -1;
+	}
 
 	parser_init(nft->nf_sock, &nft->cache, &state,
 		    &msgs, nft->debug_mask, &nft->output);
@@ -328,6 +792,7 @@ err:
 	nft_ctx_set_output(nft, fp);
 	scanner_destroy(scanner);
 	iface_cache_release();
+	stats_run_end(&nft->output);
 
 	return rc;
 }
@@ -37,10 +37,14 @@ enum opt_vals {
 	OPT_DEBUG		= 'd',
 	OPT_HANDLE_OUTPUT	= 'a',
 	OPT_ECHO		= 'e',
+	OPT_JSON		= 'j',
+	OPT_STATS		= 'S',
+	OPT_INCLUDE_CACHE	= 'C',
+	OPT_STREAM		= 'T',
 	OPT_INVALID		= '?',
 };
 
-#define OPTSTRING	"hvcf:iI:vnsNae"
+#define OPTSTRING	"hvcf:iI:vnsNaej"
 
 static const struct option options[] = {
 	{
@@ -94,6 +98,24 @@ static const struct option options[] = {
 		.name		= "echo",
 		.val		= OPT_ECHO,
 	},
+	{
+		.name		= "json",
+		.val		= OPT_JSON,
+	},
+	{
+		.name		= "stats",
+		.val		= OPT_STATS,
+		.has_arg	= 2,
+	},
+	{
+		.name		= "include-cache",
+		.val		= OPT_INCLUDE_CACHE,
+		.has_arg	= 1,
+	},
+	{
+		.name		= "stream",
+		.val		= OPT_STREAM,
+	},
 	{
 		.name		= NULL
 	}
@@ -119,8 +141,12 @@ static void show_help(const char *name)
 "  -N				Translate IP addresses to names.\n"
 "  -a, --handle			Output rule handle.\n"
 "  -e, --echo			Echo what has been added, inserted or replaced.\n"
+"  -j, --json			Format list output as JSON.\n"
 "  -I, --includepath <directory>	Add <directory> to the paths searched for include files. Default is: %s\n"
+"  --include-cache <directory>	Cache parsed include files in <directory>.\n"
+"  --stream			Send commands to the kernel batch as they are parsed, keeping memory use low on large files. Ignored with --echo.\n"
 "  --debug <level [,level...]>	Specify debugging level (scanner, parser, eval, netlink, mnl, proto-ctx, segtree, all)\n"
+"  --stats[=json]		Print per-phase timing, netlink message and memory statistics to stderr.\n"
 "\n",
 	name, DEFAULT_INCLUDE_PATH);
 }
@@ -168,6 +194,7 @@ int main(int argc, char * const *argv)
 	char *buf = NULL, *filename = NULL;
 	enum nft_numeric_level numeric;
 	bool interactive = false;
+	bool stats = false, stats_json = false;
 	unsigned int debug_mask;
 	unsigned int len;
 	int i, val, rc;
@@ -255,6 +282,30 @@ int main(int argc, char * const *argv)
 		case OPT_ECHO:
 			nft_ctx_output_set_echo(nft, true);
 			break;
+		case OPT_JSON:
+			nft_ctx_output_set_json(nft, true);
+			break;
+		case OPT_STATS:
+			if (optarg && strcmp(optarg, "json")) {
+				fprintf(stderr, "invalid stats format `%s'\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			stats = true;
+			stats_json = optarg != NULL;
+			nft_ctx_output_set_stats(nft, true);
+			break;
+		case OPT_INCLUDE_CACHE:
+			if (nft_ctx_set_include_cache(nft, optarg)) {
+				fprintf(stderr,
+					"Failed to set include cache '%s'\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case OPT_STREAM:
+			nft_ctx_set_stream(nft, true);
+			break;
 		case OPT_INVALID:
 			exit(EXIT_FAILURE);
 		}
@@ -275,15 +326,23 @@ int main(int argc, char * const *argv)
 	} else if (filename != NULL) {
 		rc = !!nft_run_cmd_from_filename(nft, filename);
 	} else if (interactive) {
+		rc = EXIT_SUCCESS;
 		if (cli_init(nft) < 0) {
 			fprintf(stderr, "%s: interactive CLI not supported in this build\n",
 				argv[0]);
-			exit(EXIT_FAILURE);
+			rc = EXIT_FAILURE;
 		}
-		return EXIT_SUCCESS;
 	} else {
 		fprintf(stderr, "%s: no command specified\n", argv[0]);
-		exit(EXIT_FAILURE);
+		rc = EXIT_FAILURE;
+	}
+
+	/* also printed if the commands failed, to see how far they got */
+	if (stats) {
+		struct nft_stats st;
+
+		if (nft_ctx_get_stats(nft, &st) == 0)
+			nft_stats_print(stderr, &st, stats_json);
 	}
 
 	xfree(buf);
@@ -448,6 +448,11 @@ static bool meta_key_is_qualified(enum nft_meta_keys key)
 	}
 }
 
+const char *meta_key_name(enum nft_meta_keys key)
+{
+	return meta_templates[key].token;
+}
+
 static void meta_expr_print(const struct expr *expr, struct output_ctx *octx)
 {
 	if (meta_key_is_qualified(expr->meta.key))
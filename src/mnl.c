@@ -23,12 +23,218 @@
 #include <linux/netfilter/nf_tables.h>
 
 #include <mnl.h>
+#include <mock.h>
 #include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <poll.h>
 #include <arpa/inet.h>
 #include <errno.h>
 #include <utils.h>
 #include <nftables.h>
+#include <stats.h>
+
+/*
+ * Sockets
+ *
+ * Messages either go to the kernel or to the in-process mock backend, which
+ * emulates nf_tables on top of an in-memory object store, see mock.c.
+ *
+ * The ruleset generation and the send buffer size are kept per socket,
+ * so that contexts in different threads or network namespaces do not
+ * step on each other.
+ */
+struct nft_sock {
+	struct mnl_socket	*nl;
+	struct mock_sock	*mock;
+	uint16_t		genid;
+	int			sndbuf;
+};
+
+struct nft_sock *nft_sock_open(void)
+{
+	struct nft_sock *sock;
+	struct mnl_socket *nl;
+
+	nl = mnl_socket_open(NETLINK_NETFILTER);
+	if (nl == NULL)
+		return NULL;
+
+	sock = xzalloc(sizeof(*sock));
+	sock->nl = nl;
+
+	return sock;
+}
+
+/* Sockets opened with a @peer share its ruleset. */
+struct nft_sock *nft_sock_open_mock(const struct nft_sock *peer)
+{
+	struct nft_sock *sock;
+	struct mock_sock *mock;
+
+	mock = mock_sock_open(peer ? peer->mock : NULL);
+	if (mock == NULL)
+		return NULL;
+
+	sock = xzalloc(sizeof(*sock));
+	sock->mock = mock;
+
+	return sock;
+}
+
+/*
+ * Open another socket that talks to the same backend as @sock. It is bound
+ * right away, replies are told apart by the port ID of their socket.
+ */
+struct nft_sock *nft_sock_open_peer(const struct nft_sock *sock)
+{
+	struct nft_sock *peer;
+
+	if (sock->mock)
+		return nft_sock_open_mock(sock);
+
+	peer = nft_sock_open();
+	if (peer == NULL)
+		return NULL;
+
+	if (mnl_socket_bind(peer->nl, 0, MNL_SOCKET_AUTOPID) < 0) {
+		nft_sock_close(peer);
+		return NULL;
+	}
+
+	return peer;
+}
+
+void nft_sock_close(struct nft_sock *sock)
+{
+	if (sock->mock)
+		mock_sock_close(sock->mock);
+	else
+		mnl_socket_close(sock->nl);
+	xfree(sock);
+}
+
+/* Replace the underlying socket, pending messages are dropped. */
+int nft_sock_reopen(struct nft_sock *sock)
+{
+	struct mnl_socket *nl;
+
+	if (sock->mock)
+		return 0;
+
+	nl = mnl_socket_open(NETLINK_NETFILTER);
+	if (nl == NULL)
+		return -1;
+
+	mnl_socket_close(sock->nl);
+	sock->nl = nl;
+	sock->sndbuf = 0;
+
+	return 0;
+}
+
+int nft_sock_fd(const struct nft_sock *sock)
+{
+	if (sock->mock)
+		return mock_sock_fd(sock->mock);
+
+	return mnl_socket_get_fd(sock->nl);
+}
+
+uint32_t nft_sock_portid(const struct nft_sock *sock)
+{
+	if (sock->mock)
+		return mock_sock_portid(sock->mock);
+
+	return mnl_socket_get_portid(sock->nl);
+}
+
+ssize_t nft_sock_sendto(struct nft_sock *sock, const void *buf, size_t len)
+{
+	if (sock->mock)
+		return mock_sock_send(sock->mock, buf, len);
+
+	return mnl_socket_sendto(sock->nl, buf, len);
+}
+
+ssize_t nft_sock_sendmsg(struct nft_sock *sock, const struct msghdr *msg)
+{
+	size_t i, len = 0;
+	ssize_t ret;
+	char *buf;
+
+	if (!sock->mock)
+		return sendmsg(mnl_socket_get_fd(sock->nl), msg, 0);
+
+	for (i = 0; i < msg->msg_iovlen; i++)
+		len += msg->msg_iov[i].iov_len;
+
+	buf = xmalloc(len);
+	for (i = 0, len = 0; i < msg->msg_iovlen; i++) {
+		memcpy(buf + len, msg->msg_iov[i].iov_base,
+		       msg->msg_iov[i].iov_len);
+		len += msg->msg_iov[i].iov_len;
+	}
+
+	ret = mock_sock_send(sock->mock, buf, len);
+	xfree(buf);
+
+	return ret;
+}
+
+ssize_t nft_sock_recvfrom(struct nft_sock *sock, void *buf, size_t len)
+{
+	if (sock->mock)
+		return mock_sock_recv(sock->mock, buf, len);
+
+	return mnl_socket_recvfrom(sock->nl, buf, len);
+}
+
+/*
+ * Receive up to @vlen datagrams without blocking, returns the number of
+ * datagrams received or -1 and EAGAIN if none is pending.
+ */
+int nft_sock_recvmmsg(struct nft_sock *sock, struct mmsghdr *msgs,
+		      unsigned int vlen)
+{
+	unsigned int i;
+	ssize_t ret;
+
+	if (!sock->mock)
+		return recvmmsg(mnl_socket_get_fd(sock->nl), msgs, vlen,
+				MSG_DONTWAIT, NULL);
+
+	for (i = 0; i < vlen; i++) {
+		ret = mock_sock_recv(sock->mock,
+				     msgs[i].msg_hdr.msg_iov[0].iov_base,
+				     msgs[i].msg_hdr.msg_iov[0].iov_len);
+		if (ret < 0)
+			break;
+		msgs[i].msg_len = ret;
+	}
+
+	return i > 0 ? (int)i : -1;
+}
+
+/*
+ * The mock backend has no socket buffers, only group membership is
+ * meaningful there.
+ */
+int nft_sock_setsockopt(struct nft_sock *sock, int level, int optname,
+			const void *val, socklen_t len)
+{
+	if (!sock->mock)
+		return setsockopt(mnl_socket_get_fd(sock->nl), level, optname,
+				  val, len);
+
+	if (level == SOL_NETLINK && optname == NETLINK_ADD_MEMBERSHIP)
+		return mock_sock_subscribe(sock->mock, *(const int *)val);
+
+	return 0;
+}
 
 uint32_t mnl_seqnum_alloc(unsigned int *seqnum)
 {
@@ -50,13 +256,14 @@ nft_mnl_recv(struct netlink_ctx *ctx, uint32_t portid,
 	char buf[NFT_NLMSG_MAXSIZE];
 	int ret;
 
-	ret = mnl_socket_recvfrom(ctx->nf_sock, buf, sizeof(buf));
+	ret = nft_sock_recvfrom(ctx->nf_sock, buf, sizeof(buf));
 	while (ret > 0) {
+		stats_msg_rx(ctx->octx, buf, ret);
 		ret = mnl_cb_run(buf, ret, ctx->seqnum, portid, cb, cb_data);
 		if (ret <= 0)
 			goto out;
 
-		ret = mnl_socket_recvfrom(ctx->nf_sock, buf, sizeof(buf));
+		ret = nft_sock_recvfrom(ctx->nf_sock, buf, sizeof(buf));
 	}
 out:
 	if (ret < 0 && errno == EAGAIN)
@@ -69,13 +276,14 @@ static int
 nft_mnl_talk(struct netlink_ctx *ctx, const void *data, unsigned int len,
 	     int (*cb)(const struct nlmsghdr *nlh, void *data), void *cb_data)
 {
-	uint32_t portid = mnl_socket_get_portid(ctx->nf_sock);
+	uint32_t portid = nft_sock_portid(ctx->nf_sock);
 
 	if (ctx->debug_mask & NFT_DEBUG_MNL)
 		mnl_nlmsg_fprintf(ctx->octx->output_fp, data, len,
 				  sizeof(struct nfgenmsg));
 
-	if (mnl_socket_sendto(ctx->nf_sock, data, len) < 0)
+	stats_msg_tx(ctx->octx, data, len);
+	if (nft_sock_sendto(ctx->nf_sock, data, len) < 0)
 		return -1;
 
 	return nft_mnl_recv(ctx, portid, cb, cb_data);
@@ -84,13 +292,12 @@ nft_mnl_talk(struct netlink_ctx *ctx, const void *data, unsigned int len,
 /*
  * Rule-set consistency check across several netlink dumps
  */
-static uint16_t nft_genid;
-
 static int genid_cb(const struct nlmsghdr *nlh, void *data)
 {
 	struct nfgenmsg *nfh = mnl_nlmsg_get_payload(nlh);
+	struct nft_sock *sock = data;
 
-	nft_genid = ntohs(nfh->res_id);
+	sock->genid = ntohs(nfh->res_id);
 
 	return MNL_CB_OK;
 }
@@ -102,22 +309,59 @@ uint16_t mnl_genid_get(struct netlink_ctx *ctx)
 
 	nlh = nftnl_nlmsg_build_hdr(buf, NFT_MSG_GETGEN, AF_UNSPEC, 0, ctx->seqnum);
 	/* Skip error checking, old kernels sets res_id field to zero. */
-	nft_mnl_talk(ctx, nlh, nlh->nlmsg_len, genid_cb, NULL);
+	nft_mnl_talk(ctx, nlh, nlh->nlmsg_len, genid_cb, ctx->nf_sock);
 
-	return nft_genid;
+	return ctx->nf_sock->genid;
 }
 
-static int check_genid(const struct nlmsghdr *nlh)
+static int check_genid(const struct nft_sock *sock, const struct nlmsghdr *nlh)
 {
 	struct nfgenmsg *nfh = mnl_nlmsg_get_payload(nlh);
 
-	if (nft_genid != ntohs(nfh->res_id)) {
+	if (sock->genid != ntohs(nfh->res_id)) {
 		errno = EINTR;
 		return -1;
 	}
 	return 0;
 }
 
+/**
+ * struct nft_mnl_dump - dump callback wrapper
+ *
+ * @sock:	socket holding the generation the dump must belong to
+ * @cb:		callback for each dumped object
+ * @data:	@cb data
+ */
+struct nft_mnl_dump {
+	const struct nft_sock	*sock;
+	int			(*cb)(const struct nlmsghdr *nlh, void *data);
+	void			*data;
+};
+
+static int nft_mnl_dump_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct nft_mnl_dump *dump = data;
+
+	if (check_genid(dump->sock, nlh) < 0)
+		return MNL_CB_ERROR;
+
+	return dump->cb(nlh, dump->data);
+}
+
+/* Like nft_mnl_talk(), bails out if the ruleset changed meanwhile. */
+static int
+nft_mnl_dump(struct netlink_ctx *ctx, const void *data, unsigned int len,
+	     int (*cb)(const struct nlmsghdr *nlh, void *data), void *cb_data)
+{
+	struct nft_mnl_dump dump = {
+		.sock	= ctx->nf_sock,
+		.cb	= cb,
+		.data	= cb_data,
+	};
+
+	return nft_mnl_talk(ctx, data, len, nft_mnl_dump_cb, &dump);
+}
+
 /*
  * Batching
  */
@@ -189,24 +433,22 @@ void mnl_err_list_free(struct mnl_err *err)
 	xfree(err);
 }
 
-static int nlbuffsiz;
-
-static void mnl_set_sndbuffer(const struct mnl_socket *nl,
+static void mnl_set_sndbuffer(struct nft_sock *nf_sock,
 			      struct nftnl_batch *batch)
 {
 	int newbuffsiz;
 
-	if (nftnl_batch_iovec_len(batch) * BATCH_PAGE_SIZE <= nlbuffsiz)
+	if (nftnl_batch_iovec_len(batch) * BATCH_PAGE_SIZE <= nf_sock->sndbuf)
 		return;
 
 	newbuffsiz = nftnl_batch_iovec_len(batch) * BATCH_PAGE_SIZE;
 
 	/* Rise sender buffer length to avoid hitting -EMSGSIZE */
-	if (setsockopt(mnl_socket_get_fd(nl), SOL_SOCKET, SO_SNDBUFFORCE,
-		       &newbuffsiz, sizeof(socklen_t)) < 0)
+	if (nft_sock_setsockopt(nf_sock, SOL_SOCKET, SO_SNDBUFFORCE,
+				&newbuffsiz, sizeof(socklen_t)) < 0)
 		return;
 
-	nlbuffsiz = newbuffsiz;
+	nf_sock->sndbuf = newbuffsiz;
 }
 
 static ssize_t mnl_nft_socket_sendmsg(const struct netlink_ctx *ctx)
@@ -222,7 +464,9 @@ static ssize_t mnl_nft_socket_sendmsg(const struct netlink_ctx *ctx)
 		.msg_iov	= iov,
 		.msg_iovlen	= iov_len,
 	};
+	enum nft_stats_phase phase;
 	uint32_t i;
+	ssize_t ret;
 
 	mnl_set_sndbuffer(ctx->nf_sock, ctx->batch);
 	nftnl_batch_iovec(ctx->batch, iov, iov_len);
@@ -233,42 +477,50 @@ static ssize_t mnl_nft_socket_sendmsg(const struct netlink_ctx *ctx)
 					  iov[i].iov_base, iov[i].iov_len,
 					  sizeof(struct nfgenmsg));
 		}
+		stats_msg_tx(ctx->octx, iov[i].iov_base, iov[i].iov_len);
 	}
 
-	return sendmsg(mnl_socket_get_fd(ctx->nf_sock), &msg, 0);
+	phase = stats_phase_enter(ctx->octx, NFT_STATS_SENDMSG);
+	ret = nft_sock_sendmsg(ctx->nf_sock, &msg);
+	stats_phase_leave(ctx->octx, phase);
+
+	return ret;
 }
 
 int mnl_batch_talk(struct netlink_ctx *ctx, struct list_head *err_list)
 {
-	struct mnl_socket *nl = ctx->nf_sock;
-	int ret, fd = mnl_socket_get_fd(nl), portid = mnl_socket_get_portid(nl);
+	struct nft_sock *nl = ctx->nf_sock;
+	int ret, fd = nft_sock_fd(nl), portid = nft_sock_portid(nl);
 	char rcv_buf[MNL_SOCKET_BUFFER_SIZE];
 	fd_set readfds;
 	struct timeval tv = {
 		.tv_sec		= 0,
 		.tv_usec	= 0
 	};
+	enum nft_stats_phase phase;
 	int err = 0;
 
 	ret = mnl_nft_socket_sendmsg(ctx);
 	if (ret == -1)
 		return -1;
 
+	phase = stats_phase_enter(ctx->octx, NFT_STATS_ACK);
 	FD_ZERO(&readfds);
 	FD_SET(fd, &readfds);
 
 	/* receive and digest all the acknowledgments from the kernel. */
 	ret = select(fd+1, &readfds, NULL, NULL, &tv);
 	if (ret == -1)
-		return -1;
+		goto err;
 
 	while (ret > 0 && FD_ISSET(fd, &readfds)) {
 		struct nlmsghdr *nlh = (struct nlmsghdr *)rcv_buf;
 
-		ret = mnl_socket_recvfrom(nl, rcv_buf, sizeof(rcv_buf));
+		ret = nft_sock_recvfrom(nl, rcv_buf, sizeof(rcv_buf));
 		if (ret == -1)
-			return -1;
+			goto err;
 
+		stats_msg_rx(ctx->octx, rcv_buf, ret);
 		ret = mnl_cb_run(rcv_buf, ret, 0, portid, &netlink_echo_callback, ctx);
 		/* Continue on error, make sure we get all acknowledgments */
 		if (ret == -1) {
@@ -278,12 +530,16 @@ int mnl_batch_talk(struct netlink_ctx *ctx, struct list_head *err_list)
 
 		ret = select(fd+1, &readfds, NULL, NULL, &tv);
 		if (ret == -1)
-			return -1;
+			goto err;
 
 		FD_ZERO(&readfds);
 		FD_SET(fd, &readfds);
 	}
+	stats_phase_leave(ctx->octx, phase);
 	return err;
+err:
+	stats_phase_leave(ctx->octx, phase);
+	return -1;
 }
 
 int mnl_nft_rule_batch_add(struct nftnl_rule *nlr, struct nftnl_batch *batch,
@@ -340,9 +596,6 @@ static int rule_cb(const struct nlmsghdr *nlh, void *data)
 	struct nftnl_rule_list *nlr_list = data;
 	struct nftnl_rule *r;
 
-	if (check_genid(nlh) < 0)
-		return MNL_CB_ERROR;
-
 	r = nftnl_rule_alloc();
 	if (r == NULL)
 		memory_allocation_error();
@@ -358,29 +611,54 @@ err_free:
 	return MNL_CB_OK;
 }
 
-struct nftnl_rule_list *mnl_nft_rule_dump(struct netlink_ctx *ctx,
-					  int family)
+/*
+ * Kernels that do not support filtering rule dumps by table and chain
+ * ignore these attributes and dump all rules of the family, so callers
+ * still have to filter the result.
+ */
+int mnl_nft_rule_dump_cb(struct netlink_ctx *ctx, int family,
+			 const char *table, const char *chain,
+			 int (*cb)(const struct nlmsghdr *nlh, void *data),
+			 void *data)
 {
 	char buf[MNL_SOCKET_BUFFER_SIZE];
-	struct nftnl_rule_list *nlr_list;
+	struct nftnl_rule *nlr;
 	struct nlmsghdr *nlh;
-	int ret;
+
+	nlh = nftnl_nlmsg_build_hdr(buf, NFT_MSG_GETRULE, family,
+				    NLM_F_DUMP, ctx->seqnum);
+	if (table != NULL) {
+		nlr = nftnl_rule_alloc();
+		if (nlr == NULL)
+			memory_allocation_error();
+
+		nftnl_rule_set_str(nlr, NFTNL_RULE_TABLE, table);
+		if (chain != NULL)
+			nftnl_rule_set_str(nlr, NFTNL_RULE_CHAIN, chain);
+		nftnl_rule_nlmsg_build_payload(nlh, nlr);
+		nftnl_rule_free(nlr);
+	}
+
+	return nft_mnl_dump(ctx, nlh, nlh->nlmsg_len, cb, data);
+}
+
+struct nftnl_rule_list *mnl_nft_rule_dump(struct netlink_ctx *ctx,
+					  int family, const char *table,
+					  const char *chain)
+{
+	struct nftnl_rule_list *nlr_list;
 
 	nlr_list = nftnl_rule_list_alloc();
 	if (nlr_list == NULL)
 		memory_allocation_error();
 
-	nlh = nftnl_nlmsg_build_hdr(buf, NFT_MSG_GETRULE, family,
-				    NLM_F_DUMP, ctx->seqnum);
-
-	ret = nft_mnl_talk(ctx, nlh, nlh->nlmsg_len, rule_cb, nlr_list);
-	if (ret < 0)
-		goto err;
+	if (mnl_nft_rule_dump_cb(ctx, family, table, chain, rule_cb,
+				 nlr_list) < 0) {
+		nftnl_rule_list_free(nlr_list);
+		return NULL;
+	}
 
 	return nlr_list;
-err:
-	nftnl_rule_list_free(nlr_list);
-	return NULL;
 }
 
 /*
@@ -450,9 +728,6 @@ static int chain_cb(const struct nlmsghdr *nlh, void *data)
 	struct nftnl_chain_list *nlc_list = data;
 	struct nftnl_chain *c;
 
-	if (check_genid(nlh) < 0)
-		return MNL_CB_ERROR;
-
 	c = nftnl_chain_alloc();
 	if (c == NULL)
 		memory_allocation_error();
@@ -483,7 +758,7 @@ struct nftnl_chain_list *mnl_nft_chain_dump(struct netlink_ctx *ctx,
 	nlh = nftnl_nlmsg_build_hdr(buf, NFT_MSG_GETCHAIN, family,
 				    NLM_F_DUMP, ctx->seqnum);
 
-	ret = nft_mnl_talk(ctx, nlh, nlh->nlmsg_len, chain_cb, nlc_list);
+	ret = nft_mnl_dump(ctx, nlh, nlh->nlmsg_len, chain_cb, nlc_list);
 	if (ret < 0)
 		goto err;
 
@@ -559,9 +834,6 @@ static int table_cb(const struct nlmsghdr *nlh, void *data)
 	struct nftnl_table_list *nlt_list = data;
 	struct nftnl_table *t;
 
-	if (check_genid(nlh) < 0)
-		return MNL_CB_ERROR;
-
 	t = nftnl_table_alloc();
 	if (t == NULL)
 		memory_allocation_error();
@@ -592,7 +864,7 @@ struct nftnl_table_list *mnl_nft_table_dump(struct netlink_ctx *ctx,
 	nlh = nftnl_nlmsg_build_hdr(buf, NFT_MSG_GETTABLE, family,
 				    NLM_F_DUMP, ctx->seqnum);
 
-	ret = nft_mnl_talk(ctx, nlh, nlh->nlmsg_len, table_cb, nlt_list);
+	ret = nft_mnl_dump(ctx, nlh, nlh->nlmsg_len, table_cb, nlt_list);
 	if (ret < 0)
 		goto err;
 
@@ -674,9 +946,6 @@ static int set_cb(const struct nlmsghdr *nlh, void *data)
 	struct nftnl_set_list *nls_list = data;
 	struct nftnl_set *s;
 
-	if (check_genid(nlh) < 0)
-		return MNL_CB_ERROR;
-
 	s = nftnl_set_alloc();
 	if (s == NULL)
 		memory_allocation_error();
@@ -716,7 +985,7 @@ mnl_nft_set_dump(struct netlink_ctx *ctx, int family, const char *table)
 	if (nls_list == NULL)
 		memory_allocation_error();
 
-	ret = nft_mnl_talk(ctx, nlh, nlh->nlmsg_len, set_cb, nls_list);
+	ret = nft_mnl_dump(ctx, nlh, nlh->nlmsg_len, set_cb, nls_list);
 	if (ret < 0)
 		goto err;
 
@@ -761,9 +1030,6 @@ static int obj_cb(const struct nlmsghdr *nlh, void *data)
 	struct nftnl_obj_list *nln_list = data;
 	struct nftnl_obj *n;
 
-	if (check_genid(nlh) < 0)
-		return MNL_CB_ERROR;
-
 	n = nftnl_obj_alloc();
 	if (n == NULL)
 		memory_allocation_error();
@@ -816,7 +1082,7 @@ mnl_nft_obj_dump(struct netlink_ctx *ctx, int family,
 	if (nln_list == NULL)
 		memory_allocation_error();
 
-	ret = nft_mnl_talk(ctx, nlh, nlh->nlmsg_len, obj_cb, nln_list);
+	ret = nft_mnl_dump(ctx, nlh, nlh->nlmsg_len, obj_cb, nln_list);
 	if (ret < 0)
 		goto err;
 
@@ -873,9 +1139,6 @@ int mnl_nft_setelem_delete(struct netlink_ctx *ctx, struct nftnl_set *nls,
 
 static int set_elem_cb(const struct nlmsghdr *nlh, void *data)
 {
-	if (check_genid(nlh) < 0)
-		return MNL_CB_ERROR;
-
 	nftnl_set_elems_nlmsg_parse(nlh, data);
 	return MNL_CB_OK;
 }
@@ -950,7 +1213,147 @@ int mnl_nft_setelem_get(struct netlink_ctx *ctx, struct nftnl_set *nls)
 				    NLM_F_DUMP|NLM_F_ACK, ctx->seqnum);
 	nftnl_set_nlmsg_build_payload(nlh, nls);
 
-	return nft_mnl_talk(ctx, nlh, nlh->nlmsg_len, set_elem_cb, nls);
+	return nft_mnl_dump(ctx, nlh, nlh->nlmsg_len, set_elem_cb, nls);
+}
+
+/*
+ * A netlink socket only runs one dump at a time, so independent set element
+ * dumps are spread over a small pool of sockets to keep several of them in
+ * flight instead of waiting for each round trip.
+ */
+#define NFT_DUMP_SOCKETS_MAX	8
+
+struct mnl_dump_sock {
+	struct nft_sock		*nl;
+	uint32_t		portid;
+	unsigned int		idx;
+	bool			busy;
+};
+
+static bool mnl_nft_setelem_dump_start(struct netlink_ctx *ctx,
+				       struct mnl_dump_sock *ds,
+				       struct nftnl_set *nls)
+{
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct nlmsghdr *nlh;
+
+	nlh = nftnl_nlmsg_build_hdr(buf, NFT_MSG_GETSETELEM,
+				    nftnl_set_get_u32(nls, NFTNL_SET_FAMILY),
+				    NLM_F_DUMP|NLM_F_ACK, ctx->seqnum);
+	nftnl_set_nlmsg_build_payload(nlh, nls);
+
+	if (ctx->debug_mask & NFT_DEBUG_MNL)
+		mnl_nlmsg_fprintf(ctx->octx->output_fp, nlh, nlh->nlmsg_len,
+				  sizeof(struct nfgenmsg));
+
+	stats_msg_tx(ctx->octx, nlh, nlh->nlmsg_len);
+	return nft_sock_sendto(ds->nl, nlh, nlh->nlmsg_len) >= 0;
+}
+
+/*
+ * Fetch the elements of @num sets. On return, @err[i] holds zero or the
+ * errno value of the failed dump for @nls[i].
+ */
+void mnl_nft_setelem_get_multi(struct netlink_ctx *ctx, struct nftnl_set **nls,
+			       int *err, unsigned int num)
+{
+	struct mnl_dump_sock socks[NFT_DUMP_SOCKETS_MAX];
+	struct pollfd fds[NFT_DUMP_SOCKETS_MAX];
+	unsigned int i, nsocks = 0, next = 0, busy = 0;
+	char buf[NFT_NLMSG_MAXSIZE];
+	int ret;
+
+	while (nsocks < num && nsocks < NFT_DUMP_SOCKETS_MAX) {
+		struct nft_sock *nl;
+
+		nl = nft_sock_open_peer(ctx->nf_sock);
+		if (nl == NULL)
+			break;
+		socks[nsocks].nl = nl;
+		socks[nsocks].portid = nft_sock_portid(nl);
+		socks[nsocks].busy = false;
+		fds[nsocks].fd = nft_sock_fd(nl);
+		fds[nsocks].events = POLLIN;
+		nsocks++;
+	}
+
+	/* No spare sockets, fall back to serial dumps on the main socket. */
+	if (nsocks == 0) {
+		for (i = 0; i < num; i++) {
+			ret = mnl_nft_setelem_get(ctx, nls[i]);
+			err[i] = ret < 0 ? errno : 0;
+		}
+		return;
+	}
+
+	do {
+		for (i = 0; i < nsocks; i++) {
+			struct mnl_dump_sock *ds = &socks[i];
+
+			while (!ds->busy && next < num) {
+				ds->idx = next++;
+				err[ds->idx] = 0;
+				if (mnl_nft_setelem_dump_start(ctx, ds,
+							       nls[ds->idx])) {
+					ds->busy = true;
+					busy++;
+				} else {
+					err[ds->idx] = errno;
+				}
+			}
+			fds[i].fd = ds->busy ? nft_sock_fd(ds->nl) : -1;
+			fds[i].revents = 0;
+		}
+
+		if (busy == 0)
+			break;
+
+		ret = poll(fds, nsocks, -1);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = errno;
+			for (i = 0; i < nsocks; i++) {
+				if (socks[i].busy)
+					err[socks[i].idx] = ret;
+			}
+			for (i = next; i < num; i++)
+				err[i] = ret;
+			break;
+		}
+
+		for (i = 0; i < nsocks; i++) {
+			struct mnl_dump_sock *ds = &socks[i];
+
+			if (!ds->busy || !(fds[i].revents & (POLLIN | POLLERR)))
+				continue;
+
+			ret = nft_sock_recvfrom(ds->nl, buf, sizeof(buf));
+			if (ret > 0) {
+				struct nft_mnl_dump dump = {
+					.sock	= ctx->nf_sock,
+					.cb	= set_elem_cb,
+					.data	= nls[ds->idx],
+				};
+
+				stats_msg_rx(ctx->octx, buf, ret);
+				ret = mnl_cb_run(buf, ret, ctx->seqnum,
+						 ds->portid, nft_mnl_dump_cb,
+						 &dump);
+			}
+			if (ret > 0)
+				continue;
+
+			/* This dump is over, either done or failed. */
+			if (ret < 0)
+				err[ds->idx] = errno;
+			ds->busy = false;
+			busy--;
+		}
+	} while (busy > 0 || next < num);
+
+	for (i = 0; i < nsocks; i++)
+		nft_sock_close(socks[i].nl);
 }
 
 /*
@@ -1001,7 +1404,7 @@ struct nftnl_ruleset *mnl_nft_ruleset_dump(struct netlink_ctx *ctx,
 
 	nftnl_ruleset_set(rs, NFTNL_RULESET_SETLIST, sl);
 
-	r = mnl_nft_rule_dump(ctx, family);
+	r = mnl_nft_rule_dump(ctx, family, NULL, NULL);
 	if (r == NULL)
 		goto err;
 
@@ -1018,61 +1421,269 @@ err:
  */
 #define NFTABLES_NLEVENT_BUFSIZ	(1 << 24)
 
-int mnl_nft_event_listener(struct mnl_socket *nf_sock, unsigned int debug_mask,
+/* Number of datagrams fetched per receive call. */
+#define NFTABLES_NLEVENT_BATCH		16
+
+/* Output is written once this many bytes are pending ... */
+#define NFTABLES_NLEVENT_FLUSH_BYTES	(1 << 16)
+/* ... or once the oldest pending output is this old, in milliseconds. */
+#define NFTABLES_NLEVENT_FLUSH_MSECS	100
+
+/* Interval of the event rate reports, in milliseconds. */
+#define NFTABLES_NLEVENT_RATE_MSECS	1000
+
+/**
+ * struct mnl_event_writer - buffered output of the event listener
+ *
+ * @octx:	output context, its stream is redirected to @mem
+ * @fp:		stream the output is eventually written to
+ * @mem:	memory stream collecting the output of decoded events
+ * @buf:	@mem buffer
+ * @size:	@mem buffer size
+ * @flushed:	time of the last flush, in milliseconds
+ * @reported:	time of the last rate report, in milliseconds
+ * @events:	events received since the last rate report
+ * @total:	events received
+ * @lost:	number of receive buffer overruns
+ * @report:	called on every rate report, with the elapsed milliseconds
+ * @report_data: @report callback data
+ */
+struct mnl_event_writer {
+	struct output_ctx	*octx;
+	FILE			*fp;
+	FILE			*mem;
+	char			*buf;
+	size_t			size;
+	uint64_t		flushed;
+	uint64_t		reported;
+	uint64_t		events;
+	uint64_t		total;
+	uint64_t		lost;
+	void			(*report)(void *data, uint64_t msecs);
+	void			*report_data;
+};
+
+static uint64_t mnl_event_msecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static void mnl_event_writer_init(struct mnl_event_writer *w,
+				  struct output_ctx *octx,
+				  void (*report)(void *data, uint64_t msecs),
+				  void *report_data)
+{
+	memset(w, 0, sizeof(*w));
+	w->octx = octx;
+	w->report = report;
+	w->report_data = report_data;
+	w->fp = octx->output_fp;
+	w->flushed = w->reported = mnl_event_msecs();
+
+	/* Without a memory stream, events are written as they come. */
+	w->mem = open_memstream(&w->buf, &w->size);
+	if (w->mem != NULL)
+		octx->output_fp = w->mem;
+}
+
+static off_t mnl_event_writer_pending(const struct mnl_event_writer *w)
+{
+	return w->mem ? ftello(w->mem) : 0;
+}
+
+static void mnl_event_writer_flush(struct mnl_event_writer *w)
+{
+	off_t len = mnl_event_writer_pending(w);
+
+	w->flushed = mnl_event_msecs();
+	if (len <= 0)
+		return;
+
+	fflush(w->mem);
+	fwrite(w->buf, 1, len, w->fp);
+	fflush(w->fp);
+	rewind(w->mem);
+}
+
+static void mnl_event_writer_report(struct mnl_event_writer *w, uint64_t now)
+{
+	uint64_t elapsed = now - w->reported;
+
+	if (elapsed == 0)
+		return;
+
+	if (w->report)
+		w->report(w->report_data, elapsed);
+
+	if (w->octx->stats)
+		fprintf(stderr, "# %llu events/s, %llu events, %llu overruns\n",
+			(unsigned long long)(w->events * 1000 / elapsed),
+			(unsigned long long)w->total,
+			(unsigned long long)w->lost);
+	w->events = 0;
+	w->reported = now;
+}
+
+/*
+ * Flush pending output and report the event rate when due. Returns the
+ * number of milliseconds until the next deadline, or -1 if there is none.
+ */
+static int mnl_event_writer_tick(struct mnl_event_writer *w)
+{
+	bool reports = w->octx->stats != NULL || w->report != NULL;
+	uint64_t now = mnl_event_msecs();
+	int timeout = -1;
+
+	/* the report may produce output, flush it right away */
+	if (reports && now - w->reported >= NFTABLES_NLEVENT_RATE_MSECS) {
+		mnl_event_writer_report(w, now);
+		mnl_event_writer_flush(w);
+	}
+
+	if (mnl_event_writer_pending(w) >= NFTABLES_NLEVENT_FLUSH_BYTES ||
+	    now - w->flushed >= NFTABLES_NLEVENT_FLUSH_MSECS)
+		mnl_event_writer_flush(w);
+	if (mnl_event_writer_pending(w) > 0)
+		timeout = w->flushed + NFTABLES_NLEVENT_FLUSH_MSECS - now;
+
+	if (!reports)
+		return timeout;
+
+	if (timeout < 0 ||
+	    w->reported + NFTABLES_NLEVENT_RATE_MSECS - now < (uint64_t)timeout)
+		timeout = w->reported + NFTABLES_NLEVENT_RATE_MSECS - now;
+
+	return timeout;
+}
+
+static void mnl_event_writer_fini(struct mnl_event_writer *w)
+{
+	if (w->mem == NULL)
+		return;
+
+	mnl_event_writer_flush(w);
+	w->octx->output_fp = w->fp;
+	fclose(w->mem);
+	free(w->buf);
+}
+
+/*
+ * Events are fetched in batches of datagrams, decoded into a memory stream
+ * and written out once enough output is pending or it gets too old, instead
+ * of flushing after every single event. If @report is set, it is called
+ * with @cb_data once per rate interval.
+ */
+int mnl_nft_event_listener(struct nft_sock *nf_sock, unsigned int debug_mask,
 			   struct output_ctx *octx,
 			   int (*cb)(const struct nlmsghdr *nlh, void *data),
-			   void *cb_data)
+			   void *cb_data,
+			   void (*report)(void *data, uint64_t msecs))
 {
 	/* Set netlink socket buffer size to 16 Mbytes to reduce chances of
  	 * message loss due to ENOBUFS.
 	 */
 	unsigned int bufsiz = NFTABLES_NLEVENT_BUFSIZ;
-	int fd = mnl_socket_get_fd(nf_sock);
-	char buf[NFT_NLMSG_MAXSIZE];
-	fd_set readfds;
-	int ret;
+	struct mmsghdr msgs[NFTABLES_NLEVENT_BATCH];
+	struct iovec iov[NFTABLES_NLEVENT_BATCH];
+	int fd = nft_sock_fd(nf_sock);
+	struct epoll_event ev = {
+		.events	= EPOLLIN,
+	};
+	struct mnl_event_writer w;
+	int epfd, ret, i, n, timeout;
+	char *buf;
 
-	ret = setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &bufsiz,
-			 sizeof(socklen_t));
+	ret = nft_sock_setsockopt(nf_sock, SOL_SOCKET, SO_RCVBUFFORCE, &bufsiz,
+				  sizeof(socklen_t));
 	if (ret < 0) {
 		/* If this doesn't work, try to reach the system wide maximum
 		 * (or whatever the user requested).
 		 */
-		ret = setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsiz,
-				 sizeof(socklen_t));
+		ret = nft_sock_setsockopt(nf_sock, SOL_SOCKET, SO_RCVBUF,
+					  &bufsiz, sizeof(socklen_t));
 		nft_print(octx, "# Cannot set up netlink socket buffer size to %u bytes, falling back to %u bytes\n",
 			  NFTABLES_NLEVENT_BUFSIZ, bufsiz);
 	}
 
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0)
+		return -1;
+
+	ev.data.fd = fd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		close(epfd);
+		return -1;
+	}
+
+	buf = xmalloc(NFTABLES_NLEVENT_BATCH * NFT_NLMSG_MAXSIZE);
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < NFTABLES_NLEVENT_BATCH; i++) {
+		iov[i].iov_base = buf + i * NFT_NLMSG_MAXSIZE;
+		iov[i].iov_len = NFT_NLMSG_MAXSIZE;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	mnl_event_writer_init(&w, octx, report, cb_data);
+	timeout = mnl_event_writer_tick(&w);
+
 	while (1) {
-		FD_ZERO(&readfds);
-		FD_SET(fd, &readfds);
+		ret = epoll_wait(epfd, &ev, 1, timeout);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
 
-		ret = select(fd + 1, &readfds, NULL, NULL, NULL);
-		if (ret < 0)
-			return -1;
-
-		if (FD_ISSET(fd, &readfds)) {
-			ret = mnl_socket_recvfrom(nf_sock, buf, sizeof(buf));
-			if (ret < 0) {
-				if (errno == ENOBUFS) {
-					nft_print(octx, "# ERROR: We lost some netlink events!\n");
-					continue;
-				}
-				nft_print(octx, "# ERROR: %s\n",
-					  strerror(errno));
-				break;
+		n = ret > 0 ? nft_sock_recvmmsg(nf_sock, msgs,
+						NFTABLES_NLEVENT_BATCH) : 0;
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EINTR) {
+				timeout = mnl_event_writer_tick(&w);
+				continue;
 			}
+			if (errno == ENOBUFS) {
+				w.lost++;
+				nft_print(octx, "# ERROR: We lost some netlink events!\n");
+				timeout = mnl_event_writer_tick(&w);
+				continue;
+			}
+			nft_print(octx, "# ERROR: %s\n", strerror(errno));
+			ret = -1;
+			break;
 		}
 
-		if (debug_mask & NFT_DEBUG_MNL) {
-			mnl_nlmsg_fprintf(octx->output_fp, buf, sizeof(buf),
-					  sizeof(struct nfgenmsg));
+		for (i = 0; i < n; i++) {
+			const struct nlmsghdr *nlh = iov[i].iov_base;
+			int len = msgs[i].msg_len;
+
+			stats_msg_rx(octx, nlh, len);
+			if (debug_mask & NFT_DEBUG_MNL) {
+				mnl_nlmsg_fprintf(octx->output_fp, nlh, len,
+						  sizeof(struct nfgenmsg));
+			}
+
+			for (; mnl_nlmsg_ok(nlh, len);
+			     nlh = mnl_nlmsg_next(nlh, &len)) {
+				w.events++;
+				w.total++;
+			}
+
+			ret = mnl_cb_run(iov[i].iov_base, msgs[i].msg_len, 0, 0,
+					 cb, cb_data);
+			if (ret <= 0)
+				goto out;
 		}
-		ret = mnl_cb_run(buf, ret, 0, 0, cb, cb_data);
-		if (ret <= 0)
-			break;
+		timeout = mnl_event_writer_tick(&w);
 	}
+out:
+	mnl_event_writer_fini(&w);
+	xfree(buf);
+	close(epfd);
+
 	return ret;
 }
 
@@ -1092,7 +1703,7 @@ static void nft_mnl_batch_put(char *buf, uint16_t type, uint32_t seqnum)
 	nfg->res_id = NFNL_SUBSYS_NFTABLES;
 }
 
-bool mnl_batch_supported(struct mnl_socket *nf_sock, uint32_t *seqnum)
+bool mnl_batch_supported(struct nft_sock *nf_sock, uint32_t *seqnum)
 {
 	struct mnl_nlmsg_batch *b;
 	char buf[MNL_SOCKET_BUFFER_SIZE];
@@ -1112,21 +1723,21 @@ bool mnl_batch_supported(struct mnl_socket *nf_sock, uint32_t *seqnum)
 			  mnl_seqnum_alloc(seqnum));
 	mnl_nlmsg_batch_next(b);
 
-	ret = mnl_socket_sendto(nf_sock, mnl_nlmsg_batch_head(b),
-				mnl_nlmsg_batch_size(b));
+	ret = nft_sock_sendto(nf_sock, mnl_nlmsg_batch_head(b),
+			      mnl_nlmsg_batch_size(b));
 	if (ret < 0)
 		goto err;
 
 	mnl_nlmsg_batch_stop(b);
 
-	ret = mnl_socket_recvfrom(nf_sock, buf, sizeof(buf));
+	ret = nft_sock_recvfrom(nf_sock, buf, sizeof(buf));
 	while (ret > 0) {
-		ret = mnl_cb_run(buf, ret, 0, mnl_socket_get_portid(nf_sock),
+		ret = mnl_cb_run(buf, ret, 0, nft_sock_portid(nf_sock),
 				 NULL, NULL);
 		if (ret <= 0)
 			break;
 
-		ret = mnl_socket_recvfrom(nf_sock, buf, sizeof(buf));
+		ret = nft_sock_recvfrom(nf_sock, buf, sizeof(buf));
 	}
 
 	/* We're sending an incomplete message to see if the kernel supports
@@ -0,0 +1,2461 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * In-process emulation of the nf_tables netlink interface.
+ *
+ * Messages sent to a mock socket are applied to an in-memory object store
+ * instead of the kernel. Batches are applied as transactions that are
+ * rolled back if any of their messages fails, dumps are answered from the
+ * store and events are delivered to the sockets subscribed to the
+ * NFNLGRP_NFTABLES group. Replies are queued on the socket and a per-socket
+ * eventfd is kept readable while the queue is not empty, so that callers
+ * can poll() on it as they would on the netlink socket.
+ *
+ * Only the subset of the interface that nft uses is implemented: rules are
+ * never evaluated, so counters stay at their initial values, and neither
+ * interval overlaps nor chain loops are detected.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/eventfd.h>
+#include <libmnl/libmnl.h>
+#include <libnftnl/common.h>
+#include <libnftnl/table.h>
+#include <libnftnl/chain.h>
+#include <libnftnl/rule.h>
+#include <libnftnl/expr.h>
+#include <libnftnl/set.h>
+#include <libnftnl/object.h>
+
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nf_tables.h>
+
+#include <list.h>
+#include <mock.h>
+#include <utils.h>
+
+#define MOCK_NLMSG_MAXSIZE	(UINT16_MAX + getpagesize())
+#define MOCK_ELEMS_CHUNK	1024
+#define MOCK_HASH_MIN		64
+
+struct mock_store {
+	unsigned int		refcnt;
+	uint32_t		genid;
+	uint32_t		portid;
+	struct list_head	socks;
+	struct list_head	tables;
+};
+
+struct mock_dgram {
+	struct list_head	list;
+	size_t			len;
+	size_t			size;
+	char			data[];
+};
+
+struct mock_sock {
+	struct list_head	list;
+	struct mock_store	*store;
+	uint32_t		portid;
+	uint32_t		groups;
+	int			fd;
+	struct list_head	rxq;
+};
+
+struct mock_table {
+	struct list_head	list;
+	struct nftnl_table	*nlt;
+	uint32_t		family;
+	uint64_t		hgenerator;
+	unsigned int		anon_idx;
+	struct list_head	chains;
+	struct list_head	sets;
+	struct list_head	objs;
+};
+
+struct mock_chain {
+	struct list_head	list;
+	struct mock_table	*table;
+	struct nftnl_chain	*nlc;
+	struct list_head	rules;
+};
+
+struct mock_rule {
+	struct list_head	list;
+	struct mock_chain	*chain;
+	struct nftnl_rule	*nlr;
+};
+
+struct mock_set {
+	struct list_head	list;
+	struct mock_table	*table;
+	struct nftnl_set	*nls;
+	uint32_t		id;
+	uint32_t		genid;
+	struct list_head	elems;
+	struct hlist_head	*hash;
+	unsigned int		hsize;
+	unsigned int		nelems;
+};
+
+struct mock_elem {
+	struct list_head	list;
+	struct hlist_node	hnode;
+	struct mock_set		*set;
+	uint32_t		hash;
+	uint32_t		flags;
+	bool			has_verdict;
+	int32_t			verdict;
+	char			*chain;
+	char			*objref;
+	uint64_t		timeout;
+	void			*udata;
+	uint32_t		udata_len;
+	uint32_t		key_len;
+	uint32_t		data_len;
+	uint8_t			buf[];
+};
+
+struct mock_obj {
+	struct list_head	list;
+	struct mock_table	*table;
+	struct nftnl_obj	*nlo;
+};
+
+enum mock_obj_type {
+	MOCK_TABLE,
+	MOCK_CHAIN,
+	MOCK_RULE,
+	MOCK_SET,
+	MOCK_ELEM,
+	MOCK_OBJ,
+};
+
+enum mock_undo_op {
+	MOCK_UNDO_ADD,
+	MOCK_UNDO_DEL,
+	MOCK_UNDO_RENAME,
+};
+
+/**
+ * struct mock_undo - transaction log entry
+ *
+ * @list:	list node, most recent entry first
+ * @op:	operation to be undone on abort
+ * @type:	object type
+ * @obj:	object
+ * @pos:	list node the object was linked after before deletion
+ * @name:	chain name before renaming
+ */
+struct mock_undo {
+	struct list_head	list;
+	enum mock_undo_op	op;
+	enum mock_obj_type	type;
+	void			*obj;
+	struct list_head	*pos;
+	char			*name;
+};
+
+struct mock_event {
+	struct list_head	list;
+	bool			echo;
+	struct nlmsghdr		nlh[];
+};
+
+struct mock_trans {
+	struct mock_sock	*sock;
+	struct list_head	undo;
+	struct list_head	events;
+	bool			failed;
+};
+
+/*
+ * Receive queue
+ */
+
+static struct mock_dgram *mock_sock_queue(struct mock_sock *sock,
+					  struct mock_dgram *dgram,
+					  const struct nlmsghdr *nlh)
+{
+	size_t len = MNL_ALIGN(nlh->nlmsg_len);
+
+	if (dgram == NULL || dgram->len + len > dgram->size) {
+		size_t size = MNL_SOCKET_BUFFER_SIZE;
+
+		if (len > size)
+			size = len;
+
+		dgram = xmalloc(sizeof(*dgram) + size);
+		dgram->len = 0;
+		dgram->size = size;
+
+		if (list_empty(&sock->rxq)) {
+			uint64_t one = 1;
+
+			if (write(sock->fd, &one, sizeof(one)) < 0)
+				BUG("cannot signal mock socket: %s\n",
+				    strerror(errno));
+		}
+		list_add_tail(&dgram->list, &sock->rxq);
+	}
+
+	memcpy(dgram->data + dgram->len, nlh, nlh->nlmsg_len);
+	memset(dgram->data + dgram->len + nlh->nlmsg_len, 0,
+	       len - nlh->nlmsg_len);
+	dgram->len += len;
+
+	return dgram;
+}
+
+static void mock_sock_flush(struct mock_sock *sock)
+{
+	struct mock_dgram *dgram, *next;
+
+	list_for_each_entry_safe(dgram, next, &sock->rxq, list) {
+		list_del(&dgram->list);
+		xfree(dgram);
+	}
+}
+
+static void mock_msg_finish(struct nlmsghdr *nlh, uint32_t portid,
+			    uint32_t genid)
+{
+	struct nfgenmsg *nfg = mnl_nlmsg_get_payload(nlh);
+
+	nlh->nlmsg_pid = portid;
+	nfg->res_id = htons(genid & 0xffff);
+}
+
+static void mock_ack(struct mock_sock *sock, const struct nlmsghdr *req,
+		     int err)
+{
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct nlmsghdr *nlh;
+	struct nlmsgerr *nlerr;
+
+	nlh = mnl_nlmsg_put_header(buf);
+	nlh->nlmsg_type = NLMSG_ERROR;
+	nlh->nlmsg_seq = req->nlmsg_seq;
+	nlh->nlmsg_pid = sock->portid;
+
+	nlerr = mnl_nlmsg_put_extra_header(nlh, sizeof(*nlerr));
+	nlerr->error = -err;
+	nlerr->msg = *req;
+
+	mock_sock_queue(sock, NULL, nlh);
+}
+
+static uint32_t mock_msg_family(const struct nlmsghdr *nlh)
+{
+	const struct nfgenmsg *nfg = mnl_nlmsg_get_payload(nlh);
+
+	return nfg->nfgen_family;
+}
+
+static bool mock_family_match(uint32_t family, uint32_t filter)
+{
+	return filter == NFPROTO_UNSPEC || family == filter;
+}
+
+static bool mock_str_match(const char *str, const char *filter)
+{
+	return filter == NULL || !strcmp(str, filter);
+}
+
+/*
+ * Object store
+ */
+
+static const char *mock_table_name(const struct mock_table *table)
+{
+	return nftnl_table_get_str(table->nlt, NFTNL_TABLE_NAME);
+}
+
+static const char *mock_chain_name(const struct mock_chain *chain)
+{
+	return nftnl_chain_get_str(chain->nlc, NFTNL_CHAIN_NAME);
+}
+
+static const char *mock_set_name(const struct mock_set *set)
+{
+	return nftnl_set_get_str(set->nls, NFTNL_SET_NAME);
+}
+
+static const char *mock_obj_name(const struct mock_obj *obj)
+{
+	return nftnl_obj_get_str(obj->nlo, NFTNL_OBJ_NAME);
+}
+
+static struct mock_table *mock_table_lookup(const struct mock_store *store,
+					    uint32_t family, const char *name)
+{
+	struct mock_table *table;
+
+	if (name == NULL)
+		return NULL;
+
+	list_for_each_entry(table, &store->tables, list) {
+		if (table->family == family &&
+		    !strcmp(mock_table_name(table), name))
+			return table;
+	}
+	return NULL;
+}
+
+static struct mock_chain *mock_chain_lookup(const struct mock_table *table,
+					    const char *name)
+{
+	struct mock_chain *chain;
+
+	if (name == NULL)
+		return NULL;
+
+	list_for_each_entry(chain, &table->chains, list) {
+		if (!strcmp(mock_chain_name(chain), name))
+			return chain;
+	}
+	return NULL;
+}
+
+static struct mock_chain *
+mock_chain_lookup_handle(const struct mock_table *table, uint64_t handle)
+{
+	struct mock_chain *chain;
+
+	list_for_each_entry(chain, &table->chains, list) {
+		if (nftnl_chain_get_u64(chain->nlc, NFTNL_CHAIN_HANDLE) == handle)
+			return chain;
+	}
+	return NULL;
+}
+
+static struct mock_rule *mock_rule_lookup(const struct mock_chain *chain,
+					  uint64_t handle)
+{
+	struct mock_rule *rule;
+
+	list_for_each_entry(rule, &chain->rules, list) {
+		if (nftnl_rule_get_u64(rule->nlr, NFTNL_RULE_HANDLE) == handle)
+			return rule;
+	}
+	return NULL;
+}
+
+static struct mock_set *mock_set_lookup(const struct mock_table *table,
+					const char *name)
+{
+	struct mock_set *set;
+
+	if (name == NULL)
+		return NULL;
+
+	list_for_each_entry(set, &table->sets, list) {
+		if (!strcmp(mock_set_name(set), name))
+			return set;
+	}
+	return NULL;
+}
+
+/* Set IDs only refer to sets added by the transaction being applied. */
+static struct mock_set *mock_set_lookup_id(const struct mock_store *store,
+					   const struct mock_table *table,
+					   uint32_t id)
+{
+	struct mock_set *set;
+
+	list_for_each_entry_reverse(set, &table->sets, list) {
+		if (set->genid == store->genid + 1 && set->id == id)
+			return set;
+	}
+	return NULL;
+}
+
+static struct mock_obj *mock_obj_lookup(const struct mock_table *table,
+					uint32_t type, const char *name)
+{
+	struct mock_obj *obj;
+
+	if (name == NULL)
+		return NULL;
+
+	list_for_each_entry(obj, &table->objs, list) {
+		if (nftnl_obj_get_u32(obj->nlo, NFTNL_OBJ_TYPE) == type &&
+		    !strcmp(mock_obj_name(obj), name))
+			return obj;
+	}
+	return NULL;
+}
+
+static void mock_elem_free(struct mock_elem *elem)
+{
+	xfree(elem->chain);
+	xfree(elem->objref);
+	xfree(elem->udata);
+	xfree(elem);
+}
+
+static void mock_set_free(struct mock_set *set)
+{
+	struct mock_elem *elem, *next;
+
+	list_for_each_entry_safe(elem, next, &set->elems, list)
+		mock_elem_free(elem);
+	nftnl_set_free(set->nls);
+	xfree(set->hash);
+	xfree(set);
+}
+
+static void mock_rule_free(struct mock_rule *rule)
+{
+	nftnl_rule_free(rule->nlr);
+	xfree(rule);
+}
+
+static void mock_chain_free(struct mock_chain *chain)
+{
+	struct mock_rule *rule, *next;
+
+	list_for_each_entry_safe(rule, next, &chain->rules, list)
+		mock_rule_free(rule);
+	nftnl_chain_free(chain->nlc);
+	xfree(chain);
+}
+
+static void mock_obj_free(struct mock_obj *obj)
+{
+	nftnl_obj_free(obj->nlo);
+	xfree(obj);
+}
+
+static void mock_table_free(struct mock_table *table)
+{
+	struct mock_chain *chain, *cnext;
+	struct mock_set *set, *snext;
+	struct mock_obj *obj, *onext;
+
+	list_for_each_entry_safe(chain, cnext, &table->chains, list)
+		mock_chain_free(chain);
+	list_for_each_entry_safe(set, snext, &table->sets, list)
+		mock_set_free(set);
+	list_for_each_entry_safe(obj, onext, &table->objs, list)
+		mock_obj_free(obj);
+	nftnl_table_free(table->nlt);
+	xfree(table);
+}
+
+/*
+ * Set elements are matched by key and interval end flag, a hash table keeps
+ * this fast for large sets.
+ */
+static uint32_t mock_elem_hash(const struct mock_elem *elem)
+{
+	uint32_t i, hash = 2166136261U;
+
+	for (i = 0; i < elem->key_len; i++)
+		hash = (hash ^ elem->buf[i]) * 16777619U;
+
+	return hash ^ (elem->flags & NFT_SET_ELEM_INTERVAL_END);
+}
+
+static bool mock_elem_cmp(const struct mock_elem *a, const struct mock_elem *b)
+{
+	return a->hash == b->hash &&
+	       a->key_len == b->key_len &&
+	       (a->flags & NFT_SET_ELEM_INTERVAL_END) ==
+	       (b->flags & NFT_SET_ELEM_INTERVAL_END) &&
+	       !memcmp(a->buf, b->buf, a->key_len);
+}
+
+static struct mock_elem *mock_elem_lookup(const struct mock_set *set,
+					  const struct mock_elem *key)
+{
+	struct hlist_node *node;
+	struct mock_elem *elem;
+
+	if (set->hsize == 0)
+		return NULL;
+
+	hlist_for_each_entry(elem, node, &set->hash[key->hash & (set->hsize - 1)],
+			     hnode) {
+		if (mock_elem_cmp(elem, key))
+			return elem;
+	}
+	return NULL;
+}
+
+static void mock_set_hash_resize(struct mock_set *set)
+{
+	struct mock_elem *elem;
+	unsigned int size;
+
+	size = set->hsize ? set->hsize * 2 : MOCK_HASH_MIN;
+	xfree(set->hash);
+	set->hash = xzalloc(size * sizeof(set->hash[0]));
+	set->hsize = size;
+
+	list_for_each_entry(elem, &set->elems, list)
+		hlist_add_head(&elem->hnode,
+			       &set->hash[elem->hash & (size - 1)]);
+}
+
+static struct list_head *mock_obj_node(enum mock_obj_type type, void *obj)
+{
+	switch (type) {
+	case MOCK_TABLE:
+		return &((struct mock_table *)obj)->list;
+	case MOCK_CHAIN:
+		return &((struct mock_chain *)obj)->list;
+	case MOCK_RULE:
+		return &((struct mock_rule *)obj)->list;
+	case MOCK_SET:
+		return &((struct mock_set *)obj)->list;
+	case MOCK_ELEM:
+		return &((struct mock_elem *)obj)->list;
+	case MOCK_OBJ:
+		return &((struct mock_obj *)obj)->list;
+	}
+	BUG("unknown mock object type %u\n", type);
+	return NULL;
+}
+
+static void mock_obj_link(enum mock_obj_type type, void *obj,
+			  struct list_head *pos)
+{
+	struct mock_elem *elem = obj;
+	struct mock_set *set;
+
+	list_add(mock_obj_node(type, obj), pos);
+	if (type != MOCK_ELEM)
+		return;
+
+	set = elem->set;
+	if (++set->nelems > set->hsize)
+		mock_set_hash_resize(set);
+	else
+		hlist_add_head(&elem->hnode,
+			       &set->hash[elem->hash & (set->hsize - 1)]);
+}
+
+static void mock_obj_unlink(enum mock_obj_type type, void *obj)
+{
+	struct mock_elem *elem = obj;
+
+	list_del(mock_obj_node(type, obj));
+	if (type != MOCK_ELEM)
+		return;
+
+	hlist_del(&elem->hnode);
+	elem->set->nelems--;
+}
+
+static void mock_obj_destroy(enum mock_obj_type type, void *obj)
+{
+	switch (type) {
+	case MOCK_TABLE:
+		mock_table_free(obj);
+		break;
+	case MOCK_CHAIN:
+		mock_chain_free(obj);
+		break;
+	case MOCK_RULE:
+		mock_rule_free(obj);
+		break;
+	case MOCK_SET:
+		mock_set_free(obj);
+		break;
+	case MOCK_ELEM:
+		mock_elem_free(obj);
+		break;
+	case MOCK_OBJ:
+		mock_obj_free(obj);
+		break;
+	}
+}
+
+/*
+ * Transactions
+ */
+
+static struct mock_undo *mock_undo_alloc(struct mock_trans *trans,
+					 enum mock_undo_op op,
+					 enum mock_obj_type type, void *obj)
+{
+	struct mock_undo *undo;
+
+	undo = xzalloc(sizeof(*undo));
+	undo->op = op;
+	undo->type = type;
+	undo->obj = obj;
+	list_add(&undo->list, &trans->undo);
+
+	return undo;
+}
+
+/* Link @obj after @pos, it is released again if the transaction aborts. */
+static void mock_trans_add(struct mock_trans *trans, enum mock_obj_type type,
+			   void *obj, struct list_head *pos)
+{
+	mock_obj_link(type, obj, pos);
+	mock_undo_alloc(trans, MOCK_UNDO_ADD, type, obj);
+}
+
+/* Unlink @obj, it is released once the transaction commits. */
+static void mock_trans_del(struct mock_trans *trans, enum mock_obj_type type,
+			   void *obj)
+{
+	struct mock_undo *undo;
+
+	undo = mock_undo_alloc(trans, MOCK_UNDO_DEL, type, obj);
+	undo->pos = mock_obj_node(type, obj)->prev;
+	mock_obj_unlink(type, obj);
+}
+
+static void mock_trans_rename(struct mock_trans *trans,
+			      struct mock_chain *chain, const char *name)
+{
+	struct mock_undo *undo;
+
+	undo = mock_undo_alloc(trans, MOCK_UNDO_RENAME, MOCK_CHAIN, chain);
+	undo->name = xstrdup(mock_chain_name(chain));
+	nftnl_chain_set_str(chain->nlc, NFTNL_CHAIN_NAME, name);
+}
+
+static void mock_trans_event(struct mock_trans *trans,
+			     const struct nlmsghdr *nlh, bool echo)
+{
+	struct mock_event *ev;
+
+	ev = xmalloc(sizeof(*ev) + nlh->nlmsg_len);
+	memcpy(ev->nlh, nlh, nlh->nlmsg_len);
+	ev->echo = echo;
+	list_add_tail(&ev->list, &trans->events);
+}
+
+static void mock_trans_init(struct mock_trans *trans, struct mock_sock *sock)
+{
+	trans->sock = sock;
+	trans->failed = false;
+	init_list_head(&trans->undo);
+	init_list_head(&trans->events);
+}
+
+static void mock_trans_notify(struct mock_trans *trans)
+{
+	struct mock_store *store = trans->sock->store;
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct mock_event *ev, *next;
+	struct mock_sock *sock;
+	struct nlmsghdr *nlh;
+
+	list_for_each_entry_safe(ev, next, &trans->events, list) {
+		mock_msg_finish(ev->nlh, trans->sock->portid, store->genid);
+		list_for_each_entry(sock, &store->socks, list) {
+			if ((sock == trans->sock && ev->echo) ||
+			    sock->groups & (1U << NFNLGRP_NFTABLES))
+				mock_sock_queue(sock, NULL, ev->nlh);
+		}
+		list_del(&ev->list);
+		xfree(ev);
+	}
+
+	nlh = nftnl_nlmsg_build_hdr(buf, NFT_MSG_NEWGEN, AF_UNSPEC, 0, 0);
+	mnl_attr_put_u32(nlh, NFTA_GEN_ID, htonl(store->genid));
+	mock_msg_finish(nlh, trans->sock->portid, store->genid);
+
+	list_for_each_entry(sock, &store->socks, list) {
+		if (sock->groups & (1U << NFNLGRP_NFTABLES))
+			mock_sock_queue(sock, NULL, nlh);
+	}
+}
+
+static void mock_trans_commit(struct mock_trans *trans)
+{
+	struct mock_undo *undo, *next;
+	bool changed = !list_empty(&trans->undo);
+
+	list_for_each_entry_safe(undo, next, &trans->undo, list) {
+		if (undo->op == MOCK_UNDO_DEL)
+			mock_obj_destroy(undo->type, undo->obj);
+		list_del(&undo->list);
+		xfree(undo->name);
+		xfree(undo);
+	}
+
+	if (changed) {
+		trans->sock->store->genid++;
+		mock_trans_notify(trans);
+	}
+}
+
+static void mock_trans_abort(struct mock_trans *trans)
+{
+	struct mock_undo *undo, *unext;
+	struct mock_event *ev, *enext;
+
+	/* The log is kept in reverse order, most recent changes first. */
+	list_for_each_entry_safe(undo, unext, &trans->undo, list) {
+		switch (undo->op) {
+		case MOCK_UNDO_ADD:
+			mock_obj_unlink(undo->type, undo->obj);
+			mock_obj_destroy(undo->type, undo->obj);
+			break;
+		case MOCK_UNDO_DEL:
+			mock_obj_link(undo->type, undo->obj, undo->pos);
+			break;
+		case MOCK_UNDO_RENAME:
+			nftnl_chain_set_str(((struct mock_chain *)undo->obj)->nlc,
+					    NFTNL_CHAIN_NAME, undo->name);
+			break;
+		}
+		list_del(&undo->list);
+		xfree(undo->name);
+		xfree(undo);
+	}
+
+	list_for_each_entry_safe(ev, enext, &trans->events, list) {
+		list_del(&ev->list);
+		xfree(ev);
+	}
+}
+
+static void mock_trans_end(struct mock_trans *trans)
+{
+	if (trans->failed)
+		mock_trans_abort(trans);
+	else
+		mock_trans_commit(trans);
+}
+
+/*
+ * Messages
+ */
+
+static struct nlmsghdr *mock_obj_build(char *buf, uint16_t type,
+				       enum mock_obj_type otype,
+				       const void *obj, uint16_t flags,
+				       uint32_t seq)
+{
+	const struct mock_table *table;
+	struct nlmsghdr *nlh;
+
+	switch (otype) {
+	case MOCK_TABLE:
+		table = obj;
+		nlh = nftnl_nlmsg_build_hdr(buf, type, table->family, flags, seq);
+		nftnl_table_nlmsg_build_payload(nlh, table->nlt);
+		break;
+	case MOCK_CHAIN:
+		table = ((const struct mock_chain *)obj)->table;
+		nlh = nftnl_nlmsg_build_hdr(buf, type, table->family, flags, seq);
+		nftnl_chain_nlmsg_build_payload(nlh,
+				((const struct mock_chain *)obj)->nlc);
+		break;
+	case MOCK_RULE:
+		table = ((const struct mock_rule *)obj)->chain->table;
+		nlh = nftnl_nlmsg_build_hdr(buf, type, table->family, flags, seq);
+		nftnl_rule_nlmsg_build_payload(nlh,
+				((const struct mock_rule *)obj)->nlr);
+		break;
+	case MOCK_SET:
+		table = ((const struct mock_set *)obj)->table;
+		nlh = nftnl_nlmsg_build_hdr(buf, type, table->family, flags, seq);
+		nftnl_set_nlmsg_build_payload(nlh,
+				((const struct mock_set *)obj)->nls);
+		break;
+	case MOCK_OBJ:
+		table = ((const struct mock_obj *)obj)->table;
+		nlh = nftnl_nlmsg_build_hdr(buf, type, table->family, flags, seq);
+		nftnl_obj_nlmsg_build_payload(nlh,
+				((const struct mock_obj *)obj)->nlo);
+		break;
+	default:
+		BUG("cannot build message for mock object type %u\n", otype);
+		return NULL;
+	}
+
+	return nlh;
+}
+
+static void mock_event(struct mock_trans *trans, uint16_t type,
+		       enum mock_obj_type otype, const void *obj,
+		       const struct nlmsghdr *req)
+{
+	char buf[MOCK_NLMSG_MAXSIZE];
+	struct nlmsghdr *nlh;
+
+	nlh = mock_obj_build(buf, type, otype, obj, 0, req->nlmsg_seq);
+	mock_trans_event(trans, nlh, req->nlmsg_flags & NLM_F_ECHO);
+}
+
+static struct mock_elem *mock_elem_alloc(const struct nftnl_set_elem *nlse)
+{
+	const void *key = NULL, *data = NULL;
+	uint32_t key_len = 0, data_len = 0;
+	struct mock_elem *elem;
+
+	if (nftnl_set_elem_is_set(nlse, NFTNL_SET_ELEM_KEY))
+		key = nftnl_set_elem_get(nlse, NFTNL_SET_ELEM_KEY, &key_len);
+	if (nftnl_set_elem_is_set(nlse, NFTNL_SET_ELEM_DATA))
+		data = nftnl_set_elem_get(nlse, NFTNL_SET_ELEM_DATA, &data_len);
+
+	elem = xzalloc(sizeof(*elem) + key_len + data_len);
+	elem->key_len = key_len;
+	elem->data_len = data_len;
+	if (key_len)
+		memcpy(elem->buf, key, key_len);
+	if (data_len)
+		memcpy(elem->buf + key_len, data, data_len);
+
+	if (nftnl_set_elem_is_set(nlse, NFTNL_SET_ELEM_FLAGS))
+		elem->flags = nftnl_set_elem_get_u32(nlse, NFTNL_SET_ELEM_FLAGS);
+	if (nftnl_set_elem_is_set(nlse, NFTNL_SET_ELEM_VERDICT)) {
+		elem->has_verdict = true;
+		elem->verdict = nftnl_set_elem_get_u32(nlse,
+						       NFTNL_SET_ELEM_VERDICT);
+	}
+	if (nftnl_set_elem_is_set(nlse, NFTNL_SET_ELEM_CHAIN))
+		elem->chain = xstrdup(nftnl_set_elem_get_str(nlse,
+						NFTNL_SET_ELEM_CHAIN));
+	if (nftnl_set_elem_is_set(nlse, NFTNL_SET_ELEM_OBJREF))
+		elem->objref = xstrdup(nftnl_set_elem_get_str(nlse,
+						NFTNL_SET_ELEM_OBJREF));
+	if (nftnl_set_elem_is_set(nlse, NFTNL_SET_ELEM_TIMEOUT))
+		elem->timeout = nftnl_set_elem_get_u64(nlse,
+						       NFTNL_SET_ELEM_TIMEOUT);
+	if (nftnl_set_elem_is_set(nlse, NFTNL_SET_ELEM_USERDATA)) {
+		data = nftnl_set_elem_get(nlse, NFTNL_SET_ELEM_USERDATA,
+					  &elem->udata_len);
+		elem->udata = xmalloc(elem->udata_len);
+		memcpy(elem->udata, data, elem->udata_len);
+	}
+
+	elem->hash = mock_elem_hash(elem);
+	return elem;
+}
+
+static struct nftnl_set_elem *mock_elem_nlse(const struct mock_elem *elem)
+{
+	struct nftnl_set_elem *nlse;
+
+	nlse = nftnl_set_elem_alloc();
+	if (nlse == NULL)
+		memory_allocation_error();
+
+	if (elem->key_len)
+		nftnl_set_elem_set(nlse, NFTNL_SET_ELEM_KEY, elem->buf,
+				   elem->key_len);
+	if (elem->data_len)
+		nftnl_set_elem_set(nlse, NFTNL_SET_ELEM_DATA,
+				   elem->buf + elem->key_len, elem->data_len);
+	if (elem->flags)
+		nftnl_set_elem_set_u32(nlse, NFTNL_SET_ELEM_FLAGS, elem->flags);
+	if (elem->has_verdict)
+		nftnl_set_elem_set_u32(nlse, NFTNL_SET_ELEM_VERDICT,
+				       elem->verdict);
+	if (elem->chain)
+		nftnl_set_elem_set_str(nlse, NFTNL_SET_ELEM_CHAIN, elem->chain);
+	if (elem->objref)
+		nftnl_set_elem_set_str(nlse, NFTNL_SET_ELEM_OBJREF,
+				       elem->objref);
+	if (elem->timeout)
+		nftnl_set_elem_set_u64(nlse, NFTNL_SET_ELEM_TIMEOUT,
+				       elem->timeout);
+	if (elem->udata)
+		nftnl_set_elem_set(nlse, NFTNL_SET_ELEM_USERDATA, elem->udata,
+				   elem->udata_len);
+
+	return nlse;
+}
+
+/*
+ * Build set element messages for @elems, which can take several messages
+ * for large sets. Each message is passed to @emit.
+ */
+static void mock_elems_build(const struct mock_set *set,
+			     struct mock_elem **elems, unsigned int num,
+			     uint16_t type, uint16_t flags, uint32_t seq,
+			     void (*emit)(struct nlmsghdr *nlh, void *data),
+			     void *data)
+{
+	uint32_t family = set->table->family;
+	struct nftnl_set_elems_iter *iter;
+	char buf[MOCK_NLMSG_MAXSIZE];
+	unsigned int i, j, n;
+	struct nftnl_set *nls;
+	struct nlmsghdr *nlh;
+	int ret;
+
+	for (i = 0; i < num; i += n) {
+		n = num - i < MOCK_ELEMS_CHUNK ? num - i : MOCK_ELEMS_CHUNK;
+
+		nls = nftnl_set_alloc();
+		if (nls == NULL)
+			memory_allocation_error();
+
+		nftnl_set_set_u32(nls, NFTNL_SET_FAMILY, family);
+		nftnl_set_set_str(nls, NFTNL_SET_TABLE,
+				  mock_table_name(set->table));
+		nftnl_set_set_str(nls, NFTNL_SET_NAME, mock_set_name(set));
+		for (j = 0; j < n; j++)
+			nftnl_set_elem_add(nls, mock_elem_nlse(elems[i + j]));
+
+		iter = nftnl_set_elems_iter_create(nls);
+		if (iter == NULL)
+			memory_allocation_error();
+
+		while (nftnl_set_elems_iter_cur(iter)) {
+			nlh = nftnl_nlmsg_build_hdr(buf, type, family, flags,
+						    seq);
+			ret = nftnl_set_elems_nlmsg_build_payload_iter(nlh,
+								       iter);
+			emit(nlh, data);
+			if (ret <= 0)
+				break;
+		}
+
+		nftnl_set_elems_iter_destroy(iter);
+		nftnl_set_free(nls);
+	}
+}
+
+struct mock_elem_event {
+	struct mock_trans	*trans;
+	bool			echo;
+};
+
+static void mock_elem_event_emit(struct nlmsghdr *nlh, void *data)
+{
+	struct mock_elem_event *ev = data;
+
+	mock_trans_event(ev->trans, nlh, ev->echo);
+}
+
+static void mock_elem_event(struct mock_trans *trans, uint16_t type,
+			    const struct mock_set *set,
+			    struct mock_elem **elems, unsigned int num,
+			    const struct nlmsghdr *req)
+{
+	struct mock_elem_event ev = {
+		.trans	= trans,
+		.echo	= req->nlmsg_flags & NLM_F_ECHO,
+	};
+
+	mock_elems_build(set, elems, num, type, 0, req->nlmsg_seq,
+			 mock_elem_event_emit, &ev);
+}
+
+/*
+ * Set references and jumps from rules
+ */
+
+static bool mock_expr_set_attrs(const struct nftnl_expr *e,
+				uint16_t *name_attr, uint16_t *id_attr)
+{
+	const char *name = nftnl_expr_get_str(e, NFTNL_EXPR_NAME);
+
+	if (!strcmp(name, "lookup")) {
+		*name_attr = NFTNL_EXPR_LOOKUP_SET;
+		*id_attr = NFTNL_EXPR_LOOKUP_SET_ID;
+	} else if (!strcmp(name, "dynset")) {
+		*name_attr = NFTNL_EXPR_DYNSET_SET_NAME;
+		*id_attr = NFTNL_EXPR_DYNSET_SET_ID;
+	} else if (!strcmp(name, "objref") &&
+		   nftnl_expr_is_set(e, NFTNL_EXPR_OBJREF_SET_NAME)) {
+		*name_attr = NFTNL_EXPR_OBJREF_SET_NAME;
+		*id_attr = NFTNL_EXPR_OBJREF_SET_ID;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static const char *mock_expr_jump(const struct nftnl_expr *e)
+{
+	if (strcmp(nftnl_expr_get_str(e, NFTNL_EXPR_NAME), "immediate") ||
+	    !nftnl_expr_is_set(e, NFTNL_EXPR_IMM_CHAIN))
+		return NULL;
+
+	return nftnl_expr_get_str(e, NFTNL_EXPR_IMM_CHAIN);
+}
+
+struct mock_expr_ctx {
+	struct mock_trans	*trans;
+	struct mock_table	*table;
+	const struct nlmsghdr	*req;
+	const char		*name;
+	int			err;
+};
+
+/* Bind the set references of a new rule, the kernel does the same. */
+static int mock_expr_resolve(struct nftnl_expr *e, void *data)
+{
+	struct mock_expr_ctx *ectx = data;
+	uint16_t name_attr, id_attr;
+	struct mock_set *set = NULL;
+	const char *name;
+
+	name = mock_expr_jump(e);
+	if (name != NULL) {
+		if (mock_chain_lookup(ectx->table, name) == NULL) {
+			ectx->err = ENOENT;
+			return -1;
+		}
+		return 0;
+	}
+
+	if (!mock_expr_set_attrs(e, &name_attr, &id_attr))
+		return 0;
+
+	name = nftnl_expr_get_str(e, name_attr);
+	if (name != NULL && strchr(name, '%') == NULL)
+		set = mock_set_lookup(ectx->table, name);
+	if (set == NULL && nftnl_expr_is_set(e, id_attr))
+		set = mock_set_lookup_id(ectx->trans->sock->store, ectx->table,
+					 nftnl_expr_get_u32(e, id_attr));
+	if (set == NULL) {
+		ectx->err = ENOENT;
+		return -1;
+	}
+
+	nftnl_expr_set_str(e, name_attr, mock_set_name(set));
+	return 0;
+}
+
+static void mock_set_del(struct mock_trans *trans, struct mock_set *set,
+			 const struct nlmsghdr *req)
+{
+	mock_event(trans, NFT_MSG_DELSET, MOCK_SET, set, req);
+	mock_trans_del(trans, MOCK_SET, set);
+}
+
+/* Anonymous sets go away with the rule they are bound to. */
+static int mock_expr_release(struct nftnl_expr *e, void *data)
+{
+	struct mock_expr_ctx *ectx = data;
+	uint16_t name_attr, id_attr;
+	struct mock_set *set;
+
+	if (!mock_expr_set_attrs(e, &name_attr, &id_attr))
+		return 0;
+
+	set = mock_set_lookup(ectx->table, nftnl_expr_get_str(e, name_attr));
+	if (set != NULL &&
+	    nftnl_set_get_u32(set->nls, NFTNL_SET_FLAGS) & NFT_SET_ANONYMOUS)
+		mock_set_del(ectx->trans, set, ectx->req);
+
+	return 0;
+}
+
+static int mock_expr_uses(struct nftnl_expr *e, void *data)
+{
+	struct mock_expr_ctx *ectx = data;
+	uint16_t name_attr, id_attr;
+	const char *name;
+
+	if (mock_expr_set_attrs(e, &name_attr, &id_attr))
+		name = nftnl_expr_get_str(e, name_attr);
+	else
+		name = mock_expr_jump(e);
+
+	if (name != NULL && !strcmp(name, ectx->name)) {
+		ectx->err = EBUSY;
+		return -1;
+	}
+	return 0;
+}
+
+/* Check whether any rule refers to the set or chain called @name. */
+static bool mock_table_uses(struct mock_table *table, const char *name)
+{
+	struct mock_expr_ctx ectx = {
+		.table	= table,
+		.name	= name,
+	};
+	struct mock_chain *chain;
+	struct mock_rule *rule;
+
+	list_for_each_entry(chain, &table->chains, list) {
+		list_for_each_entry(rule, &chain->rules, list) {
+			nftnl_expr_foreach(rule->nlr, mock_expr_uses, &ectx);
+			if (ectx.err)
+				return true;
+		}
+	}
+	return false;
+}
+
+static bool mock_table_jumps(struct mock_table *table, const char *name)
+{
+	struct mock_elem *elem;
+	struct mock_set *set;
+
+	if (mock_table_uses(table, name))
+		return true;
+
+	list_for_each_entry(set, &table->sets, list) {
+		list_for_each_entry(elem, &set->elems, list) {
+			if (elem->chain && !strcmp(elem->chain, name))
+				return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Tables
+ */
+
+static int mock_newtable(struct mock_trans *trans, const struct nlmsghdr *nlh)
+{
+	struct mock_store *store = trans->sock->store;
+	struct mock_table *table;
+	struct nftnl_table *nlt;
+
+	nlt = nftnl_table_alloc();
+	if (nlt == NULL)
+		memory_allocation_error();
+
+	if (nftnl_table_nlmsg_parse(nlh, nlt) < 0 ||
+	    !nftnl_table_is_set(nlt, NFTNL_TABLE_NAME)) {
+		nftnl_table_free(nlt);
+		return EINVAL;
+	}
+
+	table = mock_table_lookup(store, mock_msg_family(nlh),
+				  nftnl_table_get_str(nlt, NFTNL_TABLE_NAME));
+	if (table != NULL) {
+		nftnl_table_free(nlt);
+		return nlh->nlmsg_flags & NLM_F_EXCL ? EEXIST : 0;
+	}
+
+	table = xzalloc(sizeof(*table));
+	table->nlt = nlt;
+	table->family = mock_msg_family(nlh);
+	init_list_head(&table->chains);
+	init_list_head(&table->sets);
+	init_list_head(&table->objs);
+
+	mock_trans_add(trans, MOCK_TABLE, table, store->tables.prev);
+	mock_event(trans, NFT_MSG_NEWTABLE, MOCK_TABLE, table, nlh);
+
+	return 0;
+}
+
+static void mock_rule_del(struct mock_trans *trans, struct mock_rule *rule,
+			  const struct nlmsghdr *req)
+{
+	struct mock_expr_ctx ectx = {
+		.trans	= trans,
+		.table	= rule->chain->table,
+		.req	= req,
+	};
+
+	mock_event(trans, NFT_MSG_DELRULE, MOCK_RULE, rule, req);
+	mock_trans_del(trans, MOCK_RULE, rule);
+	nftnl_expr_foreach(rule->nlr, mock_expr_release, &ectx);
+}
+
+static void mock_chain_flush(struct mock_trans *trans,
+			     struct mock_chain *chain,
+			     const struct nlmsghdr *req)
+{
+	struct mock_rule *rule, *next;
+
+	list_for_each_entry_safe(rule, next, &chain->rules, list)
+		mock_rule_del(trans, rule, req);
+}
+
+static void mock_table_del(struct mock_trans *trans, struct mock_table *table,
+			   const struct nlmsghdr *req)
+{
+	struct mock_chain *chain, *cnext;
+	struct mock_set *set, *snext;
+	struct mock_obj *obj, *onext;
+
+	list_for_each_entry(chain, &table->chains, list)
+		mock_chain_flush(trans, chain, req);
+	list_for_each_entry_safe(set, snext, &table->sets, list)
+		mock_set_del(trans, set, req);
+	list_for_each_entry_safe(obj, onext, &table->objs, list) {
+		mock_event(trans, NFT_MSG_DELOBJ, MOCK_OBJ, obj, req);
+		mock_trans_del(trans, MOCK_OBJ, obj);
+	}
+	list_for_each_entry_safe(chain, cnext, &table->chains, list) {
+		mock_event(trans, NFT_MSG_DELCHAIN, MOCK_CHAIN, chain, req);
+		mock_trans_del(trans, MOCK_CHAIN, chain);
+	}
+
+	mock_event(trans, NFT_MSG_DELTABLE, MOCK_TABLE, table, req);
+	mock_trans_del(trans, MOCK_TABLE, table);
+}
+
+static int mock_deltable(struct mock_trans *trans, const struct nlmsghdr *nlh)
+{
+	struct mock_store *store = trans->sock->store;
+	uint32_t family = mock_msg_family(nlh);
+	struct mock_table *table, *next;
+	struct nftnl_table *nlt;
+	int err = 0;
+
+	nlt = nftnl_table_alloc();
+	if (nlt == NULL)
+		memory_allocation_error();
+
+	if (nftnl_table_nlmsg_parse(nlh, nlt) < 0) {
+		err = EINVAL;
+	} else if (nftnl_table_is_set(nlt, NFTNL_TABLE_NAME)) {
+		table = mock_table_lookup(store, family,
+				nftnl_table_get_str(nlt, NFTNL_TABLE_NAME));
+		if (table != NULL)
+			mock_table_del(trans, table, nlh);
+		else
+			err = ENOENT;
+	} else {
+		/* No table name, flush the whole family. */
+		list_for_each_entry_safe(table, next, &store->tables, list) {
+			if (mock_family_match(table->family, family))
+				mock_table_del(trans, table, nlh);
+		}
+	}
+
+	nftnl_table_free(nlt);
+	return err;
+}
+
+/*
+ * Chains
+ */
+
+static int mock_newchain(struct mock_trans *trans, const struct nlmsghdr *nlh)
+{
+	struct mock_table *table;
+	struct mock_chain *chain;
+	struct nftnl_chain *nlc;
+	const char *name;
+	int err = 0;
+
+	nlc = nftnl_chain_alloc();
+	if (nlc == NULL)
+		memory_allocation_error();
+
+	if (nftnl_chain_nlmsg_parse(nlh, nlc) < 0 ||
+	    !nftnl_chain_is_set(nlc, NFTNL_CHAIN_NAME)) {
+		err = EINVAL;
+		goto out;
+	}
+
+	table = mock_table_lookup(trans->sock->store, mock_msg_family(nlh),
+				  nftnl_chain_get_str(nlc, NFTNL_CHAIN_TABLE));
+	if (table == NULL) {
+		err = ENOENT;
+		goto out;
+	}
+
+	name = nftnl_chain_get_str(nlc, NFTNL_CHAIN_NAME);
+	if (nftnl_chain_is_set(nlc, NFTNL_CHAIN_HANDLE)) {
+		/* Existing chain referred to by handle, this is a rename. */
+		chain = mock_chain_lookup_handle(table,
+				nftnl_chain_get_u64(nlc, NFTNL_CHAIN_HANDLE));
+		if (chain == NULL) {
+			err = ENOENT;
+		} else if (strcmp(mock_chain_name(chain), name)) {
+			if (mock_chain_lookup(table, name) != NULL) {
+				err = EEXIST;
+				goto out;
+			}
+			mock_trans_rename(trans, chain, name);
+			mock_event(trans, NFT_MSG_NEWCHAIN, MOCK_CHAIN, chain,
+				   nlh);
+		}
+		goto out;
+	}
+
+	chain = mock_chain_lookup(table, name);
+	if (chain != NULL) {
+		if (nlh->nlmsg_flags & NLM_F_EXCL)
+			err = EEXIST;
+		goto out;
+	}
+
+	nftnl_chain_set_u64(nlc, NFTNL_CHAIN_HANDLE, ++table->hgenerator);
+
+	chain = xzalloc(sizeof(*chain));
+	chain->table = table;
+	chain->nlc = nlc;
+	init_list_head(&chain->rules);
+
+	mock_trans_add(trans, MOCK_CHAIN, chain, table->chains.prev);
+	mock_event(trans, NFT_MSG_NEWCHAIN, MOCK_CHAIN, chain, nlh);
+	return 0;
+out:
+	nftnl_chain_free(nlc);
+	return err;
+}
+
+static int mock_delchain(struct mock_trans *trans, const struct nlmsghdr *nlh)
+{
+	struct mock_table *table;
+	struct mock_chain *chain;
+	struct nftnl_chain *nlc;
+	int err = 0;
+
+	nlc = nftnl_chain_alloc();
+	if (nlc == NULL)
+		memory_allocation_error();
+
+	if (nftnl_chain_nlmsg_parse(nlh, nlc) < 0) {
+		err = EINVAL;
+		goto out;
+	}
+
+	table = mock_table_lookup(trans->sock->store, mock_msg_family(nlh),
+				  nftnl_chain_get_str(nlc, NFTNL_CHAIN_TABLE));
+	if (table == NULL) {
+		err = ENOENT;
+		goto out;
+	}
+
+	if (nftnl_chain_is_set(nlc, NFTNL_CHAIN_HANDLE))
+		chain = mock_chain_lookup_handle(table,
+				nftnl_chain_get_u64(nlc, NFTNL_CHAIN_HANDLE));
+	else
+		chain = mock_chain_lookup(table,
+				nftnl_chain_get_str(nlc, NFTNL_CHAIN_NAME));
+	if (chain == NULL) {
+		err = ENOENT;
+		goto out;
+	}
+
+	if (!list_empty(&chain->rules) ||
+	    mock_table_jumps(table, mock_chain_name(chain))) {
+		err = EBUSY;
+		goto out;
+	}
+
+	mock_event(trans, NFT_MSG_DELCHAIN, MOCK_CHAIN, chain, nlh);
+	mock_trans_del(trans, MOCK_CHAIN, chain);
+out:
+	nftnl_chain_free(nlc);
+	return err;
+}
+
+/*
+ * Rules
+ */
+
+static int mock_newrule(struct mock_trans *trans, const struct nlmsghdr *nlh)
+{
+	struct mock_expr_ctx ectx = {
+		.trans	= trans,
+		.req	= nlh,
+	};
+	struct mock_rule *rule, *old = NULL;
+	struct list_head *pos;
+	struct mock_chain *chain;
+	struct nftnl_rule *nlr;
+	int err = 0;
+
+	nlr = nftnl_rule_alloc();
+	if (nlr == NULL)
+		memory_allocation_error();
+
+	if (nftnl_rule_nlmsg_parse(nlh, nlr) < 0 ||
+	    !nftnl_rule_is_set(nlr, NFTNL_RULE_CHAIN)) {
+		err = EINVAL;
+		goto out;
+	}
+
+	ectx.table = mock_table_lookup(trans->sock->store,
+				       mock_msg_family(nlh),
+				       nftnl_rule_get_str(nlr, NFTNL_RULE_TABLE));
+	if (ectx.table == NULL) {
+		err = ENOENT;
+		goto out;
+	}
+
+	chain = mock_chain_lookup(ectx.table,
+				  nftnl_rule_get_str(nlr, NFTNL_RULE_CHAIN));
+	if (chain == NULL) {
+		err = ENOENT;
+		goto out;
+	}
+
+	if (nlh->nlmsg_flags & NLM_F_REPLACE) {
+		if (!nftnl_rule_is_set(nlr, NFTNL_RULE_HANDLE)) {
+			err = EINVAL;
+			goto out;
+		}
+		old = mock_rule_lookup(chain,
+				nftnl_rule_get_u64(nlr, NFTNL_RULE_HANDLE));
+		if (old == NULL) {
+			err = ENOENT;
+			goto out;
+		}
+		pos = &old->list;
+	} else if (nftnl_rule_is_set(nlr, NFTNL_RULE_POSITION)) {
+		old = mock_rule_lookup(chain,
+				nftnl_rule_get_u64(nlr, NFTNL_RULE_POSITION));
+		if (old == NULL) {
+			err = ENOENT;
+			goto out;
+		}
+		pos = nlh->nlmsg_flags & NLM_F_APPEND ? &old->list :
+							old->list.prev;
+		old = NULL;
+	} else {
+		pos = nlh->nlmsg_flags & NLM_F_APPEND ? chain->rules.prev :
+							&chain->rules;
+	}
+
+	nftnl_expr_foreach(nlr, mock_expr_resolve, &ectx);
+	if (ectx.err) {
+		err = ectx.err;
+		goto out;
+	}
+
+	nftnl_rule_unset(nlr, NFTNL_RULE_POSITION);
+	nftnl_rule_set_u64(nlr, NFTNL_RULE_HANDLE, ++ectx.table->hgenerator);
+
+	rule = xzalloc(sizeof(*rule));
+	rule->chain = chain;
+	rule->nlr = nlr;
+
+	mock_trans_add(trans, MOCK_RULE, rule, pos);
+	if (old != NULL)
+		mock_rule_del(trans, old, nlh);
+	mock_event(trans, NFT_MSG_NEWRULE, MOCK_RULE, rule, nlh);
+	return 0;
+out:
+	nftnl_rule_free(nlr);
+	return err;
+}
+
+static int mock_delrule(struct mock_trans *trans, const struct nlmsghdr *nlh)
+{
+	struct mock_table *table;
+	struct mock_chain *chain;
+	struct mock_rule *rule;
+	struct nftnl_rule *nlr;
+	int err = 0;
+
+	nlr = nftnl_rule_alloc();
+	if (nlr == NULL)
+		memory_allocation_error();
+
+	if (nftnl_rule_nlmsg_parse(nlh, nlr) < 0) {
+		err = EINVAL;
+		goto out;
+	}
+
+	table = mock_table_lookup(trans->sock->store, mock_msg_family(nlh),
+				  nftnl_rule_get_str(nlr, NFTNL_RULE_TABLE));
+	if (table == NULL) {
+		err = ENOENT;
+		goto out;
+	}
+
+	if (!nftnl_rule_is_set(nlr, NFTNL_RULE_CHAIN)) {
+		list_for_each_entry(chain, &table->chains, list)
+			mock_chain_flush(trans, chain, nlh);
+		goto out;
+	}
+
+	chain = mock_chain_lookup(table,
+				  nftnl_rule_get_str(nlr, NFTNL_RULE_CHAIN));
+	if (chain == NULL) {
+		err = ENOENT;
+		goto out;
+	}
+
+	if (!nftnl_rule_is_set(nlr, NFTNL_RULE_HANDLE)) {
+		mock_chain_flush(trans, chain, nlh);
+		goto out;
+	}
+
+	rule = mock_rule_lookup(chain,
+				nftnl_rule_get_u64(nlr, NFTNL_RULE_HANDLE));
+	if (rule == NULL) {
+		err = ENOENT;
+		goto out;
+	}
+	mock_rule_del(trans, rule, nlh);
+out:
+	nftnl_rule_free(nlr);
+	return err;
+}
+
+/*
+ * Sets
+ */
+
+/* Expand the "%d" template of anonymous set names, as the kernel does. */
+static void mock_set_alloc_name(struct mock_table *table, struct nftnl_set *nls)
+{
+	const char *name = nftnl_set_get_str(nls, NFTNL_SET_NAME);
+	const char *p = strstr(name, "%d");
+	char buf[NFT_SET_MAXNAMELEN];
+
+	if (p == NULL)
+		return;
+
+	do {
+		snprintf(buf, sizeof(buf), "%.*s%u%s", (int)(p - name), name,
+			 table->anon_idx++, p + 2);
+	} while (mock_set_lookup(table, buf) != NULL);
+
+	nftnl_set_set_str(nls, NFTNL_SET_NAME, buf);
+}
+
+static int mock_newset(struct mock_trans *trans, const struct nlmsghdr *nlh)
+{
+	struct mock_store *store = trans->sock->store;
+	struct mock_table *table;
+	struct nftnl_set *nls;
+	struct mock_set *set;
+	int err = 0;
+
+	nls = nftnl_set_alloc();
+	if (nls == NULL)
+		memory_allocation_error();
+
+	/* Incomplete set messages are used to probe for batch support. */
+	if (nftnl_set_nlmsg_parse(nlh, nls) < 0 ||
+	    !nftnl_set_is_set(nls, NFTNL_SET_TABLE) ||
+	    !nftnl_set_is_set(nls, NFTNL_SET_NAME) ||
+	    !nftnl_set_is_set(nls, NFTNL_SET_KEY_LEN)) {
+		err = EINVAL;
+		goto out;
+	}
+
+	table = mock_table_lookup(store, mock_msg_family(nlh),
+				  nftnl_set_get_str(nls, NFTNL_SET_TABLE));
+	if (table == NULL) {
+		err = ENOENT;
+		goto out;
+	}
+
+	if (mock_set_lookup(table, nftnl_set_get_str(nls, NFTNL_SET_NAME))) {
+		if (nlh->nlmsg_flags & NLM_F_EXCL)
+			err = EEXIST;
+		goto out;
+	}
+	mock_set_alloc_name(table, nls);
+
+	set = xzalloc(sizeof(*set));
+	set->table = table;
+	set->nls = nls;
+	set->genid = store->genid + 1;
+	init_list_head(&set->elems);
+	if (nftnl_set_is_set(nls, NFTNL_SET_ID)) {
+		set->id = nftnl_set_get_u32(nls, NFTNL_SET_ID);
+		nftnl_set_unset(nls, NFTNL_SET_ID);
+	}
+
+	mock_trans_add(trans, MOCK_SET, set, table->sets.prev);
+	mock_event(trans, NFT_MSG_NEWSET, MOCK_SET, set, nlh);
+	return 0;
+out:
+	nftnl_set_free(nls);
+	return err;
+}
+
+static int mock_delset(struct mock_trans *trans, const struct nlmsghdr *nlh)
+{
+	struct mock_table *table;
+	struct nftnl_set *nls;
+	struct mock_set *set;
+	int err = 0;
+
+	nls = nftnl_set_alloc();
+	if (nls == NULL)
+		memory_allocation_error();
+
+	if (nftnl_set_nlmsg_parse(nlh, nls) < 0) {
+		err = EINVAL;
+		goto out;
+	}
+
+	table = mock_table_lookup(trans->sock->store, mock_msg_family(nlh),
+				  nftnl_set_get_str(nls, NFTNL_SET_TABLE));
+	if (table == NULL) {
+		err = ENOENT;
+		goto out;
+	}
+
+	set = mock_set_lookup(table, nftnl_set_get_str(nls, NFTNL_SET_NAME));
+	if (set == NULL) {
+		err = ENOENT;
+		goto out;
+	}
+
+	if (mock_table_uses(table, mock_set_name(set))) {
+		err = EBUSY;
+		goto out;
+	}
+	mock_set_del(trans, set, nlh);
+out:
+	nftnl_set_free(nls);
+	return err;
+}
+
+static struct mock_set *mock_setelem_set(struct mock_trans *trans,
+					 const struct nlmsghdr *nlh,
+					 struct nftnl_set *nls, int *err)
+{
+	struct mock_store *store = trans->sock->store;
+	struct mock_table *table;
+	struct mock_set *set = NULL;
+
+	if (nftnl_set_elems_nlmsg_parse(nlh, nls) < 0) {
+		*err = EINVAL;
+		return NULL;
+	}
+
+	table = mock_table_lookup(store, mock_msg_family(nlh),
+				  nftnl_set_get_str(nls, NFTNL_SET_TABLE));
+	if (table == NULL) {
+		*err = ENOENT;
+		return NULL;
+	}
+
+	if (nftnl_set_is_set(nls, NFTNL_SET_NAME))
+		set = mock_set_lookup(table,
+				      nftnl_set_get_str(nls, NFTNL_SET_NAME));
+	if (set == NULL && nftnl_set_is_set(nls, NFTNL_SET_ID))
+		set = mock_set_lookup_id(store, table,
+					 nftnl_set_get_u32(nls, NFTNL_SET_ID));
+	if (set == NULL)
+		*err = ENOENT;
+
+	return set;
+}
+
+struct mock_setelem_ctx {
+	struct mock_trans	*trans;
+	const struct nlmsghdr	*req;
+	struct mock_set		*set;
+	struct mock_elem	**elems;
+	unsigned int		num;
+	unsigned int		size;
+	int			err;
+};
+
+static void mock_setelem_ctx_add(struct mock_setelem_ctx *sctx,
+				 struct mock_elem *elem)
+{
+	if (sctx->num == sctx->size) {
+		sctx->size = sctx->size ? sctx->size * 2 : 64;
+		sctx->elems = xrealloc(sctx->elems,
+				       sctx->size * sizeof(sctx->elems[0]));
+	}
+	sctx->elems[sctx->num++] = elem;
+}
+
+static int mock_newsetelem_cb(struct nftnl_set_elem *nlse, void *data)
+{
+	struct mock_setelem_ctx *sctx = data;
+	struct mock_set *set = sctx->set;
+	struct mock_elem *elem;
+
+	elem = mock_elem_alloc(nlse);
+	elem->set = set;
+
+	if (elem->key_len != nftnl_set_get_u32(set->nls, NFTNL_SET_KEY_LEN)) {
+		sctx->err = EINVAL;
+	} else if (elem->chain &&
+		   mock_chain_lookup(set->table, elem->chain) == NULL) {
+		sctx->err = ENOENT;
+	} else if (mock_elem_lookup(set, elem) != NULL) {
+		if (sctx->req->nlmsg_flags & NLM_F_EXCL)
+			sctx->err = EEXIST;
+	} else {
+		mock_trans_add(sctx->trans, MOCK_ELEM, elem, set->elems.prev);
+		mock_setelem_ctx_add(sctx, elem);
+		return 0;
+	}
+
+	mock_elem_free(elem);
+	return sctx->err ? -1 : 0;
+}
+
+static int mock_newsetelem(struct mock_trans *trans,
+			   const struct nlmsghdr *nlh)
+{
+	struct mock_setelem_ctx sctx = {
+		.trans	= trans,
+		.req	= nlh,
+	};
+	struct nftnl_set *nls;
+	int err = 0;
+
+	nls = nftnl_set_alloc();
+	if (nls == NULL)
+		memory_allocation_error();
+
+	sctx.set = mock_setelem_set(trans, nlh, nls, &err);
+	if (sctx.set == NULL)
+		goto out;
+
+	nftnl_set_elem_foreach(nls, mock_newsetelem_cb, &sctx);
+	err = sctx.err;
+	if (sctx.num > 0)
+		mock_elem_event(trans, NFT_MSG_NEWSETELEM, sctx.set,
+				sctx.elems, sctx.num, nlh);
+out:
+	xfree(sctx.elems);
+	nftnl_set_free(nls);
+	return err;
+}
+
+static int mock_delsetelem_cb(struct nftnl_set_elem *nlse, void *data)
+{
+	struct mock_setelem_ctx *sctx = data;
+	struct mock_elem *key, *elem;
+
+	key = mock_elem_alloc(nlse);
+	elem = mock_elem_lookup(sctx->set, key);
+	mock_elem_free(key);
+
+	if (elem == NULL) {
+		sctx->err = ENOENT;
+		return -1;
+	}
+
+	mock_trans_del(sctx->trans, MOCK_ELEM, elem);
+	mock_setelem_ctx_add(sctx, elem);
+	return 0;
+}
+
+static int mock_delsetelem(struct mock_trans *trans,
+			   const struct nlmsghdr *nlh)
+{
+	struct mock_setelem_ctx sctx = {
+		.trans	= trans,
+		.req	= nlh,
+	};
+	struct mock_elem *elem, *next;
+	struct nftnl_set *nls;
+	int err = 0;
+
+	nls = nftnl_set_alloc();
+	if (nls == NULL)
+		memory_allocation_error();
+
+	sctx.set = mock_setelem_set(trans, nlh, nls, &err);
+	if (sctx.set == NULL)
+		goto out;
+
+	if (nftnl_set_elem_foreach(nls, mock_delsetelem_cb, &sctx) == 0 &&
+	    sctx.num == 0) {
+		/* No elements given, flush the set. */
+		list_for_each_entry_safe(elem, next, &sctx.set->elems, list) {
+			mock_trans_del(trans, MOCK_ELEM, elem);
+			mock_setelem_ctx_add(&sctx, elem);
+		}
+	}
+
+	err = sctx.err;
+	if (sctx.num > 0)
+		mock_elem_event(trans, NFT_MSG_DELSETELEM, sctx.set,
+				sctx.elems, sctx.num, nlh);
+out:
+	xfree(sctx.elems);
+	nftnl_set_free(nls);
+	return err;
+}
+
+/*
+ * Stateful objects
+ */
+
+static int mock_newobj(struct mock_trans *trans, const struct nlmsghdr *nlh)
+{
+	struct mock_table *table;
+	struct nftnl_obj *nlo;
+	struct mock_obj *obj;
+	int err = 0;
+
+	nlo = nftnl_obj_alloc();
+	if (nlo == NULL)
+		memory_allocation_error();
+
+	if (nftnl_obj_nlmsg_parse(nlh, nlo) < 0 ||
+	    !nftnl_obj_is_set(nlo, NFTNL_OBJ_NAME) ||
+	    !nftnl_obj_is_set(nlo, NFTNL_OBJ_TYPE)) {
+		err = EINVAL;
+		goto out;
+	}
+
+	table = mock_table_lookup(trans->sock->store, mock_msg_family(nlh),
+				  nftnl_obj_get_str(nlo, NFTNL_OBJ_TABLE));
+	if (table == NULL) {
+		err = ENOENT;
+		goto out;
+	}
+
+	if (mock_obj_lookup(table, nftnl_obj_get_u32(nlo, NFTNL_OBJ_TYPE),
+			    nftnl_obj_get_str(nlo, NFTNL_OBJ_NAME))) {
+		if (nlh->nlmsg_flags & NLM_F_EXCL)
+			err = EEXIST;
+		goto out;
+	}
+
+	obj = xzalloc(sizeof(*obj));
+	obj->table = table;
+	obj->nlo = nlo;
+
+	mock_trans_add(trans, MOCK_OBJ, obj, table->objs.prev);
+	mock_event(trans, NFT_MSG_NEWOBJ, MOCK_OBJ, obj, nlh);
+	return 0;
+out:
+	nftnl_obj_free(nlo);
+	return err;
+}
+
+static int mock_delobj(struct mock_trans *trans, const struct nlmsghdr *nlh)
+{
+	struct mock_table *table;
+	struct nftnl_obj *nlo;
+	struct mock_obj *obj;
+	int err = 0;
+
+	nlo = nftnl_obj_alloc();
+	if (nlo == NULL)
+		memory_allocation_error();
+
+	if (nftnl_obj_nlmsg_parse(nlh, nlo) < 0) {
+		err = EINVAL;
+		goto out;
+	}
+
+	table = mock_table_lookup(trans->sock->store, mock_msg_family(nlh),
+				  nftnl_obj_get_str(nlo, NFTNL_OBJ_TABLE));
+	if (table == NULL) {
+		err = ENOENT;
+		goto out;
+	}
+
+	obj = mock_obj_lookup(table, nftnl_obj_get_u32(nlo, NFTNL_OBJ_TYPE),
+			      nftnl_obj_get_str(nlo, NFTNL_OBJ_NAME));
+	if (obj == NULL) {
+		err = ENOENT;
+		goto out;
+	}
+
+	mock_event(trans, NFT_MSG_DELOBJ, MOCK_OBJ, obj, nlh);
+	mock_trans_del(trans, MOCK_OBJ, obj);
+out:
+	nftnl_obj_free(nlo);
+	return err;
+}
+
+static int mock_modify(struct mock_trans *trans, const struct nlmsghdr *nlh)
+{
+	switch (NFNL_MSG_TYPE(nlh->nlmsg_type)) {
+	case NFT_MSG_NEWTABLE:
+		return mock_newtable(trans, nlh);
+	case NFT_MSG_DELTABLE:
+		return mock_deltable(trans, nlh);
+	case NFT_MSG_NEWCHAIN:
+		return mock_newchain(trans, nlh);
+	case NFT_MSG_DELCHAIN:
+		return mock_delchain(trans, nlh);
+	case NFT_MSG_NEWRULE:
+		return mock_newrule(trans, nlh);
+	case NFT_MSG_DELRULE:
+		return mock_delrule(trans, nlh);
+	case NFT_MSG_NEWSET:
+		return mock_newset(trans, nlh);
+	case NFT_MSG_DELSET:
+		return mock_delset(trans, nlh);
+	case NFT_MSG_NEWSETELEM:
+		return mock_newsetelem(trans, nlh);
+	case NFT_MSG_DELSETELEM:
+		return mock_delsetelem(trans, nlh);
+	case NFT_MSG_NEWOBJ:
+		return mock_newobj(trans, nlh);
+	case NFT_MSG_DELOBJ:
+		return mock_delobj(trans, nlh);
+	}
+	return EOPNOTSUPP;
+}
+
+/*
+ * Dumps
+ */
+
+struct mock_dump {
+	struct mock_sock	*sock;
+	struct mock_dgram	*dgram;
+	uint16_t		flags;
+	uint32_t		seq;
+};
+
+static void mock_dump_emit(struct nlmsghdr *nlh, void *data)
+{
+	struct mock_dump *dump = data;
+	struct mock_sock *sock = dump->sock;
+
+	mock_msg_finish(nlh, sock->portid, sock->store->genid);
+	dump->dgram = mock_sock_queue(sock, dump->dgram, nlh);
+}
+
+static void mock_dump_obj(struct mock_dump *dump, enum mock_obj_type otype,
+			  const void *obj, uint16_t type)
+{
+	char buf[MOCK_NLMSG_MAXSIZE];
+	struct nlmsghdr *nlh;
+
+	nlh = mock_obj_build(buf, type, otype, obj, dump->flags, dump->seq);
+	mock_dump_emit(nlh, dump);
+}
+
+static void mock_dump_done(struct mock_dump *dump)
+{
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct nlmsghdr *nlh;
+	int *ret;
+
+	nlh = mnl_nlmsg_put_header(buf);
+	nlh->nlmsg_type = NLMSG_DONE;
+	nlh->nlmsg_flags = NLM_F_MULTI;
+	nlh->nlmsg_seq = dump->seq;
+	nlh->nlmsg_pid = dump->sock->portid;
+	ret = mnl_nlmsg_put_extra_header(nlh, sizeof(*ret));
+	*ret = 0;
+
+	dump->dgram = mock_sock_queue(dump->sock, dump->dgram, nlh);
+}
+
+static int mock_getgen(struct mock_dump *dump)
+{
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct nlmsghdr *nlh;
+
+	nlh = nftnl_nlmsg_build_hdr(buf, NFT_MSG_NEWGEN, AF_UNSPEC, 0,
+				    dump->seq);
+	mnl_attr_put_u32(nlh, NFTA_GEN_ID, htonl(dump->sock->store->genid));
+	mock_dump_emit(nlh, dump);
+
+	return 0;
+}
+
+static int mock_gettable(struct mock_dump *dump, const struct nlmsghdr *nlh)
+{
+	uint32_t family = mock_msg_family(nlh);
+	struct mock_table *table;
+	struct nftnl_table *nlt;
+	const char *name;
+	int err = 0;
+
+	nlt = nftnl_table_alloc();
+	if (nlt == NULL)
+		memory_allocation_error();
+
+	if (nftnl_table_nlmsg_parse(nlh, nlt) < 0) {
+		err = EINVAL;
+		goto out;
+	}
+	name = nftnl_table_get_str(nlt, NFTNL_TABLE_NAME);
+
+	if (!(nlh->nlmsg_flags & NLM_F_DUMP)) {
+		table = mock_table_lookup(dump->sock->store, family, name);
+		if (table != NULL)
+			mock_dump_obj(dump, MOCK_TABLE, table,
+				      NFT_MSG_NEWTABLE);
+		else
+			err = ENOENT;
+		goto out;
+	}
+
+	list_for_each_entry(table, &dump->sock->store->tables, list) {
+		if (mock_family_match(table->family, family))
+			mock_dump_obj(dump, MOCK_TABLE, table,
+				      NFT_MSG_NEWTABLE);
+	}
+out:
+	nftnl_table_free(nlt);
+	return err;
+}
+
+static int mock_getchain(struct mock_dump *dump, const struct nlmsghdr *nlh)
+{
+	uint32_t family = mock_msg_family(nlh);
+	const char *tname, *name;
+	struct mock_table *table;
+	struct mock_chain *chain;
+	struct nftnl_chain *nlc;
+	int err = 0;
+
+	nlc = nftnl_chain_alloc();
+	if (nlc == NULL)
+		memory_allocation_error();
+
+	if (nftnl_chain_nlmsg_parse(nlh, nlc) < 0) {
+		err = EINVAL;
+		goto out;
+	}
+	tname = nftnl_chain_get_str(nlc, NFTNL_CHAIN_TABLE);
+	name = nftnl_chain_get_str(nlc, NFTNL_CHAIN_NAME);
+
+	if (!(nlh->nlmsg_flags & NLM_F_DUMP)) {
+		table = mock_table_lookup(dump->sock->store, family, tname);
+		chain = table ? mock_chain_lookup(table, name) : NULL;
+		if (chain != NULL)
+			mock_dump_obj(dump, MOCK_CHAIN, chain,
+				      NFT_MSG_NEWCHAIN);
+		else
+			err = ENOENT;
+		goto out;
+	}
+
+	list_for_each_entry(table, &dump->sock->store->tables, list) {
+		if (!mock_family_match(table->family, family) ||
+		    !mock_str_match(mock_table_name(table), tname))
+			continue;
+		list_for_each_entry(chain, &table->chains, list)
+			mock_dump_obj(dump, MOCK_CHAIN, chain,
+				      NFT_MSG_NEWCHAIN);
+	}
+out:
+	nftnl_chain_free(nlc);
+	return err;
+}
+
+static int mock_getrule(struct mock_dump *dump, const struct nlmsghdr *nlh)
+{
+	uint32_t family = mock_msg_family(nlh);
+	const char *tname, *cname;
+	struct mock_table *table;
+	struct mock_chain *chain;
+	struct mock_rule *rule;
+	struct nftnl_rule *nlr;
+	int err = 0;
+
+	nlr = nftnl_rule_alloc();
+	if (nlr == NULL)
+		memory_allocation_error();
+
+	if (nftnl_rule_nlmsg_parse(nlh, nlr) < 0) {
+		err = EINVAL;
+		goto out;
+	}
+	tname = nftnl_rule_get_str(nlr, NFTNL_RULE_TABLE);
+	cname = nftnl_rule_get_str(nlr, NFTNL_RULE_CHAIN);
+
+	if (!(nlh->nlmsg_flags & NLM_F_DUMP)) {
+		table = mock_table_lookup(dump->sock->store, family, tname);
+		chain = table ? mock_chain_lookup(table, cname) : NULL;
+		rule = chain ? mock_rule_lookup(chain,
+				nftnl_rule_get_u64(nlr, NFTNL_RULE_HANDLE)) :
+			       NULL;
+		if (rule != NULL)
+			mock_dump_obj(dump, MOCK_RULE, rule, NFT_MSG_NEWRULE);
+		else
+			err = ENOENT;
+		goto out;
+	}
+
+	list_for_each_entry(table, &dump->sock->store->tables, list) {
+		if (!mock_family_match(table->family, family) ||
+		    !mock_str_match(mock_table_name(table), tname))
+			continue;
+		list_for_each_entry(chain, &table->chains, list) {
+			if (!mock_str_match(mock_chain_name(chain), cname))
+				continue;
+			list_for_each_entry(rule, &chain->rules, list)
+				mock_dump_obj(dump, MOCK_RULE, rule,
+					      NFT_MSG_NEWRULE);
+		}
+	}
+out:
+	nftnl_rule_free(nlr);
+	return err;
+}
+
+static int mock_getset(struct mock_dump *dump, const struct nlmsghdr *nlh)
+{
+	uint32_t family = mock_msg_family(nlh);
+	struct mock_table *table;
+	const char *tname, *name;
+	struct nftnl_set *nls;
+	struct mock_set *set;
+	int err = 0;
+
+	nls = nftnl_set_alloc();
+	if (nls == NULL)
+		memory_allocation_error();
+
+	if (nftnl_set_nlmsg_parse(nlh, nls) < 0) {
+		err = EINVAL;
+		goto out;
+	}
+	tname = nftnl_set_get_str(nls, NFTNL_SET_TABLE);
+	name = nftnl_set_get_str(nls, NFTNL_SET_NAME);
+
+	if (!(nlh->nlmsg_flags & NLM_F_DUMP)) {
+		table = mock_table_lookup(dump->sock->store, family, tname);
+		set = table ? mock_set_lookup(table, name) : NULL;
+		if (set != NULL)
+			mock_dump_obj(dump, MOCK_SET, set, NFT_MSG_NEWSET);
+		else
+			err = ENOENT;
+		goto out;
+	}
+
+	list_for_each_entry(table, &dump->sock->store->tables, list) {
+		if (!mock_family_match(table->family, family) ||
+		    !mock_str_match(mock_table_name(table), tname))
+			continue;
+		list_for_each_entry(set, &table->sets, list)
+			mock_dump_obj(dump, MOCK_SET, set, NFT_MSG_NEWSET);
+	}
+out:
+	nftnl_set_free(nls);
+	return err;
+}
+
+static int mock_getsetelem(struct mock_dump *dump, const struct nlmsghdr *nlh)
+{
+	struct mock_table *table;
+	struct mock_elem **elems;
+	struct mock_elem *elem;
+	struct nftnl_set *nls;
+	struct mock_set *set;
+	unsigned int num = 0;
+	int err = 0;
+
+	nls = nftnl_set_alloc();
+	if (nls == NULL)
+		memory_allocation_error();
+
+	if (nftnl_set_nlmsg_parse(nlh, nls) < 0) {
+		err = EINVAL;
+		goto out;
+	}
+
+	table = mock_table_lookup(dump->sock->store, mock_msg_family(nlh),
+				  nftnl_set_get_str(nls, NFTNL_SET_TABLE));
+	set = table ? mock_set_lookup(table,
+			nftnl_set_get_str(nls, NFTNL_SET_NAME)) : NULL;
+	if (set == NULL) {
+		err = ENOENT;
+		goto out;
+	}
+
+	elems = xmalloc((set->nelems + 1) * sizeof(elems[0]));
+	list_for_each_entry(elem, &set->elems, list)
+		elems[num++] = elem;
+
+	mock_elems_build(set, elems, num, NFT_MSG_NEWSETELEM, dump->flags,
+			 dump->seq, mock_dump_emit, dump);
+	xfree(elems);
+out:
+	nftnl_set_free(nls);
+	return err;
+}
+
+static void mock_obj_reset(struct mock_obj *obj)
+{
+	switch (nftnl_obj_get_u32(obj->nlo, NFTNL_OBJ_TYPE)) {
+	case NFT_OBJECT_COUNTER:
+		nftnl_obj_set_u64(obj->nlo, NFTNL_OBJ_CTR_PKTS, 0);
+		nftnl_obj_set_u64(obj->nlo, NFTNL_OBJ_CTR_BYTES, 0);
+		break;
+	case NFT_OBJECT_QUOTA:
+		nftnl_obj_set_u64(obj->nlo, NFTNL_OBJ_QUOTA_CONSUMED, 0);
+		break;
+	}
+}
+
+static int mock_getobj(struct mock_dump *dump, const struct nlmsghdr *nlh)
+{
+	bool reset = NFNL_MSG_TYPE(nlh->nlmsg_type) == NFT_MSG_GETOBJ_RESET;
+	uint32_t family = mock_msg_family(nlh), type = 0;
+	struct mock_table *table;
+	const char *tname, *name;
+	struct nftnl_obj *nlo;
+	struct mock_obj *obj;
+	int err = 0;
+
+	nlo = nftnl_obj_alloc();
+	if (nlo == NULL)
+		memory_allocation_error();
+
+	if (nftnl_obj_nlmsg_parse(nlh, nlo) < 0) {
+		err = EINVAL;
+		goto out;
+	}
+	tname = nftnl_obj_get_str(nlo, NFTNL_OBJ_TABLE);
+	name = nftnl_obj_get_str(nlo, NFTNL_OBJ_NAME);
+	if (nftnl_obj_is_set(nlo, NFTNL_OBJ_TYPE))
+		type = nftnl_obj_get_u32(nlo, NFTNL_OBJ_TYPE);
+
+	if (!(nlh->nlmsg_flags & NLM_F_DUMP)) {
+		table = mock_table_lookup(dump->sock->store, family, tname);
+		obj = table ? mock_obj_lookup(table, type, name) : NULL;
+		if (obj != NULL) {
+			mock_dump_obj(dump, MOCK_OBJ, obj, NFT_MSG_NEWOBJ);
+			if (reset)
+				mock_obj_reset(obj);
+		} else {
+			err = ENOENT;
+		}
+		goto out;
+	}
+
+	list_for_each_entry(table, &dump->sock->store->tables, list) {
+		if (!mock_family_match(table->family, family) ||
+		    !mock_str_match(mock_table_name(table), tname))
+			continue;
+		list_for_each_entry(obj, &table->objs, list) {
+			if (type &&
+			    nftnl_obj_get_u32(obj->nlo, NFTNL_OBJ_TYPE) != type)
+				continue;
+			mock_dump_obj(dump, MOCK_OBJ, obj, NFT_MSG_NEWOBJ);
+			if (reset)
+				mock_obj_reset(obj);
+		}
+	}
+out:
+	nftnl_obj_free(nlo);
+	return err;
+}
+
+static bool mock_msg_is_get(const struct nlmsghdr *nlh)
+{
+	switch (NFNL_MSG_TYPE(nlh->nlmsg_type)) {
+	case NFT_MSG_GETGEN:
+	case NFT_MSG_GETTABLE:
+	case NFT_MSG_GETCHAIN:
+	case NFT_MSG_GETRULE:
+	case NFT_MSG_GETSET:
+	case NFT_MSG_GETSETELEM:
+	case NFT_MSG_GETOBJ:
+	case NFT_MSG_GETOBJ_RESET:
+		return true;
+	}
+	return false;
+}
+
+static void mock_get(struct mock_sock *sock, const struct nlmsghdr *nlh)
+{
+	bool is_dump = nlh->nlmsg_flags & NLM_F_DUMP;
+	struct mock_dump dump = {
+		.sock	= sock,
+		.flags	= is_dump ? NLM_F_MULTI : 0,
+		.seq	= nlh->nlmsg_seq,
+	};
+	int err;
+
+	switch (NFNL_MSG_TYPE(nlh->nlmsg_type)) {
+	case NFT_MSG_GETGEN:
+		err = mock_getgen(&dump);
+		break;
+	case NFT_MSG_GETTABLE:
+		err = mock_gettable(&dump, nlh);
+		break;
+	case NFT_MSG_GETCHAIN:
+		err = mock_getchain(&dump, nlh);
+		break;
+	case NFT_MSG_GETRULE:
+		err = mock_getrule(&dump, nlh);
+		break;
+	case NFT_MSG_GETSET:
+		err = mock_getset(&dump, nlh);
+		break;
+	case NFT_MSG_GETSETELEM:
+		err = mock_getsetelem(&dump, nlh);
+		break;
+	default:
+		err = mock_getobj(&dump, nlh);
+		break;
+	}
+
+	if (err)
+		mock_ack(sock, nlh, err);
+	else if (is_dump)
+		mock_dump_done(&dump);
+	else if (nlh->nlmsg_flags & NLM_F_ACK)
+		mock_ack(sock, nlh, 0);
+}
+
+/*
+ * Sockets
+ */
+
+static struct mock_store *mock_store_alloc(void)
+{
+	struct mock_store *store;
+
+	store = xzalloc(sizeof(*store));
+	init_list_head(&store->socks);
+	init_list_head(&store->tables);
+
+	return store;
+}
+
+static void mock_store_free(struct mock_store *store)
+{
+	struct mock_table *table, *next;
+
+	list_for_each_entry_safe(table, next, &store->tables, list)
+		mock_table_free(table);
+	xfree(store);
+}
+
+/*
+ * Open a mock socket, sockets opened with a @peer share its object store
+ * and see the same ruleset.
+ */
+struct mock_sock *mock_sock_open(const struct mock_sock *peer)
+{
+	struct mock_store *store;
+	struct mock_sock *sock;
+	int fd;
+
+	fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	store = peer ? peer->store : mock_store_alloc();
+	store->refcnt++;
+
+	sock = xzalloc(sizeof(*sock));
+	sock->store = store;
+	sock->portid = ++store->portid;
+	sock->fd = fd;
+	init_list_head(&sock->rxq);
+	list_add_tail(&sock->list, &store->socks);
+
+	return sock;
+}
+
+void mock_sock_close(struct mock_sock *sock)
+{
+	struct mock_store *store = sock->store;
+
+	mock_sock_flush(sock);
+	list_del(&sock->list);
+	close(sock->fd);
+	xfree(sock);
+
+	if (--store->refcnt == 0)
+		mock_store_free(store);
+}
+
+int mock_sock_fd(const struct mock_sock *sock)
+{
+	return sock->fd;
+}
+
+uint32_t mock_sock_portid(const struct mock_sock *sock)
+{
+	return sock->portid;
+}
+
+int mock_sock_subscribe(struct mock_sock *sock, unsigned int group)
+{
+	if (group >= 32) {
+		errno = EINVAL;
+		return -1;
+	}
+	sock->groups |= 1U << group;
+	return 0;
+}
+
+ssize_t mock_sock_send(struct mock_sock *sock, const void *buf, size_t len)
+{
+	const struct nlmsghdr *nlh = buf;
+	struct mock_trans trans, *batch = NULL;
+	int rem = len, err;
+
+	while (mnl_nlmsg_ok(nlh, rem)) {
+		if (nlh->nlmsg_type == NFNL_MSG_BATCH_BEGIN) {
+			if (batch == NULL) {
+				batch = &trans;
+				mock_trans_init(batch, sock);
+			}
+		} else if (nlh->nlmsg_type == NFNL_MSG_BATCH_END) {
+			if (batch != NULL) {
+				mock_trans_end(batch);
+				batch = NULL;
+			}
+		} else if (nlh->nlmsg_type < NLMSG_MIN_TYPE) {
+			/* control messages are ignored, as in the kernel. */
+		} else if (NFNL_SUBSYS_ID(nlh->nlmsg_type) !=
+			   NFNL_SUBSYS_NFTABLES) {
+			mock_ack(sock, nlh, EOPNOTSUPP);
+		} else if (mock_msg_is_get(nlh)) {
+			mock_get(sock, nlh);
+		} else if (batch != NULL) {
+			err = mock_modify(batch, nlh);
+			if (err)
+				batch->failed = true;
+			if (err || nlh->nlmsg_flags & NLM_F_ACK)
+				mock_ack(sock, nlh, err);
+		} else {
+			/* Outside of batches, each message is applied on its
+			 * own.
+			 */
+			mock_trans_init(&trans, sock);
+			err = mock_modify(&trans, nlh);
+			trans.failed = err != 0;
+			mock_trans_end(&trans);
+			if (err || nlh->nlmsg_flags & NLM_F_ACK)
+				mock_ack(sock, nlh, err);
+		}
+		nlh = mnl_nlmsg_next(nlh, &rem);
+	}
+
+	/* Batches without end message are discarded. */
+	if (batch != NULL)
+		mock_trans_abort(batch);
+
+	return len;
+}
+
+/*
+ * Dequeue the next datagram. A datagram that does not fit in @buf is
+ * dropped and reported with ENOSPC, as mnl_socket_recvfrom() does for
+ * truncated netlink messages.
+ */
+ssize_t mock_sock_recv(struct mock_sock *sock, void *buf, size_t len)
+{
+	struct mock_dgram *dgram;
+	ssize_t ret;
+	uint64_t cnt;
+
+	if (list_empty(&sock->rxq)) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	dgram = list_first_entry(&sock->rxq, struct mock_dgram, list);
+	if (dgram->len > len) {
+		ret = -1;
+	} else {
+		memcpy(buf, dgram->data, dgram->len);
+		ret = dgram->len;
+	}
+
+	list_del(&dgram->list);
+	xfree(dgram);
+
+	if (list_empty(&sock->rxq) && read(sock->fd, &cnt, sizeof(cnt)) < 0)
+		BUG("cannot clear mock socket: %s\n", strerror(errno));
+
+	if (ret < 0)
+		errno = ENOSPC;
+
+	return ret;
+}
@@ -10,6 +10,7 @@
  */
 
 #include <string.h>
+#include <endian.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <libmnl/libmnl.h>
@@ -39,6 +40,8 @@
 #include <utils.h>
 #include <erec.h>
 #include <iface.h>
+#include <trace_profile.h>
+#include <cmd_results.h>
 
 #define nft_mon_print(monh, ...) nft_print(monh->ctx->octx, __VA_ARGS__)
 
@@ -51,29 +54,42 @@ const struct location netlink_location = {
 	.indesc	= &indesc_netlink,
 };
 
-struct mnl_socket *netlink_open_sock(void)
+struct nft_sock *netlink_open_sock(void)
 {
-	struct mnl_socket *nf_sock;
+	struct nft_sock *nf_sock;
 
-	nf_sock = mnl_socket_open(NETLINK_NETFILTER);
+	nf_sock = nft_sock_open();
 	if (nf_sock == NULL)
 		netlink_init_error();
 
-	fcntl(mnl_socket_get_fd(nf_sock), F_SETFL, O_NONBLOCK);
+	fcntl(nft_sock_fd(nf_sock), F_SETFL, O_NONBLOCK);
 
 	return nf_sock;
 }
 
-void netlink_close_sock(struct mnl_socket *nf_sock)
+struct nft_sock *netlink_open_mock_sock(void)
+{
+	struct nft_sock *nf_sock;
+
+	nf_sock = nft_sock_open_mock(NULL);
+	if (nf_sock == NULL)
+		netlink_init_error();
+
+	return nf_sock;
+}
+
+void netlink_close_sock(struct nft_sock *nf_sock)
 {
 	if (nf_sock)
-		mnl_socket_close(nf_sock);
+		nft_sock_close(nf_sock);
 }
 
-void netlink_restart(struct mnl_socket *nf_sock)
+void netlink_restart(struct nft_sock *nf_sock)
 {
-	netlink_close_sock(nf_sock);
-	nf_sock = netlink_open_sock();
+	if (nft_sock_reopen(nf_sock) < 0)
+		netlink_init_error();
+
+	fcntl(nft_sock_fd(nf_sock), F_SETFL, O_NONBLOCK);
 }
 
 uint16_t netlink_genid_get(struct netlink_ctx *ctx)
@@ -470,15 +486,8 @@ int netlink_replace_rule_batch(struct netlink_ctx *ctx, const struct handle *h,
 	struct nftnl_rule *nlr;
 	int err, flags = 0;
 
-	if (ctx->octx->echo) {
-		err = cache_update(ctx->nf_sock, ctx->cache,
-				   CMD_INVALID, ctx->msgs,
-				   ctx->debug_mask & NFT_DEBUG_NETLINK, ctx->octx);
-		if (err < 0)
-			return err;
-
+	if (nft_output_echo(ctx->octx))
 		flags |= NLM_F_ECHO;
-	}
 
 	nlr = alloc_nftnl_rule(&rule->handle);
 	netlink_linearize_rule(ctx, nlr, rule);
@@ -528,11 +537,73 @@ void netlink_dump_expr(const struct nftnl_expr *nle,
 	fprintf(fp, "\n");
 }
 
+/*
+ * Rule dumps with at least this many rules are delinearized by a pool of
+ * worker threads, smaller dumps are not worth the thread setup cost.
+ */
+#define RULE_DECODE_PARALLEL_MIN	512
+#define RULE_DECODE_MAX_WORKERS		8
+
+/**
+ * struct rule_decode_vec - matching rules collected from a rule dump
+ *
+ * @h:		table (and optional chain) the rules are collected for,
+ *		all rules of the family or of all families if unset
+ * @nlrs:	netlink rules in dump order
+ * @rules:	delinearized rules, indexed like @nlrs
+ * @num:	number of collected rules
+ * @size:	allocated array size
+ * @serial:	some rules have xtables matches or targets, decode serially
+ */
+struct rule_decode_vec {
+	const struct handle	*h;
+	struct nftnl_rule	**nlrs;
+	struct rule		**rules;
+	unsigned int		num;
+	unsigned int		size;
+	bool			serial;
+};
+
+/**
+ * struct rule_decode_job - slice of a rule dump decoded by one worker
+ *
+ * @ctx:	private copy of the netlink context, the cache is only read
+ * @msgs:	private error record queue, spliced to the caller's in order
+ * @vec:	shared rule vector, each job only touches its own slice
+ * @first:	first rule index to decode
+ * @last:	rule index to stop at (exclusive)
+ * @thread:	worker thread
+ * @running:	worker thread was started successfully
+ * @counting:	allocations are counted for statistics
+ * @allocs:	allocations made by the worker thread
+ */
+struct rule_decode_job {
+	struct netlink_ctx	ctx;
+	struct list_head	msgs;
+	struct rule_decode_vec	*vec;
+	unsigned int		first;
+	unsigned int		last;
+	pthread_t		thread;
+	bool			running;
+	bool			counting;
+	struct xalloc_counters	allocs;
+};
+
+/* The xtables match and target code relies on global state. */
+static int rule_xt_expr_cb(struct nftnl_expr *nle, void *data)
+{
+	const char *name = nftnl_expr_get_str(nle, NFTNL_EXPR_NAME);
+
+	if (!strcmp(name, "match") || !strcmp(name, "target"))
+		return -1;
+
+	return 0;
+}
+
 static int list_rule_cb(struct nftnl_rule *nlr, void *arg)
 {
-	struct netlink_ctx *ctx = arg;
-	const struct handle *h = ctx->data;
-	struct rule *rule;
+	struct rule_decode_vec *vec = arg;
+	const struct handle *h = vec->h;
 	const char *table, *chain;
 	uint32_t family;
 
@@ -540,24 +611,137 @@ static int list_rule_cb(struct nftnl_rule *nlr, void *arg)
 	table  = nftnl_rule_get_str(nlr, NFTNL_RULE_TABLE);
 	chain  = nftnl_rule_get_str(nlr, NFTNL_RULE_CHAIN);
 
-	if (h->family != family ||
-	    strcmp(table, h->table) != 0 ||
+	if ((h->family != NFPROTO_UNSPEC && h->family != family) ||
+	    (h->table && strcmp(table, h->table) != 0) ||
 	    (h->chain && strcmp(chain, h->chain) != 0))
 		return 0;
 
-	netlink_dump_rule(nlr, ctx);
-	rule = netlink_delinearize_rule(ctx, nlr);
-	list_add_tail(&rule->list, &ctx->list);
+	if (vec->num == vec->size) {
+		vec->size = vec->size ? vec->size * 2 : 64;
+		vec->nlrs = xrealloc(vec->nlrs, vec->size * sizeof(vec->nlrs[0]));
+	}
+	vec->nlrs[vec->num++] = nlr;
+
+	if (!vec->serial && nftnl_expr_foreach(nlr, rule_xt_expr_cb, NULL) < 0)
+		vec->serial = true;
 
 	return 0;
 }
 
+static void rule_decode_range(struct netlink_ctx *ctx,
+			      struct rule_decode_vec *vec,
+			      unsigned int first, unsigned int last)
+{
+	unsigned int i;
+
+	for (i = first; i < last; i++)
+		vec->rules[i] = netlink_delinearize_rule(ctx, vec->nlrs[i]);
+}
+
+static void *rule_decode_worker(void *arg)
+{
+	struct rule_decode_job *job = arg;
+
+	if (job->counting)
+		xalloc_counters_set(&job->allocs);
+	rule_decode_range(&job->ctx, job->vec, job->first, job->last);
+	xalloc_counters_set(NULL);
+	return NULL;
+}
+
+static unsigned int rule_decode_workers(const struct netlink_ctx *ctx,
+					const struct rule_decode_vec *vec)
+{
+	long ncpus;
+
+	/*
+	 * Debugging output must not be interleaved and xtables is not thread
+	 * safe, decode serially.
+	 */
+	if (ctx->debug_mask || vec->serial ||
+	    vec->num < RULE_DECODE_PARALLEL_MIN)
+		return 1;
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpus <= 1)
+		return 1;
+	if (ncpus > RULE_DECODE_MAX_WORKERS)
+		ncpus = RULE_DECODE_MAX_WORKERS;
+
+	return ncpus;
+}
+
+/*
+ * Delinearize the collected rules. The rule vector is split in contiguous
+ * slices, one per worker, which only read from the cache and queue errors
+ * to private lists. The caller decodes the first slice itself, then waits
+ * for the workers and stitches rules and errors back in dump order, so the
+ * result is identical to a serial decode. The GMP allocation hooks are only
+ * set once by nft_init() and allocation counters are kept per thread, so
+ * the workers share no state besides the read-only cache.
+ */
+static void rule_decode_vec(struct netlink_ctx *ctx,
+			    struct rule_decode_vec *vec)
+{
+	struct rule_decode_job jobs[RULE_DECODE_MAX_WORKERS];
+	unsigned int i, nworkers, slice;
+
+	vec->rules = xmalloc(vec->num * sizeof(vec->rules[0]));
+
+	nworkers = rule_decode_workers(ctx, vec);
+	slice = (vec->num + nworkers - 1) / nworkers;
+
+	for (i = 1; i < nworkers; i++) {
+		struct rule_decode_job *job = &jobs[i];
+
+		job->ctx = *ctx;
+		init_list_head(&job->msgs);
+		job->ctx.msgs = &job->msgs;
+		job->vec = vec;
+		job->first = i * slice;
+		job->last = job->first + slice;
+		if (job->last > vec->num)
+			job->last = vec->num;
+		if (job->first > job->last)
+			job->first = job->last;
+		job->counting = xalloc_counting();
+		memset(&job->allocs, 0, sizeof(job->allocs));
+
+		job->running = pthread_create(&job->thread, NULL,
+					      rule_decode_worker, job) == 0;
+	}
+
+	rule_decode_range(ctx, vec, 0, slice < vec->num ? slice : vec->num);
+
+	for (i = 1; i < nworkers; i++) {
+		struct rule_decode_job *job = &jobs[i];
+
+		/* Could not spawn this worker, decode its slice here. */
+		if (job->running) {
+			pthread_join(job->thread, NULL);
+			xalloc_counters_add(&job->allocs);
+		} else {
+			rule_decode_range(&job->ctx, vec, job->first,
+					  job->last);
+		}
+
+		list_splice_tail(&job->msgs, ctx->msgs);
+	}
+
+	for (i = 0; i < vec->num; i++)
+		list_add_tail(&vec->rules[i]->list, &ctx->list);
+}
+
 static int netlink_list_rules(struct netlink_ctx *ctx, const struct handle *h,
 			      const struct location *loc)
 {
 	struct nftnl_rule_list *rule_cache;
+	struct rule_decode_vec vec = {
+		.h	= h,
+	};
+	unsigned int i;
 
-	rule_cache = mnl_nft_rule_dump(ctx, h->family);
+	rule_cache = mnl_nft_rule_dump(ctx, h->family, h->table, h->chain);
 	if (rule_cache == NULL) {
 		if (errno == EINTR)
 			return -1;
@@ -565,8 +749,16 @@ static int netlink_list_rules(struct netlink_ctx *ctx, const struct handle *h,
 		return 0;
 	}
 
-	ctx->data = h;
-	nftnl_rule_list_foreach(rule_cache, list_rule_cb, ctx);
+	nftnl_rule_list_foreach(rule_cache, list_rule_cb, &vec);
+
+	for (i = 0; i < vec.num; i++)
+		netlink_dump_rule(vec.nlrs[i], ctx);
+
+	if (vec.num > 0)
+		rule_decode_vec(ctx, &vec);
+
+	xfree(vec.rules);
+	xfree(vec.nlrs);
 	nftnl_rule_list_free(rule_cache);
 	return 0;
 }
@@ -811,7 +1003,8 @@ static int list_chain_cb(struct nftnl_chain *nlc, void *arg)
 	name   = nftnl_chain_get_str(nlc, NFTNL_CHAIN_NAME);
 	family = nftnl_chain_get_u32(nlc, NFTNL_CHAIN_FAMILY);
 
-	if (h->family != family || strcmp(table, h->table) != 0)
+	if ((h->family != NFPROTO_UNSPEC && h->family != family) ||
+	    (h->table && strcmp(table, h->table) != 0))
 		return 0;
 	if (h->chain && strcmp(name, h->chain) != 0)
 		return 0;
@@ -1053,6 +1246,7 @@ static int set_parse_udata_cb(const struct nftnl_udata *attr, void *data)
 	case UDATA_SET_KEYBYTEORDER:
 	case UDATA_SET_DATABYTEORDER:
 	case UDATA_SET_MERGE_ELEMENTS:
+	case UDATA_SET_POLICY_AUTO:
 		if (len != sizeof(uint32_t))
 			return -1;
 		break;
@@ -1071,6 +1265,7 @@ static struct set *netlink_delinearize_set(struct netlink_ctx *ctx,
 	enum byteorder keybyteorder = BYTEORDER_INVALID;
 	enum byteorder databyteorder = BYTEORDER_INVALID;
 	const struct datatype *keytype, *datatype;
+	uint32_t policy_auto = SET_POLICY_AUTO_NONE;
 	bool automerge = false;
 	const char *udata;
 	struct set *set;
@@ -1092,6 +1287,9 @@ static struct set *netlink_delinearize_set(struct netlink_ctx *ctx,
 		if (ud[UDATA_SET_MERGE_ELEMENTS])
 			automerge =
 				nftnl_udata_get_u32(ud[UDATA_SET_MERGE_ELEMENTS]);
+		if (ud[UDATA_SET_POLICY_AUTO])
+			policy_auto =
+				nftnl_udata_get_u32(ud[UDATA_SET_POLICY_AUTO]);
 	}
 
 	key = nftnl_set_get_u32(nls, NFTNL_SET_KEY_TYPE);
@@ -1125,6 +1323,7 @@ static struct set *netlink_delinearize_set(struct netlink_ctx *ctx,
 	set->handle.table  = xstrdup(nftnl_set_get_str(nls, NFTNL_SET_TABLE));
 	set->handle.set    = xstrdup(nftnl_set_get_str(nls, NFTNL_SET_NAME));
 	set->automerge	   = automerge;
+	set->policy_auto   = policy_auto;
 
 	set->key     = constant_expr_alloc(&netlink_location,
 					   set_datatype_alloc(keytype, keybyteorder),
@@ -1221,15 +1420,20 @@ static int netlink_add_set_batch(struct netlink_ctx *ctx,
 
 	nftnl_set_set_u32(nls, NFTNL_SET_ID, set->handle.set_id);
 
-	if (!(set->flags & NFT_SET_CONSTANT)) {
-		if (set->policy != NFT_SET_POL_PERFORMANCE)
-			nftnl_set_set_u32(nls, NFTNL_SET_POLICY, set->policy);
+	if ((!(set->flags & NFT_SET_CONSTANT) || set->policy_auto) &&
+	    set->policy != NFT_SET_POL_PERFORMANCE)
+		nftnl_set_set_u32(nls, NFTNL_SET_POLICY, set->policy);
 
+	/*
+	 * The size is an upper limit for the number of elements, so the
+	 * element count is only passed on as a hint for constant sets.
+	 */
+	if (!(set->flags & NFT_SET_CONSTANT)) {
 		if (set->desc.size != 0)
 			nftnl_set_set_u32(nls, NFTNL_SET_DESC_SIZE,
 					  set->desc.size);
-	} else if (set->init) {
-		nftnl_set_set_u32(nls, NFTNL_SET_DESC_SIZE, set->init->size);
+	} else if (set->nelems) {
+		nftnl_set_set_u32(nls, NFTNL_SET_DESC_SIZE, set->nelems);
 	}
 
 	udbuf = nftnl_udata_buf_alloc(NFT_USERDATA_MAXLEN);
@@ -1249,6 +1453,11 @@ static int netlink_add_set_batch(struct netlink_ctx *ctx,
 				 set->automerge))
 		memory_allocation_error();
 
+	if (set->policy_auto &&
+	    !nftnl_udata_put_u32(udbuf, UDATA_SET_POLICY_AUTO,
+				 set->policy_auto))
+		memory_allocation_error();
+
 	nftnl_set_set_data(nls, NFTNL_SET_USERDATA, nftnl_udata_buf_data(udbuf),
 			   nftnl_udata_buf_len(udbuf));
 	nftnl_udata_buf_free(udbuf);
@@ -1466,6 +1675,214 @@ int netlink_flush_setelems(struct netlink_ctx *ctx, const struct handle *h,
 	return err;
 }
 
+static int setelem_key_cmp(const struct nftnl_set_elem *e1,
+			   const struct nftnl_set_elem *e2)
+{
+	uint32_t len1, len2, flags1 = 0, flags2 = 0;
+	const void *key1, *key2;
+	int ret;
+
+	key1 = nftnl_set_elem_get(e1, NFTNL_SET_ELEM_KEY, &len1);
+	key2 = nftnl_set_elem_get(e2, NFTNL_SET_ELEM_KEY, &len2);
+	if (len1 != len2)
+		return len1 < len2 ? -1 : 1;
+	ret = memcmp(key1, key2, len1);
+	if (ret)
+		return ret;
+
+	if (nftnl_set_elem_is_set(e1, NFTNL_SET_ELEM_FLAGS))
+		flags1 = nftnl_set_elem_get_u32(e1, NFTNL_SET_ELEM_FLAGS);
+	if (nftnl_set_elem_is_set(e2, NFTNL_SET_ELEM_FLAGS))
+		flags2 = nftnl_set_elem_get_u32(e2, NFTNL_SET_ELEM_FLAGS);
+
+	return (int)(flags1 & NFT_SET_ELEM_INTERVAL_END) -
+	       (int)(flags2 & NFT_SET_ELEM_INTERVAL_END);
+}
+
+static int setelem_cmp(const void *p1, const void *p2)
+{
+	return setelem_key_cmp(*(struct nftnl_set_elem * const *)p1,
+			       *(struct nftnl_set_elem * const *)p2);
+}
+
+static bool setelem_attr_equal(const struct nftnl_set_elem *e1,
+			       const struct nftnl_set_elem *e2, uint16_t attr)
+{
+	const void *data1, *data2;
+	uint32_t len1, len2;
+
+	if (!nftnl_set_elem_is_set(e1, attr))
+		return !nftnl_set_elem_is_set(e2, attr);
+	if (!nftnl_set_elem_is_set(e2, attr))
+		return false;
+
+	data1 = nftnl_set_elem_get(e1, attr, &len1);
+	data2 = nftnl_set_elem_get(e2, attr, &len2);
+	return len1 == len2 && !memcmp(data1, data2, len1);
+}
+
+/*
+ * @cur is an element the kernel holds, @new one to replace it with. The
+ * kernel reports a timeout for every element of a set with timeouts, so
+ * the timeouts only differ if @new sets one.
+ */
+static bool setelem_data_equal(const struct nftnl_set_elem *cur,
+			       const struct nftnl_set_elem *new)
+{
+	if (nftnl_set_elem_is_set(new, NFTNL_SET_ELEM_TIMEOUT) &&
+	    !setelem_attr_equal(cur, new, NFTNL_SET_ELEM_TIMEOUT))
+		return false;
+
+	return setelem_attr_equal(cur, new, NFTNL_SET_ELEM_DATA) &&
+	       setelem_attr_equal(cur, new, NFTNL_SET_ELEM_VERDICT) &&
+	       setelem_attr_equal(cur, new, NFTNL_SET_ELEM_CHAIN) &&
+	       setelem_attr_equal(cur, new, NFTNL_SET_ELEM_OBJREF) &&
+	       setelem_attr_equal(cur, new, NFTNL_SET_ELEM_USERDATA);
+}
+
+/* Deleting an element only takes its key and interval flag */
+static void setelem_add_deletion(struct nftnl_set *nls,
+				 const struct nftnl_set_elem *elem)
+{
+	struct nftnl_set_elem *nlse;
+	const void *key;
+	uint32_t len;
+
+	nlse = nftnl_set_elem_alloc();
+	if (nlse == NULL)
+		memory_allocation_error();
+
+	key = nftnl_set_elem_get(elem, NFTNL_SET_ELEM_KEY, &len);
+	nftnl_set_elem_set(nlse, NFTNL_SET_ELEM_KEY, key, len);
+	if (nftnl_set_elem_is_set(elem, NFTNL_SET_ELEM_FLAGS))
+		nftnl_set_elem_set_u32(nlse, NFTNL_SET_ELEM_FLAGS,
+				       nftnl_set_elem_get_u32(elem,
+							      NFTNL_SET_ELEM_FLAGS));
+	nftnl_set_elem_add(nls, nlse);
+}
+
+struct setelem_array {
+	struct nftnl_set_elem	**elems;
+	unsigned int		num;
+};
+
+static int setelem_count_cb(struct nftnl_set_elem *nlse, void *arg)
+{
+	unsigned int *num = arg;
+
+	(*num)++;
+	return 0;
+}
+
+static int setelem_fill_cb(struct nftnl_set_elem *nlse, void *arg)
+{
+	struct setelem_array *array = arg;
+
+	array->elems[array->num++] = nlse;
+	return 0;
+}
+
+/*
+ * Replace the elements of a set by the ones in @expr. The current elements
+ * are fetched and compared against the new ones by a merge of both sorted
+ * lists, so only the elements that are gone and the ones that are new or
+ * whose data changed are deleted and added, in the same batch.
+ */
+int netlink_replace_setelems(struct netlink_ctx *ctx, const struct handle *h,
+			     const struct expr *expr)
+{
+	struct nftnl_set_elem **cur, **new;
+	unsigned int ncur = 0, nnew = 0, i, j;
+	unsigned int nadd = 0, ndel = 0;
+	struct nftnl_set *nls, *add, *del;
+	struct setelem_array fill;
+	const struct expr *elem;
+	int ret, err = 0;
+
+	nls = alloc_nftnl_set(h);
+	if (mnl_nft_setelem_get(ctx, nls) < 0) {
+		if (errno != EINTR)
+			netlink_io_error(ctx, &expr->location,
+					 "Could not receive set elements: %s",
+					 strerror(errno));
+		nftnl_set_free(nls);
+		return -1;
+	}
+
+	if (nftnl_set_elem_foreach(nls, setelem_count_cb, &ncur) < 0)
+		memory_allocation_error();
+	cur = xmalloc((ncur + 1) * sizeof(cur[0]));
+	fill.elems = cur;
+	fill.num = 0;
+	nftnl_set_elem_foreach(nls, setelem_fill_cb, &fill);
+
+	new = xmalloc((expr->size + 1) * sizeof(new[0]));
+	list_for_each_entry(elem, &expr->expressions, list)
+		new[nnew++] = alloc_nftnl_setelem(expr, elem);
+
+	qsort(cur, ncur, sizeof(cur[0]), setelem_cmp);
+	qsort(new, nnew, sizeof(new[0]), setelem_cmp);
+
+	/* duplicates in the new elements are added once */
+	for (i = 1, j = 0; i < nnew; i++) {
+		if (!setelem_key_cmp(new[j], new[i]))
+			nftnl_set_elem_free(new[i]);
+		else
+			new[++j] = new[i];
+	}
+	if (nnew > 0)
+		nnew = j + 1;
+
+	add = alloc_nftnl_set(h);
+	del = alloc_nftnl_set(h);
+	for (i = 0, j = 0; i < ncur || j < nnew; ) {
+		if (j == nnew)
+			ret = -1;
+		else if (i == ncur)
+			ret = 1;
+		else
+			ret = setelem_key_cmp(cur[i], new[j]);
+
+		if (ret < 0) {
+			setelem_add_deletion(del, cur[i++]);
+			ndel++;
+		} else if (ret > 0) {
+			nftnl_set_elem_add(add, new[j++]);
+			nadd++;
+		} else if (!setelem_data_equal(cur[i], new[j])) {
+			setelem_add_deletion(del, cur[i++]);
+			nftnl_set_elem_add(add, new[j++]);
+			ndel++;
+			nadd++;
+		} else {
+			nftnl_set_elem_free(new[j++]);
+			i++;
+		}
+	}
+	xfree(new);
+	xfree(cur);
+	nftnl_set_free(nls);
+
+	if (ndel > 0) {
+		netlink_dump_set(del, ctx);
+		err = mnl_nft_setelem_batch_del(del, ctx->batch, 0,
+						ctx->seqnum);
+	}
+	if (err == 0 && nadd > 0) {
+		netlink_dump_set(add, ctx);
+		err = mnl_nft_setelem_batch_add(add, ctx->batch, 0,
+						ctx->seqnum);
+	}
+	nftnl_set_free(del);
+	nftnl_set_free(add);
+
+	if (err < 0)
+		netlink_io_error(ctx, &expr->location,
+				 "Could not replace set elements: %s",
+				 strerror(errno));
+	return err;
+}
+
 static struct expr *netlink_parse_concat_elem(const struct datatype *dtype,
 					      struct expr *data)
 {
@@ -1636,6 +2053,23 @@ static int list_setelem_cb(struct nftnl_set_elem *nlse, void *arg)
 	return netlink_delinearize_setelem(nlse, ctx->set, ctx->cache);
 }
 
+static void netlink_set_init_from_elems(struct netlink_ctx *ctx,
+					const struct location *loc,
+					struct set *set, struct nftnl_set *nls)
+{
+	ctx->set = set;
+	set->init = set_expr_alloc(loc, set);
+	nftnl_set_elem_foreach(nls, list_setelem_cb, ctx);
+
+	if (!(set->flags & NFT_SET_INTERVAL))
+		list_expr_sort(&ctx->set->init->expressions);
+
+	ctx->set = NULL;
+
+	if (set->flags & NFT_SET_INTERVAL)
+		interval_map_decompose(set->init);
+}
+
 int netlink_get_setelems(struct netlink_ctx *ctx, const struct handle *h,
 			 const struct location *loc, struct set *set)
 {
@@ -1653,18 +2087,8 @@ int netlink_get_setelems(struct netlink_ctx *ctx, const struct handle *h,
 		goto out;
 	}
 
-	ctx->set = set;
-	set->init = set_expr_alloc(loc, set);
-	nftnl_set_elem_foreach(nls, list_setelem_cb, ctx);
-
-	if (!(set->flags & NFT_SET_INTERVAL))
-		list_expr_sort(&ctx->set->init->expressions);
-
+	netlink_set_init_from_elems(ctx, loc, set, nls);
 	nftnl_set_free(nls);
-	ctx->set = NULL;
-
-	if (set->flags & NFT_SET_INTERVAL)
-		interval_map_decompose(set->init);
 out:
 	if (err < 0)
 		netlink_io_error(ctx, loc, "Could not receive set elements: %s",
@@ -1672,6 +2096,52 @@ out:
 	return err;
 }
 
+/*
+ * Fetch the elements of all sets in @sets, with several dumps in flight.
+ */
+int netlink_list_setelems(struct netlink_ctx *ctx, struct list_head *sets,
+			  const struct location *loc)
+{
+	struct nftnl_set **nls;
+	unsigned int i, num = 0;
+	struct set *set;
+	int *errs, err = 0;
+
+	list_for_each_entry(set, sets, list)
+		num++;
+	if (num == 0)
+		return 0;
+
+	nls = xmalloc(num * sizeof(nls[0]));
+	errs = xmalloc(num * sizeof(errs[0]));
+
+	i = 0;
+	list_for_each_entry(set, sets, list)
+		nls[i++] = alloc_nftnl_set(&set->handle);
+
+	mnl_nft_setelem_get_multi(ctx, nls, errs, num);
+
+	i = 0;
+	list_for_each_entry(set, sets, list) {
+		if (err == 0 && errs[i] != 0) {
+			if (errs[i] != EINTR)
+				netlink_io_error(ctx, loc,
+						 "Could not receive set elements: %s",
+						 strerror(errs[i]));
+			errno = errs[i];
+			err = -1;
+		} else if (err == 0) {
+			netlink_set_init_from_elems(ctx, loc, set, nls[i]);
+		}
+		nftnl_set_free(nls[i]);
+		i++;
+	}
+
+	xfree(errs);
+	xfree(nls);
+	return err;
+}
+
 void netlink_dump_obj(struct nftnl_obj *nln, struct netlink_ctx *ctx)
 {
 	FILE *fp = ctx->octx->output_fp;
@@ -1804,6 +2274,81 @@ int netlink_list_objs(struct netlink_ctx *ctx, const struct handle *h,
 	return err;
 }
 
+struct obj_stats_array {
+	struct nft_obj_stats	*objs;
+	unsigned int		size;
+	unsigned int		num;
+};
+
+static int obj_stats_cb(struct nftnl_obj *nlo, void *arg)
+{
+	struct obj_stats_array *array = arg;
+	struct nft_obj_stats *stats;
+	uint32_t type;
+
+	type = nftnl_obj_get_u32(nlo, NFTNL_OBJ_TYPE);
+	if (type != NFT_OBJECT_COUNTER && type != NFT_OBJECT_QUOTA)
+		return 0;
+
+	/* keep counting, the caller learns how large the array must be */
+	if (array->num++ >= array->size)
+		return 0;
+
+	stats = &array->objs[array->num - 1];
+	memset(stats, 0, sizeof(*stats));
+	stats->family = nftnl_obj_get_u32(nlo, NFTNL_OBJ_FAMILY);
+	stats->type = type;
+	snprintf(stats->table, sizeof(stats->table), "%s",
+		 nftnl_obj_get_str(nlo, NFTNL_OBJ_TABLE));
+	snprintf(stats->name, sizeof(stats->name), "%s",
+		 nftnl_obj_get_str(nlo, NFTNL_OBJ_NAME));
+
+	switch (type) {
+	case NFT_OBJECT_COUNTER:
+		stats->packets = nftnl_obj_get_u64(nlo, NFTNL_OBJ_CTR_PKTS);
+		stats->bytes = nftnl_obj_get_u64(nlo, NFTNL_OBJ_CTR_BYTES);
+		break;
+	case NFT_OBJECT_QUOTA:
+		stats->quota = nftnl_obj_get_u64(nlo, NFTNL_OBJ_QUOTA_BYTES);
+		stats->consumed =
+			nftnl_obj_get_u64(nlo, NFTNL_OBJ_QUOTA_CONSUMED);
+		stats->flags = nftnl_obj_get_u32(nlo, NFTNL_OBJ_QUOTA_FLAGS);
+		break;
+	}
+	return 0;
+}
+
+/*
+ * Fill @objs with the counters and quotas of a single object dump, without
+ * delinearizing them. Returns the number of objects found, which may be
+ * larger than @num.
+ */
+int netlink_get_obj_stats(struct netlink_ctx *ctx, const struct handle *h,
+			  uint32_t type, bool reset, struct nft_obj_stats *objs,
+			  unsigned int num)
+{
+	struct obj_stats_array array = {
+		.objs	= objs,
+		.size	= num,
+	};
+	struct nftnl_obj_list *obj_cache;
+
+	obj_cache = mnl_nft_obj_dump(ctx, h->family, h->table, NULL, type,
+				     true, reset);
+	if (obj_cache == NULL) {
+		if (errno == EINTR)
+			return -1;
+
+		return netlink_io_error(ctx, NULL,
+					"Could not receive stateful objects from kernel: %s",
+					strerror(errno));
+	}
+
+	nftnl_obj_list_foreach(obj_cache, obj_stats_cb, &array);
+	nftnl_obj_list_free(obj_cache);
+	return array.num;
+}
+
 int netlink_reset_objs(struct netlink_ctx *ctx, const struct handle *h,
 		       const struct location *loc, uint32_t type, bool dump)
 {
@@ -2028,9 +2573,9 @@ static int netlink_events_table_cb(const struct nlmsghdr *nlh, int type,
 		break;
 	case NFTNL_OUTPUT_XML:
 	case NFTNL_OUTPUT_JSON:
-		nftnl_table_fprintf(stdout, nlt, monh->format,
+		nftnl_table_fprintf(monh->ctx->octx->output_fp, nlt, monh->format,
 				    netlink_msg2nftnl_of(type));
-		fprintf(stdout, "\n");
+		nft_print(monh->ctx->octx, "\n");
 		break;
 	}
 
@@ -2070,9 +2615,9 @@ static int netlink_events_chain_cb(const struct nlmsghdr *nlh, int type,
 		break;
 	case NFTNL_OUTPUT_XML:
 	case NFTNL_OUTPUT_JSON:
-		nftnl_chain_fprintf(stdout, nlc, monh->format,
+		nftnl_chain_fprintf(monh->ctx->octx->output_fp, nlc, monh->format,
 				    netlink_msg2nftnl_of(type));
-		fprintf(stdout, "\n");
+		nft_print(monh->ctx->octx, "\n");
 		break;
 	}
 
@@ -2117,9 +2662,9 @@ static int netlink_events_set_cb(const struct nlmsghdr *nlh, int type,
 		break;
 	case NFTNL_OUTPUT_XML:
 	case NFTNL_OUTPUT_JSON:
-		nftnl_set_fprintf(stdout, nls, monh->format,
+		nftnl_set_fprintf(monh->ctx->octx->output_fp, nls, monh->format,
 				netlink_msg2nftnl_of(type));
-		fprintf(stdout, "\n");
+		nft_print(monh->ctx->octx, "\n");
 		break;
 	}
 out:
@@ -2266,9 +2811,9 @@ static int netlink_events_setelem_cb(const struct nlmsghdr *nlh, int type,
 		break;
 	case NFTNL_OUTPUT_XML:
 	case NFTNL_OUTPUT_JSON:
-		nftnl_set_fprintf(stdout, nls, monh->format,
+		nftnl_set_fprintf(monh->ctx->octx->output_fp, nls, monh->format,
 				  netlink_msg2nftnl_of(type));
-		fprintf(stdout, "\n");
+		nft_print(monh->ctx->octx, "\n");
 		break;
 	}
 out:
@@ -2311,9 +2856,9 @@ static int netlink_events_obj_cb(const struct nlmsghdr *nlh, int type,
 		break;
 	case NFTNL_OUTPUT_XML:
 	case NFTNL_OUTPUT_JSON:
-		nftnl_obj_fprintf(stdout, nlo, monh->format,
+		nftnl_obj_fprintf(monh->ctx->octx->output_fp, nlo, monh->format,
 				  netlink_msg2nftnl_of(type));
-		fprintf(stdout, "\n");
+		nft_print(monh->ctx->octx, "\n");
 		break;
 	}
 
@@ -2367,9 +2912,9 @@ static int netlink_events_rule_cb(const struct nlmsghdr *nlh, int type,
 		break;
 	case NFTNL_OUTPUT_XML:
 	case NFTNL_OUTPUT_JSON:
-		nftnl_rule_fprintf(stdout, nlr, monh->format,
+		nftnl_rule_fprintf(monh->ctx->octx->output_fp, nlr, monh->format,
 				 netlink_msg2nftnl_of(type));
-		fprintf(stdout, "\n");
+		nft_print(monh->ctx->octx, "\n");
 		break;
 	}
 
@@ -2568,12 +3113,171 @@ out:
 	nftnl_obj_free(nlo);
 }
 
-static void netlink_events_cache_update(struct netlink_mon_handler *monh,
-					const struct nlmsghdr *nlh, int type)
+/* Rules of the tables the monitor filter discards are not cached. */
+static struct table *netlink_events_cache_table(struct netlink_mon_handler *monh,
+						const struct handle *h)
+{
+	const struct handle *filter = monh->filter;
+
+	if (filter && filter->family != NFPROTO_UNSPEC &&
+	    filter->family != h->family)
+		return NULL;
+	if (filter && filter->table && strcmp(filter->table, h->table))
+		return NULL;
+
+	return table_lookup(h, monh->cache);
+}
+
+static struct chain *netlink_events_cache_chain(struct netlink_mon_handler *monh,
+						const struct handle *h)
+{
+	struct table *t;
+
+	t = netlink_events_cache_table(monh, h);
+	if (t == NULL)
+		return NULL;
+
+	return chain_lookup(t, h);
+}
+
+static void netlink_events_cache_addchain(struct netlink_mon_handler *monh,
+					  const struct nlmsghdr *nlh)
+{
+	struct nftnl_chain *nlc;
+	struct table *t;
+	struct chain *c;
+
+	nlc = netlink_chain_alloc(nlh);
+	c = netlink_delinearize_chain(monh->ctx, nlc);
+	nftnl_chain_free(nlc);
+
+	/* chain updates are reported as new chains too */
+	t = netlink_events_cache_table(monh, &c->handle);
+	if (t == NULL || chain_lookup(t, &c->handle) != NULL) {
+		chain_free(c);
+		return;
+	}
+
+	chain_add_hash(c, t);
+	chain_index_rules(c);
+}
+
+static void netlink_events_cache_delchain(struct netlink_mon_handler *monh,
+					  const struct nlmsghdr *nlh)
+{
+	struct nftnl_chain *nlc;
+	struct chain *c;
+	struct handle h;
+
+	memset(&h, 0, sizeof(h));
+	nlc      = netlink_chain_alloc(nlh);
+	h.family = nftnl_chain_get_u32(nlc, NFTNL_CHAIN_FAMILY);
+	h.table  = nftnl_chain_get_str(nlc, NFTNL_CHAIN_TABLE);
+	h.chain  = nftnl_chain_get_str(nlc, NFTNL_CHAIN_NAME);
+
+	c = netlink_events_cache_chain(monh, &h);
+	if (c != NULL) {
+		list_del(&c->list);
+		chain_free(c);
+	}
+	nftnl_chain_free(nlc);
+}
+
+/*
+ * The kernel reports the handle of the rule that comes before the new one,
+ * if there is any.
+ */
+static void netlink_events_cache_addrule(struct netlink_mon_handler *monh,
+					 const struct nlmsghdr *nlh)
+{
+	struct rule *rule, *prev;
+	struct nftnl_rule *nlr;
+	struct chain *c;
+	struct handle h;
+	uint64_t pos;
+
+	memset(&h, 0, sizeof(h));
+	nlr      = netlink_rule_alloc(nlh);
+	h.family = nftnl_rule_get_u32(nlr, NFTNL_RULE_FAMILY);
+	h.table  = nftnl_rule_get_str(nlr, NFTNL_RULE_TABLE);
+	h.chain  = nftnl_rule_get_str(nlr, NFTNL_RULE_CHAIN);
+
+	c = netlink_events_cache_chain(monh, &h);
+	if (c == NULL)
+		goto out;
+
+	rule = netlink_delinearize_rule(monh->ctx, nlr);
+	list_add(&rule->list, &c->rules);
+	if (nftnl_rule_is_set(nlr, NFTNL_RULE_POSITION)) {
+		pos = nftnl_rule_get_u64(nlr, NFTNL_RULE_POSITION);
+		list_for_each_entry(prev, &c->rules, list) {
+			if (prev->handle.handle.id == pos) {
+				list_move(&rule->list, &prev->list);
+				break;
+			}
+		}
+	}
+	chain_index_rules(c);
+out:
+	nftnl_rule_free(nlr);
+}
+
+static void netlink_events_cache_delrule(struct netlink_mon_handler *monh,
+					 const struct nlmsghdr *nlh)
+{
+	struct nftnl_rule *nlr;
+	struct rule *rule;
+	struct chain *c;
+	struct handle h;
+	uint64_t handle;
+
+	memset(&h, 0, sizeof(h));
+	nlr      = netlink_rule_alloc(nlh);
+	h.family = nftnl_rule_get_u32(nlr, NFTNL_RULE_FAMILY);
+	h.table  = nftnl_rule_get_str(nlr, NFTNL_RULE_TABLE);
+	h.chain  = nftnl_rule_get_str(nlr, NFTNL_RULE_CHAIN);
+	handle   = nftnl_rule_get_u64(nlr, NFTNL_RULE_HANDLE);
+
+	c = netlink_events_cache_chain(monh, &h);
+	if (c == NULL)
+		goto out;
+
+	list_for_each_entry(rule, &c->rules, list) {
+		if (rule->handle.handle.id == handle) {
+			list_del(&rule->list);
+			rule_free(rule);
+			break;
+		}
+	}
+	chain_index_rules(c);
+out:
+	nftnl_rule_free(nlr);
+}
+
+void netlink_events_cache_update(struct netlink_mon_handler *monh,
+				 const struct nlmsghdr *nlh, int type)
 {
 	if (!monh->cache_needed)
 		return;
 
+	/* rules are only cached to resolve the handles of trace events */
+	if (monh->cache_rules) {
+		switch (type) {
+		case NFT_MSG_NEWCHAIN:
+			netlink_events_cache_addchain(monh, nlh);
+			break;
+		case NFT_MSG_DELCHAIN:
+			netlink_events_cache_delchain(monh, nlh);
+			break;
+		case NFT_MSG_NEWRULE:
+			netlink_events_cache_addrule(monh, nlh);
+			break;
+		case NFT_MSG_DELRULE:
+			netlink_events_cache_delrule(monh, nlh);
+			break;
+		}
+	}
+
 	switch (type) {
 	case NFT_MSG_NEWTABLE:
 		netlink_events_cache_addtable(monh, nlh);
@@ -2600,14 +3304,19 @@ static void netlink_events_cache_update(struct netlink_mon_handler *monh,
 	}
 }
 
-static void trace_print_hdr(const struct nftnl_trace *nlt)
+static void trace_print_hdr(const struct nftnl_trace *nlt,
+			    struct output_ctx *octx)
 {
-	printf("trace id %08x ", nftnl_trace_get_u32(nlt, NFTNL_TRACE_ID));
-	printf("%s ", family2str(nftnl_trace_get_u32(nlt, NFTNL_TRACE_FAMILY)));
+	nft_print(octx, "trace id %08x ",
+		  nftnl_trace_get_u32(nlt, NFTNL_TRACE_ID));
+	nft_print(octx, "%s ",
+		  family2str(nftnl_trace_get_u32(nlt, NFTNL_TRACE_FAMILY)));
 	if (nftnl_trace_is_set(nlt, NFTNL_TRACE_TABLE))
-		printf("%s ", nftnl_trace_get_str(nlt, NFTNL_TRACE_TABLE));
+		nft_print(octx, "%s ",
+			  nftnl_trace_get_str(nlt, NFTNL_TRACE_TABLE));
 	if (nftnl_trace_is_set(nlt, NFTNL_TRACE_CHAIN))
-		printf("%s ", nftnl_trace_get_str(nlt, NFTNL_TRACE_CHAIN));
+		nft_print(octx, "%s ",
+			  nftnl_trace_get_str(nlt, NFTNL_TRACE_CHAIN));
 }
 
 static void trace_print_expr(const struct nftnl_trace *nlt, unsigned int attr,
@@ -2624,7 +3333,7 @@ static void trace_print_expr(const struct nftnl_trace *nlt, unsigned int attr,
 	rel  = relational_expr_alloc(&netlink_location, OP_EQ, lhs, rhs);
 
 	expr_print(rel, octx);
-	printf(" ");
+	nft_print(octx, " ");
 	expr_free(rel);
 }
 
@@ -2640,7 +3349,7 @@ static void trace_print_verdict(const struct nftnl_trace *nlt,
 		chain = xstrdup(nftnl_trace_get_str(nlt, NFTNL_TRACE_JUMP_TARGET));
 	expr = verdict_expr_alloc(&netlink_location, verdict, chain);
 
-	printf("verdict ");
+	nft_print(octx, "verdict ");
 	expr_print(expr, octx);
 	expr_free(expr);
 }
@@ -2674,12 +3383,12 @@ static void trace_print_rule(const struct nftnl_trace *nlt,
 	if (!rule)
 		return;
 
-	trace_print_hdr(nlt);
-	printf("rule ");
+	trace_print_hdr(nlt, octx);
+	nft_print(octx, "rule ");
 	rule_print(rule, octx);
-	printf(" (");
+	nft_print(octx, " (");
 	trace_print_verdict(nlt, octx);
-	printf(")\n");
+	nft_print(octx, ")\n");
 }
 
 static void trace_gen_stmts(struct list_head *stmts,
@@ -2788,9 +3497,9 @@ static void trace_print_packet(const struct nftnl_trace *nlt,
 	uint32_t nfproto;
 	struct stmt *stmt, *next;
 
-	trace_print_hdr(nlt);
+	trace_print_hdr(nlt, octx);
 
-	printf("packet: ");
+	nft_print(octx, "packet: ");
 	if (nftnl_trace_is_set(nlt, NFTNL_TRACE_IIF))
 		trace_print_expr(nlt, NFTNL_TRACE_IIF,
 				 meta_expr_alloc(&netlink_location,
@@ -2826,15 +3535,16 @@ static void trace_print_packet(const struct nftnl_trace *nlt,
 
 	list_for_each_entry_safe(stmt, next, &stmts, list) {
 		stmt_print(stmt, octx);
-		printf(" ");
+		nft_print(octx, " ");
 		stmt_free(stmt);
 	}
-	printf("\n");
+	nft_print(octx, "\n");
 }
 
 static int netlink_events_trace_cb(const struct nlmsghdr *nlh, int type,
 				   struct netlink_mon_handler *monh)
 {
+	struct output_ctx *octx = monh->ctx->octx;
 	struct nftnl_trace *nlt;
 
 	assert(type == NFT_MSG_TRACE);
@@ -2850,26 +3560,26 @@ static int netlink_events_trace_cb(const struct nlmsghdr *nlh, int type,
 	case NFT_TRACETYPE_RULE:
 		if (nftnl_trace_is_set(nlt, NFTNL_TRACE_LL_HEADER) ||
 		    nftnl_trace_is_set(nlt, NFTNL_TRACE_NETWORK_HEADER))
-			trace_print_packet(nlt, monh->ctx->octx);
+			trace_print_packet(nlt, octx);
 
 		if (nftnl_trace_is_set(nlt, NFTNL_TRACE_RULE_HANDLE))
-			trace_print_rule(nlt, monh->ctx->octx, monh->cache);
+			trace_print_rule(nlt, octx, monh->cache);
 		break;
 	case NFT_TRACETYPE_POLICY:
 	case NFT_TRACETYPE_RETURN:
-		trace_print_hdr(nlt);
+		trace_print_hdr(nlt, octx);
 
 		if (nftnl_trace_is_set(nlt, NFTNL_TRACE_VERDICT)) {
-			trace_print_verdict(nlt, monh->ctx->octx);
-			printf(" ");
+			trace_print_verdict(nlt, octx);
+			nft_print(octx, " ");
 		}
 
 		if (nftnl_trace_is_set(nlt, NFTNL_TRACE_MARK))
 			trace_print_expr(nlt, NFTNL_TRACE_MARK,
 					 meta_expr_alloc(&netlink_location,
 							 NFT_META_MARK),
-					 monh->ctx->octx);
-		printf("\n");
+					 octx);
+		nft_print(octx, "\n");
 		break;
 	}
 
@@ -2903,12 +3613,13 @@ static const char *nftnl_msgtype2str(uint16_t type)
 	return nftnl_msg_types[type];
 }
 
-static void netlink_events_debug(uint16_t type, unsigned int debug_mask)
+static void netlink_events_debug(uint16_t type,
+				 const struct netlink_mon_handler *monh)
 {
-	if (!(debug_mask & NFT_DEBUG_NETLINK))
+	if (!(monh->debug_mask & NFT_DEBUG_NETLINK))
 		return;
 
-	printf("netlink event: %s\n", nftnl_msgtype2str(type));
+	nft_print(monh->ctx->octx, "netlink event: %s\n", nftnl_msgtype2str(type));
 }
 
 static int netlink_events_newgen_cb(const struct nlmsghdr *nlh, int type,
@@ -2950,17 +3661,366 @@ static int netlink_events_newgen_cb(const struct nlmsghdr *nlh, int type,
 	return MNL_CB_OK;
 }
 
+/**
+ * struct netlink_event_attrs - attributes naming the object of an event
+ *
+ * @table:	attribute holding the table name
+ * @chain:	attribute holding the chain name
+ * @set:	attribute holding the set name
+ * @obj:	attribute holding the stateful object name
+ *
+ * Zero (i.e. the unspec attribute) if the event carries no such name.
+ */
+struct netlink_event_attrs {
+	uint16_t	table;
+	uint16_t	chain;
+	uint16_t	set;
+	uint16_t	obj;
+};
+
+static const struct netlink_event_attrs netlink_event_attrs[NFT_MSG_MAX] = {
+	[NFT_MSG_NEWTABLE]	= { .table = NFTA_TABLE_NAME },
+	[NFT_MSG_DELTABLE]	= { .table = NFTA_TABLE_NAME },
+	[NFT_MSG_NEWCHAIN]	= { .table = NFTA_CHAIN_TABLE,
+				    .chain = NFTA_CHAIN_NAME },
+	[NFT_MSG_DELCHAIN]	= { .table = NFTA_CHAIN_TABLE,
+				    .chain = NFTA_CHAIN_NAME },
+	[NFT_MSG_NEWRULE]	= { .table = NFTA_RULE_TABLE,
+				    .chain = NFTA_RULE_CHAIN },
+	[NFT_MSG_DELRULE]	= { .table = NFTA_RULE_TABLE,
+				    .chain = NFTA_RULE_CHAIN },
+	[NFT_MSG_NEWSET]	= { .table = NFTA_SET_TABLE,
+				    .set = NFTA_SET_NAME },
+	[NFT_MSG_DELSET]	= { .table = NFTA_SET_TABLE,
+				    .set = NFTA_SET_NAME },
+	[NFT_MSG_NEWSETELEM]	= { .table = NFTA_SET_ELEM_LIST_TABLE,
+				    .set = NFTA_SET_ELEM_LIST_SET },
+	[NFT_MSG_DELSETELEM]	= { .table = NFTA_SET_ELEM_LIST_TABLE,
+				    .set = NFTA_SET_ELEM_LIST_SET },
+	[NFT_MSG_TRACE]		= { .table = NFTA_TRACE_TABLE,
+				    .chain = NFTA_TRACE_CHAIN },
+	[NFT_MSG_NEWOBJ]	= { .table = NFTA_OBJ_TABLE,
+				    .obj = NFTA_OBJ_NAME },
+	[NFT_MSG_DELOBJ]	= { .table = NFTA_OBJ_TABLE,
+				    .obj = NFTA_OBJ_NAME },
+};
+
+/**
+ * struct netlink_event_names - names of the object of an event
+ *
+ * @family:	nfnetlink family
+ * @table:	table name
+ * @chain:	chain name
+ * @set:	set name
+ * @obj:	stateful object name
+ *
+ * Names point into the netlink message, NULL if not present.
+ */
+struct netlink_event_names {
+	uint32_t	family;
+	const char	*table;
+	const char	*chain;
+	const char	*set;
+	const char	*obj;
+};
+
+/*
+ * Fetch the object names straight from the netlink attributes, this is
+ * cheap enough to run on every event, unlike the nftnl object parsers.
+ */
+static void netlink_event_names_parse(const struct nlmsghdr *nlh,
+				      uint16_t type,
+				      struct netlink_event_names *names)
+{
+	const struct nfgenmsg *nfg = mnl_nlmsg_get_payload(nlh);
+	const struct netlink_event_attrs *attrs;
+	const struct nlattr *attr;
+	uint16_t attr_type;
+	const char *name;
+
+	memset(names, 0, sizeof(*names));
+	names->family = nfg->nfgen_family;
+
+	if (type >= NFT_MSG_MAX)
+		return;
+	attrs = &netlink_event_attrs[type];
+	if (!attrs->table)
+		return;
+
+	mnl_attr_for_each(attr, nlh, sizeof(struct nfgenmsg)) {
+		attr_type = mnl_attr_get_type(attr);
+		if (attr_type != attrs->table && attr_type != attrs->chain &&
+		    attr_type != attrs->set && attr_type != attrs->obj)
+			continue;
+		if (mnl_attr_validate(attr, MNL_TYPE_NUL_STRING) < 0)
+			continue;
+
+		name = mnl_attr_get_str(attr);
+		if (attr_type == attrs->table)
+			names->table = name;
+		else if (attr_type == attrs->chain)
+			names->chain = name;
+		else if (attr_type == attrs->set)
+			names->set = name;
+		else
+			names->obj = name;
+	}
+}
+
+static bool netlink_event_name_match(const char *filter, const char *name)
+{
+	return name != NULL && !strcmp(filter, name);
+}
+
+/* Family and table filters, these apply before the cache is updated. */
+static bool netlink_events_filter_table(const struct handle *filter,
+					uint16_t type,
+					const struct netlink_event_names *names)
+{
+	/* generation events close a batch, they belong to no table */
+	if (type == NFT_MSG_NEWGEN)
+		return true;
+
+	if (filter->family != NFPROTO_UNSPEC &&
+	    filter->family != names->family)
+		return false;
+	if (filter->table && !netlink_event_name_match(filter->table,
+						       names->table))
+		return false;
+
+	return true;
+}
+
+/*
+ * Chain and set filters. An event passes if it refers to one of the given
+ * objects, i.e. with "chain foo set bar" both the events of chain foo and
+ * its rules and those of set bar and its elements are shown.
+ */
+static bool netlink_events_filter_object(const struct handle *filter,
+					 uint16_t type,
+					 const struct netlink_event_names *names)
+{
+	if (type == NFT_MSG_NEWGEN || (!filter->chain && !filter->set))
+		return true;
+
+	if (filter->chain && netlink_event_name_match(filter->chain,
+						      names->chain))
+		return true;
+	if (filter->set && netlink_event_name_match(filter->set, names->set))
+		return true;
+
+	return false;
+}
+
+#define NETLINK_EVENT_COUNT_HSIZE	1024
+
+/**
+ * struct netlink_event_count - events received for an object
+ *
+ * @hnode:	hash table node
+ * @list:	list node, in order of appearance
+ * @kind:	first event type of the object kind, e.g. NFT_MSG_NEWRULE
+ * @family:	nfnetlink family
+ * @table:	table name
+ * @name:	object name, NULL for tables
+ * @events:	events received since the last report, per add and delete
+ */
+struct netlink_event_count {
+	struct hlist_node	hnode;
+	struct list_head	list;
+	uint16_t		kind;
+	uint32_t		family;
+	char			*table;
+	char			*name;
+	uint64_t		events[2];
+};
+
+/**
+ * struct netlink_event_counts - per object event counters
+ *
+ * @monh:	monitor handler
+ * @hash:	counters hashed by object
+ * @list:	counters, in order of appearance
+ */
+struct netlink_event_counts {
+	struct netlink_mon_handler	*monh;
+	struct hlist_head		hash[NETLINK_EVENT_COUNT_HSIZE];
+	struct list_head		list;
+};
+
+static const char *const netlink_event_kind_name[NFT_MSG_MAX] = {
+	[NFT_MSG_NEWTABLE]	= "table",
+	[NFT_MSG_NEWCHAIN]	= "chain",
+	[NFT_MSG_NEWRULE]	= "rules",
+	[NFT_MSG_NEWSET]	= "set",
+	[NFT_MSG_NEWSETELEM]	= "elements",
+	[NFT_MSG_TRACE]		= "trace",
+	[NFT_MSG_NEWOBJ]	= "obj",
+};
+
+/* Map an event type to the object kind it is accounted to. */
+static uint16_t netlink_event_kind(uint16_t type, unsigned int *del)
+{
+	*del = 0;
+	switch (type) {
+	case NFT_MSG_DELTABLE:
+	case NFT_MSG_DELCHAIN:
+	case NFT_MSG_DELRULE:
+	case NFT_MSG_DELSET:
+	case NFT_MSG_DELSETELEM:
+	case NFT_MSG_DELOBJ:
+		/* deletions come two after the creation of the same kind */
+		*del = 1;
+		return type - 2;
+	default:
+		return type;
+	}
+}
+
+static uint32_t netlink_event_count_hash(uint16_t kind, uint32_t family,
+					 const char *table, const char *name)
+{
+	uint32_t hash = 2166136261U ^ (kind << 8) ^ family;
+
+	while (*table)
+		hash = (hash ^ (unsigned char)*table++) * 16777619U;
+	while (name && *name)
+		hash = (hash ^ (unsigned char)*name++) * 16777619U;
+
+	return hash % NETLINK_EVENT_COUNT_HSIZE;
+}
+
+static void netlink_events_count(struct netlink_event_counts *counts,
+				 uint16_t type,
+				 const struct netlink_event_names *names)
+{
+	struct netlink_event_count *cnt;
+	struct hlist_node *n;
+	const char *name;
+	unsigned int del;
+	uint16_t kind;
+	uint32_t hash;
+
+	kind = netlink_event_kind(type, &del);
+	if (kind >= NFT_MSG_MAX || !netlink_event_kind_name[kind] ||
+	    names->table == NULL)
+		return;
+
+	name = names->chain ? names->chain : names->set ? names->set :
+	       names->obj;
+	if (kind == NFT_MSG_NEWTABLE)
+		name = NULL;
+
+	hash = netlink_event_count_hash(kind, names->family, names->table,
+					name);
+	hlist_for_each_entry(cnt, n, &counts->hash[hash], hnode) {
+		if (cnt->kind == kind && cnt->family == names->family &&
+		    !strcmp(cnt->table, names->table) &&
+		    (name ? cnt->name && !strcmp(cnt->name, name) :
+			    cnt->name == NULL))
+			goto found;
+	}
+
+	cnt = xzalloc(sizeof(*cnt));
+	cnt->kind = kind;
+	cnt->family = names->family;
+	cnt->table = xstrdup(names->table);
+	if (name)
+		cnt->name = xstrdup(name);
+	hlist_add_head(&cnt->hnode, &counts->hash[hash]);
+	list_add_tail(&cnt->list, &counts->list);
+found:
+	cnt->events[del]++;
+}
+
+/* Print the event rate of every object that saw events, then reset. */
+static void netlink_events_count_report(void *data, uint64_t msecs)
+{
+	struct netlink_event_counts *counts = data;
+	struct netlink_mon_handler *monh = counts->monh;
+	struct netlink_event_count *cnt;
+
+	list_for_each_entry(cnt, &counts->list, list) {
+		if (!cnt->events[0] && !cnt->events[1])
+			continue;
+
+		nft_mon_print(monh, "%s %s %s", netlink_event_kind_name[cnt->kind],
+			      family2str(cnt->family), cnt->table);
+		if (cnt->name)
+			nft_mon_print(monh, " %s", cnt->name);
+		nft_mon_print(monh, ":");
+		if (cnt->kind == NFT_MSG_TRACE) {
+			nft_mon_print(monh, " %llu packets/s",
+				      (unsigned long long)(cnt->events[0] * 1000 / msecs));
+		} else {
+			if (cnt->events[0])
+				nft_mon_print(monh, " %llu add/s",
+					      (unsigned long long)(cnt->events[0] * 1000 / msecs));
+			if (cnt->events[1])
+				nft_mon_print(monh, " %llu delete/s",
+					      (unsigned long long)(cnt->events[1] * 1000 / msecs));
+		}
+		nft_mon_print(monh, "\n");
+
+		cnt->events[0] = cnt->events[1] = 0;
+	}
+}
+
+static void netlink_events_counts_free(struct netlink_event_counts *counts)
+{
+	struct netlink_event_count *cnt, *next;
+
+	list_for_each_entry_safe(cnt, next, &counts->list, list) {
+		xfree(cnt->table);
+		xfree(cnt->name);
+		xfree(cnt);
+	}
+}
+
+static int netlink_events_count_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct netlink_event_counts *counts = data;
+	struct netlink_mon_handler *monh = counts->monh;
+	uint16_t type = NFNL_MSG_TYPE(nlh->nlmsg_type);
+	struct netlink_event_names names;
+
+	netlink_events_debug(type, monh);
+
+	if (type >= NFT_MSG_MAX || !(monh->monitor_flags & (1 << type)))
+		return MNL_CB_OK;
+
+	netlink_event_names_parse(nlh, type, &names);
+	if (!netlink_events_filter_table(monh->filter, type, &names) ||
+	    !netlink_events_filter_object(monh->filter, type, &names))
+		return MNL_CB_OK;
+
+	netlink_events_count(counts, type, &names);
+	return MNL_CB_OK;
+}
+
 static int netlink_events_cb(const struct nlmsghdr *nlh, void *data)
 {
 	int ret = MNL_CB_OK;
 	uint16_t type = NFNL_MSG_TYPE(nlh->nlmsg_type);
 	struct netlink_mon_handler *monh = (struct netlink_mon_handler *)data;
+	struct netlink_event_names names;
+
+	netlink_events_debug(type, monh);
+
+	/* filter on the raw attributes, before any object is built */
+	if (monh->filter) {
+		netlink_event_names_parse(nlh, type, &names);
+		if (!netlink_events_filter_table(monh->filter, type, &names))
+			return ret;
+	}
 
-	netlink_events_debug(type, monh->debug_mask);
 	netlink_events_cache_update(monh, nlh, type);
 
 	if (!(monh->monitor_flags & (1 << type)))
 		return ret;
+	if (monh->filter &&
+	    !netlink_events_filter_object(monh->filter, type, &names))
+		return ret;
 
 	switch (type) {
 	case NFT_MSG_NEWTABLE:
@@ -2994,11 +4054,105 @@ static int netlink_events_cb(const struct nlmsghdr *nlh, void *data)
 		ret = netlink_events_newgen_cb(nlh, type, monh);
 		break;
 	}
-	fflush(stdout);
 
 	return ret;
 }
 
+/**
+ * struct netlink_echo_attrs - attributes an echoed object is reported from
+ *
+ * @msg:	message type
+ * @type:	echo object type
+ * @table:	table name attribute
+ * @chain:	chain name attribute, 0 if none
+ * @name:	set or object name attribute, 0 if none
+ * @handle:	handle attribute, 0 if none
+ * @id:		set ID attribute, 0 if none
+ */
+struct netlink_echo_attrs {
+	uint16_t		msg;
+	enum nft_echo_type	type;
+	uint16_t		table;
+	uint16_t		chain;
+	uint16_t		name;
+	uint16_t		handle;
+	uint16_t		id;
+};
+
+static const struct netlink_echo_attrs netlink_echo_attrs[] = {
+	{ NFT_MSG_NEWTABLE, NFT_ECHO_TABLE, NFTA_TABLE_NAME, 0, 0, 0, 0 },
+	{ NFT_MSG_NEWCHAIN, NFT_ECHO_CHAIN, NFTA_CHAIN_TABLE, NFTA_CHAIN_NAME,
+	  0, NFTA_CHAIN_HANDLE, 0 },
+	{ NFT_MSG_NEWRULE, NFT_ECHO_RULE, NFTA_RULE_TABLE, NFTA_RULE_CHAIN,
+	  0, NFTA_RULE_HANDLE, 0 },
+	{ NFT_MSG_NEWSET, NFT_ECHO_SET, NFTA_SET_TABLE, 0, NFTA_SET_NAME,
+	  0, NFTA_SET_ID },
+	{ NFT_MSG_NEWOBJ, NFT_ECHO_OBJ, NFTA_OBJ_TABLE, 0, NFTA_OBJ_NAME,
+	  0, 0 },
+};
+
+/*
+ * Report an echoed object to the echo callback and the command results. Only
+ * the names, handle and set ID are read from the message, nothing else is
+ * parsed.
+ */
+static void netlink_echo_report(const struct nlmsghdr *nlh,
+				const struct output_ctx *octx)
+{
+	const struct nfgenmsg *nfg = mnl_nlmsg_get_payload(nlh);
+	const struct netlink_echo_attrs *a = NULL;
+	struct nft_echo_object obj = {};
+	const struct nlattr *attr;
+	uint16_t type;
+	unsigned int i;
+
+	for (i = 0; i < array_size(netlink_echo_attrs); i++) {
+		if (netlink_echo_attrs[i].msg == NFNL_MSG_TYPE(nlh->nlmsg_type)) {
+			a = &netlink_echo_attrs[i];
+			break;
+		}
+	}
+	if (a == NULL)
+		return;
+
+	obj.type = a->type;
+	obj.family = nfg->nfgen_family;
+	obj.seqnum = nlh->nlmsg_seq;
+
+	mnl_attr_for_each(attr, nlh, sizeof(struct nfgenmsg)) {
+		type = mnl_attr_get_type(attr);
+		if (type == 0)
+			continue;
+
+		if (type == a->table || type == a->chain || type == a->name) {
+			if (mnl_attr_validate(attr, MNL_TYPE_NUL_STRING) < 0)
+				continue;
+			if (type == a->table)
+				obj.table = mnl_attr_get_str(attr);
+			else if (type == a->chain)
+				obj.chain = mnl_attr_get_str(attr);
+			else
+				obj.name = mnl_attr_get_str(attr);
+		} else if (type == a->handle) {
+			if (mnl_attr_validate(attr, MNL_TYPE_U64) < 0)
+				continue;
+			obj.handle = be64toh(mnl_attr_get_u64(attr));
+		} else if (type == a->id) {
+			if (mnl_attr_validate(attr, MNL_TYPE_U32) < 0)
+				continue;
+			obj.set_id = ntohl(mnl_attr_get_u32(attr));
+		}
+	}
+
+	if (obj.table == NULL)
+		return;
+
+	if (octx->echo_cb != NULL)
+		octx->echo_cb(&obj, octx->echo_data);
+	if (octx->results != NULL)
+		cmd_results_add(octx->results, &obj);
+}
+
 int netlink_echo_callback(const struct nlmsghdr *nlh, void *data)
 {
 	struct netlink_ctx *ctx = data;
@@ -3012,6 +4166,9 @@ int netlink_echo_callback(const struct nlmsghdr *nlh, void *data)
 		.debug_mask = ctx->debug_mask,
 	};
 
+	if (ctx->octx->echo_cb != NULL || ctx->octx->results != NULL)
+		netlink_echo_report(nlh, ctx->octx);
+
 	if (!echo_monh.ctx->octx->echo)
 		return MNL_CB_OK;
 
@@ -3019,32 +4176,64 @@ int netlink_echo_callback(const struct nlmsghdr *nlh, void *data)
 }
 
 int netlink_monitor(struct netlink_mon_handler *monhandler,
-		    struct mnl_socket *nf_sock)
+		    struct nft_sock *nf_sock)
 {
 	int group;
 
 	if (monhandler->monitor_flags & (1 << NFT_MSG_TRACE)) {
 		group = NFNLGRP_NFTRACE;
-		if (mnl_socket_setsockopt(nf_sock, NETLINK_ADD_MEMBERSHIP,
-					  &group, sizeof(int)) < 0)
+		if (nft_sock_setsockopt(nf_sock, SOL_NETLINK,
+					NETLINK_ADD_MEMBERSHIP, &group,
+					sizeof(int)) < 0)
 			return netlink_io_error(monhandler->ctx,
 						monhandler->loc,
 						"Could not bind to netlink socket %s",
 						strerror(errno));
 	}
-	if (monhandler->monitor_flags & ~(1 << NFT_MSG_TRACE)) {
+	/* ruleset events keep the rules cached for tracing current */
+	if (monhandler->monitor_flags & ~(1 << NFT_MSG_TRACE) ||
+	    monhandler->cache_rules) {
 		group = NFNLGRP_NFTABLES;
-		if (mnl_socket_setsockopt(nf_sock, NETLINK_ADD_MEMBERSHIP,
-					  &group, sizeof(int)) < 0)
+		if (nft_sock_setsockopt(nf_sock, SOL_NETLINK,
+					NETLINK_ADD_MEMBERSHIP, &group,
+					sizeof(int)) < 0)
 			return netlink_io_error(monhandler->ctx,
 						monhandler->loc,
 						"Could not bind to netlink socket %s",
 						strerror(errno));
 	}
 
+	if (monhandler->mode == MONITOR_MODE_PROFILE) {
+		struct trace_profile *profile;
+		int ret;
+
+		profile = trace_profile_alloc(monhandler);
+		ret = mnl_nft_event_listener(nf_sock, monhandler->debug_mask,
+					     monhandler->ctx->octx,
+					     trace_profile_event_cb, profile,
+					     trace_profile_report);
+		trace_profile_free(profile);
+		return ret;
+	}
+
+	if (monhandler->mode == MONITOR_MODE_COUNTS) {
+		struct netlink_event_counts counts = {
+			.monh	= monhandler,
+		};
+		int ret;
+
+		init_list_head(&counts.list);
+		ret = mnl_nft_event_listener(nf_sock, monhandler->debug_mask,
+					     monhandler->ctx->octx,
+					     netlink_events_count_cb, &counts,
+					     netlink_events_count_report);
+		netlink_events_counts_free(&counts);
+		return ret;
+	}
+
 	return mnl_nft_event_listener(nf_sock, monhandler->debug_mask,
 				      monhandler->ctx->octx, netlink_events_cb,
-				      monhandler);
+				      monhandler, NULL);
 }
 
 static int netlink_markup_setelems(const struct nftnl_parse_ctx *ctx)
@@ -3331,7 +4520,7 @@ int netlink_markup_parse_cb(const struct nftnl_parse_ctx *ctx)
 	return 0;
 }
 
-bool netlink_batch_supported(struct mnl_socket *nf_sock, uint32_t *seqnum)
+bool netlink_batch_supported(struct nft_sock *nf_sock, uint32_t *seqnum)
 {
 	return mnl_batch_supported(nf_sock, seqnum);
 }
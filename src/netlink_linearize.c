@@ -18,6 +18,7 @@
 #include <netlink.h>
 #include <gmputil.h>
 #include <utils.h>
+#include <stats.h>
 #include <netinet/in.h>
 
 #include <linux/netfilter.h>
@@ -1311,8 +1312,10 @@ void netlink_linearize_rule(struct netlink_ctx *ctx, struct nftnl_rule *nlr,
 			    const struct rule *rule)
 {
 	struct netlink_linearize_ctx lctx;
+	enum nft_stats_phase phase;
 	const struct stmt *stmt;
 
+	phase = stats_phase_enter(ctx->octx, NFT_STATS_LINEARIZE);
 	memset(&lctx, 0, sizeof(lctx));
 	lctx.reg_low = NFT_REG_1;
 	lctx.nlr = nlr;
@@ -1337,5 +1340,6 @@ void netlink_linearize_rule(struct netlink_ctx *ctx, struct nftnl_rule *nlr,
 		nftnl_udata_buf_free(udata);
 	}
 
+	stats_phase_leave(ctx->octx, phase);
 	netlink_dump_rule(nlr, ctx);
 }
@@ -32,11 +32,12 @@
 #include <headers.h>
 #include <utils.h>
 #include <parser.h>
+#include <include_cache.h>
 #include <erec.h>
 
 #include "parser_bison.h"
 
-void parser_init(struct mnl_socket *nf_sock, struct nft_cache *cache,
+void parser_init(struct nft_sock *nf_sock, struct nft_cache *cache,
 		 struct parser_state *state, struct list_head *msgs,
 		 unsigned int debug_mask, struct output_ctx *octx)
 {
@@ -52,6 +53,18 @@ void parser_init(struct mnl_socket *nf_sock, struct nft_cache *cache,
 	state->ectx.octx = octx;
 }
 
+/*
+ * Evaluated commands either go to the callback, which runs and releases them
+ * as they come, or are queued to be run once the whole input is parsed.
+ */
+void parser_add_cmds(struct parser_state *state, struct list_head *cmds)
+{
+	if (state->cmd_cb != NULL)
+		state->cmd_cb(state, cmds, state->cmd_data);
+	else
+		list_splice_tail(cmds, &state->cmds);
+}
+
 static void yyerror(struct location *loc, struct nft_ctx *nft, void *scanner,
 		    struct parser_state *state, const char *s)
 {
@@ -107,6 +120,40 @@ static void location_update(struct location *loc, struct location *rhs, int n)
 #define symbol_value(loc, str) \
 	symbol_expr_alloc(loc, SYMBOL_VALUE, current_scope(state), str)
 
+/* Monitor modes are not keywords, they would be reserved everywhere else. */
+static int monitor_mode_parse(const char *str)
+{
+	if (!strcmp(str, "counts"))
+		return MONITOR_MODE_COUNTS;
+	if (!strcmp(str, "profile"))
+		return MONITOR_MODE_PROFILE;
+	return -1;
+}
+
+static struct cmd *monitor_cmd_alloc(struct parser_state *state,
+				     const struct location *loc,
+				     const struct location *event_loc,
+				     const char *event, uint32_t type,
+				     struct handle *h, int mode,
+				     uint32_t format,
+				     const struct location *format_loc)
+{
+	struct monitor *m;
+
+	if (mode != MONITOR_MODE_EVENTS && format != NFTNL_OUTPUT_DEFAULT) {
+		erec_queue(error(format_loc, "output format is not supported in this mode"),
+			   state->msgs);
+		xfree(event);
+		handle_free(h);
+		return NULL;
+	}
+
+	m = monitor_alloc(format, type, event);
+	m->location = *event_loc;
+	m->mode = mode;
+	return cmd_alloc(CMD_MONITOR, CMD_OBJ_MONITOR, h, loc, m);
+}
+
 /* Declare those here to avoid compiler warnings */
 void nft_set_debug(int, void *);
 int nft_lex(void *, void *, void *);
@@ -472,6 +519,7 @@ int nft_lex(void *, void *, void *);
 %token SEED			"seed"
 
 %token POSITION			"position"
+%token INDEX			"index"
 %token COMMENT			"comment"
 
 %token XML			"xml"
@@ -499,8 +547,8 @@ int nft_lex(void *, void *, void *);
 %type <cmd>			base_cmd add_cmd replace_cmd create_cmd insert_cmd delete_cmd list_cmd reset_cmd flush_cmd rename_cmd export_cmd monitor_cmd describe_cmd import_cmd
 %destructor { cmd_free($$); }	base_cmd add_cmd replace_cmd create_cmd insert_cmd delete_cmd list_cmd reset_cmd flush_cmd rename_cmd export_cmd monitor_cmd describe_cmd import_cmd
 
-%type <handle>			table_spec chain_spec chain_identifier ruleid_spec handle_spec position_spec rule_position ruleset_spec
-%destructor { handle_free(&$$); } table_spec chain_spec chain_identifier ruleid_spec handle_spec position_spec rule_position ruleset_spec
+%type <handle>			table_spec chain_spec chain_identifier ruleid_spec handle_spec position_spec index_spec rule_position ruleset_spec
+%destructor { handle_free(&$$); } table_spec chain_spec chain_identifier ruleid_spec handle_spec position_spec index_spec rule_position ruleset_spec
 %type <handle>			set_spec set_identifier obj_spec obj_identifier
 %destructor { handle_free(&$$); } set_spec set_identifier obj_spec obj_identifier
 %type <val>			family_spec family_spec_explicit chain_policy prio_spec
@@ -686,9 +734,9 @@ int nft_lex(void *, void *, void *);
 %type <val>			fib_tuple	fib_result	fib_flag
 
 %type <val>			markup_format
-%type <string>			monitor_event
-%destructor { xfree($$); }	monitor_event
-%type <val>			monitor_object	monitor_format
+%type <val>			monitor_object	monitor_object_spec	monitor_format	monitor_mode
+%type <handle>			monitor_filter	monitor_filter_spec
+%destructor { handle_free(&$$); } monitor_filter	monitor_filter_spec
 
 %type <counter>			counter_config
 %destructor { xfree($$); }	counter_config
@@ -721,6 +769,7 @@ input			:	/* empty */
 					LIST_HEAD(list);
 
 					$2->location = @2;
+					include_cache_record_cmd(state, $2);
 
 					list_add_tail(&$2->list, &list);
 					if (cmd_evaluate(&state->ectx, $2) < 0) {
@@ -728,7 +777,7 @@ input			:	/* empty */
 						if (++state->nerrs == nft->parser_max_errors)
 							YYABORT;
 					} else
-						list_splice_tail(&list, &state->cmds);
+						parser_add_cmds(state, &list);
 				}
 			}
 			;
@@ -761,6 +810,7 @@ common_block		:	INCLUDE		QUOTED_STRING	stmt_separator
 				}
 
 				symbol_bind(scope, $2, $4);
+				include_cache_record_define(state, &@$, $2, $4);
 				xfree($2);
 			}
 			|	error		stmt_separator
@@ -789,6 +839,7 @@ line			:	common_block			{ $$ = NULL; }
 					LIST_HEAD(list);
 
 					$1->location = @1;
+					include_cache_record_cmd(state, $1);
 
 					list_add_tail(&$1->list, &list);
 					if (cmd_evaluate(&state->ectx, $1) < 0) {
@@ -796,7 +847,7 @@ line			:	common_block			{ $$ = NULL; }
 						if (++state->nerrs == nft->parser_max_errors)
 							YYABORT;
 					} else
-						list_splice_tail(&list, &state->cmds);
+						parser_add_cmds(state, &list);
 				}
 				if (state->nerrs)
 					YYABORT;
@@ -871,6 +922,38 @@ add_cmd			:	TABLE		table_spec
 			{
 				$$ = cmd_alloc(CMD_ADD, CMD_OBJ_SETELEM, &$2, &@$, $3);
 			}
+			|	ELEMENT		set_spec	STRING	STRING	QUOTED_STRING	STRING	STRING
+			{
+				enum setelem_file_format format = SETELEM_FILE_RAW;
+				bool valid = true;
+
+				/* not keywords, they would be reserved everywhere else */
+				if (strcmp($3, "from") || strcmp($4, "file") ||
+				    strcmp($6, "format")) {
+					erec_queue(error(&@3, "syntax error, expected from file \"<path>\" format <format>"),
+						   state->msgs);
+					valid = false;
+				} else if (!strcmp($7, "csv")) {
+					format = SETELEM_FILE_CSV;
+				} else if (strcmp($7, "raw")) {
+					erec_queue(error(&@7, "unknown element file format %s", $7),
+						   state->msgs);
+					valid = false;
+				}
+				xfree($3);
+				xfree($4);
+				xfree($6);
+				xfree($7);
+
+				if (!valid) {
+					xfree($5);
+					handle_free(&$2);
+					YYERROR;
+				}
+				$$ = cmd_alloc(CMD_ADD, CMD_OBJ_SETELEM_FILE, &$2, &@$,
+					       setelem_file_alloc(&@5, $5, format));
+				xfree($5);
+			}
 			|	COUNTER		obj_spec
 			{
 				struct obj *obj;
@@ -903,6 +986,10 @@ replace_cmd		:	RULE		ruleid_spec	rule
 			{
 				$$ = cmd_alloc(CMD_REPLACE, CMD_OBJ_RULE, &$2, &@$, $3);
 			}
+			|	ELEMENT		set_spec	set_block_expr
+			{
+				$$ = cmd_alloc(CMD_REPLACE, CMD_OBJ_SETELEM, &$2, &@$, $3);
+			}
 			;
 
 create_cmd		:	TABLE		table_spec
@@ -1214,21 +1301,62 @@ export_cmd		:	RULESET		markup_format
 			}
 			;
 
-monitor_cmd		:	monitor_event	monitor_object	monitor_format
+/*
+ * The event and the mode are both words, a leading one is the event unless
+ * it is the only one and names a mode.
+ */
+monitor_cmd		:	STRING	monitor_object	monitor_filter	monitor_mode	monitor_format
+			{
+				const char *event = $1;
+				int mode = $4;
+
+				if (mode == MONITOR_MODE_EVENTS) {
+					mode = monitor_mode_parse($1);
+					if (mode < 0) {
+						mode = MONITOR_MODE_EVENTS;
+					} else {
+						xfree($1);
+						event = NULL;
+					}
+				}
+
+				$$ = monitor_cmd_alloc(state, &@$, &@1, event, $2,
+						       &$3, mode, $5, &@5);
+				if ($$ == NULL)
+					YYERROR;
+			}
+			|	monitor_object_spec	monitor_filter	monitor_mode	monitor_format
 			{
-				struct handle h = { .family = NFPROTO_UNSPEC };
-				struct monitor *m = monitor_alloc($3, $2, $1);
-				m->location = @1;
-				$$ = cmd_alloc(CMD_MONITOR, CMD_OBJ_MONITOR, &h, &@$, m);
+				$$ = monitor_cmd_alloc(state, &@$, &@1, NULL, $1,
+						       &$2, $3, $4, &@4);
+				if ($$ == NULL)
+					YYERROR;
 			}
-			;
+			|	monitor_filter_spec	monitor_mode	monitor_format
+			{
+				$$ = monitor_cmd_alloc(state, &@$, &@1, NULL,
+						       CMD_MONITOR_OBJ_ANY, &$1, $2,
+						       $3, &@3);
+				if ($$ == NULL)
+					YYERROR;
+			}
+			|	monitor_format
+			{
+				struct handle h = {
+					.family	= NFPROTO_UNSPEC,
+				};
 
-monitor_event		:	/* empty */	{ $$ = NULL; }
-			|       STRING		{ $$ = $1; }
+				$$ = monitor_cmd_alloc(state, &@$, &@$, NULL,
+						       CMD_MONITOR_OBJ_ANY, &h,
+						       MONITOR_MODE_EVENTS, $1, &@1);
+			}
 			;
 
 monitor_object		:	/* empty */	{ $$ = CMD_MONITOR_OBJ_ANY; }
-			| 	TABLES		{ $$ = CMD_MONITOR_OBJ_TABLES; }
+			|	monitor_object_spec
+			;
+
+monitor_object_spec	: 	TABLES		{ $$ = CMD_MONITOR_OBJ_TABLES; }
 			| 	CHAINS		{ $$ = CMD_MONITOR_OBJ_CHAINS; }
 			| 	SETS		{ $$ = CMD_MONITOR_OBJ_SETS; }
 			|	RULES		{ $$ = CMD_MONITOR_OBJ_RULES; }
@@ -1237,6 +1365,55 @@ monitor_object		:	/* empty */	{ $$ = CMD_MONITOR_OBJ_ANY; }
 			|	TRACE		{ $$ = CMD_MONITOR_OBJ_TRACE; }
 			;
 
+monitor_filter		:	/* empty */
+			{
+				memset(&$$, 0, sizeof($$));
+				$$.family = NFPROTO_UNSPEC;
+			}
+			|	monitor_filter_spec
+			;
+
+monitor_filter_spec	:	monitor_filter	family_spec_explicit
+			{
+				$$ = $1;
+				$$.family = $2;
+			}
+			|	monitor_filter	TABLE	identifier
+			{
+				$$ = $1;
+				xfree($$.table);
+				$$.table = $3;
+			}
+			|	monitor_filter	CHAIN	identifier
+			{
+				$$ = $1;
+				xfree($$.chain);
+				$$.chain = $3;
+			}
+			|	monitor_filter	SET	identifier
+			{
+				$$ = $1;
+				xfree($$.set);
+				$$.set = $3;
+			}
+			;
+
+monitor_mode		:	/* empty */	{ $$ = MONITOR_MODE_EVENTS; }
+			|	STRING
+			{
+				int mode = monitor_mode_parse($1);
+
+				if (mode < 0) {
+					erec_queue(error(&@1, "unknown monitor mode %s", $1),
+						   state->msgs);
+					xfree($1);
+					YYERROR;
+				}
+				xfree($1);
+				$$ = mode;
+			}
+			;
+
 monitor_format		:	/* empty */	{ $$ = NFTNL_OUTPUT_DEFAULT; }
 			|	markup_format
 			;
@@ -1495,6 +1672,18 @@ set_mechanism		:	POLICY		set_policy_spec
 			{
 				$<set>0->policy = $2;
 			}
+			|	POLICY		STRING
+			{
+				if (strcmp($2, "auto") == 0) {
+					$<set>0->policy_auto = SET_POLICY_AUTO_PENDING;
+					xfree($2);
+				} else {
+					erec_queue(error(&@2, "unknown set policy %s", $2),
+						   state->msgs);
+					xfree($2);
+					YYERROR;
+				}
+			}
 			|	SIZE		NUM
 			{
 				$<set>0->desc.size = $2;
@@ -1743,6 +1932,14 @@ position_spec		:	POSITION	NUM
 			}
 			;
 
+index_spec		:	INDEX		NUM
+			{
+				memset(&$$, 0, sizeof($$));
+				$$.index.location	= @$;
+				$$.index.id		= $2 + 1;
+			}
+			;
+
 rule_position		:	chain_spec
 			{
 				$$ = $1;
@@ -1752,6 +1949,11 @@ rule_position		:	chain_spec
 				handle_merge(&$1, &$2);
 				$$ = $1;
 			}
+			|	chain_spec	index_spec
+			{
+				handle_merge(&$1, &$2);
+				$$ = $1;
+			}
 			;
 
 ruleid_spec		:	chain_spec	handle_spec
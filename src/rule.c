@@ -21,6 +21,10 @@
 #include <utils.h>
 #include <netdb.h>
 #include <netlink.h>
+#include <stats.h>
+#include <json.h>
+#include <setelem_file.h>
+#include <rule_index.h>
 
 #include <libnftnl/common.h>
 #include <libnftnl/ruleset.h>
@@ -51,14 +55,19 @@ void handle_merge(struct handle *dst, const struct handle *src)
 		dst->handle = src->handle;
 	if (dst->position.id == 0)
 		dst->position = src->position;
+	if (dst->index.id == 0)
+		dst->index = src->index;
 }
 
 static int cache_init_tables(struct netlink_ctx *ctx, struct handle *h,
 			     struct nft_cache *cache)
 {
+	enum nft_stats_phase phase;
 	int ret;
 
+	phase = stats_phase_enter(ctx->octx, NFT_STATS_CACHE_TABLE);
 	ret = netlink_list_tables(ctx, h, &internal_location);
+	stats_phase_leave(ctx->octx, phase);
 	if (ret < 0)
 		return -1;
 
@@ -66,59 +75,128 @@ static int cache_init_tables(struct netlink_ctx *ctx, struct handle *h,
 	return 0;
 }
 
+/*
+ * Chains and rules are fetched with a single dump for all tables, which
+ * returns them grouped by table, so the table is only looked up again when
+ * it changes. Objects that showed up after the tables were fetched are
+ * dropped.
+ */
+static struct table *cache_table_lookup(struct nft_cache *cache,
+					struct table *last,
+					const struct handle *h)
+{
+	if (last != NULL && last->handle.family == h->family &&
+	    !strcmp(last->handle.table, h->table))
+		return last;
+
+	return table_lookup(h, cache);
+}
+
+static int cache_init_chains(struct netlink_ctx *ctx)
+{
+	struct handle h = {
+		.family = NFPROTO_UNSPEC,
+	};
+	struct chain *chain, *next;
+	struct table *table = NULL;
+	enum nft_stats_phase phase;
+	int ret;
+
+	phase = stats_phase_enter(ctx->octx, NFT_STATS_CACHE_CHAIN);
+	ret = netlink_list_chains(ctx, &h, &internal_location);
+	list_for_each_entry_safe(chain, next, &ctx->list, list) {
+		table = cache_table_lookup(ctx->cache, table, &chain->handle);
+		if (table == NULL) {
+			list_del(&chain->list);
+			chain_free(chain);
+			continue;
+		}
+		list_move_tail(&chain->list, &table->chains);
+	}
+	stats_phase_leave(ctx->octx, phase);
+
+	return ret;
+}
+
+static int cache_init_rules(struct netlink_ctx *ctx)
+{
+	struct handle h = {
+		.family = NFPROTO_UNSPEC,
+	};
+	struct table *table = NULL, *t;
+	struct chain *chain = NULL;
+	enum nft_stats_phase phase;
+	struct rule *rule, *next;
+	int ret;
+
+	phase = stats_phase_enter(ctx->octx, NFT_STATS_CACHE_RULE);
+	ret = netlink_list_table(ctx, &h, &internal_location);
+	list_for_each_entry_safe(rule, next, &ctx->list, list) {
+		t = cache_table_lookup(ctx->cache, table, &rule->handle);
+		if (t != table) {
+			table = t;
+			chain = NULL;
+		}
+		if (table != NULL &&
+		    (chain == NULL ||
+		     strcmp(chain->handle.chain, rule->handle.chain)))
+			chain = chain_lookup(table, &rule->handle);
+
+		if (chain == NULL) {
+			list_del(&rule->list);
+			rule_free(rule);
+			continue;
+		}
+		list_move_tail(&rule->list, &chain->rules);
+	}
+	stats_phase_leave(ctx->octx, phase);
+
+	return ret;
+}
+
 static int cache_init_objects(struct netlink_ctx *ctx, enum cmd_ops cmd)
 {
+	enum nft_stats_phase phase;
 	struct table *table;
-	struct chain *chain;
-	struct rule *rule, *nrule;
-	struct set *set;
 	int ret;
 
+	if (cache_init_chains(ctx) < 0)
+		return -1;
+
 	list_for_each_entry(table, &ctx->cache->list, list) {
+		phase = stats_phase_enter(ctx->octx, NFT_STATS_CACHE_SET);
 		ret = netlink_list_sets(ctx, &table->handle,
 					&internal_location);
+		stats_phase_leave(ctx->octx, phase);
 		list_splice_tail_init(&ctx->list, &table->sets);
 
 		if (ret < 0)
 			return -1;
 
-		list_for_each_entry(set, &table->sets, list) {
-			ret = netlink_get_setelems(ctx, &set->handle,
-						   &internal_location, set);
-			if (ret < 0)
-				return -1;
-		}
-
-		ret = netlink_list_chains(ctx, &table->handle,
-					  &internal_location);
+		phase = stats_phase_enter(ctx->octx, NFT_STATS_CACHE_SETELEM);
+		ret = netlink_list_setelems(ctx, &table->sets,
+					    &internal_location);
+		stats_phase_leave(ctx->octx, phase);
 		if (ret < 0)
 			return -1;
-		list_splice_tail_init(&ctx->list, &table->chains);
 
 		if (cmd != CMD_RESET) {
+			phase = stats_phase_enter(ctx->octx, NFT_STATS_CACHE_OBJ);
 			ret = netlink_list_objs(ctx, &table->handle, &internal_location);
+			stats_phase_leave(ctx->octx, phase);
 			if (ret < 0)
 				return -1;
 			list_splice_tail_init(&ctx->list, &table->objs);
 		}
+	}
 
-		/* Skip caching other objects to speed up things: We only need
-		 * a full cache when listing the existing ruleset.
-		 */
-		if (cmd != CMD_LIST)
-			continue;
-
-		ret = netlink_list_table(ctx, &table->handle,
-					 &internal_location);
-		list_for_each_entry_safe(rule, nrule, &ctx->list, list) {
-			chain = chain_lookup(table, &rule->handle);
-			list_move_tail(&rule->list, &chain->rules);
-		}
+	/* Skip caching other objects to speed up things: We only need
+	 * a full cache when listing the existing ruleset.
+	 */
+	if (cmd != CMD_LIST)
+		return 0;
 
-		if (ret < 0)
-			return -1;
-	}
-	return 0;
+	return cache_init_rules(ctx);
 }
 
 static int cache_init(struct netlink_ctx *ctx, enum cmd_ops cmd)
@@ -138,10 +216,11 @@ static int cache_init(struct netlink_ctx *ctx, enum cmd_ops cmd)
 	return 0;
 }
 
-int cache_update(struct mnl_socket *nf_sock, struct nft_cache *cache,
+int cache_update(struct nft_sock *nf_sock, struct nft_cache *cache,
 		 enum cmd_ops cmd, struct list_head *msgs, bool debug,
 		 struct output_ctx *octx)
 {
+	enum nft_stats_phase phase;
 	uint16_t genid;
 	int ret;
 	struct netlink_ctx ctx = {
@@ -155,7 +234,9 @@ int cache_update(struct mnl_socket *nf_sock, struct nft_cache *cache,
 
 replay:
 	ctx.seqnum = cache->seqnum++;
+	phase = stats_phase_enter(octx, NFT_STATS_CACHE_GENID);
 	genid = netlink_genid_get(&ctx);
+	stats_phase_leave(octx, phase);
 	if (genid && genid == cache->genid)
 		return 0;
 	cache_release(cache);
@@ -172,6 +253,145 @@ replay:
 	return 0;
 }
 
+/*
+ * Cache update for the JSON listing, which fetches the rules itself while
+ * writing them out. A complete cache is kept if it is still current,
+ * otherwise everything but the rules is loaded. Such a cache is not tagged
+ * with the generation it was loaded from, so the next cache_update() call
+ * loads it in full.
+ */
+int cache_update_norules(struct nft_sock *nf_sock, struct nft_cache *cache,
+			 struct list_head *msgs, bool debug,
+			 struct output_ctx *octx)
+{
+	enum nft_stats_phase phase;
+	uint16_t genid;
+	int ret;
+	struct netlink_ctx ctx = {
+		.list		= LIST_HEAD_INIT(ctx.list),
+		.nf_sock	= nf_sock,
+		.cache		= cache,
+		.msgs		= msgs,
+		.debug_mask	= debug ? NFT_DEBUG_NETLINK : 0,
+		.octx		= octx,
+	};
+
+replay:
+	ctx.seqnum = cache->seqnum++;
+	phase = stats_phase_enter(octx, NFT_STATS_CACHE_GENID);
+	genid = netlink_genid_get(&ctx);
+	stats_phase_leave(octx, phase);
+	if (genid && genid == cache->genid)
+		return 0;
+	cache_release(cache);
+	ret = cache_init(&ctx, CMD_ADD);
+	if (ret < 0) {
+		cache_release(cache);
+		if (errno == EINTR) {
+			netlink_restart(nf_sock);
+			goto replay;
+		}
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Keep the tables the commands refer to only. A command that refers to no
+ * table in particular needs them all.
+ */
+static void cache_filter_tables(struct nft_cache *cache,
+				const struct list_head *cmds)
+{
+	const struct handle *last = NULL;
+	const struct cmd *cmd;
+	struct table *table;
+	LIST_HEAD(keep);
+
+	list_for_each_entry(cmd, cmds, list) {
+		if (cmd->handle.table == NULL)
+			return;
+	}
+
+	list_for_each_entry(cmd, cmds, list) {
+		if (last != NULL && last->family == cmd->handle.family &&
+		    !strcmp(last->table, cmd->handle.table))
+			continue;
+
+		last = &cmd->handle;
+		table = table_lookup(&cmd->handle, cache);
+		if (table != NULL)
+			list_move_tail(&table->list, &keep);
+	}
+
+	cache_flush(&cache->list);
+	list_splice_tail(&keep, &cache->list);
+}
+
+/*
+ * Cache update for the commands of a batch, which only loads the tables
+ * they refer to. Such a cache is not tagged with the generation it was
+ * loaded from, so the next cache_update() call loads it in full.
+ *
+ * The commands have been evaluated already, the tables in the cache may
+ * hold the objects the batch adds and are kept as they are, even if the
+ * ruleset changed since. Only the tables the commands refer to that are
+ * missing are loaded.
+ */
+int cache_update_tables(struct nft_sock *nf_sock, struct nft_cache *cache,
+			const struct list_head *cmds, struct list_head *msgs,
+			bool debug, struct output_ctx *octx)
+{
+	struct handle handle = {
+		.family = NFPROTO_UNSPEC,
+	};
+	struct nft_cache fresh = {
+		.list		= LIST_HEAD_INIT(fresh.list),
+	};
+	struct table *table, *next;
+	enum nft_stats_phase phase;
+	uint16_t genid;
+	int ret;
+	struct netlink_ctx ctx = {
+		.list		= LIST_HEAD_INIT(ctx.list),
+		.nf_sock	= nf_sock,
+		.cache		= &fresh,
+		.msgs		= msgs,
+		.debug_mask	= debug ? NFT_DEBUG_NETLINK : 0,
+		.octx		= octx,
+	};
+
+replay:
+	ctx.seqnum = cache->seqnum++;
+	phase = stats_phase_enter(octx, NFT_STATS_CACHE_GENID);
+	genid = netlink_genid_get(&ctx);
+	stats_phase_leave(octx, phase);
+	if (genid && genid == cache->genid)
+		return 0;
+
+	ret = cache_init_tables(&ctx, &handle, &fresh);
+	if (ret == 0) {
+		cache_filter_tables(&fresh, cmds);
+		list_for_each_entry_safe(table, next, &fresh.list, list) {
+			if (table_lookup(&table->handle, cache) == NULL)
+				continue;
+			list_del(&table->list);
+			table_free(table);
+		}
+		ret = cache_init_objects(&ctx, CMD_INVALID);
+	}
+	if (ret < 0) {
+		cache_flush(&fresh.list);
+		if (errno == EINTR) {
+			netlink_restart(nf_sock);
+			goto replay;
+		}
+		return -1;
+	}
+	list_splice_tail(&fresh.list, &cache->list);
+	return 0;
+}
+
 void cache_flush(struct list_head *table_list)
 {
 	struct table *table, *next;
@@ -188,7 +408,27 @@ void cache_release(struct nft_cache *cache)
 	cache->genid = 0;
 }
 
-/* internal ID to uniquely identify a set in the batch */
+/*
+ * Rule indexes follow the commands of a batch, they cannot be trusted once
+ * the batch has been sent, whether the kernel took it or not.
+ */
+void cache_release_rule_indexes(struct nft_cache *cache)
+{
+	struct table *table;
+	struct chain *chain;
+
+	list_for_each_entry(table, &cache->list, list) {
+		list_for_each_entry(chain, &table->chains, list) {
+			rule_index_free(chain->rule_index);
+			chain->rule_index = NULL;
+		}
+	}
+}
+
+/*
+ * Internal ID to uniquely identify a set in the batch. IDs only need to be
+ * unique, so a single counter is shared by all contexts and threads.
+ */
 static uint32_t set_id;
 
 struct set *set_alloc(const struct location *loc)
@@ -197,21 +437,25 @@ struct set *set_alloc(const struct location *loc)
 
 	set = xzalloc(sizeof(*set));
 	set->refcnt = 1;
-	set->handle.set_id = ++set_id;
+	set->handle.set_id = __atomic_add_fetch(&set_id, 1, __ATOMIC_RELAXED);
 	if (loc != NULL)
 		set->location = *loc;
 	return set;
 }
 
+/*
+ * Sets are referenced from rules that may be delinearized concurrently,
+ * see netlink_list_rules(), so the reference counter is updated atomically.
+ */
 struct set *set_get(struct set *set)
 {
-	set->refcnt++;
+	__atomic_add_fetch(&set->refcnt, 1, __ATOMIC_RELAXED);
 	return set;
 }
 
 void set_free(struct set *set)
 {
-	if (--set->refcnt > 0)
+	if (__atomic_sub_fetch(&set->refcnt, 1, __ATOMIC_ACQ_REL) > 0)
 		return;
 	if (set->init != NULL)
 		expr_free(set->init);
@@ -261,7 +505,7 @@ struct print_fmt_options {
 	const char	*stmt_separator;
 };
 
-static const char *set_policy2str(uint32_t policy)
+const char *set_policy2str(uint32_t policy)
 {
 	switch (policy) {
 	case NFT_SET_POL_PERFORMANCE:
@@ -273,6 +517,30 @@ static const char *set_policy2str(uint32_t policy)
 	}
 }
 
+static const char * const set_policy_auto_reason[__SET_POLICY_AUTO_MAX] = {
+	[SET_POLICY_AUTO_INTERVAL]	= "interval set",
+	[SET_POLICY_AUTO_NARROW_KEY]	= "key fits a bitmap",
+	[SET_POLICY_AUTO_FEW_ELEMS]	= "few constant elements",
+	[SET_POLICY_AUTO_MANY_ELEMS]	= "many constant elements",
+	[SET_POLICY_AUTO_DYNAMIC]	= "elements may be added later",
+};
+
+static void set_print_policy(const struct set *set,
+			     struct print_fmt_options *opts,
+			     struct output_ctx *octx)
+{
+	nft_print(octx, "%s%spolicy auto", opts->tab, opts->tab);
+
+	/* the explanation is a comment, it ends the line */
+	if (set->policy_auto < __SET_POLICY_AUTO_MAX &&
+	    set_policy_auto_reason[set->policy_auto] != NULL &&
+	    !strcmp(opts->stmt_separator, "\n"))
+		nft_print(octx, " # %s, %s", set_policy2str(set->policy),
+			  set_policy_auto_reason[set->policy_auto]);
+
+	nft_print(octx, "%s", opts->stmt_separator);
+}
+
 static void set_print_declaration(const struct set *set,
 				  struct print_fmt_options *opts,
 				  struct output_ctx *octx)
@@ -307,8 +575,12 @@ static void set_print_declaration(const struct set *set,
 
 	nft_print(octx, "%s", opts->stmt_separator);
 
+	if (set->policy_auto)
+		set_print_policy(set, opts, octx);
+
 	if (!(set->flags & (NFT_SET_CONSTANT))) {
-		if (set->policy != NFT_SET_POL_PERFORMANCE) {
+		if (set->policy != NFT_SET_POL_PERFORMANCE &&
+		    !set->policy_auto) {
 			nft_print(octx, "%s%spolicy %s%s",
 				  opts->tab, opts->tab,
 				  set_policy2str(set->policy),
@@ -447,8 +719,14 @@ void rule_print(const struct rule *rule, struct output_ctx *octx)
 
 struct rule *rule_lookup(const struct chain *chain, uint64_t handle)
 {
+	struct rule_index_entry *e;
 	struct rule *rule;
 
+	if (chain->rule_index != NULL) {
+		e = rule_index_lookup(chain->rule_index, handle);
+		return e ? e->rule : NULL;
+	}
+
 	list_for_each_entry(rule, &chain->rules, list) {
 		if (rule->handle.handle.id == handle)
 			return rule;
@@ -462,15 +740,26 @@ struct scope *scope_init(struct scope *scope, const struct scope *parent)
 	return scope;
 }
 
+static void symbol_free(struct symbol *sym)
+{
+	struct symbol_value *val, *nval;
+
+	list_for_each_entry_safe(val, nval, &sym->values, list) {
+		expr_free(val->expr);
+		xfree(val);
+	}
+	xfree(sym->identifier);
+	expr_free(sym->expr);
+	xfree(sym);
+}
+
 void scope_release(const struct scope *scope)
 {
 	struct symbol *sym, *next;
 
 	list_for_each_entry_safe(sym, next, &scope->symbols, list) {
 		list_del(&sym->list);
-		xfree(sym->identifier);
-		expr_free(sym->expr);
-		xfree(sym);
+		symbol_free(sym);
 	}
 }
 
@@ -481,10 +770,24 @@ void symbol_bind(struct scope *scope, const char *identifier, struct expr *expr)
 	sym = xzalloc(sizeof(*sym));
 	sym->identifier = xstrdup(identifier);
 	sym->expr = expr;
+	init_list_head(&sym->values);
 
 	list_add_tail(&sym->list, &scope->symbols);
 }
 
+void symbol_unbind(const struct scope *scope, const char *identifier)
+{
+	struct symbol *sym, *next;
+
+	list_for_each_entry_safe(sym, next, &scope->symbols, list) {
+		if (!strcmp(sym->identifier, identifier)) {
+			list_del(&sym->list);
+			symbol_free(sym);
+			return;
+		}
+	}
+}
+
 struct symbol *symbol_lookup(const struct scope *scope, const char *identifier)
 {
 	struct symbol *sym;
@@ -569,6 +872,7 @@ void chain_free(struct chain *chain)
 		return;
 	list_for_each_entry_safe(rule, next, &chain->rules, list)
 		rule_free(rule);
+	rule_index_free(chain->rule_index);
 	handle_free(&chain->handle);
 	scope_release(&chain->scope);
 	xfree(chain->type);
@@ -577,6 +881,18 @@ void chain_free(struct chain *chain)
 	xfree(chain);
 }
 
+/* Index the cached rules of a chain, they must all be in the cache. */
+void chain_index_rules(struct chain *chain)
+{
+	struct rule *rule;
+
+	rule_index_free(chain->rule_index);
+	chain->rule_index = rule_index_alloc(true);
+	list_for_each_entry(rule, &chain->rules, list)
+		rule_index_insert(chain->rule_index, NULL, true,
+				  rule->handle.handle.id, rule);
+}
+
 void chain_add_hash(struct chain *chain, struct table *table)
 {
 	list_add_tail(&chain->list, &table->chains);
@@ -661,7 +977,7 @@ const char *hooknum2str(unsigned int family, unsigned int hooknum)
 	return "unknown";
 }
 
-static const char *chain_policy2str(uint32_t policy)
+const char *chain_policy2str(uint32_t policy)
 {
 	switch (policy) {
 	case NF_DROP:
@@ -916,6 +1232,26 @@ void markup_free(struct markup *m)
 	xfree(m);
 }
 
+struct setelem_file *setelem_file_alloc(const struct location *loc,
+					const char *path,
+					enum setelem_file_format format)
+{
+	struct setelem_file *file;
+
+	file = xmalloc(sizeof(struct setelem_file));
+	file->location = *loc;
+	file->path = xstrdup(path);
+	file->format = format;
+
+	return file;
+}
+
+void setelem_file_free(struct setelem_file *file)
+{
+	xfree(file->path);
+	xfree(file);
+}
+
 struct monitor *monitor_alloc(uint32_t format, uint32_t type, const char *event)
 {
 	struct monitor *mon;
@@ -925,6 +1261,7 @@ struct monitor *monitor_alloc(uint32_t format, uint32_t type, const char *event)
 	mon->type = type;
 	mon->event = event;
 	mon->flags = 0;
+	mon->mode = MONITOR_MODE_EVENTS;
 
 	return mon;
 }
@@ -964,6 +1301,9 @@ void cmd_free(struct cmd *cmd)
 		case CMD_OBJ_MARKUP:
 			markup_free(cmd->markup);
 			break;
+		case CMD_OBJ_SETELEM_FILE:
+			setelem_file_free(cmd->elem_file);
+			break;
 		case CMD_OBJ_COUNTER:
 		case CMD_OBJ_QUOTA:
 		case CMD_OBJ_CT_HELPER:
@@ -990,14 +1330,34 @@ static int __do_add_setelems(struct netlink_ctx *ctx, const struct handle *h,
 	return 0;
 }
 
+/*
+ * Set the elements of a command go to. Evaluation has found it in the
+ * cache already, it can only be missing if the cache was released since.
+ */
+static struct set *setelem_set_lookup(struct netlink_ctx *ctx,
+				      const struct handle *h)
+{
+	struct table *table;
+	struct set *set = NULL;
+
+	table = table_lookup(h, ctx->cache);
+	if (table != NULL)
+		set = set_lookup(table, h->set);
+	if (set == NULL)
+		netlink_io_error(ctx, NULL,
+				 "Could not process rule: Set '%s' does not exist",
+				 h->set);
+	return set;
+}
+
 static int do_add_setelems(struct netlink_ctx *ctx, const struct handle *h,
 			   struct expr *init, uint32_t flags)
 {
-	struct table *table;
 	struct set *set;
 
-	table = table_lookup(h, ctx->cache);
-	set = set_lookup(table, h->set);
+	set = setelem_set_lookup(ctx, h);
+	if (set == NULL)
+		return -1;
 
 	if (set->flags & NFT_SET_INTERVAL &&
 	    set_to_intervals(ctx->msgs, set, init, true,
@@ -1007,15 +1367,70 @@ static int do_add_setelems(struct netlink_ctx *ctx, const struct handle *h,
 	return __do_add_setelems(ctx, h, set, init, flags);
 }
 
+static int do_add_setelems_file(struct netlink_ctx *ctx,
+				const struct handle *h,
+				const struct setelem_file *file,
+				uint32_t flags)
+{
+	const struct set *set;
+
+	set = setelem_set_lookup(ctx, h);
+	if (set == NULL)
+		return -1;
+
+	return setelem_file_load(ctx, h, set, file, flags);
+}
+
+/* Constant sets up to this number of elements are kept compact */
+#define SET_POLICY_AUTO_FEW_ELEMS	16
+
+static void set_select_policy(struct set *set)
+{
+	if (set->flags & NFT_SET_INTERVAL) {
+		set->policy = NFT_SET_POL_MEMORY;
+		set->policy_auto = SET_POLICY_AUTO_INTERVAL;
+	} else if (set->key->len <= 16) {
+		set->policy = NFT_SET_POL_PERFORMANCE;
+		set->policy_auto = SET_POLICY_AUTO_NARROW_KEY;
+	} else if (!(set->flags & NFT_SET_CONSTANT)) {
+		set->policy = NFT_SET_POL_PERFORMANCE;
+		set->policy_auto = SET_POLICY_AUTO_DYNAMIC;
+	} else if (set->nelems <= SET_POLICY_AUTO_FEW_ELEMS) {
+		set->policy = NFT_SET_POL_MEMORY;
+		set->policy_auto = SET_POLICY_AUTO_FEW_ELEMS;
+	} else {
+		set->policy = NFT_SET_POL_PERFORMANCE;
+		set->policy_auto = SET_POLICY_AUTO_MANY_ELEMS;
+	}
+}
+
 static int do_add_set(struct netlink_ctx *ctx, const struct handle *h,
 		      struct set *set, uint32_t flags)
 {
-	if (set->init != NULL) {
-		if (set->flags & NFT_SET_INTERVAL &&
-		    set_to_intervals(ctx->msgs, set, set->init, true,
+	/*
+	 * Anonymous sets with identical literals share their elements, which
+	 * only need to be converted once.
+	 */
+	if (set->init != NULL && set->flags & NFT_SET_INTERVAL &&
+	    !(set->init->flags & EXPR_F_INTERVALS)) {
+		if (set_to_intervals(ctx->msgs, set, set->init, true,
 				     ctx->debug_mask, set->automerge) < 0)
 			return -1;
+		set->init->flags |= EXPR_F_INTERVALS;
 	}
+
+	/*
+	 * Elements added later in the same batch have not been converted to
+	 * intervals yet, each of them turns into two at most.
+	 */
+	if (set->flags & NFT_SET_INTERVAL)
+		set->nelems *= 2;
+	if (set->init != NULL)
+		set->nelems += set->init->size;
+
+	if (set->policy_auto == SET_POLICY_AUTO_PENDING)
+		set_select_policy(set);
+
 	if (netlink_add_set(ctx, h, set, flags) < 0)
 		return -1;
 	if (set->init != NULL) {
@@ -1029,16 +1444,8 @@ static int do_command_add(struct netlink_ctx *ctx, struct cmd *cmd, bool excl)
 {
 	uint32_t flags = excl ? NLM_F_EXCL : 0;
 
-	if (ctx->octx->echo) {
-		int ret;
-
-		ret = cache_update(ctx->nf_sock, ctx->cache, cmd->obj,
-				   ctx->msgs, ctx->debug_mask, ctx->octx);
-		if (ret < 0)
-			return ret;
-
+	if (nft_output_echo(ctx->octx))
 		flags |= NLM_F_ECHO;
-	}
 
 	switch (cmd->obj) {
 	case CMD_OBJ_TABLE:
@@ -1054,6 +1461,9 @@ static int do_command_add(struct netlink_ctx *ctx, struct cmd *cmd, bool excl)
 		return do_add_set(ctx, &cmd->handle, cmd->set, flags);
 	case CMD_OBJ_SETELEM:
 		return do_add_setelems(ctx, &cmd->handle, cmd->expr, flags);
+	case CMD_OBJ_SETELEM_FILE:
+		return do_add_setelems_file(ctx, &cmd->handle, cmd->elem_file,
+					    flags);
 	case CMD_OBJ_COUNTER:
 	case CMD_OBJ_QUOTA:
 	case CMD_OBJ_CT_HELPER:
@@ -1065,12 +1475,43 @@ static int do_command_add(struct netlink_ctx *ctx, struct cmd *cmd, bool excl)
 	return 0;
 }
 
+static int do_replace_setelems(struct netlink_ctx *ctx, const struct handle *h,
+			       struct expr *init)
+{
+	struct expr *elems;
+	struct set *set;
+	int err;
+
+	set = setelem_set_lookup(ctx, h);
+	if (set == NULL)
+		return -1;
+
+	/*
+	 * The new elements are converted as if the set was created with
+	 * them, the result is compared against what the kernel holds.
+	 */
+	if (set->flags & NFT_SET_INTERVAL) {
+		elems = set->init;
+		set->init = init;
+		err = set_to_intervals(ctx->msgs, set, init, true,
+				       ctx->debug_mask, set->automerge);
+		set->init = elems;
+		if (err < 0)
+			return -1;
+	}
+
+	init->set_flags |= set->flags;
+	return netlink_replace_setelems(ctx, h, init);
+}
+
 static int do_command_replace(struct netlink_ctx *ctx, struct cmd *cmd)
 {
 	switch (cmd->obj) {
 	case CMD_OBJ_RULE:
 		return netlink_replace_rule_batch(ctx, &cmd->handle, cmd->rule,
 						  &cmd->location);
+	case CMD_OBJ_SETELEM:
+		return do_replace_setelems(ctx, &cmd->handle, cmd->expr);
 	default:
 		BUG("invalid command object type %u\n", cmd->obj);
 	}
@@ -1081,16 +1522,8 @@ static int do_command_insert(struct netlink_ctx *ctx, struct cmd *cmd)
 {
 	uint32_t flags = 0;
 
-	if (ctx->octx->echo) {
-		int ret;
-
-		ret = cache_update(ctx->nf_sock, ctx->cache, cmd->obj,
-				   ctx->msgs, ctx->debug_mask, ctx->octx);
-		if (ret < 0)
-			return ret;
-
+	if (nft_output_echo(ctx->octx))
 		flags |= NLM_F_ECHO;
-	}
 
 	switch (cmd->obj) {
 	case CMD_OBJ_RULE:
@@ -1590,6 +2023,9 @@ static int do_command_list(struct netlink_ctx *ctx, struct cmd *cmd)
 {
 	struct table *table = NULL;
 
+	if (ctx->octx->json)
+		return json_list(ctx, cmd);
+
 	if (cmd->handle.table != NULL)
 		table = table_lookup(&cmd->handle, ctx->cache);
 
@@ -1666,6 +2102,9 @@ static int do_command_reset(struct netlink_ctx *ctx, struct cmd *cmd)
 	if (ret < 0)
 		return ret;
 
+	if (ctx->octx->json)
+		return json_list(ctx, cmd);
+
 	return do_list_obj(ctx, cmd, type);
 }
 
@@ -1712,6 +2151,9 @@ static bool need_cache(const struct cmd *cmd)
 	 *  - new rules in default format
 	 *  - new elements
 	 */
+	if (cmd->monitor->mode == MONITOR_MODE_COUNTS)
+		return false;
+
 	if (((cmd->monitor->flags & (1 << NFT_MSG_NEWRULE)) &&
 	    (cmd->monitor->format == NFTNL_OUTPUT_DEFAULT)) ||
 	    (cmd->monitor->flags & (1 << NFT_MSG_NEWSETELEM)))
@@ -1723,6 +2165,19 @@ static bool need_cache(const struct cmd *cmd)
 	return false;
 }
 
+/* Tables whose events are discarded by the monitor filter need no cache. */
+static bool monitor_filter_table(const struct handle *filter,
+				 const struct table *t)
+{
+	if (filter->family != NFPROTO_UNSPEC &&
+	    filter->family != t->handle.family)
+		return false;
+	if (filter->table && strcmp(filter->table, t->handle.table))
+		return false;
+
+	return true;
+}
+
 static int do_command_monitor(struct netlink_ctx *ctx, struct cmd *cmd)
 {
 	struct table *t;
@@ -1734,6 +2189,8 @@ static int do_command_monitor(struct netlink_ctx *ctx, struct cmd *cmd)
 		.loc		= &cmd->location,
 		.cache		= ctx->cache,
 		.debug_mask	= ctx->debug_mask,
+		.filter		= &cmd->handle,
+		.mode		= cmd->monitor->mode,
 	};
 
 	monhandler.cache_needed = need_cache(cmd);
@@ -1742,11 +2199,16 @@ static int do_command_monitor(struct netlink_ctx *ctx, struct cmd *cmd)
 		struct chain *chain;
 		int ret;
 
+		monhandler.cache_rules = cmd->monitor->flags &
+					 (1 << NFT_MSG_TRACE);
 		list_for_each_entry(t, &ctx->cache->list, list) {
+			if (!monitor_filter_table(&cmd->handle, t))
+				continue;
+
 			list_for_each_entry(s, &t->sets, list)
 				s->init = set_expr_alloc(&cmd->location, s);
 
-			if (!(cmd->monitor->flags & (1 << NFT_MSG_TRACE)))
+			if (!monhandler.cache_rules)
 				continue;
 
 			/* When tracing we'd like to translate the rule handle
@@ -1766,6 +2228,8 @@ static int do_command_monitor(struct netlink_ctx *ctx, struct cmd *cmd)
 				chain = chain_lookup(t, &rule->handle);
 				list_move_tail(&rule->list, &chain->rules);
 			}
+			list_for_each_entry(chain, &t->chains, list)
+				chain_index_rules(chain);
 		}
 	}
 
@@ -0,0 +1,493 @@
+/*
+ * Per-rule counters read straight from rule dumps.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <libmnl/libmnl.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nf_tables.h>
+
+#include <nftables/nftables.h>
+#include <nftables.h>
+#include <netlink.h>
+#include <mnl.h>
+#include <rule.h>
+#include <rule_counters.h>
+#include <utils.h>
+
+#define RULE_COUNTERS_CHAIN_HSIZE	1024
+#define RULE_COUNTERS_HSIZE		16384
+
+/**
+ * struct rc_chain - chain with rules that have counters
+ *
+ * @hnode:	hash table node
+ * @family:	nfnetlink family
+ * @table:	table name
+ * @name:	chain name
+ * @nrules:	number of rules referring to this chain
+ */
+struct rc_chain {
+	struct hlist_node	hnode;
+	uint32_t		family;
+	char			*table;
+	char			*name;
+	unsigned int		nrules;
+};
+
+/**
+ * struct rc_rule - counters of a rule as of the previous poll
+ *
+ * @hnode:	hash table node
+ * @chain:	chain the rule belongs to
+ * @handle:	rule handle
+ * @packets:	packets reported by the previous poll
+ * @bytes:	bytes reported by the previous poll
+ * @next_packets: packets read by the poll in progress
+ * @next_bytes:	bytes read by the poll in progress
+ * @generation:	poll the rule was last seen in
+ * @committed:	the rule has been reported by a completed poll
+ */
+struct rc_rule {
+	struct hlist_node	hnode;
+	struct rc_chain		*chain;
+	uint64_t		handle;
+	uint64_t		packets;
+	uint64_t		bytes;
+	uint64_t		next_packets;
+	uint64_t		next_bytes;
+	uint64_t		generation;
+	bool			committed;
+};
+
+/**
+ * struct rule_counters - rule counters kept between two polls
+ *
+ * @chains:	chains, hashed by name
+ * @rules:	rules, hashed by chain and handle
+ * @generation:	number of polls so far
+ */
+struct rule_counters {
+	struct hlist_head	chains[RULE_COUNTERS_CHAIN_HSIZE];
+	struct hlist_head	rules[RULE_COUNTERS_HSIZE];
+	uint64_t		generation;
+};
+
+/**
+ * struct rc_msg - rule, as read from the netlink attributes
+ *
+ * @family:	nfnetlink family
+ * @table:	table name
+ * @chain:	chain name
+ * @handle:	rule handle
+ * @counter:	the rule has at least one counter expression
+ * @packets:	packets, summed over the counter expressions
+ * @bytes:	bytes, summed over the counter expressions
+ */
+struct rc_msg {
+	uint32_t		family;
+	const char		*table;
+	const char		*chain;
+	uint64_t		handle;
+	bool			counter;
+	uint64_t		packets;
+	uint64_t		bytes;
+};
+
+struct rc_poll {
+	struct rule_counters	*rc;
+	const struct handle	*filter;
+	struct nft_rule_counter	*rules;
+	unsigned int		size;
+	unsigned int		num;
+};
+
+static uint32_t rc_hash_str(uint32_t hash, const char *s)
+{
+	while (s && *s)
+		hash = (hash ^ (unsigned char)*s++) * 16777619U;
+
+	return hash;
+}
+
+static uint32_t rc_rule_hash(const struct rc_chain *chain, uint64_t handle)
+{
+	return (((uintptr_t)chain >> 4) ^ handle ^ (handle >> 32)) %
+	       RULE_COUNTERS_HSIZE;
+}
+
+static void rc_parse_counter(const struct nlattr *nest, struct rc_msg *msg)
+{
+	const struct nlattr *attr;
+
+	mnl_attr_for_each_nested(attr, nest) {
+		switch (mnl_attr_get_type(attr)) {
+		case NFTA_COUNTER_PACKETS:
+			if (mnl_attr_validate(attr, MNL_TYPE_U64) < 0)
+				break;
+			msg->packets += be64toh(mnl_attr_get_u64(attr));
+			break;
+		case NFTA_COUNTER_BYTES:
+			if (mnl_attr_validate(attr, MNL_TYPE_U64) < 0)
+				break;
+			msg->bytes += be64toh(mnl_attr_get_u64(attr));
+			break;
+		}
+	}
+}
+
+static void rc_parse_expr(const struct nlattr *nest, struct rc_msg *msg)
+{
+	const struct nlattr *attr, *data = NULL;
+	const char *name = NULL;
+
+	mnl_attr_for_each_nested(attr, nest) {
+		switch (mnl_attr_get_type(attr)) {
+		case NFTA_EXPR_NAME:
+			if (mnl_attr_validate(attr, MNL_TYPE_NUL_STRING) < 0)
+				break;
+			name = mnl_attr_get_str(attr);
+			break;
+		case NFTA_EXPR_DATA:
+			if (mnl_attr_validate(attr, MNL_TYPE_NESTED) < 0)
+				break;
+			data = attr;
+			break;
+		}
+	}
+
+	if (name == NULL || strcmp(name, "counter"))
+		return;
+
+	msg->counter = true;
+	if (data != NULL)
+		rc_parse_counter(data, msg);
+}
+
+/*
+ * Only the rule names, the handle and the counter expressions are looked
+ * at, no nftnl_rule is built and the other expressions are skipped.
+ */
+static int rc_parse(const struct nlmsghdr *nlh, struct rc_msg *msg)
+{
+	const struct nfgenmsg *nfg = mnl_nlmsg_get_payload(nlh);
+	const struct nlattr *attr, *elem;
+
+	memset(msg, 0, sizeof(*msg));
+	msg->family = nfg->nfgen_family;
+
+	mnl_attr_for_each(attr, nlh, sizeof(struct nfgenmsg)) {
+		switch (mnl_attr_get_type(attr)) {
+		case NFTA_RULE_TABLE:
+			if (mnl_attr_validate(attr, MNL_TYPE_NUL_STRING) < 0)
+				break;
+			msg->table = mnl_attr_get_str(attr);
+			break;
+		case NFTA_RULE_CHAIN:
+			if (mnl_attr_validate(attr, MNL_TYPE_NUL_STRING) < 0)
+				break;
+			msg->chain = mnl_attr_get_str(attr);
+			break;
+		case NFTA_RULE_HANDLE:
+			if (mnl_attr_validate(attr, MNL_TYPE_U64) < 0)
+				break;
+			msg->handle = be64toh(mnl_attr_get_u64(attr));
+			break;
+		case NFTA_RULE_EXPRESSIONS:
+			if (mnl_attr_validate(attr, MNL_TYPE_NESTED) < 0)
+				break;
+			mnl_attr_for_each_nested(elem, attr) {
+				if (mnl_attr_get_type(elem) != NFTA_LIST_ELEM ||
+				    mnl_attr_validate(elem, MNL_TYPE_NESTED) < 0)
+					continue;
+				rc_parse_expr(elem, msg);
+			}
+			break;
+		}
+	}
+
+	if (msg->table == NULL || msg->chain == NULL || !msg->counter)
+		return -1;
+
+	return 0;
+}
+
+static bool rc_filter_match(const struct handle *filter, uint32_t family,
+			    const char *table, const char *chain)
+{
+	if (filter->family != NFPROTO_UNSPEC && filter->family != family)
+		return false;
+	if (filter->table != NULL && strcmp(filter->table, table))
+		return false;
+	if (filter->chain != NULL && strcmp(filter->chain, chain))
+		return false;
+
+	return true;
+}
+
+static struct rc_chain *rc_chain_get(struct rule_counters *rc,
+				     const struct rc_msg *msg)
+{
+	struct rc_chain *chain;
+	struct hlist_node *n;
+	uint32_t hash;
+
+	hash = rc_hash_str(rc_hash_str(2166136261U ^ msg->family, msg->table),
+			   msg->chain) % RULE_COUNTERS_CHAIN_HSIZE;
+	hlist_for_each_entry(chain, n, &rc->chains[hash], hnode) {
+		if (chain->family == msg->family &&
+		    !strcmp(chain->table, msg->table) &&
+		    !strcmp(chain->name, msg->chain))
+			return chain;
+	}
+
+	chain = xzalloc(sizeof(*chain));
+	chain->family = msg->family;
+	chain->table = xstrdup(msg->table);
+	chain->name = xstrdup(msg->chain);
+	hlist_add_head(&chain->hnode, &rc->chains[hash]);
+
+	return chain;
+}
+
+static void rc_chain_put(struct rc_chain *chain)
+{
+	if (chain->nrules > 0)
+		return;
+
+	hlist_del(&chain->hnode);
+	xfree(chain->table);
+	xfree(chain->name);
+	xfree(chain);
+}
+
+static struct rc_rule *rc_rule_get(struct rule_counters *rc,
+				   struct rc_chain *chain, uint64_t handle)
+{
+	struct hlist_node *n;
+	struct rc_rule *rule;
+	uint32_t hash;
+
+	hash = rc_rule_hash(chain, handle);
+	hlist_for_each_entry(rule, n, &rc->rules[hash], hnode) {
+		if (rule->chain == chain && rule->handle == handle)
+			return rule;
+	}
+
+	rule = xzalloc(sizeof(*rule));
+	rule->chain = chain;
+	rule->handle = handle;
+	chain->nrules++;
+	hlist_add_head(&rule->hnode, &rc->rules[hash]);
+
+	return rule;
+}
+
+/* A counter that went backwards was reset, count from zero again. */
+static uint64_t rc_delta(uint64_t prev, uint64_t cur)
+{
+	return cur >= prev ? cur - prev : cur;
+}
+
+static int rc_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct rc_poll *poll = data;
+	struct nft_rule_counter *out;
+	struct rc_chain *chain;
+	struct rc_rule *rule;
+	struct rc_msg msg;
+
+	if (rc_parse(nlh, &msg) < 0 ||
+	    !rc_filter_match(poll->filter, msg.family, msg.table, msg.chain))
+		return MNL_CB_OK;
+
+	chain = rc_chain_get(poll->rc, &msg);
+	rule = rc_rule_get(poll->rc, chain, msg.handle);
+	rule->next_packets = msg.packets;
+	rule->next_bytes = msg.bytes;
+	rule->generation = poll->rc->generation;
+
+	if (poll->num++ >= poll->size)
+		return MNL_CB_OK;
+
+	out = &poll->rules[poll->num - 1];
+	memset(out, 0, sizeof(*out));
+	out->family = chain->family;
+	out->table = chain->table;
+	out->chain = chain->name;
+	out->handle = rule->handle;
+	out->packets = msg.packets;
+	out->bytes = msg.bytes;
+	if (rule->committed) {
+		out->delta_packets = rc_delta(rule->packets, msg.packets);
+		out->delta_bytes = rc_delta(rule->bytes, msg.bytes);
+	} else {
+		out->delta_packets = msg.packets;
+		out->delta_bytes = msg.bytes;
+		out->flags |= NFT_RULE_COUNTER_F_NEW;
+	}
+
+	return MNL_CB_OK;
+}
+
+/*
+ * The poll completed: its values become the base of the next deltas and
+ * the rules it did not see have been deleted, unless they are out of the
+ * scope of the filter.
+ */
+static void rc_commit(struct rule_counters *rc, const struct handle *filter)
+{
+	struct hlist_node *n, *tmp;
+	struct rc_chain *chain;
+	struct rc_rule *rule;
+	unsigned int i;
+
+	for (i = 0; i < RULE_COUNTERS_HSIZE; i++) {
+		hlist_for_each_safe(n, tmp, &rc->rules[i]) {
+			rule = hlist_entry(n, struct rc_rule, hnode);
+			chain = rule->chain;
+
+			if (rule->generation == rc->generation) {
+				rule->packets = rule->next_packets;
+				rule->bytes = rule->next_bytes;
+				rule->committed = true;
+				continue;
+			}
+			if (!rc_filter_match(filter, chain->family,
+					     chain->table, chain->name))
+				continue;
+
+			hlist_del(&rule->hnode);
+			xfree(rule);
+			chain->nrules--;
+			rc_chain_put(chain);
+		}
+	}
+}
+
+/*
+ * Fill @rules with the counters of the rules matching @h, along with
+ * their increase since the previous poll. Returns the number of rules
+ * with counters found, which may be larger than @num.
+ */
+int rule_counters_poll(struct netlink_ctx *ctx, struct rule_counters **rcp,
+		       const struct handle *h, struct nft_rule_counter *rules,
+		       unsigned int num)
+{
+	struct rc_poll poll = {
+		.filter	= h,
+		.rules	= rules,
+		.size	= num,
+	};
+
+	if (*rcp == NULL)
+		*rcp = xzalloc(sizeof(struct rule_counters));
+
+	poll.rc = *rcp;
+	poll.rc->generation++;
+
+	if (mnl_nft_rule_dump_cb(ctx, h->family, h->table, h->chain,
+				 rc_cb, &poll) < 0) {
+		if (errno == EINTR)
+			return -1;
+
+		return netlink_io_error(ctx, NULL,
+					"Could not receive rules from kernel: %s",
+					strerror(errno));
+	}
+
+	rc_commit(poll.rc, h);
+	return poll.num;
+}
+
+void rule_counters_free(struct rule_counters *rc)
+{
+	struct hlist_node *n, *tmp;
+	struct rc_chain *chain;
+	struct rc_rule *rule;
+	unsigned int i;
+
+	if (rc == NULL)
+		return;
+
+	for (i = 0; i < RULE_COUNTERS_HSIZE; i++) {
+		hlist_for_each_safe(n, tmp, &rc->rules[i]) {
+			rule = hlist_entry(n, struct rc_rule, hnode);
+			xfree(rule);
+		}
+	}
+	for (i = 0; i < RULE_COUNTERS_CHAIN_HSIZE; i++) {
+		hlist_for_each_safe(n, tmp, &rc->chains[i]) {
+			chain = hlist_entry(n, struct rc_chain, hnode);
+			xfree(chain->table);
+			xfree(chain->name);
+			xfree(chain);
+		}
+	}
+
+	xfree(rc);
+}
+
+static void rc_print_json_str(FILE *fp, const char *s)
+{
+	fputc('"', fp);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fputc('\\', fp);
+		fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+static void rc_print_json(FILE *fp, const struct nft_rule_counter *r)
+{
+	fprintf(fp, "{\"family\": \"%s\", \"table\": ", family2str(r->family));
+	rc_print_json_str(fp, r->table);
+	fprintf(fp, ", \"chain\": ");
+	rc_print_json_str(fp, r->chain);
+	fprintf(fp, ", \"handle\": %llu, \"packets\": %llu, \"bytes\": %llu, "
+		"\"delta_packets\": %llu, \"delta_bytes\": %llu, \"new\": %s}\n",
+		(unsigned long long)r->handle,
+		(unsigned long long)r->packets,
+		(unsigned long long)r->bytes,
+		(unsigned long long)r->delta_packets,
+		(unsigned long long)r->delta_bytes,
+		r->flags & NFT_RULE_COUNTER_F_NEW ? "true" : "false");
+}
+
+static void rc_print_plain(FILE *fp, const struct nft_rule_counter *r)
+{
+	fprintf(fp, "%s %s %s handle %llu packets %llu bytes %llu "
+		"delta packets %llu bytes %llu%s\n",
+		family2str(r->family), r->table, r->chain,
+		(unsigned long long)r->handle,
+		(unsigned long long)r->packets,
+		(unsigned long long)r->bytes,
+		(unsigned long long)r->delta_packets,
+		(unsigned long long)r->delta_bytes,
+		r->flags & NFT_RULE_COUNTER_F_NEW ? " new" : "");
+}
+
+/* One line per rule, JSON output is a stream of objects. */
+void nft_rule_counters_print(FILE *fp, const struct nft_rule_counter *rules,
+			     unsigned int num, bool json)
+{
+	unsigned int i;
+
+	for (i = 0; i < num; i++) {
+		if (json)
+			rc_print_json(fp, &rules[i]);
+		else
+			rc_print_plain(fp, &rules[i]);
+	}
+}
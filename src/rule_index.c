@@ -0,0 +1,468 @@
+/*
+ * Rules of a chain by handle and by position.
+ *
+ * Handle-addressed edits and index positions have to find a rule in chains
+ * that may hold tens of thousands of them. The index keeps the rules of a
+ * chain in a hash table by handle and in a randomized search tree ordered
+ * like the chain, where every entry knows the size of its subtree. Finding
+ * a rule by handle, finding the n-th rule, computing the position of a rule
+ * and inserting or removing one are all independent of the chain length,
+ * logarithmic at worst.
+ *
+ * An index is only loaded from the kernel when a command needs it. Edits
+ * made to the chain by earlier commands of the batch are logged until then,
+ * and replayed on top of the rules loaded.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <libmnl/libmnl.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nf_tables.h>
+
+#include <nftables.h>
+#include <netlink.h>
+#include <mnl.h>
+#include <rule.h>
+#include <rule_index.h>
+#include <utils.h>
+
+#define RULE_INDEX_MIN_HSIZE	64
+
+struct rule_index *rule_index_alloc(bool loaded)
+{
+	struct rule_index *ri;
+
+	ri = xzalloc(sizeof(*ri));
+	ri->seed = 2463534242U;
+	ri->loaded = loaded;
+	return ri;
+}
+
+static void ri_entry_free(struct rule_index_entry *e)
+{
+	if (e == NULL)
+		return;
+
+	ri_entry_free(e->left);
+	ri_entry_free(e->right);
+	xfree(e);
+}
+
+static void ri_clear(struct rule_index *ri)
+{
+	unsigned int i;
+
+	ri_entry_free(ri->root);
+	ri->root = NULL;
+	for (i = 0; i < ri->hsize; i++)
+		init_hlist_head(&ri->hash[i]);
+	ri->nhandles = 0;
+}
+
+/* The chain is known to be empty, whether the index was loaded or not. */
+void rule_index_flush(struct rule_index *ri)
+{
+	ri_clear(ri);
+	xfree(ri->log);
+	ri->log = NULL;
+	ri->nlog = 0;
+	ri->loaded = true;
+}
+
+void rule_index_free(struct rule_index *ri)
+{
+	if (ri == NULL)
+		return;
+
+	ri_entry_free(ri->root);
+	xfree(ri->hash);
+	xfree(ri->log);
+	xfree(ri);
+}
+
+static uint32_t ri_hash(const struct rule_index *ri, uint64_t handle)
+{
+	return (uint32_t)((handle * 0x9e3779b97f4a7c15ULL) >> 32) &
+	       (ri->hsize - 1);
+}
+
+static void ri_hash_grow(struct rule_index *ri)
+{
+	struct hlist_head *hash = ri->hash;
+	unsigned int i, hsize = ri->hsize;
+	struct rule_index_entry *e;
+	struct hlist_node *n, *tmp;
+
+	ri->hsize = hsize ? hsize * 2 : RULE_INDEX_MIN_HSIZE;
+	ri->hash = xmalloc_array(ri->hsize, sizeof(struct hlist_head));
+	for (i = 0; i < ri->hsize; i++)
+		init_hlist_head(&ri->hash[i]);
+
+	for (i = 0; i < hsize; i++) {
+		hlist_for_each_safe(n, tmp, &hash[i]) {
+			e = hlist_entry(n, struct rule_index_entry, hnode);
+			hlist_add_head(&e->hnode, &ri->hash[ri_hash(ri, e->handle)]);
+		}
+	}
+	xfree(hash);
+}
+
+static void ri_hash_add(struct rule_index *ri, struct rule_index_entry *e)
+{
+	if (ri->nhandles >= ri->hsize)
+		ri_hash_grow(ri);
+
+	hlist_add_head(&e->hnode, &ri->hash[ri_hash(ri, e->handle)]);
+	ri->nhandles++;
+}
+
+static unsigned int ri_size(const struct rule_index_entry *e)
+{
+	return e ? e->size : 0;
+}
+
+static void ri_update(struct rule_index_entry *e)
+{
+	e->size = 1 + ri_size(e->left) + ri_size(e->right);
+	if (e->left)
+		e->left->parent = e;
+	if (e->right)
+		e->right->parent = e;
+}
+
+/* Split @e into its first @pos entries and the others. */
+static void ri_split(struct rule_index_entry *e, unsigned int pos,
+		     struct rule_index_entry **l, struct rule_index_entry **r)
+{
+	if (e == NULL) {
+		*l = *r = NULL;
+		return;
+	}
+
+	if (ri_size(e->left) < pos) {
+		ri_split(e->right, pos - ri_size(e->left) - 1, &e->right, r);
+		*l = e;
+	} else {
+		ri_split(e->left, pos, l, &e->left);
+		*r = e;
+	}
+	ri_update(e);
+}
+
+/* Merge two trees, all entries of @a come before those of @b. */
+static struct rule_index_entry *ri_merge(struct rule_index_entry *a,
+					 struct rule_index_entry *b)
+{
+	if (a == NULL)
+		return b;
+	if (b == NULL)
+		return a;
+
+	if (a->prio > b->prio) {
+		a->right = ri_merge(a->right, b);
+		ri_update(a);
+		return a;
+	}
+	b->left = ri_merge(a, b->left);
+	ri_update(b);
+	return b;
+}
+
+unsigned int rule_index_count(const struct rule_index *ri)
+{
+	return ri_size(ri->root);
+}
+
+struct rule_index_entry *rule_index_lookup(const struct rule_index *ri,
+					   uint64_t handle)
+{
+	struct rule_index_entry *e;
+	struct hlist_node *n;
+
+	if (handle == 0 || ri->hsize == 0)
+		return NULL;
+
+	hlist_for_each_entry(e, n, &ri->hash[ri_hash(ri, handle)], hnode) {
+		if (e->handle == handle)
+			return e;
+	}
+	return NULL;
+}
+
+struct rule_index_entry *rule_index_nth(const struct rule_index *ri,
+					unsigned int pos)
+{
+	struct rule_index_entry *e = ri->root;
+
+	while (e != NULL) {
+		if (pos < ri_size(e->left)) {
+			e = e->left;
+		} else if (pos == ri_size(e->left)) {
+			return e;
+		} else {
+			pos -= ri_size(e->left) + 1;
+			e = e->right;
+		}
+	}
+	return NULL;
+}
+
+unsigned int rule_index_position(const struct rule_index_entry *e)
+{
+	unsigned int pos = ri_size(e->left);
+
+	for (; e->parent != NULL; e = e->parent) {
+		if (e == e->parent->right)
+			pos += ri_size(e->parent->left) + 1;
+	}
+	return pos;
+}
+
+struct rule_index_entry *rule_index_prev(struct rule_index_entry *e)
+{
+	if (e->left != NULL) {
+		for (e = e->left; e->right != NULL; e = e->right)
+			;
+		return e;
+	}
+	while (e->parent != NULL && e == e->parent->left)
+		e = e->parent;
+	return e->parent;
+}
+
+struct rule_index_entry *rule_index_next(struct rule_index_entry *e)
+{
+	if (e->right != NULL) {
+		for (e = e->right; e->left != NULL; e = e->left)
+			;
+		return e;
+	}
+	while (e->parent != NULL && e == e->parent->right)
+		e = e->parent;
+	return e->parent;
+}
+
+/*
+ * Insert a rule after or before @ref. Without a reference, it is appended
+ * if @after is set and inserted at the start of the chain otherwise, like
+ * the add and insert commands do.
+ */
+struct rule_index_entry *rule_index_insert(struct rule_index *ri,
+					   struct rule_index_entry *ref,
+					   bool after, uint64_t handle,
+					   struct rule *rule)
+{
+	struct rule_index_entry *e, *l, *r;
+	unsigned int pos;
+
+	if (ref == NULL)
+		pos = after ? rule_index_count(ri) : 0;
+	else
+		pos = rule_index_position(ref) + (after ? 1 : 0);
+
+	e = xzalloc(sizeof(*e));
+	e->size = 1;
+	e->handle = handle;
+	e->rule = rule;
+
+	/* xorshift, the priorities only have to look random */
+	ri->seed ^= ri->seed << 13;
+	ri->seed ^= ri->seed >> 17;
+	ri->seed ^= ri->seed << 5;
+	e->prio = ri->seed;
+
+	ri_split(ri->root, pos, &l, &r);
+	ri->root = ri_merge(ri_merge(l, e), r);
+	ri->root->parent = NULL;
+
+	if (handle != 0)
+		ri_hash_add(ri, e);
+	return e;
+}
+
+void rule_index_remove(struct rule_index *ri, struct rule_index_entry *e)
+{
+	struct rule_index_entry *m, *p;
+
+	if (e->handle != 0) {
+		hlist_del(&e->hnode);
+		ri->nhandles--;
+	}
+
+	m = ri_merge(e->left, e->right);
+	p = e->parent;
+	if (m != NULL)
+		m->parent = p;
+	if (p == NULL)
+		ri->root = m;
+	else if (p->left == e)
+		p->left = m;
+	else
+		p->right = m;
+
+	for (; p != NULL; p = p->parent)
+		p->size--;
+	xfree(e);
+}
+
+static void ri_apply(struct rule_index *ri, const struct rule_index_edit *edit)
+{
+	struct rule_index_entry *e = NULL;
+	unsigned int i;
+
+	switch (edit->op) {
+	case RULE_INDEX_APPEND:
+	case RULE_INDEX_PREPEND:
+		for (i = 0; i < edit->count; i++)
+			rule_index_insert(ri, NULL, edit->op == RULE_INDEX_APPEND,
+					  0, NULL);
+		return;
+	default:
+		break;
+	}
+
+	/* unknown handles make the kernel reject the batch anyway */
+	e = rule_index_lookup(ri, edit->handle);
+	if (e == NULL)
+		return;
+
+	switch (edit->op) {
+	case RULE_INDEX_AFTER:
+	case RULE_INDEX_BEFORE:
+		rule_index_insert(ri, e, edit->op == RULE_INDEX_AFTER, 0, NULL);
+		break;
+	case RULE_INDEX_REPLACE:
+		rule_index_insert(ri, e, true, 0, NULL);
+		/* fall through */
+	case RULE_INDEX_DELETE:
+		rule_index_remove(ri, e);
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Apply a rule edit made by a command, or log it until the index is loaded.
+ * Rules added by the batch have no handle yet, they are only counted in.
+ */
+void rule_index_edit(struct rule_index *ri, enum rule_index_op op,
+		     uint64_t handle)
+{
+	struct rule_index_edit *edit, e = {
+		.op	= op,
+		.handle	= handle,
+		.count	= 1,
+	};
+
+	if (ri->loaded) {
+		ri_apply(ri, &e);
+		return;
+	}
+
+	if (ri->nlog > 0 && (op == RULE_INDEX_APPEND ||
+			     op == RULE_INDEX_PREPEND)) {
+		edit = &ri->log[ri->nlog - 1];
+		if (edit->op == op) {
+			edit->count++;
+			return;
+		}
+	}
+
+	/* grow in powers of two */
+	if ((ri->nlog & (ri->nlog - 1)) == 0)
+		ri->log = xrealloc(ri->log, (ri->nlog ? ri->nlog * 2 : 1) *
+					    sizeof(struct rule_index_edit));
+	ri->log[ri->nlog++] = e;
+}
+
+struct ri_load {
+	struct rule_index	*ri;
+	const struct handle	*h;
+};
+
+static int ri_rule_cb(const struct nlmsghdr *nlh, void *data)
+{
+	const struct nfgenmsg *nfg = mnl_nlmsg_get_payload(nlh);
+	const char *table = NULL, *chain = NULL;
+	struct ri_load *load = data;
+	const struct nlattr *attr;
+	uint64_t handle = 0;
+
+	if (nfg->nfgen_family != load->h->family)
+		return MNL_CB_OK;
+
+	mnl_attr_for_each(attr, nlh, sizeof(struct nfgenmsg)) {
+		switch (mnl_attr_get_type(attr)) {
+		case NFTA_RULE_TABLE:
+			if (mnl_attr_validate(attr, MNL_TYPE_NUL_STRING) < 0)
+				break;
+			table = mnl_attr_get_str(attr);
+			break;
+		case NFTA_RULE_CHAIN:
+			if (mnl_attr_validate(attr, MNL_TYPE_NUL_STRING) < 0)
+				break;
+			chain = mnl_attr_get_str(attr);
+			break;
+		case NFTA_RULE_HANDLE:
+			if (mnl_attr_validate(attr, MNL_TYPE_U64) < 0)
+				break;
+			handle = be64toh(mnl_attr_get_u64(attr));
+			break;
+		}
+	}
+
+	/* the dump may not be filtered, see mnl_nft_rule_dump_cb() */
+	if (table == NULL || chain == NULL || handle == 0 ||
+	    strcmp(table, load->h->table) || strcmp(chain, load->h->chain))
+		return MNL_CB_OK;
+
+	rule_index_insert(load->ri, NULL, true, handle, NULL);
+	return MNL_CB_OK;
+}
+
+/*
+ * Load the handles of the rules of chain @h from the kernel, then replay
+ * the logged edits. Only the handles are read, rules are not turned into
+ * statements. On failure, the index is left unloaded and empty.
+ */
+int rule_index_load(struct rule_index *ri, struct netlink_ctx *ctx,
+		    const struct handle *h)
+{
+	struct ri_load load = {
+		.ri	= ri,
+		.h	= h,
+	};
+	unsigned int i;
+
+	if (ri->loaded)
+		return 0;
+
+	if (mnl_nft_rule_dump_cb(ctx, h->family, h->table, h->chain,
+				 ri_rule_cb, &load) < 0) {
+		ri_clear(ri);
+		if (errno == EINTR)
+			return -1;
+
+		return netlink_io_error(ctx, NULL,
+					"Could not receive rules from kernel: %s",
+					strerror(errno));
+	}
+
+	ri->loaded = true;
+	for (i = 0; i < ri->nlog; i++)
+		ri_apply(ri, &ri->log[i]);
+	xfree(ri->log);
+	ri->log = NULL;
+	ri->nlog = 0;
+	return 0;
+}
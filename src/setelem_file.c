@@ -0,0 +1,473 @@
+/*
+ * Bulk load of set elements from a file.
+ *
+ * Elements are read one at a time and encoded straight into netlink
+ * attributes, they never become expressions. Every SETELEM_FILE_CHUNK
+ * elements are encoded into the batch and the libnftnl objects released.
+ * The batch itself keeps every encoded message until it is sent, so memory
+ * use still grows with the number of elements in the file, though at a
+ * fraction of the cost of an element expression. Only kernels without
+ * batch support, where each chunk is sent right away, avoid that.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <libnftnl/set.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nf_tables.h>
+
+#include <nftables.h>
+#include <netlink.h>
+#include <mnl.h>
+#include <rule.h>
+#include <datatype.h>
+#include <expression.h>
+#include <setelem_file.h>
+#include <utils.h>
+
+/* Number of elements sent in one NEWSETELEM message. */
+#define SETELEM_FILE_CHUNK	4096
+
+struct setelem_file_ctx {
+	struct netlink_ctx		*nl_ctx;
+	const struct handle		*h;
+	const struct set		*set;
+	const struct setelem_file	*file;
+	uint32_t			flags;
+	unsigned int			keylen;
+	unsigned int			datalen;
+	unsigned int			line;
+	struct nftnl_set		*nls;
+	unsigned int			nelems;
+};
+
+/*
+ * Return the first type along the basetype chain the csv parser knows how
+ * to read, TYPE_INVALID if there is none.
+ */
+static uint32_t setelem_file_type(const struct datatype *dtype)
+{
+	for (; dtype != NULL; dtype = dtype->basetype) {
+		switch (dtype->type) {
+		case TYPE_IPADDR:
+		case TYPE_IP6ADDR:
+		case TYPE_ETHERADDR:
+		case TYPE_INET_SERVICE:
+		case TYPE_INET_PROTOCOL:
+		case TYPE_STRING:
+		case TYPE_INTEGER:
+		case TYPE_BITMASK:
+			return dtype->type;
+		default:
+			break;
+		}
+	}
+	return TYPE_INVALID;
+}
+
+static enum byteorder setelem_file_byteorder(const struct datatype *dtype)
+{
+	for (; dtype != NULL; dtype = dtype->basetype) {
+		if (dtype->byteorder != BYTEORDER_INVALID)
+			return dtype->byteorder;
+	}
+	return BYTEORDER_HOST_ENDIAN;
+}
+
+bool setelem_file_type_supported(const struct datatype *dtype,
+				 unsigned int len)
+{
+	if (dtype->subtypes || len == 0 || len % BITS_PER_BYTE)
+		return false;
+
+	switch (setelem_file_type(dtype)) {
+	case TYPE_IPADDR:
+		return len == 32;
+	case TYPE_IP6ADDR:
+		return len == 128;
+	case TYPE_ETHERADDR:
+		return len == 48;
+	case TYPE_INET_SERVICE:
+		return len == 16;
+	case TYPE_INET_PROTOCOL:
+		return len == 8;
+	case TYPE_STRING:
+		return len <= NFT_DATA_VALUE_MAXLEN * BITS_PER_BYTE;
+	case TYPE_INTEGER:
+	case TYPE_BITMASK:
+		if (setelem_file_byteorder(dtype) == BYTEORDER_BIG_ENDIAN)
+			return len <= 64;
+		return len == 8 || len == 16 || len == 32 || len == 64;
+	default:
+		return false;
+	}
+}
+
+static int setelem_file_error(struct setelem_file_ctx *sctx, const char *msg,
+			      const char *value)
+{
+	if (sctx->line)
+		return netlink_io_error(sctx->nl_ctx, &sctx->file->location,
+					"%s:%u: %s '%s'", sctx->file->path,
+					sctx->line, msg, value);
+	return netlink_io_error(sctx->nl_ctx, &sctx->file->location,
+				"%s: %s", sctx->file->path, msg);
+}
+
+static int parse_uint(const char *str, uint64_t max, uint64_t *val)
+{
+	unsigned long long v;
+	char *end;
+
+	if (*str == '-')
+		return -1;
+
+	errno = 0;
+	v = strtoull(str, &end, 0);
+	if (errno || end == str || *end != '\0' || v > max)
+		return -1;
+
+	*val = v;
+	return 0;
+}
+
+static void put_uint(uint8_t *buf, uint64_t val, unsigned int len,
+		     enum byteorder byteorder)
+{
+	unsigned int i;
+
+	if (byteorder == BYTEORDER_BIG_ENDIAN) {
+		for (i = 0; i < len; i++)
+			buf[len - 1 - i] = val >> (i * BITS_PER_BYTE);
+		return;
+	}
+
+	switch (len) {
+	case 1:
+		*buf = val;
+		break;
+	case 2: {
+		uint16_t v = val;
+
+		memcpy(buf, &v, sizeof(v));
+		break;
+	}
+	case 4: {
+		uint32_t v = val;
+
+		memcpy(buf, &v, sizeof(v));
+		break;
+	}
+	case 8:
+		memcpy(buf, &val, sizeof(val));
+		break;
+	}
+}
+
+/* Parse one csv field of type @dtype into @len bytes at @buf. */
+static int parse_value(const struct datatype *dtype, const char *str,
+		       uint8_t *buf, unsigned int len)
+{
+	const struct protoent *p;
+	const struct servent *s;
+	uint64_t val;
+	int n = 0;
+
+	memset(buf, 0, len);
+
+	switch (setelem_file_type(dtype)) {
+	case TYPE_IPADDR:
+		return inet_pton(AF_INET, str, buf) == 1 ? 0 : -1;
+	case TYPE_IP6ADDR:
+		return inet_pton(AF_INET6, str, buf) == 1 ? 0 : -1;
+	case TYPE_ETHERADDR:
+		if (sscanf(str, "%2hhx:%2hhx:%2hhx:%2hhx:%2hhx:%2hhx%n",
+			   &buf[0], &buf[1], &buf[2], &buf[3], &buf[4],
+			   &buf[5], &n) != 6 || str[n] != '\0')
+			return -1;
+		return 0;
+	case TYPE_INET_SERVICE:
+		if (parse_uint(str, UINT16_MAX, &val) < 0) {
+			s = getservbyname(str, NULL);
+			if (s == NULL)
+				return -1;
+			val = ntohs(s->s_port);
+		}
+		put_uint(buf, val, len, BYTEORDER_BIG_ENDIAN);
+		return 0;
+	case TYPE_INET_PROTOCOL:
+		if (parse_uint(str, UINT8_MAX, &val) < 0) {
+			p = getprotobyname(str);
+			if (p == NULL)
+				return -1;
+			val = p->p_proto;
+		}
+		*buf = val;
+		return 0;
+	case TYPE_STRING:
+		if (strlen(str) > len)
+			return -1;
+		memcpy(buf, str, strlen(str));
+		return 0;
+	case TYPE_INTEGER:
+	case TYPE_BITMASK:
+		if (parse_uint(str, len < 8 ? (1ULL << (len * BITS_PER_BYTE)) - 1 :
+					      UINT64_MAX, &val) < 0)
+			return -1;
+		put_uint(buf, val, len, setelem_file_byteorder(dtype));
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+static int parse_verdict(const char *str, struct nftnl_set_elem *nlse)
+{
+	static const struct {
+		const char	*name;
+		int		verdict;
+	} verdicts[] = {
+		{ "accept",	NF_ACCEPT },
+		{ "drop",	NF_DROP },
+		{ "continue",	NFT_CONTINUE },
+		{ "return",	NFT_RETURN },
+		{ "jump",	NFT_JUMP },
+		{ "goto",	NFT_GOTO },
+	};
+	const char *chain;
+	unsigned int i;
+	size_t len;
+
+	for (i = 0; i < array_size(verdicts); i++) {
+		len = strlen(verdicts[i].name);
+		if (strncmp(str, verdicts[i].name, len))
+			continue;
+
+		chain = str + len;
+		if (verdicts[i].verdict != NFT_JUMP &&
+		    verdicts[i].verdict != NFT_GOTO) {
+			if (*chain != '\0')
+				continue;
+		} else {
+			if (*chain != ' ' && *chain != '\t')
+				continue;
+			while (*chain == ' ' || *chain == '\t')
+				chain++;
+			if (*chain == '\0' ||
+			    strlen(chain) >= NFT_CHAIN_MAXNAMELEN)
+				return -1;
+			nftnl_set_elem_set(nlse, NFTNL_SET_ELEM_CHAIN,
+					   chain, strlen(chain));
+		}
+		nftnl_set_elem_set_u32(nlse, NFTNL_SET_ELEM_VERDICT,
+				       verdicts[i].verdict);
+		return 0;
+	}
+	return -1;
+}
+
+static int setelem_file_flush(struct setelem_file_ctx *sctx)
+{
+	struct netlink_ctx *ctx = sctx->nl_ctx;
+	int err;
+
+	if (sctx->nelems == 0)
+		return 0;
+
+	netlink_dump_set(sctx->nls, ctx);
+	if (ctx->batch_supported)
+		err = mnl_nft_setelem_batch_add(sctx->nls, ctx->batch,
+						sctx->flags, ctx->seqnum);
+	else
+		err = mnl_nft_setelem_add(ctx, sctx->nls, sctx->flags);
+
+	nftnl_set_free(sctx->nls);
+	sctx->nls = NULL;
+	sctx->nelems = 0;
+
+	if (err < 0)
+		netlink_io_error(ctx, &sctx->file->location,
+				 "Could not add set elements: %s",
+				 strerror(errno));
+	return err;
+}
+
+static struct nftnl_set_elem *setelem_file_elem(struct setelem_file_ctx *sctx)
+{
+	struct nftnl_set_elem *nlse;
+
+	if (sctx->nls == NULL)
+		sctx->nls = alloc_nftnl_set(sctx->h);
+
+	nlse = nftnl_set_elem_alloc();
+	if (nlse == NULL)
+		memory_allocation_error();
+	nftnl_set_elem_add(sctx->nls, nlse);
+	sctx->nelems++;
+
+	return nlse;
+}
+
+static int setelem_file_load_raw(struct setelem_file_ctx *sctx, FILE *fp)
+{
+	unsigned int reclen = sctx->keylen + sctx->datalen;
+	uint8_t rec[NFT_DATA_VALUE_MAXLEN * 2];
+	struct nftnl_set_elem *nlse;
+	size_t n;
+
+	while ((n = fread(rec, 1, reclen, fp)) == reclen) {
+		nlse = setelem_file_elem(sctx);
+		nftnl_set_elem_set(nlse, NFTNL_SET_ELEM_KEY, rec, sctx->keylen);
+		if (sctx->datalen)
+			nftnl_set_elem_set(nlse, NFTNL_SET_ELEM_DATA,
+					   rec + sctx->keylen, sctx->datalen);
+
+		if (sctx->nelems == SETELEM_FILE_CHUNK &&
+		    setelem_file_flush(sctx) < 0)
+			return -1;
+	}
+
+	if (ferror(fp))
+		return setelem_file_error(sctx, strerror(errno), NULL);
+	if (n != 0)
+		return setelem_file_error(sctx, "truncated element at end of file",
+					  NULL);
+	return 0;
+}
+
+static char *strip(char *str)
+{
+	char *end;
+
+	while (*str == ' ' || *str == '\t')
+		str++;
+
+	end = str + strlen(str);
+	while (end > str && (end[-1] == ' ' || end[-1] == '\t' ||
+			     end[-1] == '\n' || end[-1] == '\r'))
+		end--;
+	*end = '\0';
+
+	return str;
+}
+
+static int setelem_file_load_csv(struct setelem_file_ctx *sctx, FILE *fp)
+{
+	const struct set *set = sctx->set;
+	uint8_t buf[NFT_DATA_VALUE_MAXLEN];
+	struct nftnl_set_elem *nlse;
+	char *line = NULL, *key, *data;
+	size_t size = 0;
+	int ret = 0;
+
+	while (getline(&line, &size, fp) >= 0) {
+		sctx->line++;
+
+		key = strip(line);
+		if (*key == '\0' || *key == '#')
+			continue;
+
+		data = NULL;
+		if (set->flags & NFT_SET_MAP) {
+			data = strchr(key, ',');
+			if (data == NULL) {
+				ret = setelem_file_error(sctx, "missing data for key",
+							 key);
+				break;
+			}
+			*data++ = '\0';
+			key = strip(key);
+			data = strip(data);
+		}
+
+		if (parse_value(set->key->dtype, key, buf, sctx->keylen) < 0) {
+			ret = setelem_file_error(sctx, "invalid key", key);
+			break;
+		}
+		nlse = setelem_file_elem(sctx);
+		nftnl_set_elem_set(nlse, NFTNL_SET_ELEM_KEY, buf, sctx->keylen);
+
+		if (data == NULL) {
+			/* set without data */
+		} else if (set->datatype->type == TYPE_VERDICT) {
+			if (parse_verdict(data, nlse) < 0) {
+				ret = setelem_file_error(sctx, "invalid verdict",
+							 data);
+				break;
+			}
+		} else {
+			if (parse_value(set->datatype, data, buf,
+					sctx->datalen) < 0) {
+				ret = setelem_file_error(sctx, "invalid data",
+							 data);
+				break;
+			}
+			nftnl_set_elem_set(nlse, NFTNL_SET_ELEM_DATA, buf,
+					   sctx->datalen);
+		}
+
+		if (sctx->nelems == SETELEM_FILE_CHUNK &&
+		    setelem_file_flush(sctx) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+
+	if (ret == 0 && ferror(fp)) {
+		sctx->line = 0;
+		ret = setelem_file_error(sctx, strerror(errno), NULL);
+	}
+	free(line);
+	return ret;
+}
+
+int setelem_file_load(struct netlink_ctx *ctx, const struct handle *h,
+		      const struct set *set, const struct setelem_file *file,
+		      uint32_t flags)
+{
+	struct setelem_file_ctx sctx = {
+		.nl_ctx	= ctx,
+		.h	= h,
+		.set	= set,
+		.file	= file,
+		.flags	= flags,
+		.keylen	= div_round_up(set->key->len, BITS_PER_BYTE),
+	};
+	FILE *fp;
+	int ret;
+
+	if (set->flags & NFT_SET_MAP && set->datatype->type != TYPE_VERDICT)
+		sctx.datalen = div_round_up(set->datalen, BITS_PER_BYTE);
+
+	fp = fopen(file->path, "r");
+	if (fp == NULL)
+		return setelem_file_error(&sctx, strerror(errno), NULL);
+
+	switch (file->format) {
+	case SETELEM_FILE_RAW:
+		ret = setelem_file_load_raw(&sctx, fp);
+		break;
+	case SETELEM_FILE_CSV:
+		ret = setelem_file_load_csv(&sctx, fp);
+		break;
+	default:
+		BUG("unknown set element file format %u\n", file->format);
+	}
+	fclose(fp);
+
+	if (ret == 0)
+		ret = setelem_file_flush(&sctx);
+	else if (sctx.nls != NULL)
+		nftnl_set_free(sctx.nls);
+
+	return ret;
+}
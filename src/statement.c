@@ -225,7 +225,7 @@ static const char *syslog_level[LOG_DEBUG + 1] = {
 	[LOG_DEBUG]	= "debug",
 };
 
-static const char *log_level(uint32_t level)
+const char *log_level(uint32_t level)
 {
 	if (level > LOG_DEBUG)
 		return "unknown";
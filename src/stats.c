@@ -0,0 +1,307 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <libmnl/libmnl.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nf_tables.h>
+
+#include <nftables.h>
+#include <stats.h>
+#include <utils.h>
+
+static const char *const stats_phase_name[__NFT_STATS_MAX] = {
+	[NFT_STATS_OTHER]		= "other",
+	[NFT_STATS_PARSE]		= "parse",
+	[NFT_STATS_EVALUATE]		= "evaluate",
+	[NFT_STATS_CACHE_GENID]		= "cache-genid",
+	[NFT_STATS_CACHE_TABLE]		= "cache-table",
+	[NFT_STATS_CACHE_CHAIN]		= "cache-chain",
+	[NFT_STATS_CACHE_SET]		= "cache-set",
+	[NFT_STATS_CACHE_SETELEM]	= "cache-setelem",
+	[NFT_STATS_CACHE_OBJ]		= "cache-obj",
+	[NFT_STATS_CACHE_RULE]		= "cache-rule",
+	[NFT_STATS_LINEARIZE]		= "linearize",
+	[NFT_STATS_BATCH]		= "batch",
+	[NFT_STATS_SENDMSG]		= "sendmsg",
+	[NFT_STATS_ACK]			= "ack",
+};
+
+static const char *const stats_msg_name[NFT_STATS_MSG_TYPES] = {
+	[NFT_MSG_NEWTABLE]		= "newtable",
+	[NFT_MSG_GETTABLE]		= "gettable",
+	[NFT_MSG_DELTABLE]		= "deltable",
+	[NFT_MSG_NEWCHAIN]		= "newchain",
+	[NFT_MSG_GETCHAIN]		= "getchain",
+	[NFT_MSG_DELCHAIN]		= "delchain",
+	[NFT_MSG_NEWRULE]		= "newrule",
+	[NFT_MSG_GETRULE]		= "getrule",
+	[NFT_MSG_DELRULE]		= "delrule",
+	[NFT_MSG_NEWSET]		= "newset",
+	[NFT_MSG_GETSET]		= "getset",
+	[NFT_MSG_DELSET]		= "delset",
+	[NFT_MSG_NEWSETELEM]		= "newsetelem",
+	[NFT_MSG_GETSETELEM]		= "getsetelem",
+	[NFT_MSG_DELSETELEM]		= "delsetelem",
+	[NFT_MSG_NEWGEN]		= "newgen",
+	[NFT_MSG_GETGEN]		= "getgen",
+	[NFT_MSG_TRACE]			= "trace",
+	[NFT_MSG_NEWOBJ]		= "newobj",
+	[NFT_MSG_GETOBJ]		= "getobj",
+	[NFT_MSG_DELOBJ]		= "delobj",
+	[NFT_MSG_GETOBJ_RESET]		= "getobj-reset",
+};
+
+static uint64_t timespec_delta_ns(const struct timespec *from,
+				  const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000000000ULL +
+	       to->tv_nsec - from->tv_nsec;
+}
+
+static struct nft_stats_ctx *stats_ctx(const struct output_ctx *octx)
+{
+	return octx ? octx->stats : NULL;
+}
+
+/* Account the time elapsed since the last phase switch to the current one. */
+static void stats_account(struct nft_stats_ctx *sctx)
+{
+	struct nft_stats_time *t = &sctx->stats.phase[sctx->phase];
+	struct timespec wall, cpu;
+
+	clock_gettime(CLOCK_MONOTONIC, &wall);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+
+	t->wall_ns += timespec_delta_ns(&sctx->wall, &wall);
+	t->cpu_ns += timespec_delta_ns(&sctx->cpu, &cpu);
+
+	sctx->wall = wall;
+	sctx->cpu = cpu;
+}
+
+void stats_run_begin(struct output_ctx *octx)
+{
+	struct nft_stats_ctx *sctx = stats_ctx(octx);
+
+	if (sctx == NULL || sctx->running)
+		return;
+
+	sctx->running = true;
+	sctx->phase = NFT_STATS_OTHER;
+	sctx->stats.phase[NFT_STATS_OTHER].calls++;
+	memset(&sctx->allocs, 0, sizeof(sctx->allocs));
+	sctx->prev_allocs = xalloc_counters_set(&sctx->allocs);
+	clock_gettime(CLOCK_MONOTONIC, &sctx->wall);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &sctx->cpu);
+}
+
+void stats_run_end(struct output_ctx *octx)
+{
+	struct nft_stats_ctx *sctx = stats_ctx(octx);
+	struct rusage ru;
+
+	if (sctx == NULL || !sctx->running)
+		return;
+
+	stats_account(sctx);
+	sctx->running = false;
+
+	xalloc_counters_set(sctx->prev_allocs);
+	sctx->stats.allocs += sctx->allocs.count;
+	sctx->stats.alloc_bytes += sctx->allocs.bytes;
+
+	if (getrusage(RUSAGE_SELF, &ru) == 0)
+		sctx->stats.peak_rss_kb = ru.ru_maxrss;
+}
+
+/*
+ * Switch accounting to @phase, returns the phase to be passed to
+ * stats_phase_leave() once @phase is over.
+ */
+enum nft_stats_phase stats_phase_enter(struct output_ctx *octx,
+				       enum nft_stats_phase phase)
+{
+	struct nft_stats_ctx *sctx = stats_ctx(octx);
+	enum nft_stats_phase prev;
+
+	if (sctx == NULL || !sctx->running)
+		return NFT_STATS_OTHER;
+
+	stats_account(sctx);
+	prev = sctx->phase;
+	sctx->phase = phase;
+	sctx->stats.phase[phase].calls++;
+
+	return prev;
+}
+
+void stats_phase_leave(struct output_ctx *octx, enum nft_stats_phase prev)
+{
+	struct nft_stats_ctx *sctx = stats_ctx(octx);
+
+	if (sctx == NULL || !sctx->running)
+		return;
+
+	stats_account(sctx);
+	sctx->phase = prev;
+}
+
+static struct nft_stats_msg *stats_msg(struct nft_stats_ctx *sctx,
+				       const struct nlmsghdr *nlh)
+{
+	unsigned int type = NFNL_MSG_TYPE(nlh->nlmsg_type);
+
+	if (NFNL_SUBSYS_ID(nlh->nlmsg_type) != NFNL_SUBSYS_NFTABLES ||
+	    type >= NFT_STATS_MSG_TYPES)
+		return &sctx->stats.ctrl;
+
+	return &sctx->stats.msg[type];
+}
+
+void stats_msg_tx(struct output_ctx *octx, const void *buf, size_t len)
+{
+	const struct nlmsghdr *nlh = buf;
+	struct nft_stats_ctx *sctx = stats_ctx(octx);
+	int rem = len;
+
+	if (sctx == NULL)
+		return;
+
+	while (mnl_nlmsg_ok(nlh, rem)) {
+		struct nft_stats_msg *msg = stats_msg(sctx, nlh);
+
+		msg->tx_msgs++;
+		msg->tx_bytes += nlh->nlmsg_len;
+		nlh = mnl_nlmsg_next(nlh, &rem);
+	}
+}
+
+void stats_msg_rx(struct output_ctx *octx, const void *buf, size_t len)
+{
+	const struct nlmsghdr *nlh = buf;
+	struct nft_stats_ctx *sctx = stats_ctx(octx);
+	int rem = len;
+
+	if (sctx == NULL)
+		return;
+
+	while (mnl_nlmsg_ok(nlh, rem)) {
+		struct nft_stats_msg *msg = stats_msg(sctx, nlh);
+
+		msg->rx_msgs++;
+		msg->rx_bytes += nlh->nlmsg_len;
+		nlh = mnl_nlmsg_next(nlh, &rem);
+	}
+}
+
+static bool stats_msg_empty(const struct nft_stats_msg *msg)
+{
+	return !msg->tx_msgs && !msg->rx_msgs;
+}
+
+static void stats_print_plain(FILE *fp, const struct nft_stats *stats)
+{
+	const struct nft_stats_msg *msg;
+	unsigned int i;
+
+	fprintf(fp, "# %-14s %10s %14s %14s\n",
+		"phase", "calls", "wall-us", "cpu-us");
+	for (i = 0; i < __NFT_STATS_MAX; i++) {
+		if (!stats->phase[i].calls)
+			continue;
+		fprintf(fp, "# %-14s %10llu %14llu %14llu\n",
+			stats_phase_name[i],
+			(unsigned long long)stats->phase[i].calls,
+			(unsigned long long)stats->phase[i].wall_ns / 1000,
+			(unsigned long long)stats->phase[i].cpu_ns / 1000);
+	}
+
+	fprintf(fp, "# %-14s %10s %14s %10s %14s\n",
+		"message", "tx-msgs", "tx-bytes", "rx-msgs", "rx-bytes");
+	for (i = 0; i <= NFT_STATS_MSG_TYPES; i++) {
+		msg = i < NFT_STATS_MSG_TYPES ? &stats->msg[i] : &stats->ctrl;
+		if (stats_msg_empty(msg))
+			continue;
+
+		if (i == NFT_STATS_MSG_TYPES)
+			fprintf(fp, "# %-14s", "control");
+		else if (stats_msg_name[i])
+			fprintf(fp, "# %-14s", stats_msg_name[i]);
+		else
+			fprintf(fp, "# type-%-9u", i);
+
+		fprintf(fp, " %10llu %14llu %10llu %14llu\n",
+			(unsigned long long)msg->tx_msgs,
+			(unsigned long long)msg->tx_bytes,
+			(unsigned long long)msg->rx_msgs,
+			(unsigned long long)msg->rx_bytes);
+	}
+
+	fprintf(fp, "# allocations %llu (%llu bytes), peak rss %llu kB\n",
+		(unsigned long long)stats->allocs,
+		(unsigned long long)stats->alloc_bytes,
+		(unsigned long long)stats->peak_rss_kb);
+}
+
+static void stats_print_json(FILE *fp, const struct nft_stats *stats)
+{
+	const struct nft_stats_msg *msg;
+	const char *sep = "";
+	unsigned int i;
+
+	fprintf(fp, "{\"phases\": {");
+	for (i = 0; i < __NFT_STATS_MAX; i++) {
+		if (!stats->phase[i].calls)
+			continue;
+		fprintf(fp, "%s\"%s\": {\"calls\": %llu, \"wall_ns\": %llu, "
+			"\"cpu_ns\": %llu}", sep, stats_phase_name[i],
+			(unsigned long long)stats->phase[i].calls,
+			(unsigned long long)stats->phase[i].wall_ns,
+			(unsigned long long)stats->phase[i].cpu_ns);
+		sep = ", ";
+	}
+
+	fprintf(fp, "}, \"messages\": {");
+	sep = "";
+	for (i = 0; i <= NFT_STATS_MSG_TYPES; i++) {
+		msg = i < NFT_STATS_MSG_TYPES ? &stats->msg[i] : &stats->ctrl;
+		if (stats_msg_empty(msg))
+			continue;
+
+		if (i == NFT_STATS_MSG_TYPES)
+			fprintf(fp, "%s\"control\"", sep);
+		else if (stats_msg_name[i])
+			fprintf(fp, "%s\"%s\"", sep, stats_msg_name[i]);
+		else
+			fprintf(fp, "%s\"type-%u\"", sep, i);
+
+		fprintf(fp, ": {\"tx_msgs\": %llu, \"tx_bytes\": %llu, "
+			"\"rx_msgs\": %llu, \"rx_bytes\": %llu}",
+			(unsigned long long)msg->tx_msgs,
+			(unsigned long long)msg->tx_bytes,
+			(unsigned long long)msg->rx_msgs,
+			(unsigned long long)msg->rx_bytes);
+		sep = ", ";
+	}
+
+	fprintf(fp, "}, \"allocs\": %llu, \"alloc_bytes\": %llu, "
+		"\"peak_rss_kb\": %llu}\n",
+		(unsigned long long)stats->allocs,
+		(unsigned long long)stats->alloc_bytes,
+		(unsigned long long)stats->peak_rss_kb);
+}
+
+void nft_stats_print(FILE *fp, const struct nft_stats *stats, bool json)
+{
+	if (json)
+		stats_print_json(fp, stats);
+	else
+		stats_print_plain(fp, stats);
+}
@@ -0,0 +1,732 @@
+/*
+ * Rule hit profile built from trace events.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <endian.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <libmnl/libmnl.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nf_tables.h>
+
+#include <nftables.h>
+#include <netlink.h>
+#include <expression.h>
+#include <rule_index.h>
+#include <trace_profile.h>
+#include <utils.h>
+
+#define TRACE_PROFILE_HSIZE	1024
+/* Number of rules listed in each report. */
+#define TRACE_PROFILE_TOP	20
+/* Interval between two reports, in milliseconds. */
+#define TRACE_PROFILE_MSECS	5000
+/* Same as the kernel jump stack size. */
+#define TRACE_PROFILE_DEPTH	16
+/* Report column widths, the header is aligned on them. */
+#define TRACE_PROFILE_HITS_W	10
+#define TRACE_PROFILE_SHARE_W	8
+
+/**
+ * struct trace_chain - chain packets were traced in
+ *
+ * @hnode:	hash table node
+ * @family:	nfnetlink family
+ * @table:	table name
+ * @name:	chain name
+ * @chain:	cached chain, NULL if unknown
+ * @nrules:	number of rules of the cached chain
+ *
+ * @chain and @nrules are resolved again whenever the ruleset changes.
+ * @entered:	number of packets that entered the chain
+ */
+struct trace_chain {
+	struct hlist_node	hnode;
+	uint32_t		family;
+	char			*table;
+	char			*name;
+	const struct chain	*chain;
+	int			nrules;
+	uint64_t		entered;
+};
+
+/**
+ * struct trace_hit - packets that hit a rule with the same verdict
+ *
+ * @hnode:	hash table node
+ * @list:	list node, in order of appearance
+ * @chain:	chain the rule belongs to
+ * @handle:	rule handle, zero for the end of the chain and its policy
+ * @type:	trace type (NFT_TRACETYPE_*)
+ * @verdict:	verdict code
+ * @target:	jump or goto target, NULL otherwise
+ * @rule:	cached rule, NULL if unknown
+ * @position:	position of the rule in the chain, -1 if unknown
+ *
+ * @rule and @position are resolved again whenever the ruleset changes.
+ * @hits:	number of packets
+ * @left:	number of packets that did not continue in the chain afterwards
+ */
+struct trace_hit {
+	struct hlist_node	hnode;
+	struct list_head	list;
+	struct trace_chain	*chain;
+	uint64_t		handle;
+	uint32_t		type;
+	int			verdict;
+	char			*target;
+	const struct rule	*rule;
+	int			position;
+	uint64_t		hits;
+	uint64_t		left;
+};
+
+/**
+ * struct trace_frame - chain a packet is being evaluated in
+ *
+ * @chain:	the chain
+ * @jump:	rule the packet jumped from to the next frame, if any
+ */
+struct trace_frame {
+	struct trace_chain	*chain;
+	struct trace_hit	*jump;
+};
+
+/**
+ * struct trace_packet - packet whose traversal is in progress
+ *
+ * @hnode:	hash table node
+ * @id:		trace id
+ * @seen:	report generation the packet was last seen in
+ * @depth:	number of frames on @stack
+ * @stack:	chains the packet is being evaluated in, base chain first
+ */
+struct trace_packet {
+	struct hlist_node	hnode;
+	uint32_t		id;
+	uint64_t		seen;
+	unsigned int		depth;
+	struct trace_frame	stack[TRACE_PROFILE_DEPTH];
+};
+
+/**
+ * struct trace_profile - aggregated trace events
+ *
+ * @monh:	monitor handler
+ * @chains:	chains, hashed by name
+ * @hits:	rule hits, hashed by chain and handle
+ * @packets:	packets in progress, hashed by trace id
+ * @hit_list:	rule hits, in order of appearance
+ * @nhits:	number of entries on @hit_list
+ * @total:	number of packets traced
+ * @elapsed:	milliseconds since the last report
+ * @runtime:	milliseconds since the profile was started
+ * @generation:	number of reports so far
+ */
+struct trace_profile {
+	struct netlink_mon_handler	*monh;
+	struct hlist_head		chains[TRACE_PROFILE_HSIZE];
+	struct hlist_head		hits[TRACE_PROFILE_HSIZE];
+	struct hlist_head		packets[TRACE_PROFILE_HSIZE];
+	struct list_head		hit_list;
+	unsigned int			nhits;
+	uint64_t			total;
+	uint64_t			elapsed;
+	uint64_t			runtime;
+	uint64_t			generation;
+};
+
+/**
+ * struct trace_event - trace event, as read from the netlink attributes
+ *
+ * @family:	nfnetlink family
+ * @id:		trace id
+ * @type:	trace type (NFT_TRACETYPE_*)
+ * @table:	table name
+ * @chain:	chain name
+ * @handle:	rule handle, zero if none
+ * @verdict:	verdict code
+ * @target:	jump or goto target, NULL otherwise
+ */
+struct trace_event {
+	uint32_t		family;
+	uint32_t		id;
+	uint32_t		type;
+	const char		*table;
+	const char		*chain;
+	uint64_t		handle;
+	int			verdict;
+	const char		*target;
+};
+
+static uint32_t trace_hash_str(uint32_t hash, const char *s)
+{
+	while (s && *s)
+		hash = (hash ^ (unsigned char)*s++) * 16777619U;
+
+	return hash;
+}
+
+static void trace_event_parse_verdict(const struct nlattr *nest,
+				      struct trace_event *ev)
+{
+	const struct nlattr *attr;
+
+	mnl_attr_for_each_nested(attr, nest) {
+		switch (mnl_attr_get_type(attr)) {
+		case NFTA_VERDICT_CODE:
+			if (mnl_attr_validate(attr, MNL_TYPE_U32) < 0)
+				break;
+			ev->verdict = ntohl(mnl_attr_get_u32(attr));
+			if (ev->verdict >= 0)
+				ev->verdict &= NF_VERDICT_MASK;
+			break;
+		case NFTA_VERDICT_CHAIN:
+			if (mnl_attr_validate(attr, MNL_TYPE_NUL_STRING) < 0)
+				break;
+			ev->target = mnl_attr_get_str(attr);
+			break;
+		}
+	}
+}
+
+/*
+ * Trace events are parsed in place, there is no need for a nftnl_trace
+ * object as the packet headers are not of interest here.
+ */
+static int trace_event_parse(const struct nlmsghdr *nlh,
+			     struct trace_event *ev)
+{
+	const struct nfgenmsg *nfg = mnl_nlmsg_get_payload(nlh);
+	const struct nlattr *attr;
+
+	memset(ev, 0, sizeof(*ev));
+	ev->family = nfg->nfgen_family;
+	ev->verdict = NFT_CONTINUE;
+
+	mnl_attr_for_each(attr, nlh, sizeof(struct nfgenmsg)) {
+		switch (mnl_attr_get_type(attr)) {
+		case NFTA_TRACE_TABLE:
+			if (mnl_attr_validate(attr, MNL_TYPE_NUL_STRING) < 0)
+				break;
+			ev->table = mnl_attr_get_str(attr);
+			break;
+		case NFTA_TRACE_CHAIN:
+			if (mnl_attr_validate(attr, MNL_TYPE_NUL_STRING) < 0)
+				break;
+			ev->chain = mnl_attr_get_str(attr);
+			break;
+		case NFTA_TRACE_ID:
+			if (mnl_attr_validate(attr, MNL_TYPE_U32) < 0)
+				break;
+			ev->id = ntohl(mnl_attr_get_u32(attr));
+			break;
+		case NFTA_TRACE_TYPE:
+			if (mnl_attr_validate(attr, MNL_TYPE_U32) < 0)
+				break;
+			ev->type = ntohl(mnl_attr_get_u32(attr));
+			break;
+		case NFTA_TRACE_RULE_HANDLE:
+			if (mnl_attr_validate(attr, MNL_TYPE_U64) < 0)
+				break;
+			ev->handle = be64toh(mnl_attr_get_u64(attr));
+			break;
+		case NFTA_TRACE_VERDICT:
+			if (mnl_attr_validate(attr, MNL_TYPE_NESTED) < 0)
+				break;
+			trace_event_parse_verdict(attr, ev);
+			break;
+		}
+	}
+
+	if (ev->table == NULL || ev->chain == NULL)
+		return -1;
+
+	return 0;
+}
+
+static void trace_chain_resolve(struct trace_profile *p,
+				struct trace_chain *tc)
+{
+	const struct rule *rule;
+	const struct table *t;
+	struct handle h;
+
+	tc->chain = NULL;
+	tc->nrules = 0;
+
+	memset(&h, 0, sizeof(h));
+	h.family = tc->family;
+	h.table = tc->table;
+	h.chain = tc->name;
+	t = table_lookup(&h, p->monh->cache);
+	if (t != NULL)
+		tc->chain = chain_lookup(t, &h);
+	if (tc->chain != NULL && tc->chain->rule_index != NULL) {
+		tc->nrules = rule_index_count(tc->chain->rule_index);
+	} else if (tc->chain != NULL) {
+		list_for_each_entry(rule, &tc->chain->rules, list)
+			tc->nrules++;
+	}
+}
+
+static struct trace_chain *trace_chain_get(struct trace_profile *p,
+					   uint32_t family, const char *table,
+					   const char *name)
+{
+	struct trace_chain *tc;
+	struct hlist_node *n;
+	uint32_t hash;
+
+	hash = trace_hash_str(trace_hash_str(2166136261U ^ family, table),
+			      name) % TRACE_PROFILE_HSIZE;
+	hlist_for_each_entry(tc, n, &p->chains[hash], hnode) {
+		if (tc->family == family && !strcmp(tc->table, table) &&
+		    !strcmp(tc->name, name))
+			return tc;
+	}
+
+	tc = xzalloc(sizeof(*tc));
+	tc->family = family;
+	tc->table = xstrdup(table);
+	tc->name = xstrdup(name);
+	trace_chain_resolve(p, tc);
+
+	hlist_add_head(&tc->hnode, &p->chains[hash]);
+	return tc;
+}
+
+static bool trace_hit_match(const struct trace_hit *hit,
+			    const struct trace_chain *tc,
+			    const struct trace_event *ev)
+{
+	if (hit->chain != tc || hit->handle != ev->handle ||
+	    hit->type != ev->type || hit->verdict != ev->verdict)
+		return false;
+
+	if (hit->target == NULL || ev->target == NULL)
+		return hit->target == ev->target;
+
+	return !strcmp(hit->target, ev->target);
+}
+
+static void trace_hit_resolve(struct trace_hit *hit)
+{
+	const struct trace_chain *tc = hit->chain;
+	struct rule_index_entry *e;
+	const struct rule *rule;
+	int pos = 0;
+
+	hit->rule = NULL;
+
+	/* the end of the chain and its policy come after the last rule */
+	hit->position = -1;
+	if (tc->chain != NULL && hit->handle == 0) {
+		hit->position = tc->nrules;
+	} else if (tc->chain != NULL && tc->chain->rule_index != NULL) {
+		e = rule_index_lookup(tc->chain->rule_index, hit->handle);
+		if (e != NULL) {
+			hit->rule = e->rule;
+			hit->position = rule_index_position(e);
+		}
+	} else if (tc->chain != NULL) {
+		list_for_each_entry(rule, &tc->chain->rules, list) {
+			if (rule->handle.handle.id == hit->handle) {
+				hit->rule = rule;
+				hit->position = pos;
+				break;
+			}
+			pos++;
+		}
+	}
+}
+
+static struct trace_hit *trace_hit_get(struct trace_profile *p,
+				       struct trace_chain *tc,
+				       const struct trace_event *ev)
+{
+	struct trace_hit *hit;
+	struct hlist_node *n;
+	uint32_t hash;
+
+	hash = (((uintptr_t)tc >> 4) ^ ev->handle ^ (ev->type << 16)) %
+	       TRACE_PROFILE_HSIZE;
+	hlist_for_each_entry(hit, n, &p->hits[hash], hnode) {
+		if (trace_hit_match(hit, tc, ev))
+			return hit;
+	}
+
+	hit = xzalloc(sizeof(*hit));
+	hit->chain = tc;
+	hit->handle = ev->handle;
+	hit->type = ev->type;
+	hit->verdict = ev->verdict;
+	if (ev->target)
+		hit->target = xstrdup(ev->target);
+	trace_hit_resolve(hit);
+
+	hlist_add_head(&hit->hnode, &p->hits[hash]);
+	list_add_tail(&hit->list, &p->hit_list);
+	p->nhits++;
+	return hit;
+}
+
+static struct trace_packet *trace_packet_get(struct trace_profile *p,
+					     uint32_t id)
+{
+	struct trace_packet *pkt;
+	struct hlist_node *n;
+	uint32_t hash = id % TRACE_PROFILE_HSIZE;
+
+	hlist_for_each_entry(pkt, n, &p->packets[hash], hnode) {
+		if (pkt->id == id)
+			goto out;
+	}
+
+	pkt = xzalloc(sizeof(*pkt));
+	pkt->id = id;
+	hlist_add_head(&pkt->hnode, &p->packets[hash]);
+	p->total++;
+out:
+	pkt->seen = p->generation;
+	return pkt;
+}
+
+static void trace_packet_push(struct trace_packet *pkt,
+			      struct trace_chain *tc)
+{
+	/* lost events may leave stale frames behind, start over */
+	if (pkt->depth == TRACE_PROFILE_DEPTH)
+		pkt->depth = 0;
+
+	pkt->stack[pkt->depth].chain = tc;
+	pkt->stack[pkt->depth].jump = NULL;
+	pkt->depth++;
+	tc->entered++;
+}
+
+/*
+ * Make @tc the chain the packet is evaluated in. It is usually already on
+ * top of the stack, unless returns from other chains were not seen.
+ */
+static struct trace_frame *trace_packet_enter(struct trace_packet *pkt,
+					      struct trace_chain *tc)
+{
+	unsigned int i;
+
+	for (i = pkt->depth; i > 0; i--) {
+		if (pkt->stack[i - 1].chain == tc) {
+			pkt->depth = i;
+			return &pkt->stack[i - 1];
+		}
+	}
+
+	trace_packet_push(pkt, tc);
+	return &pkt->stack[pkt->depth - 1];
+}
+
+/* The packet got a final verdict, so it also left every calling chain. */
+static void trace_packet_done(struct trace_profile *p,
+			      struct trace_packet *pkt)
+{
+	unsigned int i;
+
+	for (i = 0; i + 1 < pkt->depth; i++) {
+		if (pkt->stack[i].jump)
+			pkt->stack[i].jump->left++;
+	}
+
+	hlist_del(&pkt->hnode);
+	xfree(pkt);
+}
+
+/*
+ * The cached chains and rules the profile points to may be gone after a
+ * ruleset update, look them up again.
+ */
+static void trace_profile_resolve(struct trace_profile *p)
+{
+	struct trace_chain *tc;
+	struct trace_hit *hit;
+	struct hlist_node *n;
+	unsigned int i;
+
+	for (i = 0; i < TRACE_PROFILE_HSIZE; i++) {
+		hlist_for_each_entry(tc, n, &p->chains[i], hnode)
+			trace_chain_resolve(p, tc);
+	}
+
+	list_for_each_entry(hit, &p->hit_list, list)
+		trace_hit_resolve(hit);
+}
+
+int trace_profile_event_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct trace_profile *p = data;
+	const struct handle *filter = p->monh->filter;
+	uint16_t type = NFNL_MSG_TYPE(nlh->nlmsg_type);
+	struct trace_packet *pkt;
+	struct trace_frame *frame;
+	struct trace_chain *tc;
+	struct trace_hit *hit;
+	struct trace_event ev;
+
+	/* keep rules added or deleted while profiling resolvable */
+	if (type != NFT_MSG_TRACE) {
+		netlink_events_cache_update(p->monh, nlh, type);
+		if (type == NFT_MSG_NEWCHAIN || type == NFT_MSG_DELCHAIN ||
+		    type == NFT_MSG_NEWRULE || type == NFT_MSG_DELRULE ||
+		    type == NFT_MSG_DELTABLE)
+			trace_profile_resolve(p);
+		return MNL_CB_OK;
+	}
+
+	if (trace_event_parse(nlh, &ev) < 0)
+		return MNL_CB_OK;
+
+	if (filter && filter->family != NFPROTO_UNSPEC &&
+	    filter->family != ev.family)
+		return MNL_CB_OK;
+	if (filter && filter->table && strcmp(filter->table, ev.table))
+		return MNL_CB_OK;
+
+	tc = trace_chain_get(p, ev.family, ev.table, ev.chain);
+	pkt = trace_packet_get(p, ev.id);
+	frame = trace_packet_enter(pkt, tc);
+
+	/* falling off the end of a chain is not a rule of its own */
+	if (ev.type != NFT_TRACETYPE_RULE && ev.verdict != NFT_RETURN)
+		ev.handle = 0;
+
+	hit = trace_hit_get(p, tc, &ev);
+	hit->hits++;
+
+	switch (ev.type) {
+	case NFT_TRACETYPE_RULE:
+		break;
+	case NFT_TRACETYPE_RETURN:
+		hit->left++;
+		pkt->depth--;
+		if (pkt->depth > 0)
+			pkt->stack[pkt->depth - 1].jump = NULL;
+		return MNL_CB_OK;
+	case NFT_TRACETYPE_POLICY:
+	default:
+		hit->left++;
+		trace_packet_done(p, pkt);
+		return MNL_CB_OK;
+	}
+
+	switch (ev.verdict) {
+	case NFT_CONTINUE:
+	case NFT_BREAK:
+		break;
+	case NFT_JUMP:
+		if (ev.target == NULL)
+			break;
+		frame->jump = hit;
+		trace_packet_push(pkt, trace_chain_get(p, ev.family, ev.table,
+						       ev.target));
+		break;
+	case NFT_GOTO:
+		if (ev.target == NULL)
+			break;
+		hit->left++;
+		pkt->depth--;
+		trace_packet_push(pkt, trace_chain_get(p, ev.family, ev.table,
+						       ev.target));
+		break;
+	default:
+		hit->left++;
+		trace_packet_done(p, pkt);
+		break;
+	}
+
+	return MNL_CB_OK;
+}
+
+/* Share of the packets entering the chain that get as far as @hit. */
+static double trace_hit_reach(const struct trace_profile *p,
+			      const struct trace_hit *hit)
+{
+	const struct trace_chain *tc = hit->chain;
+	const struct trace_hit *prev;
+	uint64_t left = 0;
+
+	list_for_each_entry(prev, &p->hit_list, list) {
+		if (prev->chain == tc && prev->position >= 0 &&
+		    prev->position < hit->position)
+			left += prev->left;
+	}
+
+	if (left >= tc->entered)
+		return 0;
+
+	return 100.0 * (tc->entered - left) / tc->entered;
+}
+
+static void trace_hit_print(const struct trace_profile *p,
+			    const struct trace_hit *hit)
+{
+	struct output_ctx *octx = p->monh->ctx->octx;
+	const struct trace_chain *tc = hit->chain;
+	char share[32], reach[32];
+	struct expr *verdict;
+
+	snprintf(share, sizeof(share), "%.2f%%", 100.0 * hit->hits / p->total);
+	if (hit->position >= 0 && tc->entered)
+		snprintf(reach, sizeof(reach), "%.2f%%",
+			 trace_hit_reach(p, hit));
+	else
+		snprintf(reach, sizeof(reach), "-");
+
+	nft_print(octx, "%*llu %*s %*s  %s %s %s ",
+		  TRACE_PROFILE_HITS_W, (unsigned long long)hit->hits,
+		  TRACE_PROFILE_SHARE_W, share, TRACE_PROFILE_SHARE_W, reach,
+		  family2str(tc->family), tc->table, tc->name);
+
+	if (hit->handle == 0) {
+		if (hit->type == NFT_TRACETYPE_POLICY)
+			nft_print(octx, "policy %s\n",
+				  hit->verdict == NF_ACCEPT ? "accept" : "drop");
+		else
+			nft_print(octx, "return\n");
+		return;
+	}
+
+	nft_print(octx, "handle %llu ", (unsigned long long)hit->handle);
+	if (hit->rule) {
+		rule_print(hit->rule, octx);
+		nft_print(octx, " ");
+	}
+
+	verdict = verdict_expr_alloc(&netlink_location, hit->verdict,
+				     hit->target ? xstrdup(hit->target) : NULL);
+	nft_print(octx, "(verdict ");
+	expr_print(verdict, octx);
+	nft_print(octx, ")\n");
+	expr_free(verdict);
+}
+
+static int trace_hit_cmp(const void *a, const void *b)
+{
+	const struct trace_hit *h1 = *(const struct trace_hit **)a;
+	const struct trace_hit *h2 = *(const struct trace_hit **)b;
+
+	if (h1->hits != h2->hits)
+		return h1->hits < h2->hits ? 1 : -1;
+
+	return 0;
+}
+
+/* Forget about packets whose remaining events were lost. */
+static void trace_profile_expire(struct trace_profile *p)
+{
+	struct hlist_node *n, *next;
+	struct trace_packet *pkt;
+	unsigned int i;
+
+	for (i = 0; i < TRACE_PROFILE_HSIZE; i++) {
+		hlist_for_each_safe(n, next, &p->packets[i]) {
+			pkt = hlist_entry(n, struct trace_packet, hnode);
+			if (pkt->seen + 1 >= p->generation)
+				continue;
+
+			hlist_del(&pkt->hnode);
+			xfree(pkt);
+		}
+	}
+}
+
+/*
+ * Print the rules hit most often so far, most frequent first, along with
+ * the share of traced packets hitting them and the share of packets
+ * entering the chain that reach the rule position.
+ */
+void trace_profile_report(void *data, uint64_t msecs)
+{
+	struct trace_profile *p = data;
+	const struct handle *filter = p->monh->filter;
+	struct output_ctx *octx = p->monh->ctx->octx;
+	struct trace_hit **hits, *hit;
+	unsigned int i, n = 0;
+
+	p->elapsed += msecs;
+	p->runtime += msecs;
+	if (p->elapsed < TRACE_PROFILE_MSECS)
+		return;
+
+	p->elapsed = 0;
+	p->generation++;
+	trace_profile_expire(p);
+
+	if (p->nhits == 0)
+		return;
+
+	hits = xmalloc(p->nhits * sizeof(*hits));
+	list_for_each_entry(hit, &p->hit_list, list) {
+		if (filter && filter->chain &&
+		    strcmp(filter->chain, hit->chain->name))
+			continue;
+		hits[n++] = hit;
+	}
+	qsort(hits, n, sizeof(*hits), trace_hit_cmp);
+
+	nft_print(octx, "# trace profile: %llu packets in %llu seconds\n",
+		  (unsigned long long)p->total,
+		  (unsigned long long)p->runtime / 1000);
+	nft_print(octx, "#%*s %*s %*s  %s\n", TRACE_PROFILE_HITS_W - 1, "hits",
+		  TRACE_PROFILE_SHARE_W, "packets", TRACE_PROFILE_SHARE_W,
+		  "reach", "rule");
+	for (i = 0; i < n && i < TRACE_PROFILE_TOP; i++)
+		trace_hit_print(p, hits[i]);
+
+	xfree(hits);
+}
+
+struct trace_profile *trace_profile_alloc(struct netlink_mon_handler *monh)
+{
+	struct trace_profile *p;
+
+	p = xzalloc(sizeof(*p));
+	p->monh = monh;
+	init_list_head(&p->hit_list);
+
+	return p;
+}
+
+void trace_profile_free(struct trace_profile *p)
+{
+	struct trace_chain *tc;
+	struct trace_packet *pkt;
+	struct trace_hit *hit, *next;
+	struct hlist_node *n, *tmp;
+	unsigned int i;
+
+	list_for_each_entry_safe(hit, next, &p->hit_list, list) {
+		xfree(hit->target);
+		xfree(hit);
+	}
+
+	for (i = 0; i < TRACE_PROFILE_HSIZE; i++) {
+		hlist_for_each_safe(n, tmp, &p->chains[i]) {
+			tc = hlist_entry(n, struct trace_chain, hnode);
+			xfree(tc->table);
+			xfree(tc->name);
+			xfree(tc);
+		}
+		hlist_for_each_safe(n, tmp, &p->packets[i]) {
+			pkt = hlist_entry(n, struct trace_packet, hnode);
+			xfree(pkt);
+		}
+	}
+
+	xfree(p);
+}
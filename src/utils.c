@@ -24,6 +24,50 @@ void __noreturn __memory_allocation_error(const char *filename, uint32_t line)
 	exit(NFT_EXIT_NOMEM);
 }
 
+/*
+ * Allocation counters of the context whose commands run on this thread, only
+ * set while statistics are collected, see stats_run_begin().
+ */
+static __thread struct xalloc_counters *xalloc_counters;
+
+static void xalloc_account(size_t size)
+{
+	struct xalloc_counters *c = xalloc_counters;
+
+	if (c == NULL)
+		return;
+
+	c->count++;
+	c->bytes += size;
+}
+
+/*
+ * Account the allocations of the calling thread to @c, or stop accounting
+ * if NULL. Returns the counters used so far, to be restored afterwards.
+ */
+struct xalloc_counters *xalloc_counters_set(struct xalloc_counters *c)
+{
+	struct xalloc_counters *prev = xalloc_counters;
+
+	xalloc_counters = c;
+	return prev;
+}
+
+/* Add allocations counted on another thread to those of the calling thread. */
+void xalloc_counters_add(const struct xalloc_counters *c)
+{
+	if (xalloc_counters == NULL)
+		return;
+
+	xalloc_counters->count += c->count;
+	xalloc_counters->bytes += c->bytes;
+}
+
+bool xalloc_counting(void)
+{
+	return xalloc_counters != NULL;
+}
+
 void xfree(const void *ptr)
 {
 	free((void *)ptr);
@@ -36,6 +80,7 @@ void *xmalloc(size_t size)
 	ptr = malloc(size);
 	if (ptr == NULL)
 		memory_allocation_error();
+	xalloc_account(size);
 	return ptr;
 }
 
@@ -55,6 +100,7 @@ void *xrealloc(void *ptr, size_t size)
 	ptr = realloc(ptr, size);
 	if (ptr == NULL && size != 0)
 		memory_allocation_error();
+	xalloc_account(size);
 	return ptr;
 }
 
@@ -75,6 +121,7 @@ char *xstrdup(const char *s)
 	res = strdup(s);
 	if (res == NULL)
 		memory_allocation_error();
+	xalloc_account(strlen(res) + 1);
 	return res;
 }
 
@@ -7,6 +7,7 @@
  * published by the Free Software Foundation.
  */
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
@@ -26,10 +27,19 @@
 #include <linux/netfilter_arp/arp_tables.h>
 #include <linux/netfilter_bridge/ebtables.h>
 
+/*
+ * libxtables keeps the protocol family and the list of loaded extensions
+ * in global variables, which are shared by all contexts. Looking up and
+ * printing extensions is serialized.
+ */
+static pthread_mutex_t xt_lock = PTHREAD_MUTEX_INITIALIZER;
+
 void xt_stmt_xlate(const struct stmt *stmt)
 {
 	struct xt_xlate *xl = xt_xlate_alloc(10240);
 
+	pthread_mutex_lock(&xt_lock);
+
 	switch (stmt->xt.type) {
 	case NFT_XT_MATCH:
 		if (stmt->xt.match == NULL && stmt->xt.opts) {
@@ -70,6 +80,7 @@ void xt_stmt_xlate(const struct stmt *stmt)
 	default:
 		break;
 	}
+	pthread_mutex_unlock(&xt_lock);
 
 	xt_xlate_free(xl);
 }
@@ -199,13 +210,15 @@ void netlink_parse_match(struct netlink_parse_ctx *ctx,
 	struct xt_entry_match *m;
 	uint32_t mt_len;
 
-	xtables_set_nfproto(ctx->table->handle.family);
-
 	name = nftnl_expr_get_str(nle, NFTNL_EXPR_MT_NAME);
 
+	pthread_mutex_lock(&xt_lock);
+	xtables_set_nfproto(ctx->table->handle.family);
 	mt = xtables_find_match(name, XTF_TRY_LOAD, NULL);
 	if (!mt)
 		BUG("XT match %s not found\n", name);
+	mt = xt_match_clone(mt);
+	pthread_mutex_unlock(&xt_lock);
 
 	mtinfo = nftnl_expr_get(nle, NFTNL_EXPR_MT_INFO, &mt_len);
 
@@ -218,7 +231,7 @@ void netlink_parse_match(struct netlink_parse_ctx *ctx,
 	stmt = xt_stmt_alloc(loc);
 	stmt->xt.name = strdup(name);
 	stmt->xt.type = NFT_XT_MATCH;
-	stmt->xt.match = xt_match_clone(mt);
+	stmt->xt.match = mt;
 	stmt->xt.match->m = m;
 
 	list_add_tail(&stmt->list, &ctx->rule->stmts);
@@ -236,12 +249,15 @@ void netlink_parse_target(struct netlink_parse_ctx *ctx,
 	size_t size;
 	uint32_t tg_len;
 
-	xtables_set_nfproto(ctx->table->handle.family);
-
 	name = nftnl_expr_get_str(nle, NFTNL_EXPR_TG_NAME);
+
+	pthread_mutex_lock(&xt_lock);
+	xtables_set_nfproto(ctx->table->handle.family);
 	tg = xtables_find_target(name, XTF_TRY_LOAD);
 	if (!tg)
 		BUG("XT target %s not found\n", name);
+	tg = xt_target_clone(tg);
+	pthread_mutex_unlock(&xt_lock);
 
 	tginfo = nftnl_expr_get(nle, NFTNL_EXPR_TG_INFO, &tg_len);
 
@@ -255,7 +271,7 @@ void netlink_parse_target(struct netlink_parse_ctx *ctx,
 	stmt = xt_stmt_alloc(loc);
 	stmt->xt.name = strdup(name);
 	stmt->xt.type = NFT_XT_TARGET;
-	stmt->xt.target = xt_target_clone(tg);
+	stmt->xt.target = tg;
 	stmt->xt.target->t = t;
 
 	list_add_tail(&stmt->list, &ctx->rule->stmts);
@@ -0,0 +1,154 @@
+#!/bin/bash
+
+# Generate a synthetic ruleset for benchmarking, in nft -f format.
+#
+# Every table gets the same layout: sets and maps first, then chains
+# with rules matching on addresses and ports. The first chain of each
+# table also references every set and the verdict map.
+
+TABLES=1
+CHAINS=4
+RULES=100
+SETS=10
+ELEMENTS=100
+INTERVAL=n
+CONCAT=n
+VMAP=n
+OFFSET=
+
+usage() {
+	cat << EOF2
+Usage: $0 [ options ]
+
+  -t <n>	number of tables (default: $TABLES)
+  -c <n>	number of chains per table (default: $CHAINS)
+  -r <n>	number of rules per chain (default: $RULES)
+  -s <n>	number of sets per table (default: $SETS)
+  -e <n>	number of elements per set and map (default: $ELEMENTS)
+  -i		use interval sets, elements are /24 prefixes
+  -C		use concatenated ipv4_addr . inet_service set keys
+  -m		add a verdict map per table
+  -A <n>	only print an add element command for set s0 in table t0,
+		with elements numbered from <n> on
+EOF2
+}
+
+while getopts "t:c:r:s:e:iCmA:h" opt ; do
+	case $opt in
+	t) TABLES=$OPTARG ;;
+	c) CHAINS=$OPTARG ;;
+	r) RULES=$OPTARG ;;
+	s) SETS=$OPTARG ;;
+	e) ELEMENTS=$OPTARG ;;
+	i) INTERVAL=y ;;
+	C) CONCAT=y ;;
+	m) VMAP=y ;;
+	A) OFFSET=$OPTARG ;;
+	h) usage ; exit 0 ;;
+	*) usage >&2 ; exit 1 ;;
+	esac
+done
+
+if [ "$INTERVAL" == "y" ] && [ "$CONCAT" == "y" ] ; then
+	echo "E: interval sets with concatenated keys are not supported" >&2
+	exit 1
+fi
+
+# The ruleset is written by awk, generating big sets from shell loops is
+# far too slow.
+awk -v tables=$TABLES -v chains=$CHAINS -v rules=$RULES -v sets=$SETS \
+    -v elements=$ELEMENTS -v interval=$INTERVAL -v concat=$CONCAT \
+    -v vmap=$VMAP -v offset=$OFFSET '
+# address number i, unique up to 2^24 elements
+function addr(i) {
+	return sprintf("10.%d.%d.%d", int(i / 65536) % 256,
+		       int(i / 256) % 256, i % 256)
+}
+
+# prefix number i, unique up to 2^16 elements
+function prefix(i) {
+	return sprintf("10.%d.%d.0/24", int(i / 256) % 256, i % 256)
+}
+
+function set_elements(first,	i, sep) {
+	for (i = first; i < first + elements; i++) {
+		if (interval == "y")
+			printf "%s%s", sep, prefix(i)
+		else if (concat == "y")
+			printf "%s%s . %d", sep, addr(i), i % 65535 + 1
+		else
+			printf "%s%s", sep, addr(i)
+		sep = ", "
+	}
+}
+
+function map_elements(	i, sep) {
+	printf "\t\telements = { "
+	for (i = 0; i < elements; i++) {
+		printf "%s%s : %s", sep, addr(i), i % 2 ? "drop" : "accept"
+		sep = ", "
+	}
+	printf " }\n"
+}
+
+function set_match(name) {
+	if (concat == "y")
+		return "ip saddr . tcp dport @" name
+	return "ip saddr @" name
+}
+
+BEGIN {
+	if (offset != "") {
+		printf "add element ip t0 s0 { "
+		set_elements(offset)
+		printf " }\n"
+		exit
+	}
+
+	for (t = 0; t < tables; t++) {
+		printf "table ip t%d {\n", t
+
+		for (s = 0; s < sets; s++) {
+			printf "\tset s%d {\n", s
+			if (concat == "y")
+				printf "\t\ttype ipv4_addr . inet_service\n"
+			else
+				printf "\t\ttype ipv4_addr\n"
+			if (interval == "y")
+				printf "\t\tflags interval\n"
+			if (elements > 0) {
+				printf "\t\telements = { "
+				set_elements(0)
+				printf " }\n"
+			}
+			printf "\t}\n"
+		}
+
+		if (vmap == "y") {
+			printf "\tmap m {\n"
+			printf "\t\ttype ipv4_addr : verdict\n"
+			if (elements > 0)
+				map_elements()
+			printf "\t}\n"
+		}
+
+		for (c = 0; c < chains; c++) {
+			printf "\tchain c%d {\n", c
+			if (c == 0) {
+				printf "\t\ttype filter hook input priority 0; policy accept;\n"
+				for (s = 0; s < sets; s++)
+					printf "\t\t%s counter drop\n", set_match("s" s)
+				if (vmap == "y")
+					printf "\t\tip daddr vmap @m\n"
+				for (j = 1; j < chains; j++)
+					printf "\t\tip protocol %d jump c%d\n", j % 255 + 1, j
+			}
+			for (r = 0; r < rules; r++)
+				printf "\t\tip saddr %s tcp dport %d counter accept\n",
+				       addr(r), r % 65535 + 1
+			printf "\t}\n"
+		}
+
+		printf "}\n"
+	}
+}'
@@ -0,0 +1,200 @@
+#!/bin/bash
+
+# Run the benchmarks against a synthetic ruleset in a throwaway network
+# namespace. Results are printed as one JSON object per line, e.g.:
+#
+# {"commit": "abc123", "test": "load", "tables": 1, ..., "ns": 1234}
+#
+# Options not listed below are passed to gen-ruleset.sh.
+
+cd $(dirname $0)
+NFT=${NFT:-../../src/nft}
+GEN=./gen-ruleset.sh
+RUNS=3
+
+msg_error() {
+	echo "E: $1 ..." >&2
+	exit 1
+}
+
+usage() {
+	echo "Usage: $0 [ -n runs ] [ -o output ] [ gen-ruleset.sh options ]"
+	echo ""
+	echo "  -n <n>	number of runs per test, the fastest one is reported (default: $RUNS)"
+	echo "  -o <file>	append results to <file> instead of printing them"
+	echo ""
+}
+
+OUTPUT=/dev/stdout
+GEN_ARGS=()
+while [ $# -gt 0 ] ; do
+	case $1 in
+	-n) RUNS=$2 ; shift ;;
+	-o) OUTPUT=$2 ; shift ;;
+	-h) usage ; $GEN -h ; exit 0 ;;
+	-i|-C|-m) GEN_ARGS+=($1) ;;
+	*) GEN_ARGS+=($1 $2) ; shift ;;
+	esac
+	shift
+done
+
+if [ "$(id -u)" != "0" ] ; then
+	msg_error "this requires root!"
+fi
+
+if [ ! -x "$NFT" ] ; then
+	msg_error "no nft binary!"
+fi
+
+IP=$(which ip)
+if [ ! -x "$IP" ] ; then
+	msg_error "no ip binary"
+fi
+
+# ruleset parameters reported along with each result
+TABLES=1 CHAINS=4 RULES=100 SETS=10 ELEMENTS=100 FLAGS=""
+set -- "${GEN_ARGS[@]}"
+while getopts "t:c:r:s:e:iCm" opt ; do
+	case $opt in
+	t) TABLES=$OPTARG ;;
+	c) CHAINS=$OPTARG ;;
+	r) RULES=$OPTARG ;;
+	s) SETS=$OPTARG ;;
+	e) ELEMENTS=$OPTARG ;;
+	i) FLAGS="${FLAGS}interval," ;;
+	C) FLAGS="${FLAGS}concat," ;;
+	m) FLAGS="${FLAGS}vmap," ;;
+	*) usage >&2 ; exit 1 ;;
+	esac
+done
+FLAGS=${FLAGS%,}
+
+if [ $SETS -eq 0 ] ; then
+	msg_error "at least one set is required"
+fi
+
+COMMIT=$(git rev-parse --short HEAD 2>/dev/null)
+
+testdir=$(mktemp -d)
+if [ ! -d $testdir ] ; then
+	msg_error "failed to create test directory"
+fi
+
+NETNS_NAME=nft-bench-$$
+$IP netns add $NETNS_NAME || msg_error "unable to create netns"
+trap "$IP netns del $NETNS_NAME; rm -rf $testdir" EXIT
+
+nft() {
+	$IP netns exec $NETNS_NAME $NFT "$@"
+}
+
+$GEN "${GEN_ARGS[@]}" > $testdir/ruleset || exit 1
+$GEN "${GEN_ARGS[@]}" -A $ELEMENTS > $testdir/elements || exit 1
+
+# nft --stats splits the run time per phase, report it if available
+STATS=n
+nft --stats=json list tables >/dev/null 2>&1 && STATS=y
+
+now() {
+	date +%s%N
+}
+
+# report <test> <ns> [ <extra json members> ]
+report() {
+	echo -n "{\"commit\": \"$COMMIT\", \"test\": \"$1\", " >> $OUTPUT
+	echo -n "\"tables\": $TABLES, \"chains\": $CHAINS, " >> $OUTPUT
+	echo -n "\"rules\": $RULES, \"sets\": $SETS, " >> $OUTPUT
+	echo -n "\"elements\": $ELEMENTS, \"flags\": \"$FLAGS\", " >> $OUTPUT
+	echo "\"ns\": $2${3:+, $3}}" >> $OUTPUT
+}
+
+# bench <test> <setup command> <nft arguments...>
+#
+# Runs the setup command, then times nft with the given arguments. The
+# fastest of $RUNS runs is reported, with the --stats output of that run.
+bench() {
+	local name=$1 setup=$2 best="" stats="" start end i
+	shift 2
+
+	for ((i = 0; i < RUNS; i++)) ; do
+		$setup || msg_error "setup for $name failed"
+
+		if [ "$STATS" == "y" ] ; then
+			start=$(now)
+			nft --stats=json "$@" > /dev/null 2> $testdir/stats || \
+				msg_error "$name failed"
+			end=$(now)
+		else
+			start=$(now)
+			nft "$@" > /dev/null || msg_error "$name failed"
+			end=$(now)
+		fi
+
+		if [ -z "$best" ] || [ $((end - start)) -lt $best ] ; then
+			best=$((end - start))
+			[ "$STATS" == "y" ] && stats=$(tail -n 1 $testdir/stats)
+		fi
+	done
+
+	report $name $best ${stats:+"\"stats\": $stats"}
+}
+
+flush() {
+	nft flush ruleset
+}
+
+load() {
+	flush && nft -f $testdir/ruleset
+}
+
+# parse and evaluate only, nothing is sent to the kernel
+bench check flush -c -f $testdir/ruleset
+bench load flush -f $testdir/ruleset
+bench list load list ruleset
+bench add-element load -f $testdir/elements
+
+# delete a rule in the middle of the first chain by handle
+best=""
+for ((i = 0; i < RUNS; i++)) ; do
+	load || msg_error "setup for delete-rule failed"
+	handle=$(nft -a list chain ip t0 c0 | \
+		 awk '/# handle/ { h[n++] = $NF } END { print h[int(n / 2)] }')
+
+	start=$(now)
+	nft delete rule ip t0 c0 handle $handle || \
+		msg_error "delete-rule failed"
+	end=$(now)
+
+	if [ -z "$best" ] || [ $((end - start)) -lt $best ] ; then
+		best=$((end - start))
+	fi
+done
+report delete-rule $best
+
+# monitor throughput: load the ruleset while listening for events, then
+# wait until no more events are printed.
+flush
+$IP netns exec $NETNS_NAME $NFT monitor > $testdir/monitor &
+monitor_pid=$!
+sleep 0.5
+
+start=$(now)
+end=$start
+nft -f $testdir/ruleset || msg_error "monitor load failed"
+events=0
+while true ; do
+	sleep 0.1
+	count=$(wc -l < $testdir/monitor)
+	[ $count -eq $events ] && break
+	events=$count
+	end=$(now)
+done
+kill $monitor_pid
+wait $monitor_pid 2>/dev/null
+
+if [ $events -gt 0 ] ; then
+	report monitor $((end - start)) "\"events\": $events, \
+\"events_per_sec\": $((events * 1000000000 / (end - start)))"
+fi
+
+exit 0
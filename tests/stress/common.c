@@ -0,0 +1,70 @@
+/*
+ * Helpers shared by the stress tests.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <nftables/nftables.h>
+
+#include "common.h"
+
+/* Run @cmd, which is left untouched. */
+int run_cmd(struct nft_ctx *nft, const char *cmd)
+{
+	char *buf = strdup(cmd);
+	int ret;
+
+	if (buf == NULL)
+		return -1;
+
+	ret = nft_run_cmd_from_buffer(nft, buf, strlen(buf));
+	free(buf);
+	return ret;
+}
+
+/*
+ * Run the commands written to @fp, a stream opened with open_memstream()
+ * on @buf and @len. The stream is closed and the buffer released, so that
+ * they can be opened again for the next batch.
+ */
+int run_buffer(struct nft_ctx *nft, FILE *fp, char **buf, size_t *len)
+{
+	int ret;
+
+	fclose(fp);
+	ret = nft_run_cmd_from_buffer(nft, *buf, *len);
+	free(*buf);
+	*buf = NULL;
+	*len = 0;
+	return ret;
+}
+
+/* Returns the output of @cmd, to be released with free(), NULL on error. */
+char *run_cmd_output(struct nft_ctx *nft, const char *cmd)
+{
+	char *out = NULL;
+	size_t outlen = 0;
+	FILE *fp, *old;
+	int ret;
+
+	fp = open_memstream(&out, &outlen);
+	if (fp == NULL)
+		return NULL;
+
+	old = nft_ctx_set_output(nft, fp);
+	ret = run_cmd(nft, cmd);
+	nft_ctx_set_output(nft, old);
+	fclose(fp);
+
+	if (ret < 0) {
+		free(out);
+		return NULL;
+	}
+	return out;
+}
@@ -0,0 +1,12 @@
+#ifndef NFTABLES_STRESS_COMMON_H
+#define NFTABLES_STRESS_COMMON_H
+
+#include <stdio.h>
+
+#include <nftables/nftables.h>
+
+extern int run_cmd(struct nft_ctx *nft, const char *cmd);
+extern int run_buffer(struct nft_ctx *nft, FILE *fp, char **buf, size_t *len);
+extern char *run_cmd_output(struct nft_ctx *nft, const char *cmd);
+
+#endif /* NFTABLES_STRESS_COMMON_H */
@@ -0,0 +1,208 @@
+/*
+ * Match the handles assigned by the kernel to the commands of a batch.
+ *
+ * A batch mixing single commands and a table block is added to the emulated
+ * nf_tables backend with command results enabled. Every object must be
+ * reported against the command and input line that added it, and the rule
+ * handles must be the ones the rule counters poll reports. A run that
+ * fails must leave no results behind.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <linux/netfilter.h>
+
+#include <nftables/nftables.h>
+
+#include "common.h"
+
+#define DEFAULT_RULES		10000
+
+/* commands and lines before the rules added to chain c */
+#define RULES_FIRST_CMD		7
+#define RULES_FIRST_LINE	10
+
+static unsigned int nrules = DEFAULT_RULES;
+
+static bool result_is(const struct nft_cmd_result *r, unsigned int cmd,
+		      unsigned int line, enum nft_echo_type type,
+		      const char *chain, const char *name)
+{
+	const struct nft_echo_object *obj = &r->object;
+
+	if (r->cmd != cmd || r->line != line || obj->type != type ||
+	    obj->family != NFPROTO_IPV4 || strcmp(obj->table, "t"))
+		return false;
+	if (chain && (obj->chain == NULL || strcmp(obj->chain, chain) ||
+		      obj->handle == 0))
+		return false;
+	if (name && (obj->name == NULL || strcmp(obj->name, name)))
+		return false;
+
+	return true;
+}
+
+/* Results come in batch order, the table block may echo its table again. */
+static int check_results(const struct nft_cmd_result *res, unsigned int num,
+			 uint64_t *handles)
+{
+	unsigned int i = 0, k;
+
+	if (num < 6 ||
+	    !result_is(&res[i++], 0, 1, NFT_ECHO_TABLE, NULL, NULL) ||
+	    !result_is(&res[i++], 1, 2, NFT_ECHO_CHAIN, "c", NULL) ||
+	    !result_is(&res[i++], 2, 3, NFT_ECHO_SET, NULL, "s"))
+		goto err;
+	if (result_is(&res[i], 3, 4, NFT_ECHO_TABLE, NULL, NULL))
+		i++;
+	if (num - i != 3 + nrules ||
+	    !result_is(&res[i++], 4, 5, NFT_ECHO_CHAIN, "d", NULL) ||
+	    !result_is(&res[i++], 5, 6, NFT_ECHO_RULE, "d", NULL) ||
+	    !result_is(&res[i++], 6, 7, NFT_ECHO_RULE, "d", NULL))
+		goto err;
+
+	for (k = 0; k < nrules; k++, i++) {
+		if (!result_is(&res[i], RULES_FIRST_CMD + k,
+			       RULES_FIRST_LINE + k, NFT_ECHO_RULE, "c", NULL))
+			goto err;
+		handles[k] = res[i].object.handle;
+	}
+	return 0;
+err:
+	fprintf(stderr, "unexpected result %u of %u\n", i, num);
+	if (i < num)
+		fprintf(stderr, "type %u, command %u, line %u\n",
+			res[i].object.type, res[i].cmd, res[i].line);
+	return -1;
+}
+
+/* The handles reported must be the rules of chain c, in chain order. */
+static int check_handles(struct nft_ctx *nft, const uint64_t *handles)
+{
+	struct nft_rule_counter *rules;
+	unsigned int i;
+	int ret = -1, n;
+
+	rules = calloc(nrules, sizeof(*rules));
+	if (rules == NULL)
+		return -1;
+
+	n = nft_ctx_get_rule_counters(nft, NFPROTO_IPV4, "t", "c",
+				      rules, nrules);
+	if (n != (int)nrules) {
+		fprintf(stderr, "%d rules in the chain, expected %u\n",
+			n, nrules);
+		goto out;
+	}
+	for (i = 0; i < nrules; i++) {
+		if (rules[i].handle != handles[i]) {
+			fprintf(stderr, "rule %u has handle %llu, %llu reported\n",
+				i, (unsigned long long)rules[i].handle,
+				(unsigned long long)handles[i]);
+			goto out;
+		}
+	}
+	ret = 0;
+out:
+	free(rules);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	const struct nft_cmd_result *res;
+	struct nft_ctx *nft;
+	uint64_t *handles;
+	char *buf = NULL;
+	size_t len = 0;
+	unsigned int i;
+	int opt, ret = 1, num;
+	FILE *fp;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nrules = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n rules]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (nrules == 0) {
+		fprintf(stderr, "at least one rule is needed\n");
+		return 1;
+	}
+
+	handles = calloc(nrules, sizeof(*handles));
+	if (handles == NULL)
+		return 1;
+
+	nft = nft_ctx_new(NFT_CTX_NETLINK_MOCK);
+	if (nft == NULL)
+		goto err_ctx;
+
+	if (nft_ctx_get_results(nft, &res) != -1 || errno != EINVAL) {
+		fprintf(stderr, "results reported while disabled\n");
+		goto err;
+	}
+	nft_ctx_output_set_results(nft, true);
+
+	fp = open_memstream(&buf, &len);
+	if (fp == NULL)
+		goto err;
+	fprintf(fp, "add table ip t\n");
+	fprintf(fp, "add chain ip t c\n");
+	fprintf(fp, "add set ip t s { type ipv4_addr; }\n");
+	fprintf(fp, "table ip t {\n");
+	fprintf(fp, "\tchain d {\n");
+	fprintf(fp, "\t\tcounter\n");
+	fprintf(fp, "\t\tcounter\n");
+	fprintf(fp, "\t}\n");
+	fprintf(fp, "}\n");
+	for (i = 0; i < nrules; i++)
+		fprintf(fp, "add rule ip t c ip saddr @s tcp dport %u accept\n",
+			i % 65536);
+	if (run_buffer(nft, fp, &buf, &len) < 0) {
+		fprintf(stderr, "failed to load the rules\n");
+		goto err;
+	}
+
+	num = nft_ctx_get_results(nft, &res);
+	if (num < 0 || check_results(res, num, handles) < 0 ||
+	    check_handles(nft, handles) < 0)
+		goto err;
+
+	/* a failed run leaves nothing from the previous one */
+	fp = open_memstream(&buf, &len);
+	if (fp == NULL)
+		goto err;
+	fprintf(fp, "add rule ip t c counter\n");
+	fprintf(fp, "add rule ip t missing counter\n");
+	if (run_buffer(nft, fp, &buf, &len) == 0) {
+		fprintf(stderr, "rule added to a missing chain\n");
+		goto err;
+	}
+	num = nft_ctx_get_results(nft, &res);
+	if (num != 0) {
+		fprintf(stderr, "%d results after a failed run\n", num);
+		goto err;
+	}
+
+	ret = 0;
+err:
+	nft_ctx_free(nft);
+err_ctx:
+	free(handles);
+	return ret;
+}
@@ -0,0 +1,198 @@
+/*
+ * Learn rule handles through the echo callback.
+ *
+ * A batch of rules with counters is added to the emulated nf_tables backend
+ * with an echo callback set. Every rule must be reported once, with the
+ * handle the rule counters poll reports for it. The rules are then deleted
+ * by the handles learnt, which must leave the chain empty.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <linux/netfilter.h>
+
+#include <nftables/nftables.h>
+
+#include "common.h"
+
+#define DEFAULT_RULES		10000
+
+struct echo_state {
+	uint64_t	*handles;
+	unsigned int	nrules;
+	unsigned int	ntables;
+	unsigned int	nchains;
+	unsigned int	errors;
+};
+
+static unsigned int nrules = DEFAULT_RULES;
+
+static void echo_cb(const struct nft_echo_object *obj, void *data)
+{
+	struct echo_state *st = data;
+
+	if (obj->family != NFPROTO_IPV4 || strcmp(obj->table, "t")) {
+		st->errors++;
+		return;
+	}
+
+	switch (obj->type) {
+	case NFT_ECHO_TABLE:
+		st->ntables++;
+		break;
+	case NFT_ECHO_CHAIN:
+		if (obj->chain == NULL || strcmp(obj->chain, "c") ||
+		    obj->handle == 0)
+			st->errors++;
+		st->nchains++;
+		break;
+	case NFT_ECHO_RULE:
+		if (obj->chain == NULL || strcmp(obj->chain, "c") ||
+		    obj->handle == 0 || st->nrules == nrules) {
+			st->errors++;
+			break;
+		}
+		st->handles[st->nrules++] = obj->handle;
+		break;
+	default:
+		st->errors++;
+		break;
+	}
+}
+
+static int cmp_handle(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Every rule echoed must be in the chain, and the other way around. */
+static int check_handles(struct nft_ctx *nft, struct echo_state *st)
+{
+	struct nft_rule_counter *rules;
+	uint64_t *polled;
+	unsigned int i;
+	int ret = -1, n;
+
+	rules = calloc(nrules, sizeof(*rules));
+	polled = calloc(nrules, sizeof(*polled));
+	if (rules == NULL || polled == NULL)
+		goto out;
+
+	n = nft_ctx_get_rule_counters(nft, NFPROTO_IPV4, "t", "c",
+				      rules, nrules);
+	if (n != (int)nrules) {
+		fprintf(stderr, "%d rules in the chain, expected %u\n",
+			n, nrules);
+		goto out;
+	}
+	for (i = 0; i < nrules; i++)
+		polled[i] = rules[i].handle;
+
+	qsort(polled, nrules, sizeof(*polled), cmp_handle);
+	qsort(st->handles, nrules, sizeof(*st->handles), cmp_handle);
+	for (i = 0; i < nrules; i++) {
+		if (polled[i] != st->handles[i] ||
+		    (i > 0 && polled[i] == polled[i - 1])) {
+			fprintf(stderr, "handle %llu echoed, %llu in the chain\n",
+				(unsigned long long)st->handles[i],
+				(unsigned long long)polled[i]);
+			goto out;
+		}
+	}
+	ret = 0;
+out:
+	free(polled);
+	free(rules);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	struct echo_state st = {};
+	struct nft_rule_counter rule;
+	struct nft_ctx *nft;
+	char *buf = NULL;
+	size_t len = 0;
+	unsigned int i;
+	int opt, ret = 1;
+	FILE *fp;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nrules = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n rules]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (nrules == 0) {
+		fprintf(stderr, "at least one rule is needed\n");
+		return 1;
+	}
+
+	st.handles = calloc(nrules, sizeof(*st.handles));
+	if (st.handles == NULL)
+		return 1;
+
+	nft = nft_ctx_new(NFT_CTX_NETLINK_MOCK);
+	if (nft == NULL)
+		goto err_ctx;
+	nft_ctx_output_set_echo_cb(nft, echo_cb, &st);
+
+	fp = open_memstream(&buf, &len);
+	if (fp == NULL)
+		goto err;
+	fprintf(fp, "add table ip t\n");
+	fprintf(fp, "add chain ip t c\n");
+	for (i = 0; i < nrules; i++)
+		fprintf(fp, "add rule ip t c tcp dport %u counter accept\n",
+			i % 65536);
+	if (run_buffer(nft, fp, &buf, &len) < 0) {
+		fprintf(stderr, "failed to load the rules\n");
+		goto err;
+	}
+
+	if (st.errors || st.ntables != 1 || st.nchains != 1 ||
+	    st.nrules != nrules) {
+		fprintf(stderr, "echoed %u tables, %u chains, %u rules, "
+			"%u unexpected objects\n", st.ntables, st.nchains,
+			st.nrules, st.errors);
+		goto err;
+	}
+	if (check_handles(nft, &st) < 0)
+		goto err;
+
+	/* delete everything by the handles learnt, nothing is echoed */
+	nft_ctx_output_set_echo_cb(nft, NULL, NULL);
+	fp = open_memstream(&buf, &len);
+	if (fp == NULL)
+		goto err;
+	for (i = 0; i < nrules; i++)
+		fprintf(fp, "delete rule ip t c handle %llu\n",
+			(unsigned long long)st.handles[i]);
+	if (run_buffer(nft, fp, &buf, &len) < 0 ||
+	    nft_ctx_get_rule_counters(nft, NFPROTO_IPV4, "t", "c",
+				      &rule, 1) != 0) {
+		fprintf(stderr, "failed to delete the rules by handle\n");
+		goto err;
+	}
+
+	ret = 0;
+err:
+	nft_ctx_free(nft);
+err_ctx:
+	free(st.handles);
+	return ret;
+}
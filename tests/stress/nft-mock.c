@@ -0,0 +1,191 @@
+/*
+ * Check the emulated nf_tables backend against the listing it dumps.
+ *
+ * A ruleset with a large set, a jump and a set reference is loaded into the
+ * emulated backend and listed back, the listing must hold every element and
+ * load again into the same ruleset. Batches the kernel would reject, such as
+ * deleting a chain that is still jumped to or a set that is still in use,
+ * must fail and leave the ruleset untouched, commands earlier in the batch
+ * included.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nftables/nftables.h>
+
+#include "common.h"
+
+#define DEFAULT_ELEMS		50000
+
+static unsigned int nelems = DEFAULT_ELEMS;
+
+/* Returns the listing of the ruleset, to be released with free(). */
+static char *list_ruleset(struct nft_ctx *nft)
+{
+	char *out;
+
+	out = run_cmd_output(nft, "list ruleset");
+	if (out == NULL)
+		fprintf(stderr, "cannot list the ruleset\n");
+	return out;
+}
+
+static void print_elem(char *buf, size_t len, unsigned int i)
+{
+	snprintf(buf, len, "10.%u.%u.%u", (i >> 16) & 0xff, (i >> 8) & 0xff,
+		 i & 0xff);
+}
+
+static int check_listing(const char *out)
+{
+	static const char * const expected[] = {
+		"table ip t {", "set s {", "chain c {", "chain d {",
+		"ip saddr @s", "jump d",
+	};
+	char elem[sizeof("255.255.255.255")];
+	unsigned int i;
+
+	for (i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+		if (strstr(out, expected[i]) == NULL) {
+			fprintf(stderr, "\"%s\" not listed\n", expected[i]);
+			return -1;
+		}
+	}
+	print_elem(elem, sizeof(elem), nelems - 1);
+	if (strstr(out, elem) == NULL) {
+		fprintf(stderr, "element %s not listed\n", elem);
+		return -1;
+	}
+	return 0;
+}
+
+/* The batch in @cmd must fail and leave the ruleset as listed in @ref. */
+static int check_rejected(struct nft_ctx *nft, const char *cmd,
+			  const char *ref)
+{
+	char *out;
+	int ret = 0;
+
+	if (run_cmd(nft, cmd) == 0) {
+		fprintf(stderr, "batch not rejected:\n%s", cmd);
+		return -1;
+	}
+
+	out = list_ruleset(nft);
+	if (out == NULL)
+		return -1;
+	if (strcmp(out, ref)) {
+		fprintf(stderr, "rejected batch changed the ruleset:\n%s", cmd);
+		ret = -1;
+	}
+	free(out);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	char *buf = NULL, *ref = NULL, *out = NULL;
+	char elem[sizeof("255.255.255.255")];
+	struct nft_ctx *nft;
+	size_t len = 0;
+	unsigned int i;
+	int opt, ret = 1;
+	FILE *fp;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nelems = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n elements]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (nelems == 0 || nelems > 1 << 24) {
+		fprintf(stderr, "between 1 and %u elements are needed\n",
+			1 << 24);
+		return 1;
+	}
+
+	nft = nft_ctx_new(NFT_CTX_NETLINK_MOCK);
+	if (nft == NULL)
+		return 1;
+
+	fp = open_memstream(&buf, &len);
+	if (fp == NULL)
+		goto err;
+	fprintf(fp, "add table ip t\n");
+	fprintf(fp, "add set ip t s { type ipv4_addr; }\n");
+	fprintf(fp, "add chain ip t c\n");
+	fprintf(fp, "add chain ip t d\n");
+	fprintf(fp, "add rule ip t c ip saddr @s counter jump d\n");
+	fprintf(fp, "add element ip t s { ");
+	for (i = 0; i < nelems; i++) {
+		print_elem(elem, sizeof(elem), i);
+		fprintf(fp, "%s%s", i ? ", " : "", elem);
+	}
+	fprintf(fp, " }\n");
+	if (run_buffer(nft, fp, &buf, &len) < 0) {
+		fprintf(stderr, "failed to load the ruleset\n");
+		goto err;
+	}
+
+	ref = list_ruleset(nft);
+	if (ref == NULL || check_listing(ref) < 0)
+		goto err;
+
+	/* the listing loads back into the same ruleset */
+	if (run_cmd(nft, "flush ruleset") < 0 ||
+	    run_cmd(nft, ref) < 0) {
+		fprintf(stderr, "cannot load the listing back\n");
+		goto err;
+	}
+	out = list_ruleset(nft);
+	if (out == NULL)
+		goto err;
+	if (strcmp(out, ref)) {
+		fprintf(stderr, "listing changed after loading it back\n");
+		goto err;
+	}
+
+	if (check_rejected(nft, "add table ip u\n"
+				"add chain ip t e\n"
+				"delete chain ip t d\n", ref) < 0 ||
+	    check_rejected(nft, "add element ip t s { 192.168.0.1 }\n"
+				"delete set ip t s\n", ref) < 0 ||
+	    check_rejected(nft, "add rule ip t d counter\n"
+				"delete rule ip t c handle 999999999\n",
+			   ref) < 0)
+		goto err;
+
+	/* once nothing refers to them, both can go */
+	if (run_cmd(nft, "flush chain ip t c\n"
+			 "delete chain ip t d\n"
+			 "delete set ip t s\n") < 0) {
+		fprintf(stderr, "cannot delete unused chain and set\n");
+		goto err;
+	}
+	free(out);
+	out = list_ruleset(nft);
+	if (out == NULL)
+		goto err;
+	if (strstr(out, "chain d") || strstr(out, "set s")) {
+		fprintf(stderr, "deleted objects still listed:\n%s", out);
+		goto err;
+	}
+
+	ret = 0;
+err:
+	free(out);
+	free(ref);
+	nft_ctx_free(nft);
+	return ret;
+}
@@ -0,0 +1,204 @@
+/*
+ * Poll named counters and quotas through nft_ctx_get_obj_stats().
+ *
+ * A table with many counters and a few quotas is loaded into the emulated
+ * nf_tables backend, then polled repeatedly. Every round checks the values
+ * reported for each object, a final round resets them and checks that the
+ * next poll returns them zeroed.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nf_tables.h>
+
+#include <nftables/nftables.h>
+
+#include "common.h"
+
+#define DEFAULT_COUNTERS	1000
+#define DEFAULT_ROUNDS		200
+#define NUM_QUOTAS		4
+
+static unsigned int ncounters = DEFAULT_COUNTERS;
+
+static int load_objects(struct nft_ctx *nft)
+{
+	char *buf = NULL;
+	size_t len = 0;
+	unsigned int i;
+	FILE *fp;
+	int ret;
+
+	fp = open_memstream(&buf, &len);
+	if (fp == NULL)
+		return -1;
+
+	fprintf(fp, "add table ip t\n");
+	fprintf(fp, "add table ip other\n");
+	fprintf(fp, "add counter ip other c { packets 1 bytes 1 }\n");
+	for (i = 0; i < ncounters; i++)
+		fprintf(fp, "add counter ip t c%u { packets %u bytes %u }\n",
+			i, i + 1, (i + 1) * 100);
+	for (i = 0; i < NUM_QUOTAS; i++)
+		fprintf(fp, "add quota ip t q%u { over %u bytes used %u bytes }\n",
+			i, (i + 1) * 1000, i + 10);
+	fclose(fp);
+
+	ret = nft_run_cmd_from_buffer(nft, buf, len);
+	free(buf);
+	return ret;
+}
+
+static int check_counter(const struct nft_obj_stats *s, unsigned int scale)
+{
+	unsigned int i;
+
+	if (s->family != NFPROTO_IPV4 || strcmp(s->table, "t") ||
+	    sscanf(s->name, "c%u", &i) != 1 || i >= ncounters) {
+		fprintf(stderr, "unexpected counter %s %s\n", s->table, s->name);
+		return -1;
+	}
+	if (s->packets != (i + 1) * scale || s->bytes != (i + 1) * 100 * scale) {
+		fprintf(stderr, "counter %s: packets %llu bytes %llu\n",
+			s->name, (unsigned long long)s->packets,
+			(unsigned long long)s->bytes);
+		return -1;
+	}
+	return 0;
+}
+
+static int check_quota(const struct nft_obj_stats *s, unsigned int scale)
+{
+	unsigned int i;
+
+	if (strcmp(s->table, "t") || sscanf(s->name, "q%u", &i) != 1 ||
+	    i >= NUM_QUOTAS) {
+		fprintf(stderr, "unexpected quota %s %s\n", s->table, s->name);
+		return -1;
+	}
+	if (s->quota != (i + 1) * 1000 || s->consumed != (i + 10) * scale ||
+	    !(s->flags & NFT_QUOTA_F_INV)) {
+		fprintf(stderr, "quota %s: quota %llu consumed %llu\n",
+			s->name, (unsigned long long)s->quota,
+			(unsigned long long)s->consumed);
+		return -1;
+	}
+	return 0;
+}
+
+/* Poll table t, @scale is 1 for the loaded values and 0 after a reset. */
+static int poll_objs(struct nft_ctx *nft, struct nft_obj_stats *objs,
+		     unsigned int num, uint32_t type, bool reset,
+		     unsigned int scale)
+{
+	unsigned int expected = 0, i;
+	int ret;
+
+	if (type != NFT_OBJECT_QUOTA)
+		expected += ncounters;
+	if (type != NFT_OBJECT_COUNTER)
+		expected += NUM_QUOTAS;
+
+	ret = nft_ctx_get_obj_stats(nft, NFPROTO_IPV4, "t", type, reset,
+				    objs, num);
+	if (ret < 0) {
+		perror("nft_ctx_get_obj_stats");
+		return -1;
+	}
+	if ((unsigned int)ret != expected) {
+		fprintf(stderr, "got %d objects, expected %u\n", ret, expected);
+		return -1;
+	}
+
+	for (i = 0; i < num && i < expected; i++) {
+		switch (objs[i].type) {
+		case NFT_OBJECT_COUNTER:
+			if (type == NFT_OBJECT_QUOTA ||
+			    check_counter(&objs[i], scale) < 0)
+				return -1;
+			break;
+		case NFT_OBJECT_QUOTA:
+			if (type == NFT_OBJECT_COUNTER ||
+			    check_quota(&objs[i], scale) < 0)
+				return -1;
+			break;
+		default:
+			fprintf(stderr, "unexpected object type %u\n",
+				objs[i].type);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int rounds = DEFAULT_ROUNDS, num, i;
+	struct nft_obj_stats *objs;
+	struct nft_ctx *nft;
+	int opt, ret = 1;
+
+	while ((opt = getopt(argc, argv, "c:r:")) != -1) {
+		switch (opt) {
+		case 'c':
+			ncounters = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-c counters] [-r rounds]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	num = ncounters + NUM_QUOTAS;
+	objs = calloc(num, sizeof(*objs));
+	if (objs == NULL)
+		return 1;
+
+	nft = nft_ctx_new(NFT_CTX_NETLINK_MOCK);
+	if (nft == NULL)
+		goto err_ctx;
+
+	if (load_objects(nft) < 0) {
+		fprintf(stderr, "failed to load the objects\n");
+		goto err;
+	}
+
+	for (i = 0; i < rounds; i++) {
+		if (poll_objs(nft, objs, num, NFT_OBJECT_UNSPEC, false, 1) < 0)
+			goto err;
+	}
+
+	/* a short array is filled up to its size, the full count is returned */
+	if (poll_objs(nft, objs, num / 2, NFT_OBJECT_UNSPEC, false, 1) < 0 ||
+	    poll_objs(nft, objs, 0, NFT_OBJECT_UNSPEC, false, 1) < 0 ||
+	    poll_objs(nft, objs, num, NFT_OBJECT_QUOTA, false, 1) < 0 ||
+	    poll_objs(nft, objs, num, NFT_OBJECT_COUNTER, false, 1) < 0)
+		goto err;
+
+	/* the reset dump reports the values before resetting them */
+	if (poll_objs(nft, objs, num, NFT_OBJECT_UNSPEC, true, 1) < 0 ||
+	    poll_objs(nft, objs, num, NFT_OBJECT_UNSPEC, false, 0) < 0)
+		goto err;
+
+	if (run_cmd(nft, "flush ruleset\n") < 0)
+		goto err;
+
+	ret = 0;
+err:
+	nft_ctx_free(nft);
+err_ctx:
+	free(objs);
+	return ret;
+}
@@ -0,0 +1,209 @@
+/*
+ * Poll rule counters through nft_ctx_get_rule_counters().
+ *
+ * Many rules with counters are loaded into the emulated nf_tables backend
+ * and polled repeatedly. The first poll reports every rule as new, the
+ * following ones must report no increase. Rules are then deleted and added
+ * between two polls to check that the state kept by the context follows.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <linux/netfilter.h>
+
+#include <nftables/nftables.h>
+
+#include "common.h"
+
+#define DEFAULT_RULES		2000
+#define DEFAULT_ROUNDS		100
+
+static unsigned int nrules = DEFAULT_RULES;
+
+/*
+ * Rule i of chain c counts i + 1 packets of 100 bytes. The rule of chain d
+ * has no counter, the one of table other has two.
+ */
+static int load_rules(struct nft_ctx *nft)
+{
+	char *buf = NULL;
+	size_t len = 0;
+	unsigned int i;
+	FILE *fp;
+	int ret;
+
+	fp = open_memstream(&buf, &len);
+	if (fp == NULL)
+		return -1;
+
+	fprintf(fp, "add table ip t\n");
+	fprintf(fp, "add chain ip t c\n");
+	fprintf(fp, "add chain ip t d\n");
+	fprintf(fp, "add rule ip t d accept\n");
+	for (i = 0; i < nrules; i++)
+		fprintf(fp, "add rule ip t c tcp dport %u counter packets %u bytes %u accept\n",
+			i % 65536, i + 1, (i + 1) * 100);
+	fprintf(fp, "add table ip other\n");
+	fprintf(fp, "add chain ip other c\n");
+	fprintf(fp, "add rule ip other c counter packets 1 bytes 2 counter packets 3 bytes 4\n");
+	fclose(fp);
+
+	ret = nft_run_cmd_from_buffer(nft, buf, len);
+	free(buf);
+	return ret;
+}
+
+static int check_rule(const struct nft_rule_counter *r, bool new)
+{
+	if (r->family != NFPROTO_IPV4 || strcmp(r->table, "t") ||
+	    strcmp(r->chain, "c") || r->packets == 0 ||
+	    r->packets > nrules + 1) {
+		fprintf(stderr, "unexpected rule %s %s handle %llu\n",
+			r->table, r->chain, (unsigned long long)r->handle);
+		return -1;
+	}
+	if (r->bytes != r->packets * 100 ||
+	    r->delta_packets != (new ? r->packets : 0) ||
+	    r->delta_bytes != (new ? r->bytes : 0) ||
+	    !(r->flags & NFT_RULE_COUNTER_F_NEW) != !new) {
+		fprintf(stderr, "rule %llu: packets %llu bytes %llu "
+			"delta %llu %llu flags %u\n",
+			(unsigned long long)r->handle,
+			(unsigned long long)r->packets,
+			(unsigned long long)r->bytes,
+			(unsigned long long)r->delta_packets,
+			(unsigned long long)r->delta_bytes, r->flags);
+		return -1;
+	}
+	return 0;
+}
+
+/* Poll chain t c, every rule must be new or unchanged. */
+static int poll_rules(struct nft_ctx *nft, struct nft_rule_counter *rules,
+		      unsigned int num, unsigned int expected, bool new)
+{
+	unsigned int i;
+	int ret;
+
+	ret = nft_ctx_get_rule_counters(nft, NFPROTO_IPV4, "t", NULL,
+					rules, num);
+	if (ret < 0) {
+		perror("nft_ctx_get_rule_counters");
+		return -1;
+	}
+	if ((unsigned int)ret != expected) {
+		fprintf(stderr, "got %d rules, expected %u\n", ret, expected);
+		return -1;
+	}
+
+	for (i = 0; i < num && i < expected; i++) {
+		if (check_rule(&rules[i], new) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int check_other(struct nft_ctx *nft, struct nft_rule_counter *rules)
+{
+	int ret;
+
+	ret = nft_ctx_get_rule_counters(nft, NFPROTO_UNSPEC, "other", "c",
+					rules, 1);
+	if (ret != 1 || rules[0].packets != 4 || rules[0].bytes != 6) {
+		fprintf(stderr, "table other: got %d rules\n", ret);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int rounds = DEFAULT_ROUNDS, i;
+	struct nft_rule_counter *rules;
+	struct nft_ctx *nft;
+	int opt, ret = 1;
+	uint64_t handle;
+	char cmd[128];
+
+	while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nrules = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n rules] [-r rounds]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (nrules < 2) {
+		fprintf(stderr, "at least two rules are needed\n");
+		return 1;
+	}
+
+	rules = calloc(nrules + 1, sizeof(*rules));
+	if (rules == NULL)
+		return 1;
+
+	nft = nft_ctx_new(NFT_CTX_NETLINK_MOCK);
+	if (nft == NULL)
+		goto err_ctx;
+
+	if (load_rules(nft) < 0) {
+		fprintf(stderr, "failed to load the rules\n");
+		goto err;
+	}
+
+	if (poll_rules(nft, rules, nrules, nrules, true) < 0)
+		goto err;
+	handle = rules[0].handle;
+	for (i = 0; i < rounds; i++) {
+		if (poll_rules(nft, rules, nrules, nrules, false) < 0)
+			goto err;
+	}
+
+	/* a short array is filled up to its size, the full count is returned */
+	if (poll_rules(nft, rules, nrules / 2, nrules, false) < 0 ||
+	    check_other(nft, rules) < 0)
+		goto err;
+
+	/* a deleted rule is forgotten, an added one is reported as new */
+	snprintf(cmd, sizeof(cmd), "delete rule ip t c handle %llu\n",
+		 (unsigned long long)handle);
+	if (run_cmd(nft, cmd) < 0 ||
+	    poll_rules(nft, rules, nrules, nrules - 1, false) < 0)
+		goto err;
+
+	snprintf(cmd, sizeof(cmd),
+		 "add rule ip t c counter packets %u bytes %u\n",
+		 nrules + 1, (nrules + 1) * 100);
+	if (run_cmd(nft, cmd) < 0 ||
+	    nft_ctx_get_rule_counters(nft, NFPROTO_IPV4, "t", "c",
+				      rules, nrules) != (int)nrules ||
+	    check_rule(&rules[nrules - 1], true) < 0) {
+		fprintf(stderr, "added rule not reported as new\n");
+		goto err;
+	}
+
+	if (run_cmd(nft, "flush ruleset\n") < 0 ||
+	    poll_rules(nft, rules, nrules, 0, false) < 0)
+		goto err;
+
+	ret = 0;
+err:
+	nft_ctx_free(nft);
+err_ctx:
+	free(rules);
+	return ret;
+}
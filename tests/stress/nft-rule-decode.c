@@ -0,0 +1,203 @@
+/*
+ * Measure how listing rules scales with the size of the rule dump.
+ *
+ * Chains of growing size are loaded into the emulated nf_tables backend
+ * and listed, once with all CPUs available and once pinned to a single
+ * CPU, where the worker threads decoding large dumps cannot run in
+ * parallel. The best of a few runs is reported for both, along with the
+ * speedup. Both listings must be identical, and the time per rule must
+ * stay roughly constant as the chain grows: decoding is linear in the
+ * number of rules.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <nftables/nftables.h>
+
+#include "common.h"
+
+#define MIN_RULES		128
+#define DEFAULT_RULES		8192
+#define DEFAULT_ROUNDS		3
+/*
+ * Allowed growth of the time per rule between the smallest and the
+ * largest chain, generous enough for noisy machines.
+ */
+#define MAX_SLOWDOWN		4
+
+static const char list_cmd[] = "list chain ip t c";
+
+static unsigned int max_rules = DEFAULT_RULES;
+static unsigned int rounds = DEFAULT_ROUNDS;
+
+static double now_usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int load_rules(struct nft_ctx *nft, unsigned int nrules)
+{
+	char *buf = NULL;
+	size_t len = 0;
+	unsigned int i;
+	FILE *fp;
+
+	if (run_cmd(nft, "flush ruleset") < 0)
+		return -1;
+
+	fp = open_memstream(&buf, &len);
+	if (fp == NULL)
+		return -1;
+	fprintf(fp, "add table ip t\nadd chain ip t c\n");
+	for (i = 0; i < nrules; i++)
+		fprintf(fp, "add rule ip t c ip saddr 10.%u.%u.0/24 "
+			"tcp dport %u counter accept\n",
+			(i >> 8) & 0xff, i & 0xff, 1024 + i % 60000);
+
+	return run_buffer(nft, fp, &buf, &len);
+}
+
+/*
+ * List the chain @rounds times, return the fastest run in microseconds
+ * and the last listing in @out.
+ */
+static double list_rules(struct nft_ctx *nft, char **out)
+{
+	double best = -1, start, elapsed;
+	unsigned int i;
+
+	for (i = 0; i < rounds; i++) {
+		free(*out);
+		start = now_usecs();
+		*out = run_cmd_output(nft, list_cmd);
+		elapsed = now_usecs() - start;
+		if (*out == NULL)
+			return -1;
+		if (best < 0 || elapsed < best)
+			best = elapsed;
+	}
+
+	return best;
+}
+
+static unsigned int count_rules(const char *out)
+{
+	unsigned int n = 0;
+
+	while ((out = strstr(out, " accept\n")) != NULL) {
+		out++;
+		n++;
+	}
+
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	double all, one, per_rule, first_per_rule = -1;
+	cpu_set_t cpus, cpu0;
+	char *out_all = NULL, *out_one = NULL;
+	unsigned int nrules;
+	struct nft_ctx *nft;
+	int opt, ret = 1;
+
+	while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+		switch (opt) {
+		case 'n':
+			max_rules = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n rules] [-r rounds]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (max_rules < MIN_RULES || rounds == 0) {
+		fprintf(stderr, "at least %u rules and one round are needed\n",
+			MIN_RULES);
+		return 1;
+	}
+
+	if (sched_getaffinity(0, sizeof(cpus), &cpus) < 0) {
+		perror("sched_getaffinity");
+		return 1;
+	}
+	CPU_ZERO(&cpu0);
+	CPU_SET(sched_getcpu() < 0 ? 0 : sched_getcpu(), &cpu0);
+
+	nft = nft_ctx_new(NFT_CTX_NETLINK_MOCK);
+	if (nft == NULL)
+		return 1;
+
+	printf("%8s %12s %12s %12s %8s\n", "rules", "all cpus", "one cpu",
+	       "per rule", "speedup");
+	for (nrules = MIN_RULES; nrules <= max_rules; nrules *= 4) {
+		if (load_rules(nft, nrules) < 0) {
+			fprintf(stderr, "failed to load %u rules\n", nrules);
+			goto err;
+		}
+
+		all = list_rules(nft, &out_all);
+		if (sched_setaffinity(0, sizeof(cpu0), &cpu0) < 0) {
+			perror("sched_setaffinity");
+			goto err;
+		}
+		one = list_rules(nft, &out_one);
+		if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+			perror("sched_setaffinity");
+			goto err;
+		}
+		if (all < 0 || one < 0) {
+			fprintf(stderr, "cannot list %u rules\n", nrules);
+			goto err;
+		}
+
+		if (count_rules(out_all) != nrules) {
+			fprintf(stderr, "%u of %u rules listed\n",
+				count_rules(out_all), nrules);
+			goto err;
+		}
+		if (strcmp(out_all, out_one)) {
+			fprintf(stderr, "listings of %u rules differ\n", nrules);
+			goto err;
+		}
+
+		per_rule = all / nrules;
+		printf("%8u %10.0fus %10.0fus %10.2fus %7.2fx\n", nrules,
+		       all, one, per_rule, one / all);
+		fflush(stdout);
+
+		if (first_per_rule < 0)
+			first_per_rule = per_rule;
+		else if (per_rule > first_per_rule * MAX_SLOWDOWN) {
+			fprintf(stderr, "listing %u rules takes %.2fus per rule, "
+				"%.2fus with %u rules\n", nrules, per_rule,
+				first_per_rule, MIN_RULES);
+			goto err;
+		}
+	}
+
+	ret = 0;
+err:
+	free(out_all);
+	free(out_one);
+	nft_ctx_free(nft);
+	return ret;
+}
@@ -0,0 +1,164 @@
+/*
+ * Share identical anonymous set literals between the rules of a batch.
+ *
+ * Rules carrying the same interval set literal are added to the emulated
+ * nf_tables backend and compared with rules carrying literals of the same
+ * size but different contents. The shared literal is converted to intervals
+ * once, which must save at least one allocation per element and rule, and
+ * every rule must still list the whole set. Literals are only shared within
+ * a batch: loading the same batch again must not pick up the literals of
+ * the previous run.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <nftables/nftables.h>
+
+#include "common.h"
+
+#define DEFAULT_RULES		100
+#define ELEMS			100
+/* distance between two ranges of a literal */
+#define ELEM_STRIDE		200
+
+static unsigned int nrules = DEFAULT_RULES;
+
+/*
+ * Load @nrules rules into a new table, all with the same set literal if
+ * @shared is set, and return the number of allocations it took.
+ */
+static int64_t load_rules(struct nft_ctx *nft, bool shared)
+{
+	struct nft_stats stats;
+	unsigned int i, j, base;
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *fp;
+
+	if (run_cmd(nft, "flush ruleset") < 0)
+		return -1;
+
+	fp = open_memstream(&buf, &len);
+	if (fp == NULL)
+		return -1;
+	fprintf(fp, "add table ip t\nadd chain ip t c\n");
+	for (i = 0; i < nrules; i++) {
+		base = shared ? 0 : i;
+		fprintf(fp, "add rule ip t c tcp dport { ");
+		for (j = 0; j < ELEMS; j++)
+			fprintf(fp, "%s%u-%u", j ? ", " : "",
+				j * ELEM_STRIDE + base,
+				j * ELEM_STRIDE + base + ELEM_STRIDE / 4);
+		fprintf(fp, " } accept\n");
+	}
+
+	nft_ctx_reset_stats(nft);
+	if (run_buffer(nft, fp, &buf, &len) < 0 ||
+	    nft_ctx_get_stats(nft, &stats) < 0) {
+		fprintf(stderr, "failed to load the rules\n");
+		return -1;
+	}
+	return stats.allocs;
+}
+
+/* Every rule must list the whole literal. */
+static int check_listing(struct nft_ctx *nft)
+{
+	unsigned int n = 0, elems;
+	char *out, *line, *end;
+
+	out = run_cmd_output(nft, "list chain ip t c");
+	if (out == NULL) {
+		fprintf(stderr, "cannot list the rules\n");
+		return -1;
+	}
+
+	for (line = strstr(out, "{ "); line != NULL;
+	     line = strstr(end, "{ ")) {
+		end = strstr(line, " }");
+		if (end == NULL)
+			break;
+		for (elems = 1; (line = strstr(line, ", ")) && line < end;
+		     line++)
+			elems++;
+		if (elems == ELEMS)
+			n++;
+	}
+	free(out);
+
+	if (n != nrules) {
+		fprintf(stderr, "%u of %u rules list the whole set\n",
+			n, nrules);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int64_t shared, distinct, again;
+	struct nft_ctx *nft;
+	int opt, ret = 1;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nrules = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n rules]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (nrules < 2) {
+		fprintf(stderr, "at least two rules are needed\n");
+		return 1;
+	}
+
+	nft = nft_ctx_new(NFT_CTX_NETLINK_MOCK);
+	if (nft == NULL)
+		return 1;
+	nft_ctx_output_set_stats(nft, true);
+	nft_ctx_output_set_numeric(nft, NFT_NUMERIC_PORT);
+
+	distinct = load_rules(nft, false);
+	if (distinct < 0 || check_listing(nft) < 0)
+		goto err;
+
+	shared = load_rules(nft, true);
+	if (shared < 0 || check_listing(nft) < 0)
+		goto err;
+
+	if (distinct - shared < (int64_t)(nrules - 1) * ELEMS) {
+		fprintf(stderr, "%lld allocations with shared literals, "
+			"%lld without\n", (long long)shared,
+			(long long)distinct);
+		goto err;
+	}
+
+	/* the literals of the previous batch are gone */
+	again = load_rules(nft, true);
+	if (again < 0 || check_listing(nft) < 0)
+		goto err;
+
+	if (again + ELEMS <= shared) {
+		fprintf(stderr, "%lld allocations on the second run, "
+			"%lld on the first one\n", (long long)again,
+			(long long)shared);
+		goto err;
+	}
+
+	ret = 0;
+err:
+	nft_ctx_free(nft);
+	return ret;
+}
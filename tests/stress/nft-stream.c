@@ -0,0 +1,269 @@
+/*
+ * Load a large batch with commands put in the batch as they are parsed.
+ *
+ * Rules are added to the emulated nf_tables backend in streaming mode, they
+ * must end up in the chain in input order, with the handles reported for
+ * the lines that added them. A batch rejected by the kernel must be reported
+ * on the line of the failing command, and a syntax error at the end of the
+ * input must leave the ruleset unchanged, even though the commands before
+ * it were already in the batch.
+ *
+ * Streaming must also keep memory use down with rules that carry distinct
+ * set literals: the batch is built in check mode, once streamed and once
+ * parsed as a whole, and the peak memory use of the former must stay well
+ * below the one of the latter.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <linux/netfilter.h>
+
+#include <nftables/nftables.h>
+
+#include "common.h"
+
+#define DEFAULT_RULES		100000
+
+/* lines before the rules added to chain c */
+#define RULES_FIRST_LINE	3
+
+#define LITERAL_RULES		1000
+#define LITERAL_ELEMS		64
+
+static unsigned int nrules = DEFAULT_RULES;
+
+static void print_rules(FILE *fp, unsigned int num)
+{
+	unsigned int i;
+
+	for (i = 0; i < num; i++)
+		fprintf(fp, "add rule ip t c tcp dport %u counter accept\n",
+			i % 65536);
+}
+
+/* Chain c must hold the rules reported for lines 3 onwards, in order. */
+static int check_rules(struct nft_ctx *nft)
+{
+	const struct nft_cmd_result *res;
+	struct nft_rule_counter *rules;
+	unsigned int i, k = 0;
+	int ret = -1, n, num;
+
+	rules = calloc(nrules + 1, sizeof(*rules));
+	if (rules == NULL)
+		return -1;
+
+	n = nft_ctx_get_rule_counters(nft, NFPROTO_IPV4, "t", "c",
+				      rules, nrules + 1);
+	if (n != (int)nrules) {
+		fprintf(stderr, "%d rules in the chain, expected %u\n",
+			n, nrules);
+		goto out;
+	}
+
+	num = nft_ctx_get_results(nft, &res);
+	for (i = 0; i < (unsigned int)num && k < nrules; i++) {
+		if (res[i].object.type != NFT_ECHO_RULE ||
+		    strcmp(res[i].object.chain, "c"))
+			continue;
+		if (res[i].line != RULES_FIRST_LINE + k ||
+		    res[i].object.handle != rules[k].handle) {
+			fprintf(stderr, "rule %u: line %u, handle %llu reported, "
+				"handle %llu in the chain\n", k, res[i].line,
+				(unsigned long long)res[i].object.handle,
+				(unsigned long long)rules[k].handle);
+			goto out;
+		}
+		k++;
+	}
+	if (k != nrules) {
+		fprintf(stderr, "%u rules reported, expected %u\n", k, nrules);
+		goto out;
+	}
+	ret = 0;
+out:
+	free(rules);
+	return ret;
+}
+
+/* Growth of the peak memory use while the rules with literals are loaded. */
+static long load_literals(bool stream)
+{
+	struct rusage before, after;
+	struct nft_ctx *nft;
+	char *buf = NULL;
+	size_t len = 0;
+	unsigned int i, j;
+	long ret = -1;
+	FILE *fp;
+
+	nft = nft_ctx_new(NFT_CTX_NETLINK_MOCK);
+	if (nft == NULL)
+		return -1;
+	nft_ctx_set_stream(nft, stream);
+	nft_ctx_set_dry_run(nft, true);
+
+	fp = open_memstream(&buf, &len);
+	if (fp == NULL)
+		goto err;
+	fprintf(fp, "add table ip t\nadd chain ip t e\n");
+	for (i = 0; i < LITERAL_RULES; i++) {
+		fprintf(fp, "add rule ip t e tcp dport { ");
+		for (j = 0; j < LITERAL_ELEMS; j++)
+			fprintf(fp, "%s%u", j ? ", " : "",
+				i * LITERAL_ELEMS + j);
+		fprintf(fp, " } accept\n");
+	}
+	fflush(fp);
+
+	getrusage(RUSAGE_SELF, &before);
+	if (run_buffer(nft, fp, &buf, &len) < 0) {
+		fprintf(stderr, "failed to load the rules with literals\n");
+		goto err;
+	}
+	getrusage(RUSAGE_SELF, &after);
+	ret = after.ru_maxrss - before.ru_maxrss;
+err:
+	nft_ctx_free(nft);
+	return ret;
+}
+
+/*
+ * The streamed run goes first: the whole batch then has to grow the peak
+ * further than the streamed run did on its own.
+ */
+static int check_literals(void)
+{
+	long streamed, whole;
+
+	streamed = load_literals(true);
+	if (streamed < 0)
+		return -1;
+	whole = load_literals(false);
+	if (whole < 0)
+		return -1;
+
+	if (streamed >= whole) {
+		fprintf(stderr, "streaming set literals took %ld KiB, "
+			"%ld KiB more without\n", streamed, whole);
+		return -1;
+	}
+	return 0;
+}
+
+static int check_unchanged(struct nft_ctx *nft)
+{
+	struct nft_rule_counter rule;
+	int n;
+
+	n = nft_ctx_get_rule_counters(nft, NFPROTO_IPV4, "t", "d", &rule, 1);
+	if (n != 0) {
+		fprintf(stderr, "failed batch added %d rules\n", n);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	char *buf = NULL, *out = NULL;
+	size_t len = 0, outlen = 0;
+	struct nft_ctx *nft;
+	FILE *fp, *outfp;
+	int opt, ret = 1;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nrules = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n rules]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (nrules == 0) {
+		fprintf(stderr, "at least one rule is needed\n");
+		return 1;
+	}
+
+	/* first, before the other loads raise the peak memory use */
+	if (check_literals() < 0)
+		return 1;
+
+	nft = nft_ctx_new(NFT_CTX_NETLINK_MOCK);
+	if (nft == NULL)
+		return 1;
+	nft_ctx_set_stream(nft, true);
+	nft_ctx_output_set_results(nft, true);
+
+	outfp = open_memstream(&out, &outlen);
+	if (outfp == NULL)
+		goto err;
+	nft_ctx_set_output(nft, outfp);
+
+	fp = open_memstream(&buf, &len);
+	if (fp == NULL)
+		goto err;
+	fprintf(fp, "add table ip t\n");
+	fprintf(fp, "add chain ip t c\n");
+	print_rules(fp, nrules);
+	fprintf(fp, "table ip t {\n\tchain d {\n\t}\n}\n");
+	if (run_buffer(nft, fp, &buf, &len) < 0) {
+		fprintf(stderr, "failed to load the rules\n");
+		goto err;
+	}
+	if (check_rules(nft) < 0)
+		goto err;
+
+	/* the kernel rejects the last command, the error points to it */
+	fp = open_memstream(&buf, &len);
+	if (fp == NULL)
+		goto err;
+	fprintf(fp, "add rule ip t d counter\n");
+	fprintf(fp, "delete rule ip t c handle 999999999\n");
+	if (run_buffer(nft, fp, &buf, &len) == 0) {
+		fprintf(stderr, "deleted a missing rule\n");
+		goto err;
+	}
+	fflush(outfp);
+	if (out == NULL || strstr(out, "<cmdline>:2:") == NULL) {
+		fprintf(stderr, "error not reported on line 2:\n%s\n",
+			out ? out : "");
+		goto err;
+	}
+	if (check_unchanged(nft) < 0)
+		goto err;
+
+	/* a syntax error at the end discards the batch built so far */
+	fp = open_memstream(&buf, &len);
+	if (fp == NULL)
+		goto err;
+	fprintf(fp, "add rule ip t d counter\n");
+	fprintf(fp, "add rule ip t d counter\n");
+	fprintf(fp, "add rule ip t d bogus\n");
+	if (run_buffer(nft, fp, &buf, &len) == 0) {
+		fprintf(stderr, "syntax error not reported\n");
+		goto err;
+	}
+	if (check_unchanged(nft) < 0)
+		goto err;
+
+	ret = 0;
+err:
+	nft_ctx_free(nft);
+	if (outfp != NULL)
+		fclose(outfp);
+	free(out);
+	return ret;
+}
@@ -0,0 +1,216 @@
+/*
+ * Run independent libnftables contexts in parallel threads.
+ *
+ * Each thread repeatedly creates a context on top of its own emulated
+ * nf_tables backend, loads a ruleset, lists it and compares the listing
+ * with the one obtained by a single context before any thread started.
+ *
+ * Rules with xtables matches and targets are decoded through the global
+ * state of libxtables. They can only be added by iptables-nft, so they are
+ * listed from the kernel, in a network namespace of our own: when run as
+ * root with iptables-nft installed, the threads also list such a table.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nftables/nftables.h>
+
+#include "common.h"
+
+#define DEFAULT_THREADS		8
+#define DEFAULT_ROUNDS		50
+
+static const char ruleset[] =
+	"add table ip t\n"
+	"add chain ip t input { type filter hook input priority 0; policy drop; }\n"
+	"add chain ip t other\n"
+	"add set ip t s { type ipv4_addr; flags interval; }\n"
+	"add map ip t m { type inet_service : verdict; }\n"
+	"add element ip t s { 10.0.0.0/8, 192.168.1.1 }\n"
+	"add element ip t m { 22 : accept, 80 : jump other }\n"
+	"add counter ip t c\n"
+	"add rule ip t input ct state established,related accept\n"
+	"add rule ip t input meta mark 0x10 ip saddr @s counter accept\n"
+	"add rule ip t input tcp dport vmap @m\n"
+	"add rule ip t input ip daddr { 1.1.1.1, 2.2.2.2 } tcp dport { 53, 853 } drop\n"
+	"add rule ip t other counter name c meta iif \"lo\" return\n";
+
+static const char list_cmd[] = "list ruleset\n";
+static const char flush_cmd[] = "flush ruleset\n";
+
+static const char xt_rules[] =
+	"iptables-nft -w -A INPUT -m comment --comment nft-threads -j ACCEPT && "
+	"iptables-nft -w -A INPUT -p tcp -m multiport --dports 22,80 -j REJECT && "
+	"ip6tables-nft -w -A INPUT -m limit --limit 10/s -j LOG";
+static const char xt_list_cmd[] = "list table ip filter\nlist table ip6 filter\n";
+
+static char *expected;
+static char *xt_expected;
+static unsigned int rounds = DEFAULT_ROUNDS;
+
+/* Load the ruleset on a fresh context, return its listing. */
+static char *load_and_list(void)
+{
+	struct nft_ctx *nft;
+	char *out = NULL;
+	size_t len = 0;
+	FILE *fp;
+
+	nft = nft_ctx_new(NFT_CTX_NETLINK_MOCK);
+	if (nft == NULL)
+		return NULL;
+
+	fp = open_memstream(&out, &len);
+	if (fp == NULL)
+		goto err;
+	nft_ctx_set_output(nft, fp);
+
+	if (run_cmd(nft, ruleset) < 0 || run_cmd(nft, list_cmd) < 0 ||
+	    run_cmd(nft, flush_cmd) < 0) {
+		fclose(fp);
+		free(out);
+		out = NULL;
+		goto err;
+	}
+	fclose(fp);
+err:
+	nft_ctx_free(nft);
+	return out;
+}
+
+/* List the tables added by iptables-nft on a fresh context. */
+static char *xt_list(void)
+{
+	struct nft_ctx *nft;
+	char *out;
+
+	nft = nft_ctx_new(NFT_CTX_DEFAULT);
+	if (nft == NULL)
+		return NULL;
+
+	out = run_cmd_output(nft, xt_list_cmd);
+	nft_ctx_free(nft);
+	return out;
+}
+
+/* Threads created afterwards share the network namespace. */
+static bool xt_setup(void)
+{
+	if (geteuid() != 0) {
+		fprintf(stderr, "not root, skipping xtables rules\n");
+		return false;
+	}
+	if (unshare(CLONE_NEWNET) < 0) {
+		perror("unshare, skipping xtables rules");
+		return false;
+	}
+	if (system(xt_rules) != 0) {
+		fprintf(stderr, "iptables-nft failed, skipping xtables rules\n");
+		return false;
+	}
+
+	xt_expected = xt_list();
+	return xt_expected != NULL;
+}
+
+static void *worker(void *arg)
+{
+	unsigned long id = (unsigned long)arg;
+	unsigned int i;
+	char *out;
+
+	for (i = 0; i < rounds; i++) {
+		out = load_and_list();
+		if (out == NULL) {
+			fprintf(stderr, "thread %lu: round %u failed\n", id, i);
+			return (void *)1;
+		}
+		if (strcmp(out, expected)) {
+			fprintf(stderr, "thread %lu: round %u listing differs:\n%s",
+				id, i, out);
+			free(out);
+			return (void *)1;
+		}
+		free(out);
+
+		if (xt_expected == NULL)
+			continue;
+
+		out = xt_list();
+		if (out == NULL || strcmp(out, xt_expected)) {
+			fprintf(stderr, "thread %lu: round %u xtables listing differs:\n%s",
+				id, i, out ? out : "(failed)\n");
+			free(out);
+			return (void *)1;
+		}
+		free(out);
+	}
+
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int nthreads = DEFAULT_THREADS, i;
+	pthread_t *threads;
+	int opt, ret = 0;
+	void *res;
+
+	while ((opt = getopt(argc, argv, "t:r:")) != -1) {
+		switch (opt) {
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-t threads] [-r rounds]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	expected = load_and_list();
+	if (expected == NULL) {
+		fprintf(stderr, "failed to load the ruleset\n");
+		return 1;
+	}
+	xt_setup();
+
+	threads = calloc(nthreads, sizeof(*threads));
+	if (threads == NULL)
+		return 1;
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, worker,
+				   (void *)(unsigned long)i)) {
+			fprintf(stderr, "failed to create thread %u\n", i);
+			nthreads = i;
+			ret = 1;
+			break;
+		}
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i], &res);
+		if (res != NULL)
+			ret = 1;
+	}
+
+	free(threads);
+	free(expected);
+	free(xt_expected);
+	return ret;
+}